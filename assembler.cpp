@@ -0,0 +1,50 @@
+#include <map>
+#include <stdexcept>
+#include "assembler.h"
+
+namespace {
+    uint16_t resolve(const std::map<uint16_t, uint16_t>& labels, uint16_t label) {
+        auto it = labels.find(label);
+        if (it == labels.end()) {
+            throw std::domain_error("Unknown label in symbolic program");
+        }
+        return it->second;
+    }
+}
+
+std::vector<instruction> symbolic_program_to_instructions(const symbolic_program& sprog) {
+    std::map<uint16_t, uint16_t> labels;
+
+    // labels resolve to word addresses, not instruction indices
+    uint16_t address = 0;
+    for (auto& instr : sprog) {
+        if (instr.first != NO_LABEL) {
+            labels.emplace(instr.first, address);
+        }
+        address += 1 + argument_count(instr.second.mnem());
+    }
+
+    std::vector<instruction> result;
+    // rewrite all labels
+    for (auto& instr : sprog) {
+        instruction i = instr.second;
+        if (i.mnem() == mnemonic::CALL) {
+            i.arg(1) = resolve(labels, i.arg(1));
+        } else if (i.mnem() == mnemonic::TCALL) {
+            i.arg(2) = resolve(labels, i.arg(2));
+        } else if (i.mnem() == mnemonic::GOTO
+                || i.mnem() == mnemonic::IFZERO
+                || i.mnem() == mnemonic::IFNZERO
+                || i.mnem() == mnemonic::DJNZ) {
+            i.arg(0) = resolve(labels, i.arg(0));
+        }
+
+        result.push_back(i);
+    }
+
+    return result;
+}
+
+std::vector<uint16_t> assemble(const symbolic_program& sprog) {
+    return to_binary_list(symbolic_program_to_instructions(sprog));
+}
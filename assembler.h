@@ -0,0 +1,23 @@
+#ifndef STACKMACHINE_ASSEMBLER_H
+#define STACKMACHINE_ASSEMBLER_H
+
+#include <utility>
+#include "instructions.h"
+
+//! A program whose jump and call targets are labels instead of addresses.
+//! Each instruction may carry a label, NO_LABEL marks unlabeled instructions.
+using symbolic_program = std::vector<std::pair<uint16_t, instruction>>;
+
+const uint16_t NO_LABEL = 0xFFFF;
+
+//! Resolve all labels of a symbolic program to code addresses.
+//! \param sprog the symbolic program
+//! \return the instructions with absolute targets
+std::vector<instruction> symbolic_program_to_instructions(const symbolic_program& sprog);
+
+//! Resolve and encode a symbolic program.
+//! \param sprog the symbolic program
+//! \return the binary code
+std::vector<uint16_t> assemble(const symbolic_program& sprog);
+
+#endif //STACKMACHINE_ASSEMBLER_H
@@ -0,0 +1,457 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <streambuf>
+#include "../block_layout.h"
+#include "../call_memo.h"
+#include "../channel.h"
+#include "../compact_engine.h"
+#include "../debugger.h"
+#include "../interpreter.h"
+#include "../loop_fusion.h"
+#include "../metrics.h"
+#include "../parallel_engine.h"
+#include "../process_pool.h"
+#include "../register_engine.h"
+#include "../sampling_profiler.h"
+#include "../scheduler.h"
+#include "../ssa_passes.h"
+#include "perf_counters.h"
+#include "workloads.h"
+
+namespace {
+
+    //! Swallows the output of the measured programs.
+    class null_buffer : public std::streambuf {
+    protected:
+        int overflow(int c) override {
+            return c;
+        }
+
+        std::streamsize xsputn(const char*, std::streamsize n) override {
+            return n;
+        }
+    };
+
+    struct measurement {
+        uint64_t dispatches;
+        double seconds;
+        bool counters[perf_counters::COUNTER_COUNT];
+        uint64_t values[perf_counters::COUNTER_COUNT];
+    };
+
+    //! An interpreter that memoizes calls of pure functions.
+    class memo_interpreter : public interpreter {
+    public:
+        explicit memo_interpreter(const std::vector<uint16_t>& code) : interpreter(code) {
+            set_call_memo(std::make_shared<call_memo>(code));
+        }
+    };
+
+    //! An interpreter whose stack lies between guard pages.
+    class safe_interpreter : public interpreter {
+    public:
+        explicit safe_interpreter(const std::vector<uint16_t>& code) : interpreter(code) {
+            set_safe_mode(true);
+        }
+    };
+
+    //! An interpreter sampled by a profiler at 1 kHz while it exists.
+    class profiled_interpreter : public interpreter {
+    public:
+        explicit profiled_interpreter(const std::vector<uint16_t>& code) : interpreter(code) {
+            m_profiler.start(1000);
+        }
+
+    private:
+        sampling_profiler m_profiler;
+    };
+
+    //! An interpreter with a debugger attached that has no breakpoints.
+    class debugged_interpreter : public interpreter {
+    public:
+        explicit debugged_interpreter(const std::vector<uint16_t>& code) : interpreter(code), m_debugger(*this) {
+        }
+
+    private:
+        debugger m_debugger;
+    };
+
+    //! The compact engine running its loop on the word form.
+    class words_engine : public compact_engine {
+    public:
+        explicit words_engine(const std::vector<uint16_t>& code) : compact_engine(code, WORDS) {
+        }
+    };
+
+    //! The number of VM instructions a workload dispatches until STOP.
+    uint64_t count_dispatches(interpreter& interp) {
+        return interp.run(std::numeric_limits<uint64_t>::max());
+    }
+
+    //! The number of register instructions a workload dispatches until STOP.
+    uint64_t count_dispatches(register_engine& engine) {
+        engine.run();
+        return engine.dispatches();
+    }
+
+    //! The number of VM instructions a workload executes on all threads until STOP.
+    uint64_t count_dispatches(parallel_engine& engine) {
+        engine.run();
+        return engine.dispatches();
+    }
+
+    //! The number of VM instructions a workload executes until STOP.
+    uint64_t count_dispatches(compact_engine& engine) {
+        engine.run();
+        return engine.dispatches();
+    }
+
+    //! The workload with its blocks relaid after a profiling run.
+    workload profile_guided(const workload& w) {
+        null_buffer sink;
+        std::ostream out(&sink);
+        auto profile = std::make_shared<branch_profile>();
+
+        interpreter interp(w.code);
+        interp.set_output(out);
+        interp.set_command_line_arguments(w.args);
+        interp.set_data_segment(w.data);
+        interp.set_branch_profile(profile);
+        interp.run();
+
+        auto relaid = w;
+        relaid.code = relayout(w.code, *profile);
+        return relaid;
+    }
+
+    template <typename Engine>
+    measurement measure(const workload& w, int repetitions) {
+        null_buffer sink;
+        std::ostream out(&sink);
+
+        measurement best;
+        {
+            Engine engine(w.code);
+            engine.set_output(out);
+            engine.set_command_line_arguments(w.args);
+            engine.set_data_segment(w.data);
+            best.dispatches = count_dispatches(engine);
+        }
+        best.seconds = -1;
+
+        perf_counters counters;
+
+        for (int r = 0; r < repetitions; ++r) {
+            Engine engine(w.code);
+            engine.set_output(out);
+            engine.set_command_line_arguments(w.args);
+            engine.set_data_segment(w.data);
+
+            counters.start();
+            auto begin = std::chrono::steady_clock::now();
+            engine.run();
+            auto end = std::chrono::steady_clock::now();
+            counters.stop();
+
+            double seconds = std::chrono::duration<double>(end - begin).count();
+            if (best.seconds < 0 || seconds < best.seconds) {
+                best.seconds = seconds;
+                for (int c = 0; c < perf_counters::COUNTER_COUNT; ++c) {
+                    auto counter = static_cast<perf_counters::counter>(c);
+                    best.counters[c] = counters.available(counter);
+                    best.values[c] = counters.value(counter);
+                }
+            }
+        }
+
+        return best;
+    }
+
+    void print_ratio(bool available, double numerator, double denominator, int precision) {
+        std::cout << std::setw(14);
+        if (available && denominator > 0) {
+            std::cout << std::fixed << std::setprecision(precision) << numerator / denominator;
+        } else {
+            std::cout << "n/a";
+        }
+    }
+
+    void print_header() {
+        std::cout << std::left << std::setw(20) << "workload" << std::right
+                  << std::setw(14) << "dispatches"
+                  << std::setw(14) << "time[ms]"
+                  << std::setw(14) << "Mdisp/s"
+                  << std::setw(14) << "IPC"
+                  << std::setw(14) << "cycles/disp"
+                  << std::setw(14) << "instr/disp"
+                  << std::setw(14) << "brmiss/disp"
+                  << std::setw(14) << "L1dmiss/disp"
+                  << std::setw(14) << "L1imiss/disp"
+                  << std::endl;
+    }
+
+    void print_measurement(const std::string& name, const measurement& m) {
+        const auto& on = m.counters;
+        const auto& v = m.values;
+        double dispatches = static_cast<double>(m.dispatches);
+
+        std::cout << std::left << std::setw(20) << name << std::right
+                  << std::setw(14) << m.dispatches
+                  << std::setw(14) << std::fixed << std::setprecision(3) << m.seconds * 1e3
+                  << std::setw(14) << std::fixed << std::setprecision(2) << dispatches / m.seconds / 1e6;
+
+        print_ratio(on[perf_counters::CYCLES] && on[perf_counters::INSTRUCTIONS],
+                    v[perf_counters::INSTRUCTIONS], v[perf_counters::CYCLES], 2);
+        print_ratio(on[perf_counters::CYCLES], v[perf_counters::CYCLES], dispatches, 2);
+        print_ratio(on[perf_counters::INSTRUCTIONS], v[perf_counters::INSTRUCTIONS], dispatches, 2);
+        print_ratio(on[perf_counters::BRANCH_MISSES], v[perf_counters::BRANCH_MISSES], dispatches, 4);
+        print_ratio(on[perf_counters::L1D_MISSES], v[perf_counters::L1D_MISSES], dispatches, 4);
+        print_ratio(on[perf_counters::L1I_MISSES], v[perf_counters::L1I_MISSES], dispatches, 4);
+        std::cout << std::endl;
+    }
+
+    //! Runs vms interpreters of between 9 and 18000 instructions with mixed
+    //! priorities on the scheduler at once and reports throughput and the
+    //! latency from spawn to STOP.
+    void measure_scheduler(size_t vms) {
+        null_buffer sink;
+        std::ostream out(&sink);
+
+        auto metrics = std::make_shared<metrics_registry>();
+        std::vector<std::unique_ptr<interpreter>> pending;
+        for (size_t i = 0; i < vms; ++i) {
+            // a few long VMs among many short ones
+            auto n = static_cast<uint16_t>(i % 10 == 0 ? 2000 : 1 + (i * 7919) % 200);
+            pending.push_back(std::unique_ptr<interpreter>(new interpreter(countdown_program(n))));
+            pending.back()->set_output(out);
+            pending.back()->set_metrics(metrics);
+        }
+
+        scheduler s;
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < vms; ++i) {
+            s.spawn(std::move(pending[i]), static_cast<scheduler::priority>(i % scheduler::PRIORITY_COUNT));
+        }
+        s.wait();
+        auto end = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(end - begin).count();
+
+        uint64_t instructions = 0;
+        double cpu = 0;
+        for (size_t i = 0; i < vms; ++i) {
+            auto stats = s.stats(i);
+            instructions += stats.instructions;
+            cpu += stats.cpu_seconds;
+        }
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << "scheduler: " << vms << " VMs, " << instructions << " instructions in "
+                  << seconds * 1e3 << " ms, " << instructions / seconds / 1e6 << " Minstr/s, "
+                  << vms / seconds << " VMs/s" << std::endl
+                  << "latency[ms]: p50 " << s.latency_percentile(0.5) * 1e3
+                  << ", p99 " << s.latency_percentile(0.99) * 1e3
+                  << ", max " << s.latency_percentile(1.0) * 1e3
+                  << "; cpu per VM[us] " << cpu / vms * 1e6
+                  << "; steals " << s.steals() << std::endl;
+        std::cout << "metrics: ";
+        metrics->snapshot().write_json(std::cout);
+    }
+
+    //! Runs jobs countdown programs of mixed length on the scheduler and in
+    //! the same number of worker processes and reports both throughputs.
+    void measure_processes(size_t jobs) {
+        null_buffer sink;
+        std::ostream out(&sink);
+        auto workers = std::max(std::thread::hardware_concurrency(), 1u);
+
+        std::vector<job> batch;
+        for (size_t i = 0; i < jobs; ++i) {
+            auto n = static_cast<uint16_t>(i % 10 == 0 ? 2000 : 1 + (i * 7919) % 200);
+            batch.push_back(job{countdown_program(n), {}});
+        }
+
+        auto begin = std::chrono::steady_clock::now();
+        {
+            scheduler s(workers);
+            for (auto& j : batch) {
+                std::unique_ptr<interpreter> vm(new interpreter(j.code));
+                vm->set_output(out);
+                s.spawn(std::move(vm));
+            }
+            s.wait();
+        }
+        auto end = std::chrono::steady_clock::now();
+        double threads = std::chrono::duration<double>(end - begin).count();
+
+        process_pool pool(workers);
+        begin = std::chrono::steady_clock::now();
+        pool.run(batch);
+        end = std::chrono::steady_clock::now();
+        double processes = std::chrono::duration<double>(end - begin).count();
+
+        std::cout << std::fixed << std::setprecision(3)
+                  << "processes: " << jobs << " jobs on " << workers << " workers, scheduler "
+                  << threads * 1e3 << " ms (" << jobs / threads << " jobs/s), process pool "
+                  << processes * 1e3 << " ms (" << jobs / processes << " jobs/s)" << std::endl;
+    }
+
+    //! Send n down to 1 on channel 0, then close it.
+    std::vector<uint16_t> producer_program(uint16_t n) {
+        return {CONST, n, DUP, IFZERO, 13, DUP, SEND, 0, CONST, 1, SUB, GOTO, 2, CLOSE, 0};
+    }
+
+    //! Multiply every word from channel 0 by 3 rounds times and send it on
+    //! channel 1, about 8 instructions per round.
+    std::vector<uint16_t> stage_program(uint16_t rounds) {
+        return {
+                RECV, 0, IFZERO, 25,
+                CONST, rounds,
+                DUP, IFZERO, 19,
+                SWAP, CONST, 3, MUL, SWAP, CONST, 1, SUB, GOTO, 6,
+                DECSP, 1, SEND, 1, GOTO, 0,
+                CLOSE, 1
+        };
+    }
+
+    //! Sum channel 0 and print the sum.
+    std::vector<uint16_t> consumer_program() {
+        return {CONST, 0, RECV, 0, IFZERO, 9, ADD, GOTO, 2, DECSP, 1, PRINTI};
+    }
+
+    //! Streams items words through a producer, stages VMs of equal work and
+    //! a consumer connected by channels and reports the throughput for a
+    //! growing number of workers.
+    void measure_pipeline(uint16_t items, unsigned stages) {
+        null_buffer sink;
+        std::ostream out(&sink);
+
+        auto max_workers = std::max(std::thread::hardware_concurrency(), 1u);
+        for (unsigned workers = 1; ; workers *= 2) {
+            workers = std::min(workers, max_workers);
+
+            std::vector<std::shared_ptr<channel>> channels;
+            for (unsigned c = 0; c <= stages; ++c) {
+                channels.push_back(std::make_shared<channel>(256));
+            }
+
+            scheduler s(workers, 1000);
+            auto begin = std::chrono::steady_clock::now();
+
+            std::unique_ptr<interpreter> vm(new interpreter(consumer_program()));
+            vm->set_channel(0, channels[stages]);
+            vm->set_output(out);
+            s.spawn(std::move(vm));
+            for (unsigned st = 0; st < stages; ++st) {
+                vm.reset(new interpreter(stage_program(10)));
+                vm->set_channel(0, channels[st]);
+                vm->set_channel(1, channels[st + 1]);
+                s.spawn(std::move(vm));
+            }
+            vm.reset(new interpreter(producer_program(items)));
+            vm->set_channel(0, channels[0]);
+            s.spawn(std::move(vm));
+            s.wait();
+
+            auto end = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(end - begin).count();
+            double blocked = 0;
+            for (size_t i = 0; i < s.size(); ++i) {
+                blocked += s.stats(i).blocked_seconds;
+            }
+
+            std::cout << std::fixed << std::setprecision(3)
+                      << "pipeline: " << stages << " stages, " << workers << " workers, "
+                      << items << " items in " << seconds * 1e3 << " ms, "
+                      << items / seconds / 1e3 << " kitems/s; blocked per VM[ms] "
+                      << blocked / s.size() * 1e3 << std::endl;
+
+            if (workers == max_workers) {
+                break;
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+
+    int repetitions = 5;
+    size_t vms = 0;
+    int items = 0;
+    size_t jobs = 0;
+    std::vector<std::string> selected;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repetitions = std::max(1, std::atoi(argv[++i]));
+        } else if (std::strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            vms = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        } else if (std::strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            items = std::min(std::max(1, std::atoi(argv[++i])), 0xFFFF);
+        } else if (std::strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            jobs = static_cast<size_t>(std::max(1, std::atoi(argv[++i])));
+        } else {
+            selected.push_back(argv[i]);
+        }
+    }
+
+    if (vms > 0 || items > 0 || jobs > 0) {
+        if (vms > 0) {
+            measure_scheduler(vms);
+        }
+        if (items > 0) {
+            measure_pipeline(static_cast<uint16_t>(items), 4);
+        }
+        if (jobs > 0) {
+            measure_processes(jobs);
+        }
+        return 0;
+    }
+
+    {
+        perf_counters probe;
+        if (!probe.any_available()) {
+            std::cout << "Hardware performance counters are unavailable, reporting timings only." << std::endl;
+        } else {
+            for (int c = 0; c < perf_counters::COUNTER_COUNT; ++c) {
+                auto counter = static_cast<perf_counters::counter>(c);
+                if (!probe.available(counter)) {
+                    std::cout << "Counter " << perf_counters::name(counter) << " is unavailable." << std::endl;
+                }
+            }
+        }
+    }
+
+    print_header();
+
+    for (auto& w : benchmark_workloads()) {
+        if (!selected.empty() && std::find(selected.begin(), selected.end(), w.name) == selected.end()) {
+            continue;
+        }
+        print_measurement(w.name, measure<interpreter>(w, repetitions));
+        print_measurement(w.name + "/reg", measure<register_engine>(w, repetitions));
+        print_measurement(w.name + "/par", measure<parallel_engine>(w, repetitions));
+        print_measurement(w.name + "/memo", measure<memo_interpreter>(w, repetitions));
+        print_measurement(w.name + "/safe", measure<safe_interpreter>(w, repetitions));
+        print_measurement(w.name + "/prof", measure<profiled_interpreter>(w, repetitions));
+        print_measurement(w.name + "/dbg", measure<debugged_interpreter>(w, repetitions));
+        print_measurement(w.name + "/c8", measure<compact_engine>(w, repetitions));
+        print_measurement(w.name + "/c16", measure<words_engine>(w, repetitions));
+        print_measurement(w.name + "/pgo", measure<interpreter>(profile_guided(w), repetitions));
+
+        auto fused = w;
+        fused.code = loop_fusion().run(w.code);
+        print_measurement(w.name + "/djnz", measure<interpreter>(fused, repetitions));
+        print_measurement(w.name + "/djnz/reg", measure<register_engine>(fused, repetitions));
+
+        auto optimized = w;
+        optimized.code = optimize(w.code);
+        print_measurement(w.name + "/opt", measure<interpreter>(optimized, repetitions));
+    }
+
+    return 0;
+}
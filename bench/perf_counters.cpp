@@ -0,0 +1,127 @@
+#include <cstring>
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    int open_counter(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    uint64_t cache_miss(uint64_t cache) {
+        return cache
+               | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+               | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+}
+
+perf_counters::perf_counters() {
+    m_fds[CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    m_fds[INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    m_fds[BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    m_fds[L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+    m_fds[L1I_MISSES] = open_counter(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1I));
+
+    for (auto& v : m_values) {
+        v = 0;
+    }
+}
+
+perf_counters::~perf_counters() {
+    for (auto fd : m_fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+}
+
+void perf_counters::start() {
+    for (auto fd : m_fds) {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void perf_counters::stop() {
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        if (m_fds[c] < 0) {
+            continue;
+        }
+        ioctl(m_fds[c], PERF_EVENT_IOC_DISABLE, 0);
+
+        // value, time enabled, time running
+        uint64_t data[3] = {0, 0, 0};
+        if (read(m_fds[c], data, sizeof(data)) != sizeof(data)) {
+            m_values[c] = 0;
+        } else if (data[2] != 0 && data[2] < data[1]) {
+            m_values[c] = static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]);
+        } else {
+            m_values[c] = data[0];
+        }
+    }
+}
+
+#else
+
+perf_counters::perf_counters() {
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        m_fds[c] = -1;
+        m_values[c] = 0;
+    }
+}
+
+perf_counters::~perf_counters() {
+}
+
+void perf_counters::start() {
+}
+
+void perf_counters::stop() {
+}
+
+#endif
+
+bool perf_counters::available(counter c) const {
+    return m_fds[c] >= 0;
+}
+
+bool perf_counters::any_available() const {
+    for (auto fd : m_fds) {
+        if (fd >= 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t perf_counters::value(counter c) const {
+    return m_values[c];
+}
+
+const char* perf_counters::name(counter c) {
+    switch (c) {
+        case CYCLES: return "cycles";
+        case INSTRUCTIONS: return "instructions";
+        case BRANCH_MISSES: return "branch-misses";
+        case L1D_MISSES: return "L1d-misses";
+        case L1I_MISSES: return "L1i-misses";
+        case COUNTER_COUNT: break;
+    }
+    return "";
+}
@@ -0,0 +1,44 @@
+#ifndef STACKMACHINE_PERF_COUNTERS_H
+#define STACKMACHINE_PERF_COUNTERS_H
+
+#include <cstdint>
+
+//! Hardware performance counters of the calling thread, read through
+//! Linux perf_event_open. Every counter is opened on its own, so a counter
+//! the CPU or the kernel does not provide (or which the user may not access)
+//! is reported as unavailable while the others keep working.
+class perf_counters {
+public:
+    enum counter {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_MISSES,
+        L1I_MISSES,
+        COUNTER_COUNT
+    };
+
+    perf_counters();
+    ~perf_counters();
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    void start();
+    void stop();
+
+    bool available(counter c) const;
+    bool any_available() const;
+
+    //! Value of the last start()/stop() interval, scaled when the kernel
+    //! had to multiplex the counters.
+    uint64_t value(counter c) const;
+
+    static const char* name(counter c);
+
+private:
+    int m_fds[COUNTER_COUNT];
+    uint64_t m_values[COUNTER_COUNT];
+};
+
+#endif //STACKMACHINE_PERF_COUNTERS_H
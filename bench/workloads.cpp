@@ -0,0 +1,513 @@
+#include "workloads.h"
+#include "../assembler.h"
+
+namespace {
+
+    //! Nested counting loops updating an accumulator in slot 1.
+    symbolic_program arith_loop() {
+        return {
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},
+                {NO_LABEL, instruction(mnemonic::CONST, {200})},
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0004})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1000})},
+                {0x0002  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0003})},
+                // acc = acc * 3 + 7
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::CONST, {7})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0002})},
+                {0x0003  , instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0004  , instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)}
+        };
+    }
+
+    //! A loop whose branch direction follows a pseudo random sequence.
+    symbolic_program branchy() {
+        return {
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},     // slot 1: acc
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},     // slot 2: seed
+                {NO_LABEL, instruction(mnemonic::CONST, {60000})}, // slot 3: counter
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0004})},
+                // seed = seed * 25173 + 13849
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {25173})},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::CONST, {13849})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {0x8000})},
+                {NO_LABEL, instruction(mnemonic::LT)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})},
+                // acc = acc + 3
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0003})},
+                // acc = acc * 5
+                {0x0002  , instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {5})},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {0x0003  , instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0004  , instruction(mnemonic::DECSP, {2})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)}
+        };
+    }
+
+    //! Fill an array with i * 3 and sum it up again.
+    symbolic_program memory() {
+        return {
+                {NO_LABEL, instruction(mnemonic::CONST, {30000})},
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1000})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0002  , instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},     // slot 1: sum
+                {NO_LABEL, instruction(mnemonic::CONST, {30000})}, // slot 2: counter
+                {0x0003  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0004})},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1000})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SWAP)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0003})},
+                {0x0004  , instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)}
+        };
+    }
+
+    //! Print one character per iteration.
+    symbolic_program print_loop() {
+        return {
+                {NO_LABEL, instruction(mnemonic::CONST, {50000})},
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})},
+                {NO_LABEL, instruction(mnemonic::CONST, {'x'})},
+                {NO_LABEL, instruction(mnemonic::PRINTC)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0002  , instruction(mnemonic::STOP)}
+        };
+    }
+
+    //! Nested loops as a naive code generator emits them: every variable is
+    //! loaded and stored through its constant slot address.
+    symbolic_program codegen() {
+        return {
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},     // slot 1: acc
+                {NO_LABEL, instruction(mnemonic::CONST, {100})},   // slot 2: j
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},     // slot 3: i
+                {0x0001  , instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0004})},
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::CONST, {500})},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {0x0002  , instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0003})},
+                // acc = acc + j * j + 7
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::CONST, {7})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                // i = i - 1
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0002})},
+                // j = j - 1
+                {0x0003  , instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0004  , instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)}
+        };
+    }
+
+    //! Naive recursive fibonacci of the first command line argument.
+    symbolic_program fib() {
+        return {
+                {NO_LABEL, instruction(mnemonic::LDARGS)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x0001})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)},
+                // fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2)
+                {0x0001  , instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LT)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})},
+                {NO_LABEL, instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::RET, {0})},
+                {0x0002  , instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x0001})},
+                {NO_LABEL, instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x0001})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::RET, {0})}
+        };
+    }
+
+    //! A loop around a body of straight line code far larger than the L1
+    //! instruction and data caches, as a code generator emits for unrolled
+    //! loops. The word form takes about 64 KB, the compact form half of it.
+    symbolic_program big() {
+        symbolic_program program = {
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},     // slot 1: acc
+                {NO_LABEL, instruction(mnemonic::CONST, {40})},    // slot 2: counter
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})}
+        };
+        for (uint16_t k = 0; k < 2900; ++k) {
+            // acc = acc + k % 200
+            program.push_back({NO_LABEL, instruction(mnemonic::CONST, {1})});
+            program.push_back({NO_LABEL, instruction(mnemonic::CONST, {1})});
+            program.push_back({NO_LABEL, instruction(mnemonic::LDI)});
+            program.push_back({NO_LABEL, instruction(mnemonic::CONST, {static_cast<uint16_t>(k % 200)})});
+            program.push_back({NO_LABEL, instruction(mnemonic::ADD)});
+            program.push_back({NO_LABEL, instruction(mnemonic::STI)});
+            program.push_back({NO_LABEL, instruction(mnemonic::DECSP, {1})});
+        }
+        program.push_back({NO_LABEL, instruction(mnemonic::CONST, {1})});
+        program.push_back({NO_LABEL, instruction(mnemonic::SUB)});
+        program.push_back({NO_LABEL, instruction(mnemonic::GOTO, {0x0001})});
+        program.push_back({0x0002  , instruction(mnemonic::DECSP, {1})});
+        program.push_back({NO_LABEL, instruction(mnemonic::PRINTI)});
+        program.push_back({NO_LABEL, instruction(mnemonic::STOP)});
+        return program;
+    }
+
+    const uint16_t TABLE_SIZE = 4096;
+
+    //! The entry i of the lookup table of the table workloads.
+    uint16_t table_entry(uint16_t i) {
+        return static_cast<uint16_t>(i * i * 7 + 3);
+    }
+
+    //! Sums 2000 entries of a table of 4096 words. Without preloaded the
+    //! program first fills the table in slots 0x1000 and up, as programs had
+    //! to before the data segment, with it the table is read by LDD.
+    symbolic_program table(bool preloaded) {
+        symbolic_program program = {
+                {NO_LABEL, instruction(mnemonic::CONST, {0})}      // slot 1: acc
+        };
+        if (!preloaded) {
+            symbolic_program fill = {
+                    {NO_LABEL, instruction(mnemonic::CONST, {TABLE_SIZE})},
+                    // s[0x0FFF + k] = table_entry(k - 1)
+                    {0x0001  , instruction(mnemonic::DUP)},
+                    {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})},
+                    {NO_LABEL, instruction(mnemonic::DUP)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x0FFF})},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                    {NO_LABEL, instruction(mnemonic::SUB)},
+                    {NO_LABEL, instruction(mnemonic::DUP)},
+                    {NO_LABEL, instruction(mnemonic::MUL)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {7})},
+                    {NO_LABEL, instruction(mnemonic::MUL)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::STI)},
+                    {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                    {NO_LABEL, instruction(mnemonic::SUB)},
+                    {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                    {0x0002  , instruction(mnemonic::DECSP, {1})}
+            };
+            program.insert(program.end(), fill.begin(), fill.end());
+        }
+        symbolic_program sum = {
+                {NO_LABEL, instruction(mnemonic::CONST, {2000})},  // slot 2: counter j
+                {0x0003  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0004})},
+                // acc = acc + table[j * 37 % 4096]
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {37})},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::CONST, {TABLE_SIZE})},
+                {NO_LABEL, instruction(mnemonic::MOD)}
+        };
+        if (preloaded) {
+            sum.push_back({NO_LABEL, instruction(mnemonic::LDD)});
+        } else {
+            sum.push_back({NO_LABEL, instruction(mnemonic::CONST, {0x1000})});
+            sum.push_back({NO_LABEL, instruction(mnemonic::ADD)});
+            sum.push_back({NO_LABEL, instruction(mnemonic::LDI)});
+        }
+        symbolic_program rest = {
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0003})},
+                {0x0004  , instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)}
+        };
+        sum.insert(sum.end(), rest.begin(), rest.end());
+        program.insert(program.end(), sum.begin(), sum.end());
+        return program;
+    }
+
+    //! 20 rounds of c = a + b and acc = acc + c . b over arrays of 256 words
+    //! at 0x1000, 0x2000 and 0x3000, with bytecode loops or with VADD and
+    //! VDOT.
+    symbolic_program arrays(bool vectors) {
+        symbolic_program program = {
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},     // slot 1: acc
+                {NO_LABEL, instruction(mnemonic::CONST, {20})},    // slot 2: rounds
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})}
+        };
+        symbolic_program round;
+        if (vectors) {
+            round = {
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x3000})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x1000})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x2000})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {256})},
+                    {NO_LABEL, instruction(mnemonic::VADD)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x3000})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x2000})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {256})},
+                    {NO_LABEL, instruction(mnemonic::VDOT)},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::STI)},
+                    {NO_LABEL, instruction(mnemonic::DECSP, {1})}
+            };
+        } else {
+            // slot 3: i, element i - 1
+            round = {
+                    {NO_LABEL, instruction(mnemonic::CONST, {256})},
+                    {0x0003  , instruction(mnemonic::DUP)},
+                    {NO_LABEL, instruction(mnemonic::IFZERO, {0x0004})},
+                    // c[i - 1] = a[i - 1] + b[i - 1]
+                    {NO_LABEL, instruction(mnemonic::DUP)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x2FFF})},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x0FFF})},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x1FFF})},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::STI)},
+                    {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                    // acc = acc + c[i - 1] * b[i - 1]
+                    {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x2FFF})},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::CONST, {0x1FFF})},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::LDI)},
+                    {NO_LABEL, instruction(mnemonic::MUL)},
+                    {NO_LABEL, instruction(mnemonic::ADD)},
+                    {NO_LABEL, instruction(mnemonic::STI)},
+                    {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                    {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                    {NO_LABEL, instruction(mnemonic::SUB)},
+                    {NO_LABEL, instruction(mnemonic::GOTO, {0x0003})},
+                    {0x0004  , instruction(mnemonic::DECSP, {1})}
+            };
+        }
+        program.insert(program.end(), round.begin(), round.end());
+        symbolic_program rest = {
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0002  , instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)}
+        };
+        program.insert(program.end(), rest.begin(), rest.end());
+        return program;
+    }
+
+    //! Print text one character at a time with PRINTC or as a block with
+    //! PRINTS.
+    symbolic_program print_text(const std::string& text, bool blocks) {
+        symbolic_program program;
+        for (char c : text) {
+            program.push_back({NO_LABEL, instruction(mnemonic::CONST, {static_cast<uint16_t>(c)})});
+            if (!blocks) {
+                program.push_back({NO_LABEL, instruction(mnemonic::PRINTC)});
+            }
+        }
+        if (blocks) {
+            program.push_back({NO_LABEL, instruction(mnemonic::CONST, {static_cast<uint16_t>(text.size())})});
+            program.push_back({NO_LABEL, instruction(mnemonic::PRINTS)});
+        }
+        return program;
+    }
+
+    //! Print the lines "order <i>: <i * i> units shipped" for i from 2000
+    //! down to 1, with PRINTC or with PRINTS.
+    symbolic_program report(bool blocks) {
+        symbolic_program program = {
+                {NO_LABEL, instruction(mnemonic::CONST, {2000})},
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})}
+        };
+        auto append = [&program](const symbolic_program& part) {
+            program.insert(program.end(), part.begin(), part.end());
+        };
+        append(print_text("order ", blocks));
+        append({
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::PRINTI)}
+        });
+        append(print_text(": ", blocks));
+        append({
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::PRINTI)}
+        });
+        append(print_text(" units shipped\n", blocks));
+        append({
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0002  , instruction(mnemonic::STOP)}
+        });
+        return program;
+    }
+
+    std::shared_ptr<const data_segment> table_data() {
+        std::vector<uint16_t> words(TABLE_SIZE);
+        for (uint16_t i = 0; i < TABLE_SIZE; ++i) {
+            words[i] = table_entry(i);
+        }
+        return std::make_shared<const data_segment>(words);
+    }
+}
+
+std::vector<workload> benchmark_workloads() {
+    return {
+            {"arith_loop", assemble(arith_loop()), {}, nullptr},
+            {"branchy", assemble(branchy()), {}, nullptr},
+            {"memory", assemble(memory()), {}, nullptr},
+            {"print_loop", assemble(print_loop()), {}, nullptr},
+            {"codegen", assemble(codegen()), {}, nullptr},
+            {"fib", assemble(fib()), {20}, nullptr},
+            {"big", assemble(big()), {}, nullptr},
+            {"table_init", assemble(table(false)), {}, nullptr},
+            {"table_data", assemble(table(true)), {}, table_data()},
+            {"arrays_loop", assemble(arrays(false)), {}, nullptr},
+            {"arrays_vector", assemble(arrays(true)), {}, nullptr},
+            {"report_chars", assemble(report(false)), {}, nullptr},
+            {"report_blocks", assemble(report(true)), {}, nullptr}
+    };
+}
+
+std::vector<uint16_t> countdown_program(uint16_t n) {
+    return {
+            CONST, 0, CONST, n,
+            DUP, IFZERO, 17,
+            SWAP, CONST, 1, ADD, SWAP, CONST, 1, SUB, GOTO, 4,
+            DECSP, 1, PRINTI
+    };
+}
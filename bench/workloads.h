@@ -0,0 +1,26 @@
+#ifndef STACKMACHINE_WORKLOADS_H
+#define STACKMACHINE_WORKLOADS_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "../data_segment.h"
+
+struct workload {
+    std::string name;
+    std::vector<uint16_t> code;
+    std::vector<uint16_t> args;
+    //! the data section, nullptr for none
+    std::shared_ptr<const data_segment> data;
+};
+
+//! The programs the benchmark runner measures.
+std::vector<workload> benchmark_workloads();
+
+//! Count down from n to zero and print n, about 9 instructions per round.
+//! Many of these of different n make the load of the scheduler and process
+//! pool benchmarks.
+std::vector<uint16_t> countdown_program(uint16_t n);
+
+#endif //STACKMACHINE_WORKLOADS_H
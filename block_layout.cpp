@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "block_layout.h"
+#include "control_flow.h"
+
+uint64_t branch_profile::taken(uint16_t pc) const {
+    return pc < m_counts.size() ? m_counts[pc].taken : 0;
+}
+
+uint64_t branch_profile::not_taken(uint16_t pc) const {
+    return pc < m_counts.size() ? m_counts[pc].not_taken : 0;
+}
+
+void branch_profile::write(std::ostream &out) const {
+    for (size_t pc = 0; pc < m_counts.size(); ++pc) {
+        if (m_counts[pc].taken != 0 || m_counts[pc].not_taken != 0) {
+            out << pc << ' ' << m_counts[pc].taken << ' ' << m_counts[pc].not_taken << '\n';
+        }
+    }
+}
+
+void branch_profile::read(std::istream &in) {
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        std::istringstream fields(line);
+        uint32_t pc;
+        uint64_t taken, not_taken;
+        if (!(fields >> pc >> taken >> not_taken) || !(fields >> std::ws).eof() || pc > 0xFFFF) {
+            throw std::domain_error("Malformed branch profile line: " + line);
+        }
+        if (pc >= m_counts.size()) {
+            m_counts.resize(pc + 1u);
+        }
+        m_counts[pc].taken += taken;
+        m_counts[pc].not_taken += not_taken;
+    }
+}
+
+namespace {
+    const size_t NO_BLOCK = std::numeric_limits<size_t>::max();
+
+    //! the weight of falling through to the next instruction
+    const uint64_t ALWAYS = std::numeric_limits<uint64_t>::max();
+
+    struct block {
+        //! the instructions in address order
+        std::vector<uint16_t> pcs;
+        //! the block executed when the last instruction does not jump
+        size_t fall;
+        uint64_t fall_weight;
+        //! the block the jump at the end goes to
+        size_t target;
+        uint64_t target_weight;
+        bool hot;
+    };
+
+    struct edge {
+        size_t from;
+        size_t to;
+        uint64_t weight;
+    };
+
+    bool is_branch(mnemonic m) {
+        return m == mnemonic::IFZERO || m == mnemonic::IFNZERO || m == mnemonic::DJNZ;
+    }
+}
+
+std::vector<uint16_t> relayout(const std::vector<uint16_t> &code, const branch_profile &profile) {
+
+    auto full = code;
+    full.push_back(mk_stop());
+    verify(full);
+    control_flow cfg(full);
+
+    // blocks start at pc 0, at static targets and after jumps
+    std::vector<bool> starts(full.size() + 1, false);
+    std::vector<uint16_t> pcs;
+    size_t end = 0;
+    starts[0] = true;
+    for (size_t pc = 0; pc < full.size(); ++pc) {
+        if (!cfg.is_instruction(pc)) {
+            continue;
+        }
+        if (pc < end) {
+            // within the operands of the previous instruction
+            return code;
+        }
+        auto instr = cfg.at(static_cast<uint16_t>(pc));
+        auto m = instr.mnem();
+        end = cfg.next(static_cast<uint16_t>(pc));
+        pcs.push_back(static_cast<uint16_t>(pc));
+
+        uint16_t target;
+        if (static_target(instr, target)) {
+            starts[target] = true;
+        }
+        if (is_branch(m) || is_unconditional_transfer(m)) {
+            starts[end] = true;
+        }
+    }
+
+    std::vector<block> blocks;
+    std::vector<size_t> block_of(full.size(), NO_BLOCK);
+    for (auto pc : pcs) {
+        if (starts[pc]) {
+            blocks.push_back({{}, NO_BLOCK, 0, NO_BLOCK, 0, false});
+        }
+        blocks.back().pcs.push_back(pc);
+        block_of[pc] = blocks.size() - 1;
+    }
+
+    std::vector<edge> edges;
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        auto& b = blocks[i];
+        auto last = b.pcs.back();
+        auto instr = cfg.at(last);
+        auto m = instr.mnem();
+        if (m == mnemonic::GOTO || is_branch(m)) {
+            b.target = block_of[instr.arg(0)];
+            b.target_weight = profile.taken(last);
+            edges.push_back({i, b.target, b.target_weight});
+        }
+        if (!is_unconditional_transfer(m)) {
+            b.fall = block_of[cfg.next(last)];
+            b.fall_weight = is_branch(m) ? profile.not_taken(last) : ALWAYS;
+            edges.push_back({i, b.fall, b.fall_weight});
+        }
+    }
+
+    // hot blocks are those the profiled run can have reached
+    std::vector<size_t> work{0};
+    while (!work.empty()) {
+        auto i = work.back();
+        work.pop_back();
+        auto& b = blocks[i];
+        if (b.hot) {
+            continue;
+        }
+        b.hot = true;
+        for (auto pc : b.pcs) {
+            auto instr = cfg.at(pc);
+            uint16_t target;
+            if ((instr.mnem() == mnemonic::CALL || instr.mnem() == mnemonic::TCALL) && static_target(instr, target)) {
+                work.push_back(block_of[target]);
+            }
+        }
+        if (b.target != NO_BLOCK && b.target_weight > 0) {
+            work.push_back(b.target);
+        }
+        if (b.fall != NO_BLOCK && b.fall_weight > 0) {
+            work.push_back(b.fall);
+        }
+    }
+
+    // chain blocks along the heaviest edges, pc 0 stays in front
+    std::stable_sort(edges.begin(), edges.end(), [](const edge& a, const edge& b) {
+        return a.weight > b.weight;
+    });
+    std::vector<size_t> next(blocks.size(), NO_BLOCK), prev(blocks.size(), NO_BLOCK), head(blocks.size());
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        head[i] = i;
+    }
+    for (auto& e : edges) {
+        if (e.weight == 0 || e.to == 0 || next[e.from] != NO_BLOCK || prev[e.to] != NO_BLOCK
+            || head[e.from] == head[e.to] || blocks[e.from].hot != blocks[e.to].hot) {
+            continue;
+        }
+        next[e.from] = e.to;
+        prev[e.to] = e.from;
+        for (auto i = e.to; i != NO_BLOCK; i = next[i]) {
+            head[i] = head[e.from];
+        }
+    }
+
+    std::vector<size_t> order;
+    for (int pass = 0; pass < 2; ++pass) {
+        bool hot = pass == 0;
+        for (size_t h = 0; h < blocks.size(); ++h) {
+            if (prev[h] != NO_BLOCK || blocks[h].hot != hot) {
+                continue;
+            }
+            for (auto i = h; i != NO_BLOCK; i = next[i]) {
+                order.push_back(i);
+            }
+        }
+    }
+
+    // emit the blocks, jump targets are filled in when all addresses are known
+    std::vector<uint16_t> result;
+    std::vector<std::pair<size_t, size_t>> fixups;
+    std::vector<size_t> address(blocks.size(), 0);
+
+    auto emit = [&](uint16_t pc, mnemonic m, size_t target_block) {
+        auto instr = cfg.at(pc);
+        uint16_t target;
+        bool relocated = static_target(instr, target);
+        result.push_back(m);
+        auto n = argument_count(m);
+        for (size_t a = 0; a < n; ++a) {
+            bool is_target = relocated && a + 1 == n;
+            if (is_target) {
+                fixups.push_back({result.size(), target_block != NO_BLOCK ? target_block : block_of[target]});
+            }
+            result.push_back(instr.arg(a));
+        }
+    };
+    auto jump = [&](size_t target_block) {
+        result.push_back(mnemonic::GOTO);
+        fixups.push_back({result.size(), target_block});
+        result.push_back(0);
+    };
+
+    for (size_t k = 0; k < order.size(); ++k) {
+        auto& b = blocks[order[k]];
+        auto following = k + 1 < order.size() ? order[k + 1] : NO_BLOCK;
+        address[order[k]] = result.size();
+
+        for (size_t n = 0; n + 1 < b.pcs.size(); ++n) {
+            emit(b.pcs[n], static_cast<mnemonic>(full[b.pcs[n]]), NO_BLOCK);
+        }
+
+        auto last = b.pcs.back();
+        auto m = static_cast<mnemonic>(full[last]);
+        if (m == mnemonic::GOTO) {
+            if (b.target != following) {
+                emit(last, m, NO_BLOCK);
+            }
+        } else if ((m == mnemonic::IFZERO || m == mnemonic::IFNZERO) && b.fall != following && b.target == following) {
+            auto inverted = m == mnemonic::IFZERO ? mnemonic::IFNZERO : mnemonic::IFZERO;
+            emit(last, inverted, b.fall);
+        } else {
+            emit(last, m, NO_BLOCK);
+            if (b.fall != NO_BLOCK && b.fall != following) {
+                jump(b.fall);
+            }
+        }
+    }
+
+    // the interpreter appends a STOP
+    if (result.size() >= std::numeric_limits<uint16_t>::max()) {
+        return code;
+    }
+    for (auto& f : fixups) {
+        result[f.first] = static_cast<uint16_t>(address[f.second]);
+    }
+    return result;
+}
@@ -0,0 +1,67 @@
+#ifndef STACKMACHINE_BLOCK_LAYOUT_H
+#define STACKMACHINE_BLOCK_LAYOUT_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+//! Counts which way the jumps of a program went, filled by an interpreter
+//! with interpreter::set_branch_profile(). IFZERO, IFNZERO and DJNZ count
+//! taken and not taken executions at their pc, GOTO counts as taken. A profile
+//! belongs to one interpreter at a time.
+class branch_profile {
+public:
+    void record(uint16_t pc, bool taken) {
+        if (pc >= m_counts.size()) {
+            m_counts.resize(pc + 1u);
+        }
+        if (taken) {
+            ++m_counts[pc].taken;
+        } else {
+            ++m_counts[pc].not_taken;
+        }
+    }
+
+    uint64_t taken(uint16_t pc) const;
+    uint64_t not_taken(uint16_t pc) const;
+
+    //! Write the counts as text, one line "pc taken not_taken" per jump
+    //! that executed.
+    void write(std::ostream& out) const;
+
+    //! Read counts written by write() and add them to this profile, so the
+    //! profiles of several runs can be combined.
+    //! \throws std::domain_error if the input is malformed
+    void read(std::istream& in);
+
+private:
+    struct counts {
+        uint64_t taken;
+        uint64_t not_taken;
+    };
+
+    std::vector<counts> m_counts;
+};
+
+//! Reorder the basic blocks of a program so that the more frequent
+//! successor of every jump follows it and blocks that never ran in the
+//! profile move to the end.
+//!
+//! Blocks are chained greedily along their heaviest edges, IFZERO and
+//! IFNZERO are inverted where the taken successor becomes the next block,
+//! a GOTO to the next block is dropped and a GOTO is added where a block
+//! no longer falls through to its successor. All jump and call targets are
+//! relocated, code that is not reachable from pc 0 is removed.
+//!
+//! The result behaves like the input on a fresh interpreter as far as the
+//! output, sp, bp and the slots 0..sp at STOP go, except for return
+//! addresses, which follow the new layout.
+//! \param code the program as passed to the interpreter
+//! \param profile counts of a run of code
+//! \return the relaid program, or the input if it jumps into the middle of
+//!         an instruction or would not fit 64k words
+//! \throws std::domain_error if the program does not verify
+std::vector<uint16_t> relayout(const std::vector<uint16_t>& code, const branch_profile& profile);
+
+#endif //STACKMACHINE_BLOCK_LAYOUT_H
@@ -0,0 +1,142 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "call_memo.h"
+#include "control_flow.h"
+#include "purity.h"
+
+namespace {
+    const size_t CACHE_LINE = 64;
+}
+
+call_memo::call_memo(const std::vector<uint16_t> &code, size_t capacity)
+: m_buckets(nullptr), m_bucket_count(1), m_lookups(0), m_hits(0), m_evictions(0)
+{
+    static_assert(sizeof(bucket) == CACHE_LINE, "a bucket must fill a cache line");
+
+    // the interpreter ends every program with STOP
+    auto program = code;
+    program.push_back(mk_stop());
+    verify(program);
+
+    control_flow cfg(program);
+    purity_analysis purity(cfg);
+    m_memoized.assign(program.size(), 0);
+    for (size_t pc = 0; pc < program.size(); ++pc) {
+        auto m = purity.arguments(static_cast<uint16_t>(pc));
+        if (purity.is_pure(static_cast<uint16_t>(pc)) && m <= MAX_ARGUMENTS) {
+            m_memoized[pc] = static_cast<uint16_t>(m + 1);
+        }
+    }
+
+    while (m_bucket_count * WAYS < capacity) {
+        m_bucket_count *= 2;
+    }
+    void* memory = nullptr;
+    if (posix_memalign(&memory, CACHE_LINE, m_bucket_count * sizeof(bucket)) != 0) {
+        throw std::bad_alloc();
+    }
+    m_buckets = static_cast<bucket*>(memory);
+    clear();
+}
+
+call_memo::~call_memo() {
+    std::free(m_buckets);
+}
+
+call_memo::bucket &call_memo::find_bucket(const entry &key) {
+    uint32_t h = key.target * 0x9E3779B1u;
+    for (uint8_t i = 0; i < key.count; ++i) {
+        h = (h ^ key.args[i]) * 0x9E3779B1u;
+    }
+    return m_buckets[(h ^ (h >> 16)) & (m_bucket_count - 1)];
+}
+
+bool call_memo::lookup(uint16_t entry_pc, const uint16_t *args, uint16_t m, uint16_t &result) {
+    ++m_lookups;
+
+    entry key;
+    key.target = entry_pc;
+    key.count = static_cast<uint8_t>(m);
+    std::memcpy(key.args, args, m * sizeof(uint16_t));
+
+    auto& b = find_bucket(key);
+    for (auto& e : b.ways) {
+        if (e.uses != 0 && e.target == entry_pc && e.count == m
+            && std::memcmp(e.args, args, m * sizeof(uint16_t)) == 0) {
+            if (e.uses < 0xFF) {
+                ++e.uses;
+            }
+            result = e.result;
+            ++m_hits;
+            return true;
+        }
+    }
+    return false;
+}
+
+void call_memo::enter(uint16_t entry_pc, const uint16_t *args, uint16_t m, uint16_t bp) {
+    pending call;
+    call.bp = bp;
+    call.key.target = entry_pc;
+    call.key.count = static_cast<uint8_t>(m);
+    std::memcpy(call.key.args, args, m * sizeof(uint16_t));
+    m_pending.push_back(call);
+}
+
+void call_memo::insert(const pending &call, uint16_t result) {
+    auto& b = find_bucket(call.key);
+
+    entry* victim = &b.ways[0];
+    bool evict = true;
+    for (auto& e : b.ways) {
+        if (e.uses == 0 || (e.target == call.key.target && e.count == call.key.count
+                            && std::memcmp(e.args, call.key.args, e.count * sizeof(uint16_t)) == 0)) {
+            victim = &e;
+            evict = false;
+            break;
+        }
+        if (e.uses < victim->uses) {
+            victim = &e;
+        }
+    }
+
+    if (evict) {
+        // age the survivors so that entries hot long ago can leave
+        ++m_evictions;
+        for (auto& e : b.ways) {
+            e.uses = static_cast<uint8_t>(e.uses > 1 ? e.uses / 2 : 1);
+        }
+    }
+
+    *victim = call.key;
+    victim->result = result;
+    victim->uses = 1;
+}
+
+void call_memo::clear() {
+    std::memset(m_buckets, 0, m_bucket_count * sizeof(bucket));
+    m_pending.clear();
+    m_lookups = 0;
+    m_hits = 0;
+    m_evictions = 0;
+}
+
+double call_memo::hit_rate() const {
+    return m_lookups == 0 ? 0.0 : static_cast<double>(m_hits) / static_cast<double>(m_lookups);
+}
+
+size_t call_memo::size() const {
+    size_t count = 0;
+    for (size_t i = 0; i < m_bucket_count; ++i) {
+        for (auto& e : m_buckets[i].ways) {
+            count += e.uses != 0 ? 1 : 0;
+        }
+    }
+    return count;
+}
+
+size_t call_memo::memory_bytes() const {
+    return m_bucket_count * sizeof(bucket) + m_memoized.capacity() * sizeof(uint16_t)
+           + m_pending.capacity() * sizeof(pending);
+}
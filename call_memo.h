@@ -0,0 +1,117 @@
+#ifndef STACKMACHINE_CALL_MEMO_H
+#define STACKMACHINE_CALL_MEMO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! Remembers the results of calls of pure functions, see purity_analysis,
+//! keyed on the target address and the argument words. An interpreter with
+//! a memo answers a CALL it has seen before without building a frame, which
+//! leaves the slots above sp as they were; output, registers and the slots
+//! up to sp are those without the memo.
+//!
+//! The table has a fixed size. It is split into buckets of four entries that
+//! fill one cache line, a lookup touches a single bucket, and a full bucket
+//! evicts its least used entry. Functions with more than MAX_ARGUMENTS
+//! arguments are not memoized. A memo belongs to one interpreter.
+class call_memo {
+public:
+    static const unsigned MAX_ARGUMENTS = 5;
+
+    //! \param code the program as passed to the interpreter
+    //! \param capacity the number of results to keep, rounded up to a power of two
+    //! \throws std::domain_error if the program does not verify
+    explicit call_memo(const std::vector<uint16_t>& code, size_t capacity = 4096);
+    ~call_memo();
+
+    call_memo(const call_memo&) = delete;
+    call_memo& operator=(const call_memo&) = delete;
+
+    //! \return true if calls of entry with m arguments are memoized
+    bool memoizes(uint16_t entry, uint16_t m) const {
+        return entry < m_memoized.size() && m_memoized[entry] == m + 1;
+    }
+
+    //! Look up a call.
+    //! \param args the m argument words
+    //! \param result receives the result on a hit
+    //! \return true on a hit
+    bool lookup(uint16_t entry, const uint16_t* args, uint16_t m, uint16_t& result);
+
+    //! Note a call that missed, its frame starts at bp.
+    void enter(uint16_t entry, const uint16_t* args, uint16_t m, uint16_t bp);
+
+    //! Note a RET from the frame at bp, which stores the result of the
+    //! innermost call passed to enter() if it has this frame.
+    void leave(uint16_t bp, uint16_t result) {
+        if (!m_pending.empty() && m_pending.back().bp == bp) {
+            insert(m_pending.back(), result);
+            m_pending.pop_back();
+        }
+    }
+
+    //! Forget all results and statistics.
+    void clear();
+
+    uint64_t lookups() const {
+        return m_lookups;
+    }
+
+    uint64_t hits() const {
+        return m_hits;
+    }
+
+    uint64_t evictions() const {
+        return m_evictions;
+    }
+
+    //! \return hits per lookup, 0 without lookups
+    double hit_rate() const;
+
+    //! \return the number of results the table holds
+    size_t size() const;
+
+    size_t capacity() const {
+        return m_bucket_count * WAYS;
+    }
+
+    //! \return the bytes of memory taken by the table
+    size_t memory_bytes() const;
+
+private:
+    static const unsigned WAYS = 4;
+
+    struct entry {
+        uint16_t target;
+        uint16_t result;
+        uint16_t args[MAX_ARGUMENTS];
+        uint8_t count;
+        //! how often the entry was used, 0 if it is empty
+        uint8_t uses;
+    };
+
+    //! one cache line
+    struct bucket {
+        entry ways[WAYS];
+    };
+
+    struct pending {
+        uint16_t bp;
+        entry key;
+    };
+
+    bucket& find_bucket(const entry& key);
+    void insert(const pending& call, uint16_t result);
+
+    //! the argument count plus one of every memoized entry, 0 for others
+    std::vector<uint16_t> m_memoized;
+    bucket* m_buckets;
+    size_t m_bucket_count;
+    std::vector<pending> m_pending;
+    uint64_t m_lookups;
+    uint64_t m_hits;
+    uint64_t m_evictions;
+};
+
+#endif //STACKMACHINE_CALL_MEMO_H
@@ -0,0 +1,130 @@
+#include <algorithm>
+#include "channel.h"
+
+channel::channel(size_t capacity, unsigned senders)
+: m_mask(1), m_tail(0), m_head(0), m_open_senders(senders), m_parked(0)
+{
+    size_t size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+    m_mask = size - 1;
+    m_cells.reset(new cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        m_cells[i].value = 0;
+    }
+}
+
+bool channel::try_send(uint16_t v) {
+    if (is_closed()) {
+        return true;
+    }
+
+    auto pos = m_tail.load(std::memory_order_relaxed);
+    cell* c;
+    for (;;) {
+        c = &m_cells[pos & m_mask];
+        auto seq = c->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the receivers did not free the cell of the last round yet
+            return false;
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+    c->value = v;
+    c->sequence.store(pos + 1, std::memory_order_release);
+
+    progress();
+    return true;
+}
+
+bool channel::try_receive(uint16_t &v) {
+    auto pos = m_head.load(std::memory_order_relaxed);
+    cell* c;
+    for (;;) {
+        c = &m_cells[pos & m_mask];
+        auto seq = c->sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0) {
+            if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+    v = c->value;
+    // the cell is free for the sender one round ahead
+    c->sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+    progress();
+    return true;
+}
+
+void channel::close() {
+    auto open = m_open_senders.load();
+    while (open > 0 && !m_open_senders.compare_exchange_weak(open, open - 1)) {
+    }
+    progress();
+}
+
+bool channel::is_closed() const {
+    return m_open_senders.load() == 0;
+}
+
+bool channel::can_send() const {
+    auto pos = m_tail.load();
+    return is_closed() || m_cells[pos & m_mask].sequence.load() == pos;
+}
+
+bool channel::can_receive() const {
+    auto pos = m_head.load();
+    return is_closed() || m_cells[pos & m_mask].sequence.load() == pos + 1;
+}
+
+bool channel::park(channel_waiter *w, bool sending) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_parked;
+    // pairs with the fence in progress(): either that sees the waiter or
+    // this sees the progress
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sending ? can_send() : can_receive()) {
+        --m_parked;
+        return false;
+    }
+    m_waiters.push_back(w);
+    return true;
+}
+
+void channel::unpark(channel_waiter *w) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = std::find(m_waiters.begin(), m_waiters.end(), w);
+    if (it != m_waiters.end()) {
+        m_waiters.erase(it);
+        --m_parked;
+    }
+}
+
+void channel::progress() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_parked.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<channel_waiter*> ready;
+    ready.swap(m_waiters);
+    m_parked -= static_cast<unsigned>(ready.size());
+    for (auto w : ready) {
+        w->channel_ready();
+    }
+}
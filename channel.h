@@ -0,0 +1,96 @@
+#ifndef STACKMACHINE_CHANNEL_H
+#define STACKMACHINE_CHANNEL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//! Something to resume once a channel made progress, see channel::park().
+class channel_waiter {
+public:
+    virtual ~channel_waiter() {}
+
+    //! Called once, by the thread that sent, received or closed, while the
+    //! channel's waiters are locked. Must not call back into the channel.
+    virtual void channel_ready() = 0;
+};
+
+//! A bounded queue of words between interpreters, written by SEND and read
+//! by RECV.
+//!
+//! The words live in a lock-free ring where every cell carries a sequence
+//! number, so any number of senders and receivers on any threads exchange
+//! words with one compare-and-swap each and never take a lock. A channel
+//! counts its senders; once each of them called close() and the ring is
+//! drained, receiving reports the end of the stream. Words sent after that
+//! are dropped.
+//!
+//! A VM that cannot proceed parks on the channel instead of spinning. Only
+//! while someone is parked do senders and receivers take the waiter lock.
+class channel {
+public:
+    //! \param capacity rounded up to a power of two, at least 2
+    //! \param senders number of close() calls that end the stream
+    explicit channel(size_t capacity = 1024, unsigned senders = 1);
+
+    channel(const channel&) = delete;
+    channel& operator=(const channel&) = delete;
+
+    //! \return false if the channel is full, true if v was sent or dropped
+    //! because the channel is closed
+    bool try_send(uint16_t v);
+
+    //! \return false if the channel is empty
+    bool try_receive(uint16_t& v);
+
+    //! Mark one sender as done.
+    void close();
+
+    //! \return true once every sender closed the channel
+    bool is_closed() const;
+
+    //! \return true if try_send() would not fail
+    bool can_send() const;
+
+    //! \return true if try_receive() would succeed or the stream ended
+    bool can_receive() const;
+
+    size_t capacity() const {
+        return m_mask + 1;
+    }
+
+    //! Register w to be resumed after the next send, receive or close,
+    //! unless the channel already lets it proceed.
+    //! \param sending true if w waits to send, false if it waits to receive
+    //! \return false without registering if w can proceed at once
+    bool park(channel_waiter* w, bool sending);
+
+    //! Withdraw a registration that did not fire yet.
+    void unpark(channel_waiter* w);
+
+private:
+    struct cell {
+        std::atomic<size_t> sequence;
+        uint16_t value;
+    };
+
+    void progress();
+
+    std::unique_ptr<cell[]> m_cells;
+    size_t m_mask;
+    // senders and receivers advance different cache lines
+    char m_pad0[64];
+    std::atomic<size_t> m_tail;
+    char m_pad1[64];
+    std::atomic<size_t> m_head;
+    char m_pad2[64];
+    std::atomic<unsigned> m_open_senders;
+    std::atomic<unsigned> m_parked;
+    std::mutex m_mutex;
+    std::vector<channel_waiter*> m_waiters;
+};
+
+#endif //STACKMACHINE_CHANNEL_H
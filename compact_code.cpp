@@ -0,0 +1,91 @@
+#include <stdexcept>
+#include "compact_code.h"
+#include "instructions.h"
+
+std::vector<uint8_t> compact(const std::vector<uint16_t> &code, std::vector<uint32_t> *offsets) {
+    std::vector<uint8_t> bytes;
+    bytes.reserve(code.size() + code.size() / 2);
+    if (offsets) {
+        offsets->assign(code.size() + 1, NO_OFFSET);
+    }
+
+    auto word = [&bytes](uint16_t w) {
+        bytes.push_back(static_cast<uint8_t>(w));
+        bytes.push_back(static_cast<uint8_t>(w >> 8));
+    };
+
+    size_t pc = 0;
+    while (pc < code.size()) {
+        if (offsets) {
+            (*offsets)[pc] = static_cast<uint32_t>(bytes.size());
+        }
+
+        auto w = code[pc];
+        auto n = is_mnemonic(w) ? argument_count(static_cast<mnemonic>(w)) : 0;
+        if (!is_mnemonic(w) || w > COMPACT_OPCODE_MASK || pc + n >= code.size()) {
+            bytes.push_back(COMPACT_RAW);
+            word(w);
+            ++pc;
+            continue;
+        }
+
+        bool is_long = false;
+        for (unsigned i = 1; i <= n; ++i) {
+            is_long = is_long || code[pc + i] > 0xFF;
+        }
+        bytes.push_back(static_cast<uint8_t>(w | (is_long ? COMPACT_LONG : 0)));
+        for (unsigned i = 1; i <= n; ++i) {
+            if (is_long) {
+                word(code[pc + i]);
+            } else {
+                bytes.push_back(static_cast<uint8_t>(code[pc + i]));
+            }
+        }
+        pc += 1 + n;
+    }
+
+    if (offsets) {
+        (*offsets)[code.size()] = static_cast<uint32_t>(bytes.size());
+    }
+    return bytes;
+}
+
+std::vector<uint16_t> expand(const std::vector<uint8_t> &bytes) {
+    std::vector<uint16_t> code;
+    code.reserve(bytes.size());
+
+    size_t p = 0;
+    auto word = [&bytes, &p]() {
+        if (p + 2 > bytes.size()) {
+            throw std::domain_error("Compact code ends within a word");
+        }
+        auto w = static_cast<uint16_t>(bytes[p] | bytes[p + 1] << 8);
+        p += 2;
+        return w;
+    };
+
+    while (p < bytes.size()) {
+        auto b = bytes[p++];
+        if (b == COMPACT_RAW) {
+            code.push_back(word());
+            continue;
+        }
+
+        auto op = static_cast<uint16_t>(b & ~COMPACT_LONG);
+        if (op > COMPACT_OPCODE_MASK || !is_mnemonic(op)) {
+            throw std::domain_error("Invalid opcode in compact code");
+        }
+        code.push_back(op);
+        auto n = argument_count(static_cast<mnemonic>(op));
+        for (unsigned i = 0; i < n; ++i) {
+            if (b & COMPACT_LONG) {
+                code.push_back(word());
+            } else if (p < bytes.size()) {
+                code.push_back(bytes[p++]);
+            } else {
+                throw std::domain_error("Compact code ends within an instruction");
+            }
+        }
+    }
+    return code;
+}
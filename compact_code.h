@@ -0,0 +1,36 @@
+#ifndef STACKMACHINE_COMPACT_CODE_H
+#define STACKMACHINE_COMPACT_CODE_H
+
+#include <cstdint>
+#include <vector>
+
+//! A byte oriented encoding of programs.
+//!
+//! Every instruction starts with one byte holding the mnemonic. If all its
+//! operands are below 256 they follow in one byte each, otherwise the byte
+//! has COMPACT_LONG set and every operand follows in two bytes, low byte
+//! first. A word that does not start a complete instruction, like data or a
+//! cut off instruction at the end, is written as COMPACT_RAW and the word in
+//! two bytes. Operands keep their values, in particular jump and call
+//! targets remain word addresses, so expand(compact(code)) == code for every
+//! program and a VM running either form pushes the same return addresses.
+const uint8_t COMPACT_LONG = 0x80;
+const uint8_t COMPACT_RAW = 0x40;
+const uint8_t COMPACT_OPCODE_MASK = 0x3F;
+
+//! Marks words without an offset of their own, see compact().
+const uint32_t NO_OFFSET = 0xFFFFFFFFu;
+
+//! Encode a program in the compact form, decoding it from address 0.
+//! \param code the program
+//! \param offsets if given, receives for every word the offset of the
+//!        instruction it starts or NO_OFFSET for operands, and the size of
+//!        the result at index code.size()
+//! \return the compact form
+std::vector<uint8_t> compact(const std::vector<uint16_t>& code, std::vector<uint32_t>* offsets = nullptr);
+
+//! Decode the compact form back into words.
+//! \throws std::domain_error if bytes is not a valid compact form
+std::vector<uint16_t> expand(const std::vector<uint8_t>& bytes);
+
+#endif //STACKMACHINE_COMPACT_CODE_H
@@ -0,0 +1,363 @@
+#include <numeric>
+#include <ostream>
+#include <thread>
+#include "compact_code.h"
+#include "compact_engine.h"
+#include "decimal.h"
+
+namespace {
+    const uint16_t NOT_AN_INSTRUCTION = 0xFFFF;
+
+    //! Reads instructions out of the compact form.
+    struct byte_stream {
+        const uint8_t* code;
+
+        uint16_t opcode(uint32_t p) const {
+            auto b = code[p];
+            return b == COMPACT_RAW ? NOT_AN_INSTRUCTION : static_cast<uint16_t>(b & COMPACT_OPCODE_MASK);
+        }
+
+        uint16_t operand(uint32_t p, unsigned i) const {
+            return code[p] & COMPACT_LONG
+                   ? static_cast<uint16_t>(code[p + 1 + 2 * i] | code[p + 2 + 2 * i] << 8)
+                   : code[p + 1 + i];
+        }
+
+        uint32_t next(uint32_t p, unsigned n) const {
+            return p + 1 + (code[p] & COMPACT_LONG ? 2 * n : n);
+        }
+    };
+
+    //! Reads instructions out of the word form.
+    struct word_stream {
+        const uint16_t* code;
+
+        uint16_t opcode(uint32_t p) const {
+            return code[p];
+        }
+
+        uint16_t operand(uint32_t p, unsigned i) const {
+            return code[p + 1 + i];
+        }
+
+        uint32_t next(uint32_t p, unsigned n) const {
+            return p + 1 + n;
+        }
+    };
+}
+
+compact_engine::compact_engine(const std::vector<uint8_t> &code)
+: m_state(expand(code)), m_encoding(COMPACT), m_dispatches(0)
+{
+    encode(COMPACT);
+}
+
+compact_engine::compact_engine(const std::vector<uint16_t> &code, encoding e)
+: m_state(code), m_encoding(e), m_dispatches(0)
+{
+    encode(e);
+}
+
+void compact_engine::encode(encoding e) {
+    // with the STOP the interpreter appended
+    if (e == COMPACT) {
+        m_bytes = compact(m_state.code, &m_offsets);
+        // running off the end is the interpreter's business
+        m_offsets.pop_back();
+    } else {
+        m_offsets.resize(m_state.code.size());
+        std::iota(m_offsets.begin(), m_offsets.end(), 0u);
+    }
+}
+
+uint32_t compact_engine::offset(uint32_t pc) const {
+    return pc < m_offsets.size() ? m_offsets[pc] : NO_OFFSET;
+}
+
+void compact_engine::set_command_line_arguments(const std::vector<uint16_t> &args) {
+    m_state.set_command_line_arguments(args);
+}
+
+void compact_engine::set_stack(const std::vector<uint16_t> &stack) {
+    m_state.set_stack(stack);
+}
+
+void compact_engine::set_input_channel(std::shared_ptr<input_channel> channel) {
+    m_state.set_input_channel(std::move(channel));
+}
+
+void compact_engine::set_channel(uint16_t number, std::shared_ptr<channel> ch) {
+    m_state.set_channel(number, std::move(ch));
+}
+
+void compact_engine::set_data_segment(std::shared_ptr<const data_segment> data) {
+    m_state.set_data_segment(std::move(data));
+}
+
+void compact_engine::set_output(std::ostream &out) {
+    m_state.set_output(out);
+}
+
+interpreter::configs compact_engine::registers() const {
+    return m_state.registers();
+}
+
+const std::vector<uint16_t> &compact_engine::stack() const {
+    return m_state.stack();
+}
+
+bool compact_engine::is_stopped() const {
+    return m_state.is_stopped();
+}
+
+uint64_t compact_engine::dispatches() const {
+    return m_dispatches;
+}
+
+size_t compact_engine::code_bytes() const {
+    return m_encoding == COMPACT ? m_bytes.size() : m_state.code.size() * sizeof(uint16_t);
+}
+
+void compact_engine::run() {
+    if (m_state.m_stopped) {
+        return;
+    }
+    if (m_encoding == COMPACT) {
+        run_stream(byte_stream{m_bytes.data()});
+    } else {
+        run_stream(word_stream{m_state.code.data()});
+    }
+}
+
+#define BINARY(NAME, EXPR) \
+        case mnemonic::NAME: { \
+            uint16_t x = s[sp-1]; uint16_t y = s[sp]; \
+            s[sp-1] = static_cast<uint16_t>(EXPR); \
+            --sp; ++pc; ++p; \
+            break; \
+        }
+
+template <typename Stream>
+void compact_engine::run_stream(const Stream& c) {
+    uint16_t* s = m_state.m_words;
+    uint16_t pc = m_state.pc;
+    uint16_t sp = m_state.sp;
+    uint16_t bp = m_state.bp;
+    std::ostream& out = *m_state.m_output;
+    std::string text;
+    uint64_t dispatches = 0;
+
+    uint32_t p = offset(pc);
+    bool stopped = false;
+    while (!stopped) {
+        if (p == NO_OFFSET) {
+            // the interpreter executes until the stream can take over again
+            m_state.pc = pc;
+            m_state.sp = sp;
+            m_state.bp = bp;
+            m_state.step();
+            if (m_state.m_blocked) {
+                // waits for the other end of a channel
+                std::this_thread::yield();
+            } else {
+                ++dispatches;
+            }
+            pc = m_state.pc;
+            sp = m_state.sp;
+            bp = m_state.bp;
+            if (m_state.m_stopped) {
+                break;
+            }
+            p = offset(pc);
+            continue;
+        }
+
+        ++dispatches;
+        switch (c.opcode(p)) {
+            case mnemonic::CONST:
+                ++sp;
+                s[sp] = c.operand(p, 0);
+                pc += 2;
+                p = c.next(p, 1);
+                break;
+            BINARY(ADD, x + y)
+            BINARY(SUB, x - y)
+            BINARY(MUL, static_cast<uint32_t>(x) * y)
+            BINARY(DIV, x / y)
+            BINARY(MOD, x % y)
+            BINARY(EQ, x == y ? 1 : 0)
+            BINARY(LT, x < y ? 1 : 0)
+            case mnemonic::NOT:
+                s[sp] = s[sp] == 0 ? 1 : 0;
+                ++pc; ++p;
+                break;
+            case mnemonic::DUP:
+                s[sp+1] = s[sp];
+                ++sp; ++pc; ++p;
+                break;
+            case mnemonic::SWAP: {
+                auto v = s[sp];
+                s[sp] = s[sp-1];
+                s[sp-1] = v;
+                ++pc; ++p;
+                break;
+            }
+            case mnemonic::LDI:
+                s[sp] = s[s[sp]];
+                ++pc; ++p;
+                break;
+            case mnemonic::LDD:
+                // STD runs in the interpreter, which may switch to its own copy
+                s[sp] = m_state.m_data_words[s[sp]];
+                ++pc; ++p;
+                break;
+            case mnemonic::STI: {
+                auto i = s[sp-1];
+                auto v = s[sp];
+                s[i] = v;
+                s[sp-1] = v;
+                --sp; ++pc; ++p;
+                break;
+            }
+            case mnemonic::GETBP:
+                s[sp+1] = bp;
+                ++sp; ++pc; ++p;
+                break;
+            case mnemonic::GETSP:
+                s[sp+1] = sp;
+                ++sp; ++pc; ++p;
+                break;
+            case mnemonic::INCSP:
+                sp += c.operand(p, 0);
+                pc += 2;
+                p = c.next(p, 1);
+                break;
+            case mnemonic::DECSP:
+                sp -= c.operand(p, 0);
+                pc += 2;
+                p = c.next(p, 1);
+                break;
+            case mnemonic::GOTO:
+                pc = c.operand(p, 0);
+                p = offset(pc);
+                break;
+            case mnemonic::IFZERO:
+            case mnemonic::IFNZERO: {
+                bool zero = s[sp] == 0;
+                --sp;
+                if (zero == (c.opcode(p) == mnemonic::IFZERO)) {
+                    pc = c.operand(p, 0);
+                    p = offset(pc);
+                } else {
+                    pc += 2;
+                    p = c.next(p, 1);
+                }
+                break;
+            }
+            case mnemonic::DJNZ:
+                if (--s[sp] != 0) {
+                    pc = c.operand(p, 0);
+                    p = offset(pc);
+                } else {
+                    pc += 2;
+                    p = c.next(p, 1);
+                }
+                break;
+            case mnemonic::CALL: {
+                // s,v1,...,vm => s,r,bp,v1,...,vm
+                auto m = c.operand(p, 0);
+                auto a = c.operand(p, 1);
+                for (int idx = 0; idx < m; ++idx) {
+                    s[sp + 2 - idx] = s[sp - idx];
+                }
+                auto stack_r = static_cast<uint16_t>(sp - m + 1);
+                auto stack_bp = static_cast<uint16_t>(sp - m + 2);
+                s[stack_r] = static_cast<uint16_t>(pc + 3);
+                s[stack_bp] = bp;
+                bp = static_cast<uint16_t>(stack_bp + 1);
+                sp = static_cast<uint16_t>(stack_bp + m);
+                pc = a;
+                p = offset(pc);
+                break;
+            }
+            case mnemonic::TCALL: {
+                // s,r,b,u1,...,un,v1,...,vm => s,r,b,v1,...,vm
+                auto m = c.operand(p, 0);
+                auto n = c.operand(p, 1);
+                for (int idx = 0; idx < m; ++idx) {
+                    s[sp - n - idx] = s[sp - idx];
+                }
+                sp = static_cast<uint16_t>(sp - n);
+                pc = c.operand(p, 2);
+                p = offset(pc);
+                break;
+            }
+            case mnemonic::RET: {
+                // s,r,b,v1,...,vm,v => s,v
+                auto old_bp = s[bp - 1];
+                pc = s[bp - 2];
+                auto v = s[sp];
+                sp = static_cast<uint16_t>(bp - 2u);
+                s[sp] = v;
+                bp = old_bp;
+                p = offset(pc);
+                break;
+            }
+            case mnemonic::PRINTI: {
+                char digits[MAX_DECIMAL_DIGITS];
+                out.write(digits, format_decimal(s[sp], digits) - digits);
+                --sp; ++pc; ++p;
+                break;
+            }
+            case mnemonic::PRINTC:
+                out.put(static_cast<char>(s[sp]));
+                --sp; ++pc; ++p;
+                break;
+            case mnemonic::PRINTS: {
+                // s,c1,...,cn,n => s
+                uint16_t n = s[sp];
+                text.resize(n);
+                for (uint16_t k = 0; k < n; ++k) {
+                    text[k] = static_cast<char>(s[static_cast<uint16_t>(sp - n + k)]);
+                }
+                out.write(text.data(), n);
+                sp = static_cast<uint16_t>(sp - n - 1); ++pc; ++p;
+                break;
+            }
+            case mnemonic::PRINTN: {
+                // s,v1,...,vn,n => s
+                uint16_t n = s[sp];
+                text.clear();
+                for (uint16_t k = 0; k < n; ++k) {
+                    if (k != 0) {
+                        text += ' ';
+                    }
+                    append_decimal(text, s[static_cast<uint16_t>(sp - n + k)]);
+                }
+                out.write(text.data(), static_cast<std::streamsize>(text.size()));
+                sp = static_cast<uint16_t>(sp - n - 1); ++pc; ++p;
+                break;
+            }
+            case mnemonic::NOOP:
+                ++pc; ++p;
+                break;
+            case mnemonic::STOP:
+                ++pc;
+                m_state.m_stopped = true;
+                stopped = true;
+                break;
+            default:
+                // input, channels and words that are no instruction
+                --dispatches;
+                p = NO_OFFSET;
+                break;
+        }
+    }
+
+    m_state.pc = pc;
+    m_state.sp = sp;
+    m_state.bp = bp;
+    m_dispatches += dispatches;
+}
+
+#undef BINARY
@@ -0,0 +1,69 @@
+#ifndef STACKMACHINE_COMPACT_ENGINE_H
+#define STACKMACHINE_COMPACT_ENGINE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "interpreter.h"
+
+//! Runs a program straight from its compact form, see compact().
+//!
+//! The state lives in an interpreter as in register_engine, so registers(),
+//! stack() and the output are exactly those of interpreter::run(). The loop
+//! decodes one instruction at a time from the byte stream and only touches
+//! the word form to find the offset of a jump target, a return address or
+//! an instruction it leaves to the interpreter: input, channels, words that
+//! are not instructions and jumps into operands.
+class compact_engine {
+public:
+    enum encoding {
+        //! run the compact form
+        COMPACT,
+        //! run the same loop on the word form, for comparison
+        WORDS
+    };
+
+    //! \param code the program in the compact form
+    //! \throws std::domain_error if the code does not decode
+    explicit compact_engine(const std::vector<uint8_t>& code);
+
+    //! \param code the program in the word form, it is compacted first
+    explicit compact_engine(const std::vector<uint16_t>& code, encoding e = COMPACT);
+
+    void set_command_line_arguments(const std::vector<uint16_t>& args);
+    void set_stack(const std::vector<uint16_t>& stack);
+    void set_input_channel(std::shared_ptr<input_channel> channel);
+    void set_channel(uint16_t number, std::shared_ptr<channel> ch);
+    void set_data_segment(std::shared_ptr<const data_segment> data);
+    //! see interpreter::set_output()
+    void set_output(std::ostream& out);
+
+    interpreter::configs registers() const;
+    const std::vector<uint16_t>& stack() const;
+
+    void run();
+    bool is_stopped() const;
+
+    //! \return the number of VM instructions executed so far
+    uint64_t dispatches() const;
+
+    //! \return the size of the code the loop decodes in bytes
+    size_t code_bytes() const;
+
+private:
+    template <typename Stream>
+    void run_stream(const Stream& stream);
+
+    void encode(encoding e);
+    uint32_t offset(uint32_t pc) const;
+
+    interpreter m_state;
+    encoding m_encoding;
+    std::vector<uint8_t> m_bytes;
+    //! for every word of the program, the offset of the instruction it
+    //! starts in the decoded stream or NO_OFFSET
+    std::vector<uint32_t> m_offsets;
+    uint64_t m_dispatches;
+};
+
+#endif //STACKMACHINE_COMPACT_ENGINE_H
@@ -0,0 +1,148 @@
+#include <stdexcept>
+#include <sstream>
+#include "control_flow.h"
+
+bool is_unconditional_transfer(mnemonic m) {
+    return m == mnemonic::GOTO
+        || m == mnemonic::TCALL
+        || m == mnemonic::RET
+        || m == mnemonic::STOP;
+}
+
+bool static_target(const instruction &instr, uint16_t &target) {
+    switch (instr.mnem()) {
+        case mnemonic::GOTO:
+        case mnemonic::IFZERO:
+        case mnemonic::IFNZERO:
+        case mnemonic::DJNZ:
+            target = instr.arg(0);
+            return true;
+        case mnemonic::CALL:
+            target = instr.arg(1);
+            return true;
+        case mnemonic::TCALL:
+            target = instr.arg(2);
+            return true;
+        default:
+            return false;
+    }
+}
+
+namespace {
+    //! Check that the instruction at pc can be decoded.
+    bool decodable(const std::vector<uint16_t>& code, size_t pc) {
+        return pc < code.size()
+            && is_mnemonic(code[pc])
+            && pc + argument_count(static_cast<mnemonic>(code[pc])) < code.size();
+    }
+}
+
+control_flow::control_flow(const std::vector<uint16_t> &code)
+: m_code(code), m_flags(code.size(), 0)
+{
+    std::vector<uint16_t> work;
+
+    if (!m_code.empty()) {
+        work.push_back(0);
+        m_flags[0] |= LEADER;
+    }
+
+    while (!work.empty()) {
+        size_t pc = work.back();
+        work.pop_back();
+
+        // follow the straight-line code until it ends or joins known code
+        while (pc < m_code.size() && (m_flags[pc] & INSTRUCTION) == 0 && decodable(m_code, pc)) {
+            m_flags[pc] |= INSTRUCTION;
+
+            auto instr = at(static_cast<uint16_t>(pc));
+            auto m = instr.mnem();
+            size_t next_pc = pc + 1 + argument_count(m);
+
+            uint16_t target;
+            if (static_target(instr, target) && target < m_code.size()) {
+                m_flags[target] |= LEADER;
+                if (m == mnemonic::CALL || m == mnemonic::TCALL) {
+                    m_flags[target] |= FUNCTION;
+                }
+                work.push_back(target);
+            }
+
+            bool branches = m == mnemonic::IFZERO || m == mnemonic::IFNZERO || m == mnemonic::DJNZ
+                         || m == mnemonic::CALL;
+            if (next_pc < m_code.size() && (branches || is_unconditional_transfer(m))) {
+                m_flags[next_pc] |= LEADER;
+            }
+
+            if (is_unconditional_transfer(m)) {
+                break;
+            }
+            pc = next_pc;
+        }
+    }
+}
+
+control_flow::control_flow(const std::vector<uint16_t> &code, const std::vector<uint8_t> &flags)
+: m_code(code), m_flags(flags)
+{
+    if (m_flags.size() != m_code.size()) {
+        throw std::domain_error("Control flow flags do not match the code");
+    }
+}
+
+std::vector<uint16_t> control_flow::leaders() const {
+    std::vector<uint16_t> result;
+    for (size_t pc = 0; pc < m_flags.size(); ++pc) {
+        if ((m_flags[pc] & (LEADER | INSTRUCTION)) == (LEADER | INSTRUCTION)) {
+            result.push_back(static_cast<uint16_t>(pc));
+        }
+    }
+    return result;
+}
+
+instruction control_flow::at(uint16_t pc) const {
+    auto m = static_cast<mnemonic>(m_code.at(pc));
+    std::vector<uint16_t> args;
+    for (size_t arg = 1; arg <= argument_count(m); ++arg) {
+        args.push_back(m_code.at(pc + arg));
+    }
+    return instruction(m, args);
+}
+
+uint16_t control_flow::next(uint16_t pc) const {
+    return static_cast<uint16_t>(pc + 1 + argument_count(static_cast<mnemonic>(m_code.at(pc))));
+}
+
+void verify(const std::vector<uint16_t> &code) {
+
+    control_flow cfg(code);
+
+    auto fail = [](size_t pc, const char* reason) {
+        std::stringstream msg;
+        msg << reason << " at pc=0x" << std::hex << pc;
+        throw std::domain_error(msg.str());
+    };
+
+    // every address the control flow can reach must hold a valid instruction
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (!cfg.is_instruction(pc)) {
+            continue;
+        }
+        auto instr = cfg.at(static_cast<uint16_t>(pc));
+        auto m = instr.mnem();
+
+        uint16_t target;
+        if (static_target(instr, target) && !cfg.is_instruction(target)) {
+            fail(pc, target < code.size() ? "Invalid jump target" : "Jump target outside of code");
+        }
+
+        size_t next_pc = pc + 1 + argument_count(m);
+        if (!is_unconditional_transfer(m) && !cfg.is_instruction(next_pc)) {
+            fail(next_pc, next_pc < code.size() ? "Invalid instruction" : "Missing STOP");
+        }
+    }
+
+    if (!code.empty() && !cfg.is_instruction(0)) {
+        fail(0, "Invalid instruction");
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef STACKMACHINE_CONTROL_FLOW_H
+#define STACKMACHINE_CONTROL_FLOW_H
+
+#include <cstdint>
+#include <vector>
+#include "instructions.h"
+
+//! Check whether an instruction never falls through to the next one.
+//! \param m the mnemonic
+//! \return true for GOTO, TCALL, RET and STOP
+bool is_unconditional_transfer(mnemonic m);
+
+//! Get the statically known jump or call target of an instruction.
+//! \param instr the instruction
+//! \param target receives the target address
+//! \return false if the instruction has no static target
+bool static_target(const instruction& instr, uint16_t& target);
+
+//! The instructions of a program that are reachable from pc 0, following
+//! fall-through, jumps, calls and the return points after calls, together
+//! with the basic block leaders among them.
+class control_flow {
+public:
+    explicit control_flow(const std::vector<uint16_t>& code);
+
+    //! Restore the control flow of code from flags() of an earlier analysis,
+    //! for example one kept in a program_cache.
+    //! \throws std::domain_error if there is not one flag per code word
+    control_flow(const std::vector<uint16_t>& code, const std::vector<uint8_t>& flags);
+
+    //! \return true if an instruction reachable from pc 0 starts at pc
+    bool is_instruction(size_t pc) const {
+        return pc < m_flags.size() && (m_flags[pc] & INSTRUCTION) != 0;
+    }
+
+    //! \return true if a basic block starts at pc
+    bool is_leader(size_t pc) const {
+        return pc < m_flags.size() && (m_flags[pc] & LEADER) != 0;
+    }
+
+    //! \return true if pc is the target of a CALL or TCALL
+    bool is_function_entry(size_t pc) const {
+        return pc < m_flags.size() && (m_flags[pc] & FUNCTION) != 0;
+    }
+
+    //! All basic block leaders in ascending order.
+    std::vector<uint16_t> leaders() const;
+
+    //! Decode the instruction at pc.
+    instruction at(uint16_t pc) const;
+
+    //! \return the address after the instruction at pc
+    uint16_t next(uint16_t pc) const;
+
+    const std::vector<uint16_t>& code() const {
+        return m_code;
+    }
+
+    //! The analysis result, one byte per code word.
+    const std::vector<uint8_t>& flags() const {
+        return m_flags;
+    }
+
+private:
+    enum flag : uint8_t {
+        INSTRUCTION = 1,
+        LEADER = 2,
+        FUNCTION = 4
+    };
+
+    std::vector<uint16_t> m_code;
+    std::vector<uint8_t> m_flags;
+};
+
+//! Verify that every instruction reachable from pc 0 is a known mnemonic
+//! whose arguments lie within the code and whose static targets are
+//! addresses inside the code.
+//! \param code the program
+//! \throws std::domain_error if the program is malformed
+void verify(const std::vector<uint16_t>& code);
+
+#endif //STACKMACHINE_CONTROL_FLOW_H
@@ -0,0 +1,22 @@
+#include <algorithm>
+#include <stdexcept>
+#include "data_segment.h"
+
+data_segment::data_segment(const std::vector<uint16_t> &words)
+: m_words(), m_size(words.size())
+{
+    if (words.size() > WORDS) {
+        throw std::domain_error("data segment exceeds 64k words");
+    }
+    m_words.assign(WORDS, 0);
+    std::copy(words.begin(), words.end(), m_words.begin());
+}
+
+std::shared_ptr<const data_segment> data_segment::empty() {
+    static const std::shared_ptr<const data_segment> segment(new data_segment(std::vector<uint16_t>()));
+    return segment;
+}
+
+size_t data_segment::size() const {
+    return m_size;
+}
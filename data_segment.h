@@ -0,0 +1,44 @@
+#ifndef STACKMACHINE_DATA_SEGMENT_H
+#define STACKMACHINE_DATA_SEGMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//! The data section of a program: constant tables addressed by LDD and STD
+//! in an address space of their own instead of being built on the stack at
+//! run time. A segment spans 64k words, the words past the preloaded ones
+//! are 0.
+//!
+//! A segment never changes once built, so all interpreters running a program
+//! share one, see interpreter::set_data_segment(). An interpreter copies the
+//! segment on its first STD and its stores stay private.
+class data_segment {
+public:
+    static const size_t WORDS = 0x10000;
+
+    //! \param words the preloaded words, starting at address 0
+    //! \throws std::domain_error if there are more than WORDS words
+    explicit data_segment(const std::vector<uint16_t>& words);
+
+    data_segment(const data_segment&) = delete;
+    data_segment& operator=(const data_segment&) = delete;
+
+    //! \return the segment of interpreters without a data section, all 0
+    static std::shared_ptr<const data_segment> empty();
+
+    //! \return the WORDS words of the segment
+    const uint16_t* words() const {
+        return m_words.data();
+    }
+
+    //! \return the number of preloaded words
+    size_t size() const;
+
+private:
+    std::vector<uint16_t> m_words;
+    size_t m_size;
+};
+
+#endif //STACKMACHINE_DATA_SEGMENT_H
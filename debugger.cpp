@@ -0,0 +1,168 @@
+#include <stdexcept>
+#include <string>
+#include "debugger.h"
+#include "guarded_stack.h"
+#include "instructions.h"
+
+debugger::debugger(interpreter &vm)
+: m_vm(vm), m_starts(vm.code.size(), false), m_breakpoints(), m_watches(), m_watch_slot(0)
+{
+    size_t pc = 0;
+    while (pc < m_vm.code.size()) {
+        m_starts[pc] = true;
+        auto word = m_vm.code[pc];
+        pc += 1 + (is_mnemonic(word) ? argument_count(static_cast<mnemonic>(word)) : 0);
+    }
+}
+
+debugger::~debugger() {
+    for (auto& breakpoint : m_breakpoints) {
+        m_vm.code[breakpoint.first] = breakpoint.second;
+    }
+    if (m_vm.m_break) {
+        resume();
+    }
+}
+
+void debugger::set_breakpoint(uint16_t pc) {
+    if (pc >= m_starts.size() || !m_starts[pc]) {
+        throw std::domain_error("No instruction starts at " + std::to_string(pc));
+    }
+    if (m_breakpoints.count(pc) == 0) {
+        m_breakpoints[pc] = m_vm.code[pc];
+        m_vm.code[pc] = BREAK;
+    }
+}
+
+void debugger::clear_breakpoint(uint16_t pc) {
+    auto breakpoint = m_breakpoints.find(pc);
+    if (breakpoint != m_breakpoints.end()) {
+        m_vm.code[pc] = breakpoint->second;
+        m_breakpoints.erase(breakpoint);
+    }
+}
+
+void debugger::watch(uint16_t slot) {
+    m_vm.set_safe_mode(true);
+    m_watches[slot] = m_vm.m_words[slot];
+}
+
+void debugger::unwatch(uint16_t slot) {
+    m_watches.erase(slot);
+}
+
+debugger::stop_reason debugger::run() {
+    resume();
+    if (m_vm.m_stopped) {
+        return STOPPED;
+    }
+    if (m_breakpoints.count(m_vm.pc) != 0) {
+        // leave the breakpoint we stopped at
+        auto reason = step();
+        if (reason != STEPPED) {
+            return reason;
+        }
+    }
+
+    while (true) {
+        arm();
+        m_vm.run();
+        if (disarm()) {
+            return WATCHPOINT;
+        }
+        if (!m_vm.m_break || m_vm.m_fault != interpreter::NO_FAULT) {
+            return STOPPED;
+        }
+        if (m_vm.pc == m_vm.m_op_pc && m_vm.code[m_vm.pc] == BREAK) {
+            return BREAKPOINT;
+        }
+        // a write to a watched page that left the watched slots alone
+        resume();
+    }
+}
+
+debugger::stop_reason debugger::step() {
+    resume();
+    if (m_vm.m_stopped) {
+        return STOPPED;
+    }
+
+    auto pc = m_vm.pc;
+    auto breakpoint = m_breakpoints.find(pc);
+    if (breakpoint != m_breakpoints.end()) {
+        m_vm.code[pc] = breakpoint->second;
+    }
+    arm();
+    m_vm.step();
+    auto changed = disarm();
+    if (breakpoint != m_breakpoints.end()) {
+        m_vm.code[pc] = BREAK;
+    }
+
+    if (changed) {
+        return WATCHPOINT;
+    }
+    if (m_vm.m_break && m_vm.m_fault == interpreter::NO_FAULT) {
+        // the instruction completed, only the watched page stopped it
+        resume();
+    }
+    return m_vm.m_stopped ? STOPPED : STEPPED;
+}
+
+interpreter::configs debugger::registers() const {
+    return m_vm.registers();
+}
+
+uint16_t debugger::word(uint16_t slot) const {
+    return m_vm.m_words[slot];
+}
+
+uint16_t debugger::code_word(uint16_t pc) const {
+    auto breakpoint = m_breakpoints.find(pc);
+    return breakpoint != m_breakpoints.end() ? breakpoint->second : m_vm.code.at(pc);
+}
+
+uint16_t debugger::watch_slot() const {
+    return m_watch_slot;
+}
+
+void debugger::resume() {
+    if (m_vm.m_break) {
+        m_vm.m_break = false;
+        m_vm.m_stopped = false;
+    }
+}
+
+void debugger::arm() {
+    if (m_watches.empty()) {
+        return;
+    }
+    std::vector<uint16_t> slots;
+    for (auto& w : m_watches) {
+        w.second = m_vm.m_words[w.first];
+        slots.push_back(w.first);
+    }
+    m_vm.m_guarded->watch(slots, &m_vm.m_stopped);
+}
+
+bool debugger::disarm() {
+    if (m_watches.empty()) {
+        return false;
+    }
+    uint16_t hit = 0;
+    auto written = m_vm.m_guarded->watch_hit(hit);
+    m_vm.m_guarded->unwatch();
+    if (!written) {
+        return false;
+    }
+
+    // the slot written first if it changed, else the lowest that did
+    bool changed = false;
+    for (auto& w : m_watches) {
+        if (m_vm.m_words[w.first] != w.second && (!changed || w.first == hit)) {
+            m_watch_slot = w.first;
+            changed = true;
+        }
+    }
+    return changed;
+}
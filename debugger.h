@@ -0,0 +1,83 @@
+#ifndef STACKMACHINE_DEBUGGER_H
+#define STACKMACHINE_DEBUGGER_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "interpreter.h"
+
+//! Breakpoints, single steps and stack watchpoints on an interpreter that
+//! cost nothing on the instructions that do not hit them.
+//!
+//! A breakpoint replaces its instruction in the interpreter's own copy of
+//! the code with BREAK, which stops the VM with the pc on it; resuming runs
+//! the original instruction by one step and puts BREAK back. A watchpoint
+//! makes the page of the guarded stack holding its slot read-only while the
+//! debugger runs the VM, so only writes to that page trap, and the VM stops
+//! after the instruction that changed a watched slot. Without breakpoints
+//! and watchpoints run() is the interpreter's own run().
+//!
+//! The interpreter must outlive the debugger, which restores its code.
+class debugger {
+public:
+    enum stop_reason {
+        //! the VM reached STOP or a fault, or was stopped before
+        STOPPED,
+        //! the pc is on a breakpoint
+        BREAKPOINT,
+        //! an instruction changed a watched slot, see watch_slot()
+        WATCHPOINT,
+        //! step() executed one instruction
+        STEPPED
+    };
+
+    explicit debugger(interpreter& vm);
+    //! removes all breakpoints and lets a VM stopped at one continue
+    ~debugger();
+
+    debugger(const debugger&) = delete;
+    debugger& operator=(const debugger&) = delete;
+
+    //! \throws std::domain_error if pc is not the start of an instruction
+    void set_breakpoint(uint16_t pc);
+    void clear_breakpoint(uint16_t pc);
+
+    //! Stop when slot changes. Puts the VM into safe mode.
+    //! \throws std::runtime_error if the stack cannot be mapped
+    void watch(uint16_t slot);
+    void unwatch(uint16_t slot);
+
+    //! Run until STOP, a fault, a breakpoint or a watchpoint, starting with
+    //! the instruction at the pc even if it has a breakpoint. A VM that
+    //! waits on a channel is yielded to the other threads as in
+    //! interpreter::run().
+    stop_reason run();
+    //! Execute one instruction, also the one under a breakpoint.
+    stop_reason step();
+
+    interpreter::configs registers() const;
+    //! \return the word at slot of the stack
+    uint16_t word(uint16_t slot) const;
+    //! \return the word at pc of the code without the breakpoints
+    uint16_t code_word(uint16_t pc) const;
+    //! \return the slot the last WATCHPOINT stop was for
+    uint16_t watch_slot() const;
+
+private:
+    //! Clear a stop at a breakpoint or watchpoint so the VM can go on.
+    void resume();
+    void arm();
+    //! \return true if a watched slot changed since arm()
+    bool disarm();
+
+    interpreter& m_vm;
+    //! the instructions start at the code words set here
+    std::vector<bool> m_starts;
+    //! pc to the word BREAK replaced
+    std::map<uint16_t, uint16_t> m_breakpoints;
+    //! slot to the value it had when the VM last ran
+    std::map<uint16_t, uint16_t> m_watches;
+    uint16_t m_watch_slot;
+};
+
+#endif //STACKMACHINE_DEBUGGER_H
@@ -0,0 +1,47 @@
+#include "decimal.h"
+
+namespace {
+    const char DIGIT_PAIRS[201] =
+            "00010203040506070809"
+            "10111213141516171819"
+            "20212223242526272829"
+            "30313233343536373839"
+            "40414243444546474849"
+            "50515253545556575859"
+            "60616263646566676869"
+            "70717273747576777879"
+            "80818283848586878889"
+            "90919293949596979899";
+
+    //! Write the two digits of v < 100.
+    char* pair(unsigned v, char* out) {
+        out[0] = DIGIT_PAIRS[2 * v];
+        out[1] = DIGIT_PAIRS[2 * v + 1];
+        return out + 2;
+    }
+}
+
+char* format_decimal(uint16_t v, char* out) {
+    unsigned n = v;
+    if (n < 10) {
+        *out = static_cast<char>('0' + n);
+        return out + 1;
+    }
+    if (n < 100) {
+        return pair(n, out);
+    }
+    if (n < 1000) {
+        *out = static_cast<char>('0' + n / 100);
+        return pair(n % 100, out + 1);
+    }
+    if (n < 10000) {
+        return pair(n % 100, pair(n / 100, out));
+    }
+    *out = static_cast<char>('0' + n / 10000);
+    return pair(n % 100, pair(n / 100 % 100, out + 1));
+}
+
+void append_decimal(std::string& out, uint16_t v) {
+    char digits[MAX_DECIMAL_DIGITS];
+    out.append(digits, format_decimal(v, digits));
+}
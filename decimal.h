@@ -0,0 +1,22 @@
+#ifndef STACKMACHINE_DECIMAL_H
+#define STACKMACHINE_DECIMAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//! The most digits a word has in decimal.
+const size_t MAX_DECIMAL_DIGITS = 5;
+
+//! Write v in decimal without leading zeros, as PRINTI prints it. Digits are
+//! looked up two at a time in a table of the pairs 00 to 99, no stream or
+//! locale is involved.
+//! \param v the word
+//! \param out room for MAX_DECIMAL_DIGITS chars, no terminating 0 is written
+//! \return one past the last digit written
+char* format_decimal(uint16_t v, char* out);
+
+//! Append v in decimal to out, see format_decimal().
+void append_decimal(std::string& out, uint16_t v);
+
+#endif //STACKMACHINE_DECIMAL_H
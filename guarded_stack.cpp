@@ -0,0 +1,162 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "guarded_stack.h"
+
+namespace {
+    thread_local trap_scope* t_innermost = nullptr;
+
+    struct sigaction g_previous_segv;
+    struct sigaction g_previous_fpe;
+    std::once_flag g_installed;
+
+    size_t round_to_pages(size_t bytes) {
+        auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+        return (bytes + page - 1) / page * page;
+    }
+
+    size_t guard_bytes() {
+        return round_to_pages(guarded_stack::GUARD_WORDS * sizeof(uint16_t));
+    }
+
+    //! Pass a fault on as if we had never seen it.
+    void forward(int signal, siginfo_t* info, void* context) {
+        auto& previous = signal == SIGSEGV ? g_previous_segv : g_previous_fpe;
+        if (previous.sa_flags & SA_SIGINFO) {
+            previous.sa_sigaction(signal, info, context);
+        } else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+            previous.sa_handler(signal);
+        } else {
+            // returning repeats the faulting instruction under the default
+            ::sigaction(signal, &previous, nullptr);
+        }
+    }
+}
+
+const size_t guarded_stack::WORDS;
+const size_t guarded_stack::GUARD_WORDS;
+
+guarded_stack::guarded_stack()
+: m_mapping(nullptr), m_size(0), m_words(nullptr), m_page_words(0), m_watched(), m_stop(nullptr), m_hit(0),
+  m_hit_slot(0)
+{
+    auto guard = guard_bytes();
+    auto words = round_to_pages(WORDS * sizeof(uint16_t));
+    m_size = guard + words + guard;
+
+    m_mapping = ::mmap(nullptr, m_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m_mapping == MAP_FAILED) {
+        throw std::runtime_error(std::string("Cannot map a guarded stack: ") + std::strerror(errno));
+    }
+    auto stack = static_cast<char*>(m_mapping) + guard;
+    if (::mprotect(stack, words, PROT_READ | PROT_WRITE) != 0) {
+        auto error = errno;
+        ::munmap(m_mapping, m_size);
+        throw std::runtime_error(std::string("Cannot map a guarded stack: ") + std::strerror(error));
+    }
+    m_words = reinterpret_cast<uint16_t*>(stack);
+    m_page_words = round_to_pages(1) / sizeof(uint16_t);
+    m_watched.assign(words / sizeof(uint16_t) / m_page_words, 0);
+}
+
+guarded_stack::~guarded_stack() {
+    ::munmap(m_mapping, m_size);
+}
+
+bool guarded_stack::guards(const void *address) const {
+    auto begin = static_cast<const char*>(m_mapping);
+    auto a = static_cast<const char*>(address);
+    auto stack = reinterpret_cast<const char*>(m_words);
+    auto end = stack + WORDS * sizeof(uint16_t);
+    return (a >= begin && a < stack) || (a >= end && a < begin + m_size);
+}
+
+void guarded_stack::watch(const std::vector<uint16_t> &slots, bool* stop) {
+    unwatch();
+    m_stop = stop;
+    m_hit = 0;
+    for (auto slot : slots) {
+        auto page = slot / m_page_words;
+        if (!m_watched[page]) {
+            if (::mprotect(m_words + page * m_page_words, m_page_words * sizeof(uint16_t), PROT_READ) != 0) {
+                throw std::runtime_error(std::string("Cannot protect a watched page: ") + std::strerror(errno));
+            }
+            m_watched[page] = 1;
+        }
+    }
+}
+
+void guarded_stack::unwatch() {
+    for (size_t page = 0; page < m_watched.size(); ++page) {
+        if (m_watched[page]) {
+            ::mprotect(m_words + page * m_page_words, m_page_words * sizeof(uint16_t), PROT_READ | PROT_WRITE);
+            m_watched[page] = 0;
+        }
+    }
+    m_stop = nullptr;
+    m_hit = 0;
+}
+
+bool guarded_stack::watch_hit(uint16_t &slot) const {
+    slot = m_hit_slot;
+    return m_hit != 0;
+}
+
+bool guarded_stack::take_watch_fault(const void *address) {
+    auto a = static_cast<const char*>(address);
+    auto stack = reinterpret_cast<const char*>(m_words);
+    if (a < stack || a >= stack + WORDS * sizeof(uint16_t)) {
+        return false;
+    }
+    auto slot = static_cast<size_t>(a - stack) / sizeof(uint16_t);
+    auto page = slot / m_page_words;
+    if (!m_watched[page]) {
+        return false;
+    }
+    ::mprotect(m_words + page * m_page_words, m_page_words * sizeof(uint16_t), PROT_READ | PROT_WRITE);
+    m_watched[page] = 0;
+    if (!m_hit) {
+        m_hit_slot = static_cast<uint16_t>(slot);
+        m_hit = 1;
+    }
+    if (m_stop != nullptr) {
+        *m_stop = true;
+    }
+    return true;
+}
+
+trap_scope::trap_scope(guarded_stack &stack)
+: m_stack(stack), m_outer(t_innermost)
+{
+    std::call_once(g_installed, [] {
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = &trap_scope::handle;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        ::sigaction(SIGSEGV, &action, &g_previous_segv);
+        ::sigaction(SIGFPE, &action, &g_previous_fpe);
+    });
+    t_innermost = this;
+}
+
+trap_scope::~trap_scope() {
+    t_innermost = m_outer;
+}
+
+void trap_scope::handle(int signal, siginfo_t *info, void *context) {
+    auto scope = t_innermost;
+    if (scope != nullptr && signal == SIGSEGV && scope->m_stack.take_watch_fault(info->si_addr)) {
+        // the write is repeated on return and goes through
+        return;
+    }
+    if (scope != nullptr && (signal == SIGFPE || scope->m_stack.guards(info->si_addr))) {
+        siglongjmp(scope->m_buffer, signal);
+    }
+    forward(signal, info, context);
+}
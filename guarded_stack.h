@@ -0,0 +1,93 @@
+#ifndef STACKMACHINE_GUARDED_STACK_H
+#define STACKMACHINE_GUARDED_STACK_H
+
+#include <csetjmp>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//! The 64K words a VM can address, mapped between two PROT_NONE regions.
+//!
+//! Every stack index the interpreter computes is a 16-bit register plus or
+//! minus at most two 16-bit values, so it lies less than GUARD_WORDS outside
+//! the stack and any access out of range hits a guard region instead of
+//! other memory. The guards only reserve address space.
+class guarded_stack {
+public:
+    static const size_t WORDS = 0x10000;
+    static const size_t GUARD_WORDS = 0x20000;
+
+    //! \throws std::runtime_error if the memory cannot be mapped
+    guarded_stack();
+    ~guarded_stack();
+
+    guarded_stack(const guarded_stack&) = delete;
+    guarded_stack& operator=(const guarded_stack&) = delete;
+
+    uint16_t* data() {
+        return m_words;
+    }
+
+    //! \return true if address lies in one of the guard regions
+    bool guards(const void* address) const;
+
+    //! Make the pages holding slots read-only until unwatch(). In a
+    //! trap_scope the first write to such a page makes it writable again,
+    //! records the slot written and sets *stop, then the write goes ahead.
+    //! Pages are protected whole, so writes to their other slots count too.
+    void watch(const std::vector<uint16_t>& slots, bool* stop);
+    void unwatch();
+
+    //! \return true if a watched page was written since watch(), false
+    //!         after unwatch()
+    //! \param slot receives the slot written first
+    bool watch_hit(uint16_t& slot) const;
+
+private:
+    friend class trap_scope;
+
+    //! Note a write to a watched page from the trap handler.
+    //! \return false if address is not on a watched page
+    bool take_watch_fault(const void* address);
+
+    void* m_mapping;
+    size_t m_size;
+    uint16_t* m_words;
+    size_t m_page_words;
+    //! one entry per page of the stack, non-zero while it is read-only
+    std::vector<char> m_watched;
+    bool* m_stop;
+    volatile sig_atomic_t m_hit;
+    uint16_t m_hit_slot;
+};
+
+//! Catches the hardware traps of one guarded stack on this thread.
+//!
+//! While a scope is the innermost on its thread, a SIGSEGV in a guard region
+//! of its stack and any SIGFPE jump to its buffer with the signal number, a
+//! SIGSEGV on a watched page returns after unprotecting it;
+//! the caller arms the buffer with sigsetjmp(buffer(), 1) right after
+//! construction. Other faults go to the handler installed before, so a real
+//! crash stays a crash. The handlers are installed on first use.
+class trap_scope {
+public:
+    explicit trap_scope(guarded_stack& stack);
+    ~trap_scope();
+
+    trap_scope(const trap_scope&) = delete;
+    trap_scope& operator=(const trap_scope&) = delete;
+
+    sigjmp_buf& buffer() {
+        return m_buffer;
+    }
+
+private:
+    static void handle(int signal, siginfo_t* info, void* context);
+
+    guarded_stack& m_stack;
+    trap_scope* m_outer;
+    sigjmp_buf m_buffer;
+};
+
+#endif //STACKMACHINE_GUARDED_STACK_H
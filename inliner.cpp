@@ -0,0 +1,524 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include "control_flow.h"
+#include "inliner.h"
+
+namespace {
+    const uint32_t NO_TARGET = 0xFFFFFFFFu;
+
+    //! Labels of copied instructions start above all code addresses.
+    const uint32_t FIRST_COPY_LABEL = 0x10000;
+
+    //! An instruction whose jump or call target is a label. Original
+    //! instructions are labeled with their old address.
+    struct item {
+        instruction instr;
+        uint32_t target;
+        std::vector<uint32_t> labels;
+    };
+
+    //! What the analysis knows about a stack slot of the frame.
+    struct value {
+        enum kind : uint8_t {
+            //! any word that does not depend on bp
+            DATA,
+            //! a known word
+            CONSTANT,
+            //! bp plus offset
+            FRAME
+        };
+
+        kind k;
+        int32_t n;
+
+        bool operator==(const value& other) const {
+            return k == other.k && (k == DATA || n == other.n);
+        }
+
+        bool operator!=(const value& other) const {
+            return !(*this == other);
+        }
+    };
+
+    const value DATA_VALUE = {value::DATA, 0};
+
+    value constant(int32_t c) {
+        return {value::CONSTANT, c & 0xFFFF};
+    }
+
+    value frame(int32_t offset) {
+        return {value::FRAME, offset};
+    }
+
+    //! A constant as the signed offset it adds to a frame address.
+    int32_t offset_of(const value& c) {
+        return c.n >= 0x8000 ? c.n - 0x10000 : c.n;
+    }
+
+    //! A value an instruction may compute with, branch on or store.
+    bool is_data(const value& v) {
+        return v.k != value::FRAME;
+    }
+
+    //! Merge the state of another path into the state at a join point.
+    //! \return false if the paths disagree on the depth or on a frame address
+    bool join(std::vector<value>& into, const std::vector<value>& from) {
+        if (into.size() != from.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < into.size(); ++i) {
+            if (into[i] == from[i]) {
+                continue;
+            }
+            if (into[i].k == value::FRAME || from[i].k == value::FRAME) {
+                return false;
+            }
+            into[i] = DATA_VALUE;
+        }
+        return true;
+    }
+
+    //! A function body that can be copied into its callers.
+    struct callee {
+        bool inlinable;
+        //! the instructions of the body in address order
+        std::vector<uint16_t> pcs;
+        //! stack depth above the arguments before each instruction
+        std::map<uint16_t, int32_t> depth;
+    };
+
+    //! Walk the body of the function at entry called with m arguments. The
+    //! state of each instruction tells what is known of the stack slots of the
+    //! frame from the first argument up. A frame address must be bp plus a
+    //! known offset of at least 0: bp - 2 and bp - 1 hold the return address
+    //! and the old bp, which an inlined body does not have.
+    callee analyze(const control_flow& cfg, uint16_t entry, uint16_t m, unsigned max_size) {
+
+        callee result{false, {}, {}};
+        std::map<uint16_t, std::vector<value>> states;
+        std::vector<uint16_t> work{entry};
+        states[entry] = std::vector<value>(m, DATA_VALUE);
+        // a RET is walked again when a join widens its state
+        std::set<uint16_t> rets;
+
+        while (!work.empty()) {
+            auto pc = work.back();
+            work.pop_back();
+            if (states.size() > max_size) {
+                return result;
+            }
+
+            auto s = states[pc];
+            auto instr = cfg.at(pc);
+            auto mnem = instr.mnem();
+            bool falls_through = true;
+            uint16_t target = 0;
+            bool jumps = false;
+
+            bool ok = true;
+            auto pop = [&s, &ok]() {
+                if (s.empty()) {
+                    ok = false;
+                    return DATA_VALUE;
+                }
+                auto v = s.back();
+                s.pop_back();
+                return v;
+            };
+
+            switch (mnem) {
+                case mnemonic::CONST:
+                    s.push_back(constant(instr.arg(0)));
+                    break;
+                case mnemonic::READ:
+                    s.push_back(DATA_VALUE);
+                    s.push_back(DATA_VALUE);
+                    break;
+                case mnemonic::ADD: {
+                    auto b = pop();
+                    auto a = pop();
+                    if (a.k == value::FRAME && b.k == value::CONSTANT) {
+                        s.push_back(frame(a.n + offset_of(b)));
+                    } else if (a.k == value::CONSTANT && b.k == value::FRAME) {
+                        s.push_back(frame(b.n + offset_of(a)));
+                    } else if (a.k == value::CONSTANT && b.k == value::CONSTANT) {
+                        s.push_back(constant(a.n + b.n));
+                    } else {
+                        // bp plus a word only known at run time may be any slot
+                        ok = ok && is_data(a) && is_data(b);
+                        s.push_back(DATA_VALUE);
+                    }
+                    ok = ok && (s.back().k != value::FRAME || s.back().n >= 0);
+                    break;
+                }
+                case mnemonic::SUB:
+                case mnemonic::MUL:
+                case mnemonic::DIV:
+                case mnemonic::MOD:
+                case mnemonic::EQ:
+                case mnemonic::LT: {
+                    // a frame address below bp would reach the return address and old bp
+                    auto b = pop();
+                    auto a = pop();
+                    ok = ok && is_data(a) && is_data(b);
+                    s.push_back(DATA_VALUE);
+                    break;
+                }
+                case mnemonic::NOT:
+                    ok = is_data(pop()) && ok;
+                    s.push_back(DATA_VALUE);
+                    break;
+                case mnemonic::DUP: {
+                    auto v = pop();
+                    s.push_back(v);
+                    s.push_back(v);
+                    break;
+                }
+                case mnemonic::SWAP: {
+                    auto b = pop();
+                    auto a = pop();
+                    s.push_back(b);
+                    s.push_back(a);
+                    break;
+                }
+                case mnemonic::LDI:
+                    pop();
+                    s.push_back(DATA_VALUE);
+                    break;
+                case mnemonic::STI: {
+                    // s,i,v => s,v
+                    auto v = pop();
+                    pop();
+                    ok = ok && is_data(v);
+                    s.push_back(DATA_VALUE);
+                    break;
+                }
+                case mnemonic::GETBP:
+                    s.push_back(frame(0));
+                    break;
+                case mnemonic::INCSP:
+                    s.insert(s.end(), instr.arg(0), DATA_VALUE);
+                    break;
+                case mnemonic::DECSP:
+                    ok = instr.arg(0) <= s.size();
+                    if (ok) {
+                        s.resize(s.size() - instr.arg(0));
+                    }
+                    break;
+                case mnemonic::GOTO:
+                    falls_through = false;
+                    jumps = true;
+                    target = instr.arg(0);
+                    break;
+                case mnemonic::IFZERO:
+                case mnemonic::IFNZERO:
+                case mnemonic::PRINTI:
+                case mnemonic::PRINTC:
+                    ok = is_data(pop()) && ok;
+                    jumps = mnem == mnemonic::IFZERO || mnem == mnemonic::IFNZERO;
+                    target = jumps ? instr.arg(0) : 0;
+                    break;
+                case mnemonic::NOOP:
+                    break;
+                case mnemonic::RET:
+                    ok = is_data(pop()) && ok;
+                    falls_through = false;
+                    rets.insert(pc);
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+            if (!ok || rets.size() > 1) {
+                return result;
+            }
+
+            std::vector<uint16_t> successors;
+            if (falls_through) {
+                successors.push_back(cfg.next(pc));
+            }
+            if (jumps) {
+                successors.push_back(target);
+            }
+            for (auto next : successors) {
+                auto it = states.find(next);
+                if (it == states.end()) {
+                    states[next] = s;
+                    work.push_back(next);
+                    continue;
+                }
+                auto merged = it->second;
+                if (!join(merged, s)) {
+                    return result;
+                }
+                if (merged != it->second) {
+                    it->second = merged;
+                    work.push_back(next);
+                }
+            }
+        }
+
+        if (rets.size() != 1 || states.size() > max_size) {
+            return result;
+        }
+
+        // the body must be contiguous and start at the entry
+        for (auto& state : states) {
+            if (!result.pcs.empty() && cfg.next(result.pcs.back()) != state.first) {
+                return result;
+            }
+            result.pcs.push_back(state.first);
+            result.depth[state.first] = static_cast<int32_t>(state.second.size()) - m;
+        }
+        result.inlinable = result.pcs.front() == entry;
+        return result;
+    }
+
+    //! Copy a body into a call site with m arguments, the copy continues at
+    //! return_label. Labels in pending go to the first item appended to out,
+    //! labels left over go to the next one.
+    void copy_body(const control_flow& cfg, const callee& body, uint16_t m, uint32_t first_label,
+                   uint32_t return_label, std::vector<uint32_t>& pending, std::vector<item>& out) {
+
+        auto add = [&](const instruction& instr, uint32_t target) {
+            out.push_back({instr, target, pending});
+            pending.clear();
+        };
+        auto label_of = [&](uint16_t pc) {
+            auto idx = std::lower_bound(body.pcs.begin(), body.pcs.end(), pc) - body.pcs.begin();
+            return first_label + static_cast<uint32_t>(idx);
+        };
+
+        std::vector<uint16_t> targets;
+        for (auto pc : body.pcs) {
+            uint16_t target;
+            if (static_target(cfg.at(pc), target)) {
+                targets.push_back(target);
+            }
+        }
+        auto is_target = [&targets](uint16_t pc) {
+            return std::find(targets.begin(), targets.end(), pc) != targets.end();
+        };
+
+        for (size_t idx = 0; idx < body.pcs.size(); ++idx) {
+            auto pc = body.pcs[idx];
+            auto instr = cfg.at(pc);
+            auto d = body.depth.at(pc);
+            if (is_target(pc)) {
+                pending.push_back(first_label + static_cast<uint32_t>(idx));
+            }
+
+            switch (instr.mnem()) {
+                case mnemonic::GETBP: {
+                    // bp is where the first argument is, sp is m + d - 1 slots above
+                    int32_t offset = m - 1 + d;
+                    if (idx + 2 < body.pcs.size()) {
+                        auto c = cfg.at(body.pcs[idx + 1]);
+                        auto a = cfg.at(body.pcs[idx + 2]);
+                        if (c.mnem() == mnemonic::CONST && a.mnem() == mnemonic::ADD
+                            && !is_target(body.pcs[idx + 1]) && !is_target(body.pcs[idx + 2])) {
+                            offset -= c.arg(0);
+                            idx += 2;
+                        }
+                    }
+                    add(instruction(mnemonic::GETSP), NO_TARGET);
+                    if (offset > 0) {
+                        add(instruction(mnemonic::CONST, {static_cast<uint16_t>(offset)}), NO_TARGET);
+                        add(instruction(mnemonic::SUB), NO_TARGET);
+                    } else if (offset < 0) {
+                        add(instruction(mnemonic::CONST, {static_cast<uint16_t>(-offset)}), NO_TARGET);
+                        add(instruction(mnemonic::ADD), NO_TARGET);
+                    }
+                    break;
+                }
+                case mnemonic::RET: {
+                    // s,v1,...,vm,...,v => s,v
+                    auto below = static_cast<uint16_t>(m + d - 1);
+                    if (below == 1) {
+                        add(instruction(mnemonic::SWAP), NO_TARGET);
+                        add(instruction(mnemonic::DECSP, {1}), NO_TARGET);
+                    } else if (below > 1) {
+                        add(instruction(mnemonic::GETSP), NO_TARGET);
+                        add(instruction(mnemonic::CONST, {below}), NO_TARGET);
+                        add(instruction(mnemonic::SUB), NO_TARGET);
+                        add(instruction(mnemonic::SWAP), NO_TARGET);
+                        add(instruction(mnemonic::STI), NO_TARGET);
+                        add(instruction(mnemonic::DECSP, {below}), NO_TARGET);
+                    }
+                    if (idx + 1 < body.pcs.size()) {
+                        add(instruction(mnemonic::GOTO, {0}), return_label);
+                    }
+                    break;
+                }
+                case mnemonic::GOTO:
+                case mnemonic::IFZERO:
+                case mnemonic::IFNZERO:
+                    add(instr, label_of(instr.arg(0)));
+                    break;
+                default:
+                    add(instr, NO_TARGET);
+                    break;
+            }
+        }
+    }
+
+    size_t words(const std::vector<item>& items) {
+        size_t result = 0;
+        for (auto& i : items) {
+            result += 1 + argument_count(i.instr.mnem());
+        }
+        return result;
+    }
+
+    bool is_jump(mnemonic m) {
+        return m == mnemonic::GOTO || m == mnemonic::IFZERO || m == mnemonic::IFNZERO || m == mnemonic::DJNZ
+            || m == mnemonic::CALL || m == mnemonic::TCALL;
+    }
+
+    //! Drop unreachable items, assign addresses and encode.
+    std::vector<uint16_t> layout(const std::vector<item>& items) {
+
+        std::map<uint32_t, size_t> index;
+        for (size_t i = 0; i < items.size(); ++i) {
+            for (auto l : items[i].labels) {
+                index[l] = i;
+            }
+        }
+
+        std::vector<bool> reachable(items.size(), false);
+        std::vector<size_t> work{0};
+        while (!work.empty()) {
+            auto i = work.back();
+            work.pop_back();
+            if (i >= items.size() || reachable[i]) {
+                continue;
+            }
+            reachable[i] = true;
+            auto m = items[i].instr.mnem();
+            if (items[i].target != NO_TARGET) {
+                work.push_back(index.at(items[i].target));
+            }
+            if (!is_unconditional_transfer(m)) {
+                work.push_back(i + 1);
+            }
+        }
+
+        std::vector<size_t> address(items.size(), 0);
+        size_t pc = 0;
+        for (size_t i = 0; i < items.size(); ++i) {
+            address[i] = pc;
+            if (reachable[i]) {
+                pc += 1 + argument_count(items[i].instr.mnem());
+            }
+        }
+        if (pc > 0xFFFF) {
+            throw std::domain_error("Program too large after inlining");
+        }
+
+        std::vector<instruction> result;
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (!reachable[i]) {
+                continue;
+            }
+            auto instr = items[i].instr;
+            if (items[i].target != NO_TARGET) {
+                auto target = static_cast<uint16_t>(address[index.at(items[i].target)]);
+                switch (instr.mnem()) {
+                    case mnemonic::CALL: instr.arg(1) = target; break;
+                    case mnemonic::TCALL: instr.arg(2) = target; break;
+                    default: instr.arg(0) = target; break;
+                }
+            }
+            result.push_back(instr);
+        }
+        return to_binary_list(result);
+    }
+}
+
+inliner::inliner(unsigned max_callee_size, unsigned growth_budget)
+: m_max_callee_size(max_callee_size), m_growth_budget(growth_budget), m_inlined(0)
+{
+}
+
+unsigned inliner::inlined() const {
+    return m_inlined;
+}
+
+std::vector<uint16_t> inliner::run(const std::vector<uint16_t> &code) {
+
+    m_inlined = 0;
+
+    auto full = code;
+    full.push_back(mk_stop());
+    verify(full);
+    control_flow cfg(full);
+
+    // original instructions in address order, every jump target must be one of them
+    std::vector<uint16_t> pcs;
+    for (size_t pc = 0; pc < full.size(); ) {
+        if (!cfg.is_instruction(pc)) {
+            if (!is_mnemonic(full[pc]) || pc + argument_count(static_cast<mnemonic>(full[pc])) >= full.size()) {
+                throw std::domain_error("Code that cannot be decoded");
+            }
+        }
+        pcs.push_back(static_cast<uint16_t>(pc));
+        pc += 1 + argument_count(static_cast<mnemonic>(full[pc]));
+    }
+    for (size_t pc = 0; pc < full.size(); ++pc) {
+        if (cfg.is_leader(pc) && cfg.is_instruction(pc) && !std::binary_search(pcs.begin(), pcs.end(), pc)) {
+            return code;
+        }
+    }
+
+    std::map<std::pair<uint16_t, uint16_t>, callee> callees;
+    std::vector<item> items;
+    std::vector<uint32_t> pending;
+    uint32_t next_label = FIRST_COPY_LABEL;
+    size_t growth = 0;
+
+    for (auto pc : pcs) {
+        auto instr = cfg.at(pc);
+        auto m = instr.mnem();
+
+        if (m == mnemonic::CALL && cfg.is_instruction(pc)) {
+            auto key = std::make_pair(instr.arg(1), instr.arg(0));
+            auto it = callees.find(key);
+            if (it == callees.end()) {
+                it = callees.emplace(key, analyze(cfg, key.first, key.second, m_max_callee_size)).first;
+            }
+            if (it->second.inlinable) {
+                auto labels = pending;
+                labels.push_back(pc);
+                std::vector<item> body;
+                copy_body(cfg, it->second, key.second, next_label, cfg.next(pc), labels, body);
+
+                // the CALL itself takes three words
+                auto size = words(body);
+                if (size <= 3 || growth + size - 3 <= m_growth_budget) {
+                    growth += size > 3 ? size - 3 : 0;
+                    next_label += static_cast<uint32_t>(it->second.pcs.size());
+                    items.insert(items.end(), body.begin(), body.end());
+                    pending = labels;
+                    ++m_inlined;
+                    continue;
+                }
+            }
+        }
+
+        uint32_t target = NO_TARGET;
+        uint16_t address;
+        if (is_jump(m) && static_target(instr, address)) {
+            target = address;
+        }
+        pending.push_back(pc);
+        items.push_back({instr, target, pending});
+        pending.clear();
+    }
+
+    if (m_inlined == 0) {
+        return code;
+    }
+    return layout(items);
+}
@@ -0,0 +1,44 @@
+#ifndef STACKMACHINE_INLINER_H
+#define STACKMACHINE_INLINER_H
+
+#include <cstdint>
+#include <vector>
+#include "instructions.h"
+
+//! Replaces CALLs of small functions by a copy of the function body.
+//!
+//! Inside the copy there is no frame: the arguments stay where the caller
+//! pushed them, GETBP based addresses are computed from sp, which is known
+//! relative to the arguments at every instruction of the body, and the RET
+//! moves the result down onto the first argument. Jump and call targets of
+//! the whole program are relocated.
+//!
+//! A function is inlined if it has at most max_callee_size instructions, a
+//! single RET, a stack depth that is the same on every path, and uses
+//! frame addresses only to load and store slots at or above its first
+//! argument. CALL, TCALL, STOP, GETSP, LDARGS, READN and the channel
+//! instructions keep a function from being inlined.
+//!
+//! The result behaves like the input on a fresh interpreter as far as the
+//! output, sp, bp and the slots 0..sp at STOP go; slots above sp may differ.
+class inliner {
+public:
+    //! \param max_callee_size largest function body, in instructions
+    //! \param growth_budget how many code words the program may grow by
+    explicit inliner(unsigned max_callee_size = 16, unsigned growth_budget = 256);
+
+    //! \param code the program as passed to the interpreter
+    //! \return the program with CALLs inlined, the input if there were none
+    //! \throws std::domain_error if the program does not verify
+    std::vector<uint16_t> run(const std::vector<uint16_t>& code);
+
+    //! \return the number of call sites inlined by the last run
+    unsigned inlined() const;
+
+private:
+    unsigned m_max_callee_size;
+    unsigned m_growth_budget;
+    unsigned m_inlined;
+};
+
+#endif //STACKMACHINE_INLINER_H
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "input_channel.h"
+
+namespace {
+    //! Consumed input is handed back to the kernel in chunks of this size,
+    //! which keeps the resident set constant while streaming large files.
+    const size_t RELEASE_CHUNK_WORDS = (16u << 20) / sizeof(uint16_t);
+}
+
+input_channel::input_channel(const uint16_t *words, size_t count)
+: m_pos(words), m_end(words + count), m_release_mark(words + count),
+  m_mapping(nullptr), m_mapping_size(0), m_released(0)
+{
+}
+
+input_channel::input_channel(void *mapping, size_t mapping_size)
+: m_pos(static_cast<const uint16_t*>(mapping)),
+  m_end(m_pos + mapping_size / sizeof(uint16_t)), m_release_mark(m_end),
+  m_mapping(mapping), m_mapping_size(mapping_size), m_released(0)
+{
+    if (m_mapping != nullptr) {
+        m_release_mark = m_pos + std::min(RELEASE_CHUNK_WORDS, remaining());
+    }
+}
+
+std::shared_ptr<input_channel> input_channel::from_file(const std::string &path) {
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open input file " + path + ": " + std::strerror(errno));
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat input file " + path + ": " + std::strerror(errno));
+    }
+
+    auto size = static_cast<size_t>(st.st_size);
+    void* mapping = nullptr;
+
+    if (size >= sizeof(uint16_t)) {
+        mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Cannot map input file " + path + ": " + std::strerror(errno));
+        }
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+    } else {
+        size = 0;
+    }
+
+    ::close(fd);
+
+    return std::shared_ptr<input_channel>(new input_channel(mapping, size));
+}
+
+input_channel::~input_channel() {
+    if (m_mapping != nullptr) {
+        ::munmap(m_mapping, m_mapping_size);
+    }
+}
+
+size_t input_channel::read(uint16_t *dst, size_t count) {
+
+    count = std::min(count, remaining());
+    std::copy(m_pos, m_pos + count, dst);
+    m_pos += count;
+
+    if (m_pos >= m_release_mark) {
+        release_consumed();
+    }
+
+    return count;
+}
+
+void input_channel::release_consumed() {
+
+    if (m_mapping == nullptr) {
+        return;
+    }
+
+    // only whole pages that lie completely behind the read position
+    auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    auto consumed = static_cast<size_t>(reinterpret_cast<const char*>(m_pos) - static_cast<const char*>(m_mapping));
+    consumed -= consumed % page;
+
+    if (consumed > m_released) {
+        ::madvise(static_cast<char*>(m_mapping) + m_released, consumed - m_released, MADV_DONTNEED);
+        m_released = consumed;
+    }
+
+    m_release_mark = m_pos + std::min(RELEASE_CHUNK_WORDS, remaining());
+}
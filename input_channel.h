@@ -0,0 +1,71 @@
+#ifndef STACKMACHINE_INPUT_CHANNEL_H
+#define STACKMACHINE_INPUT_CHANNEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+
+//! Sequential source of uint16 words for the READ and READN instructions.
+//! Words are read straight out of the backing memory, either a buffer owned
+//! by the caller or a read-only memory mapping of a file, so a channel never
+//! copies its input into an intermediate buffer.
+class input_channel {
+public:
+    //! Create a channel over caller-provided memory.
+    //! The buffer must outlive the channel.
+    //! \param words first word of the input
+    //! \param count number of words
+    input_channel(const uint16_t* words, size_t count);
+
+    //! Create a channel over a memory mapped file. The file is interpreted
+    //! as uint16 words in host byte order, a trailing odd byte is ignored.
+    //! \param path the file to map
+    //! \return the channel
+    static std::shared_ptr<input_channel> from_file(const std::string& path);
+
+    ~input_channel();
+
+    input_channel(const input_channel&) = delete;
+    input_channel& operator=(const input_channel&) = delete;
+
+    //! Read a single word.
+    //! \param word receives the word
+    //! \return false if the input is exhausted
+    bool read(uint16_t& word) {
+        if (m_pos == m_end) {
+            return false;
+        }
+        word = *m_pos++;
+        if (m_pos >= m_release_mark) {
+            release_consumed();
+        }
+        return true;
+    }
+
+    //! Read up to count words into dst.
+    //! \return the number of words read
+    size_t read(uint16_t* dst, size_t count);
+
+    size_t remaining() const {
+        return static_cast<size_t>(m_end - m_pos);
+    }
+
+    bool eof() const {
+        return m_pos == m_end;
+    }
+
+private:
+    input_channel(void* mapping, size_t mapping_size);
+
+    void release_consumed();
+
+    const uint16_t* m_pos;
+    const uint16_t* m_end;
+    const uint16_t* m_release_mark;
+    void* m_mapping;
+    size_t m_mapping_size;
+    size_t m_released;
+};
+
+#endif //STACKMACHINE_INPUT_CHANNEL_H
@@ -16,6 +16,60 @@ instruction::instruction(mnemonic m)
 
 }
 
+bool is_mnemonic(uint16_t word)
+{
+    switch (static_cast<mnemonic>(word)) {
+        case mnemonic::CONST:
+        case mnemonic::ADD:
+        case mnemonic::SUB:
+        case mnemonic::MUL:
+        case mnemonic::DIV:
+        case mnemonic::MOD:
+        case mnemonic::EQ:
+        case mnemonic::LT:
+        case mnemonic::NOT:
+        case mnemonic::DUP:
+        case mnemonic::SWAP:
+        case mnemonic::LDI:
+        case mnemonic::STI:
+        case mnemonic::GETBP:
+        case mnemonic::GETSP:
+        case mnemonic::INCSP:
+        case mnemonic::DECSP:
+        case mnemonic::GOTO:
+        case mnemonic::IFZERO:
+        case mnemonic::IFNZERO:
+        case mnemonic::CALL:
+        case mnemonic::TCALL:
+        case mnemonic::RET:
+        case mnemonic::PRINTI:
+        case mnemonic::PRINTC:
+        case mnemonic::LDARGS:
+        case mnemonic::READ:
+        case mnemonic::READN:
+        case mnemonic::SEND:
+        case mnemonic::RECV:
+        case mnemonic::CLOSE:
+        case mnemonic::DJNZ:
+        case mnemonic::STOP:
+        case mnemonic::NOOP:
+        case mnemonic::LDD:
+        case mnemonic::STD:
+        case mnemonic::VADD:
+        case mnemonic::VSUB:
+        case mnemonic::VMUL:
+        case mnemonic::VEQ:
+        case mnemonic::VLT:
+        case mnemonic::VDOT:
+        case mnemonic::VMAX:
+        case mnemonic::BREAK:
+        case mnemonic::PRINTS:
+        case mnemonic::PRINTN:
+            return true;
+    }
+    return false;
+}
+
 unsigned int argument_count(mnemonic m)
 {
     switch (m) {
@@ -45,8 +99,26 @@ unsigned int argument_count(mnemonic m)
         case mnemonic::PRINTI: return 0;
         case mnemonic::PRINTC: return 0;
         case mnemonic::LDARGS: return 0;
+        case mnemonic::READ: return 0;
+        case mnemonic::READN: return 0;
+        case mnemonic::SEND: return 1;
+        case mnemonic::RECV: return 1;
+        case mnemonic::CLOSE: return 1;
+        case mnemonic::DJNZ: return 1;
         case mnemonic::STOP: return 0;
         case mnemonic::NOOP: return 0;
+        case mnemonic::LDD: return 0;
+        case mnemonic::STD: return 0;
+        case mnemonic::VADD: return 0;
+        case mnemonic::VSUB: return 0;
+        case mnemonic::VMUL: return 0;
+        case mnemonic::VEQ: return 0;
+        case mnemonic::VLT: return 0;
+        case mnemonic::VDOT: return 0;
+        case mnemonic::VMAX: return 0;
+        case mnemonic::BREAK: return 0;
+        case mnemonic::PRINTS: return 0;
+        case mnemonic::PRINTN: return 0;
     }
 }
 
@@ -78,8 +150,26 @@ std::ostream& operator<<(std::ostream& str, const mnemonic &m) {
         case mnemonic::PRINTI: str << "PRINTI"; break;
         case mnemonic::PRINTC: str << "PRINTC"; break;
         case mnemonic::LDARGS: str << "LDARGS"; break;
+        case mnemonic::READ: str << "READ"; break;
+        case mnemonic::READN: str << "READN"; break;
+        case mnemonic::SEND: str << "SEND"; break;
+        case mnemonic::RECV: str << "RECV"; break;
+        case mnemonic::CLOSE: str << "CLOSE"; break;
+        case mnemonic::DJNZ: str << "DJNZ"; break;
         case mnemonic::STOP: str << "STOP"; break;
         case mnemonic::NOOP: str << "NOOP"; break;
+        case mnemonic::LDD: str << "LDD"; break;
+        case mnemonic::STD: str << "STD"; break;
+        case mnemonic::VADD: str << "VADD"; break;
+        case mnemonic::VSUB: str << "VSUB"; break;
+        case mnemonic::VMUL: str << "VMUL"; break;
+        case mnemonic::VEQ: str << "VEQ"; break;
+        case mnemonic::VLT: str << "VLT"; break;
+        case mnemonic::VDOT: str << "VDOT"; break;
+        case mnemonic::VMAX: str << "VMAX"; break;
+        case mnemonic::BREAK: str << "BREAK"; break;
+        case mnemonic::PRINTS: str << "PRINTS"; break;
+        case mnemonic::PRINTN: str << "PRINTN"; break;
     }
     return str;
 }
@@ -128,6 +218,23 @@ std::vector<instruction> from_binary_list(const std::vector<uint16_t> &code) {
     return result;
 }
 
+std::vector<uint16_t> to_binary_list(const std::vector<instruction> &instructions) {
+
+    std::vector<uint16_t> result;
+
+    for (auto& instr : instructions) {
+        auto m = instr.mnem();
+        result.push_back(m);
+
+        size_t arg_count = argument_count(m);
+        for (size_t arg = 0; arg < arg_count; ++arg) {
+            result.push_back(instr.arg(arg));
+        }
+    }
+
+    return result;
+}
+
 std::vector<uint16_t> mk_const(uint16_t v) {
     return {CONST, v};
 }
@@ -232,6 +339,30 @@ uint16_t mk_ldargs() {
     return LDARGS;
 }
 
+uint16_t mk_read() {
+    return READ;
+}
+
+uint16_t mk_readn() {
+    return READN;
+}
+
+std::vector<uint16_t> mk_send(uint16_t channel) {
+    return {SEND, channel};
+}
+
+std::vector<uint16_t> mk_recv(uint16_t channel) {
+    return {RECV, channel};
+}
+
+std::vector<uint16_t> mk_close(uint16_t channel) {
+    return {CLOSE, channel};
+}
+
+std::vector<uint16_t> mk_djnz(uint16_t address) {
+    return {DJNZ, address};
+}
+
 uint16_t mk_stop() {
     return STOP;
 }
@@ -240,6 +371,54 @@ uint16_t mk_noop() {
     return NOOP;
 }
 
+uint16_t mk_ldd() {
+    return LDD;
+}
+
+uint16_t mk_std() {
+    return STD;
+}
+
+uint16_t mk_vadd() {
+    return VADD;
+}
+
+uint16_t mk_vsub() {
+    return VSUB;
+}
+
+uint16_t mk_vmul() {
+    return VMUL;
+}
+
+uint16_t mk_veq() {
+    return VEQ;
+}
+
+uint16_t mk_vlt() {
+    return VLT;
+}
+
+uint16_t mk_vdot() {
+    return VDOT;
+}
+
+uint16_t mk_vmax() {
+    return VMAX;
+}
+
+uint16_t mk_break() {
+    return BREAK;
+}
+
+uint16_t mk_prints() {
+    return PRINTS;
+}
+
+uint16_t mk_printn() {
+    return PRINTN;
+}
+
 void program::append(uint16_t code) {
     this->bytes.push_back(code);
 }
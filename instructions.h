@@ -33,8 +33,26 @@ enum mnemonic : uint16_t
     PRINTI = 0x17,
     PRINTC = 0x18,
     LDARGS = 0x19,
+    READ = 0x1A,
+    READN = 0x1B,
+    SEND = 0x1C,
+    RECV = 0x1D,
+    CLOSE = 0x1E,
+    DJNZ = 0x1F,
     STOP = 0x20,
-    NOOP = 0x21
+    NOOP = 0x21,
+    LDD = 0x22,
+    STD = 0x23,
+    VADD = 0x24,
+    VSUB = 0x25,
+    VMUL = 0x26,
+    VEQ = 0x27,
+    VLT = 0x28,
+    VDOT = 0x29,
+    VMAX = 0x2A,
+    BREAK = 0x2B,
+    PRINTS = 0x2C,
+    PRINTN = 0x2D
 };
 
 std::vector<uint16_t> mk_const(uint16_t v);
@@ -63,8 +81,26 @@ std::vector<uint16_t> mk_ret(uint16_t variable_count);
 uint16_t mk_printi();
 uint16_t mk_printc();
 uint16_t mk_ldargs();
+uint16_t mk_read();
+uint16_t mk_readn();
+std::vector<uint16_t> mk_send(uint16_t channel);
+std::vector<uint16_t> mk_recv(uint16_t channel);
+std::vector<uint16_t> mk_close(uint16_t channel);
+std::vector<uint16_t> mk_djnz(uint16_t address);
 uint16_t mk_stop();
 uint16_t mk_noop();
+uint16_t mk_ldd();
+uint16_t mk_std();
+uint16_t mk_vadd();
+uint16_t mk_vsub();
+uint16_t mk_vmul();
+uint16_t mk_veq();
+uint16_t mk_vlt();
+uint16_t mk_vdot();
+uint16_t mk_vmax();
+uint16_t mk_break();
+uint16_t mk_prints();
+uint16_t mk_printn();
 
 class program {
 public:
@@ -76,6 +112,11 @@ private:
     std::vector<uint16_t> bytes;
 };
 
+//! Check whether a code word is a known mnemonic.
+//! \param word the code word
+//! \return true if the word names an instruction
+bool is_mnemonic(uint16_t word);
+
 //! Get the number of arguments the mnemonic requires.
 //! \param m the mnemonic
 //! \return the number of arguments
@@ -110,4 +151,9 @@ std::ostream& operator<<(std::ostream& str, const instruction& instr);
 
 std::vector<instruction> from_binary_list(const std::vector<uint16_t>& code);
 
+//! Encode instructions as binary code, the inverse of from_binary_list().
+//! \param instructions the instructions
+//! \return the binary code
+std::vector<uint16_t> to_binary_list(const std::vector<instruction>& instructions);
+
 #endif //STACKMACHINE_mnemonicS_H
@@ -2,17 +2,37 @@
 #include <sstream>
 #include <iomanip>
 #include <limits>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <thread>
+#include "block_layout.h"
+#include "call_memo.h"
+#include "channel.h"
+#include "data_segment.h"
+#include "decimal.h"
+#include "guarded_stack.h"
 #include "interpreter.h"
+#include "metrics.h"
+#include "sampling_profiler.h"
+#include "vector_ops.h"
 
 interpreter::interpreter(const std::vector<uint16_t> &code)
-: m_tracing(false), m_stopped(false), pc(0), sp(0), bp(0xFFFF), code(code), m_stack()
+: m_tracing(false), m_stopped(false), m_break(false), pc(0), sp(0), bp(0xFFFF), code(code), m_stack(), m_output(&std::cout),
+  m_data(data_segment::empty()), m_data_words(m_data->words()), m_blocked(nullptr), m_blocked_sending(false),
+  m_op_pc(0), m_sampled(false), m_fault(NO_FAULT), m_vector(&vector_kernels_for(best_vector_isa())), m_output_bytes(0)
 {
     m_stack.resize(std::numeric_limits<uint16_t>::max(), 0x00);
     m_stack[0] = 0xFFFF;
+    m_words = m_stack.data();
 
     this->code.push_back(mk_stop());
 }
 
+interpreter::~interpreter() {
+}
+
 namespace {
     std::string printable_chars(const std::string& s) {
 
@@ -45,15 +65,30 @@ namespace {
 }
 
 void interpreter::step() {
+    if (m_guarded) {
+        run_guarded(1);
+    } else {
+        execute<true>();
+    }
+}
+
+template <bool Publish>
+void interpreter::execute() {
 
+    m_blocked = nullptr;
     if (m_stopped) {
         return;
     }
+    if (Publish) {
+        m_op_pc = pc;
+        // the trap handler reads m_op_pc, keep the store ahead of the instruction
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
 
     static const unsigned short VAL_TRUE = static_cast<unsigned short>(1);
     static const unsigned short VAL_FALSE = static_cast<unsigned short>(0);
 
-    std::stringstream output;
+    std::string output;
     std::string trace_str;
 
     auto i = code.at(pc);
@@ -66,10 +101,10 @@ void interpreter::step() {
         trace << " [";
 
         if (sp >= 1) {
-            trace << std::hex << std::internal << std::setw(4) << std::setfill('0') << m_stack[sp] << " ";
-            trace <<std::hex << std::internal << std::setw(4) << std::setfill('0') << m_stack[sp-1] << " ... ]";
+            trace << std::hex << std::internal << std::setw(4) << std::setfill('0') << m_words[sp] << " ";
+            trace <<std::hex << std::internal << std::setw(4) << std::setfill('0') << m_words[sp-1] << " ... ]";
         } else if (sp == 0) {
-            trace << std::hex << std::internal << std::setw(4) << std::setfill('0') << m_stack[sp];
+            trace << std::hex << std::internal << std::setw(4) << std::setfill('0') << m_words[sp];
             trace << "          ] ";
         } else {
             trace << "]";
@@ -87,78 +122,119 @@ void interpreter::step() {
         case mnemonic::CONST:
             // s => s,i
             ++sp;
-            m_stack[sp] = code[pc];
+            m_words[sp] = code[pc];
             ++pc;
             break;
         case mnemonic::ADD:
             // s,v1,v2 => s,(v1 + v2)
-            m_stack[sp-1] = m_stack[sp-1] + m_stack[sp];
+            m_words[sp-1] = m_words[sp-1] + m_words[sp];
             --sp;
             break;
         case mnemonic::SUB:
             // s,v1,v2 => s,(v1 - v2)
-            m_stack[sp-1] = m_stack[sp-1] - m_stack[sp];
+            m_words[sp-1] = m_words[sp-1] - m_words[sp];
             --sp;
             break;
         case mnemonic::MUL:
             // s,v1,v2 => s,(v1 * v2)
-            m_stack[sp-1] = m_stack[sp-1] * m_stack[sp];
+            m_words[sp-1] = static_cast<uint16_t>(static_cast<uint32_t>(m_words[sp-1]) * m_words[sp]);
             --sp;
             break;
         case mnemonic::DIV:
             // s,v1,v2 => s,(v1 / v2)
-            m_stack[sp-1] = m_stack[sp-1] / m_stack[sp];
+            m_words[sp-1] = m_words[sp-1] / m_words[sp];
             --sp;
             break;
         case mnemonic::MOD:
             // s,v1,v2 => s,(v1 % v2)
-            m_stack[sp-1] = m_stack[sp-1] % m_stack[sp];
+            m_words[sp-1] = m_words[sp-1] % m_words[sp];
             --sp;
             break;
         case mnemonic::EQ:
             // s,v1,v2 => s,(v1 == v2)
-            m_stack[sp-1] = m_stack[sp-1] == m_stack[sp] ? VAL_TRUE : VAL_FALSE;
+            m_words[sp-1] = m_words[sp-1] == m_words[sp] ? VAL_TRUE : VAL_FALSE;
             --sp;
             break;
         case mnemonic::LT:
             // s,v1,v2 => s,(v1 < v2)
-            m_stack[sp-1] = m_stack[sp-1] < m_stack[sp] ? VAL_TRUE : VAL_FALSE;
+            m_words[sp-1] = m_words[sp-1] < m_words[sp] ? VAL_TRUE : VAL_FALSE;
             --sp;
             break;
         case mnemonic::NOT:
             // s,v => s,!v
-            m_stack[sp] = m_stack[sp] == VAL_FALSE ? VAL_TRUE : VAL_FALSE;
+            m_words[sp] = m_words[sp] == VAL_FALSE ? VAL_TRUE : VAL_FALSE;
             break;
         case mnemonic::DUP:
             // s,v => s,v,v
-            m_stack[sp+1] = m_stack[sp];
+            m_words[sp+1] = m_words[sp];
             ++sp;
             break;
         case mnemonic::SWAP:
             // s,v1,v2 => s,v2,v1
-            std::swap(m_stack[sp], m_stack[sp-1]);
+            std::swap(m_words[sp], m_words[sp-1]);
             break;
         case mnemonic::LDI:
             // s,i => s,s[i]
-            m_stack[sp] = m_stack[m_stack[sp]];
+            m_words[sp] = m_words[m_words[sp]];
             break;
         case mnemonic::STI: {
             // s,i,v => s,v
 
-            auto i = m_stack[sp - 1];
-            auto v = m_stack[sp];
-            m_stack[i] = v;
-            m_stack[sp - 1] = v;
+            auto i = m_words[sp - 1];
+            auto v = m_words[sp];
+            m_words[i] = v;
+            m_words[sp - 1] = v;
+            --sp;
+            break;
+        }
+        case mnemonic::LDD:
+            // s,i => s,d[i]
+            m_words[sp] = m_data_words[m_words[sp]];
+            break;
+        case mnemonic::STD: {
+            // s,i,v => s,v
+            if (m_own_data.empty()) {
+                m_own_data.assign(m_data_words, m_data_words + data_segment::WORDS);
+                m_data_words = m_own_data.data();
+            }
+            auto i = m_words[sp - 1];
+            auto v = m_words[sp];
+            m_own_data[i] = v;
+            m_words[sp - 1] = v;
             --sp;
             break;
         }
+        case mnemonic::VADD:
+        case mnemonic::VSUB:
+        case mnemonic::VMUL:
+        case mnemonic::VEQ:
+        case mnemonic::VLT: {
+            // s,d,a,b,n => s
+            auto d = m_words[sp - 3];
+            auto a = m_words[sp - 2];
+            auto b = m_words[sp - 1];
+            auto n = m_words[sp];
+            sp -= 4;
+            vector_binary(*m_vector, static_cast<mnemonic>(i), m_words, d, a, b, n);
+            break;
+        }
+        case mnemonic::VDOT:
+            // s,a,b,n => s,v
+            m_words[sp - 2] = vector_dot(*m_vector, m_words, m_words[sp - 2], m_words[sp - 1], m_words[sp]);
+            sp -= 2;
+            break;
+        case mnemonic::VMAX:
+            // s,a,n => s,v
+            m_words[sp - 1] = vector_max(*m_vector, m_words, m_words[sp - 1], m_words[sp]);
+            --sp;
+            break;
         case mnemonic::GETBP:
-            m_stack[sp+1] = bp;
+            m_words[sp+1] = bp;
             ++sp;
             break;
         case mnemonic::GETSP:
             // s => s,sp
-            m_stack[sp+1] = sp;
+            m_words[sp+1] = sp;
             ++sp;
             break;
         case mnemonic::INCSP: {
@@ -172,40 +248,69 @@ void interpreter::step() {
             break;
         }
         case mnemonic::GOTO:
+            if (m_profile) {
+                m_profile->record(static_cast<uint16_t>(pc - 1), true);
+            }
             pc = code[pc];
             break;
         case mnemonic::IFZERO:
             ++pc;
-            if (m_stack[sp] == 0) {
+            if (m_profile) {
+                m_profile->record(static_cast<uint16_t>(pc - 2), m_words[sp] == 0);
+            }
+            if (m_words[sp] == 0) {
                 pc = code[pc-1];
             }
             --sp;
             break;
         case mnemonic::IFNZERO:
             ++pc;
-            if (m_stack[sp] != 0) {
+            if (m_profile) {
+                m_profile->record(static_cast<uint16_t>(pc - 2), m_words[sp] != 0);
+            }
+            if (m_words[sp] != 0) {
                 pc = code[pc-1];
             }
             --sp;
             break;
+        case mnemonic::DJNZ:
+            ++pc;
+            --m_words[sp];
+            if (m_profile) {
+                m_profile->record(static_cast<uint16_t>(pc - 2), m_words[sp] != 0);
+            }
+            if (m_words[sp] != 0) {
+                pc = code[pc-1];
+            }
+            break;
         case mnemonic::CALL: {
             // s,v1,...,vm => s,r,bp,v1,...,vm
-            auto m = code[pc];
-            ++pc;
+            auto m = code[pc]; ++pc;
+            auto a = code[pc]; ++pc;
+            if (m_memo && m_memo->memoizes(a, m)) {
+                // s,v1,...,vm => s,r if the result is known
+                auto base = static_cast<uint16_t>(sp - m + 1);
+                uint16_t r;
+                if (m_memo->lookup(a, &m_words[base], m, r)) {
+                    sp = base;
+                    m_words[sp] = r;
+                    break;
+                }
+                m_memo->enter(a, &m_words[base], m, static_cast<uint16_t>(base + 2));
+            }
             // move arguments
             for (int idx = 0; idx < m; ++idx) {
-                m_stack[sp + 2 - idx] = m_stack[sp - idx];
+                m_words[sp + 2 - idx] = m_words[sp - idx];
             }
             uint16_t stack_r  = static_cast<uint16_t>(sp - m + 1);
             uint16_t stack_bp = static_cast<uint16_t>(sp - m + 2);
 
-            m_stack[stack_r] = pc; // return address
-            m_stack[stack_bp] = bp; // old bp
+            m_words[stack_r] = pc; // return address
+            m_words[stack_bp] = bp; // old bp
 
             bp = static_cast<uint16_t>(stack_bp + 1); // one after old_bp
             sp = stack_bp + m;
-            pc = code[pc];
-            ++pc;
+            pc = a;
             break;
         }
         case mnemonic::TCALL: {
@@ -215,10 +320,10 @@ void interpreter::step() {
             auto a = code[pc]; ++pc;
             // move vi arguments to uj
             for (int idx = 0; idx < m; ++idx) {
-                m_stack[sp - n - idx] = m_stack[sp - idx];
+                m_words[sp - n - idx] = m_words[sp - idx];
             }
 
-            sp = sp - m - n;
+            sp = sp - n;
 
             pc = a;
             break;
@@ -226,31 +331,120 @@ void interpreter::step() {
         case mnemonic::RET: {
             // s,r,b,v1,...,vm,v => s,v
             // bp points to current stackframe's v1.
-            auto old_bp = m_stack[bp - 1];
-            pc = m_stack[bp - 2];
-            auto v = m_stack[sp];
+            auto old_bp = m_words[bp - 1];
+            pc = m_words[bp - 2];
+            auto v = m_words[sp];
+            if (m_memo) {
+                m_memo->leave(bp, v);
+            }
             sp = static_cast<uint16_t>(bp - 2u);
-            m_stack[sp] = v;
+            m_words[sp] = v;
             bp = old_bp;
             break;
         }
         case mnemonic::PRINTI:
-            output << m_stack[sp];
+            append_decimal(output, m_words[sp]);
             --sp;
             break;
         case mnemonic::PRINTC:
-            output << static_cast<char>(m_stack[sp]);
+            output += static_cast<char>(m_words[sp]);
             --sp;
             break;
+        case mnemonic::PRINTS: {
+            // s,c1,...,cn,n => s
+            uint16_t n = m_words[sp];
+            output.resize(n);
+            for (uint16_t k = 0; k < n; ++k) {
+                output[k] = static_cast<char>(m_words[static_cast<uint16_t>(sp - n + k)]);
+            }
+            sp -= n + 1;
+            break;
+        }
+        case mnemonic::PRINTN: {
+            // s,v1,...,vn,n => s
+            uint16_t n = m_words[sp];
+            output.reserve(n * (MAX_DECIMAL_DIGITS + 1));
+            for (uint16_t k = 0; k < n; ++k) {
+                if (k != 0) {
+                    output += ' ';
+                }
+                append_decimal(output, m_words[static_cast<uint16_t>(sp - n + k)]);
+            }
+            sp -= n + 1;
+            break;
+        }
         case mnemonic::LDARGS:
             // s => s,i_1,...,i_n,n
             for (auto& cmd_arg : cmd_args) {
-                m_stack[sp+1] = cmd_arg;
+                m_words[sp+1] = cmd_arg;
                 ++sp;
             }
-            m_stack[sp+1] = static_cast<uint16_t>(cmd_args.size());
+            m_words[sp+1] = static_cast<uint16_t>(cmd_args.size());
+            ++sp;
+            break;
+        case mnemonic::READ: {
+            // s => s,v,f
+            uint16_t v = 0;
+            uint16_t f = m_input && m_input->read(v) ? VAL_TRUE : VAL_FALSE;
+            m_words[sp+1] = v;
+            m_words[sp+2] = f;
+            sp += 2;
+            break;
+        }
+        case mnemonic::READN: {
+            // s,n => s,v1,...,vk,k
+            size_t n = m_words[sp];
+            --sp;
+            // keep room for the count above the block
+            size_t room = sp + 2u < m_stack.size() ? m_stack.size() - sp - 2u : 0;
+            size_t k = m_input ? m_input->read(&m_words[sp+1], std::min(n, room)) : 0;
+            sp += k;
+            m_words[sp+1] = static_cast<uint16_t>(k);
             ++sp;
             break;
+        }
+        case mnemonic::SEND: {
+            // s,v => s
+            auto ch = bound_channel(code[pc]);
+            if (ch && !ch->try_send(m_words[sp])) {
+                block(ch, true);
+                return;
+            }
+            ++pc;
+            --sp;
+            break;
+        }
+        case mnemonic::RECV: {
+            // s => s,v,f
+            auto ch = bound_channel(code[pc]);
+            uint16_t v = 0;
+            uint16_t f = VAL_FALSE;
+            if (ch) {
+                if (ch->try_receive(v)) {
+                    f = VAL_TRUE;
+                } else if (!ch->is_closed()) {
+                    block(ch, false);
+                    return;
+                } else if (ch->try_receive(v)) {
+                    // sent just before the last close
+                    f = VAL_TRUE;
+                }
+            }
+            ++pc;
+            m_words[sp+1] = v;
+            m_words[sp+2] = f;
+            sp += 2;
+            break;
+        }
+        case mnemonic::CLOSE: {
+            // s => s
+            auto ch = bound_channel(code[pc]);
+            if (ch) {
+                ch->close();
+            }
+            ++pc;
+            break;
+        }
         case mnemonic::STOP:
             // s => s
             m_stopped = true;
@@ -258,12 +452,20 @@ void interpreter::step() {
         case mnemonic::NOOP:
             // s => s
             break;
+        case mnemonic::BREAK:
+            // s => s, a debugger continues with the instruction it replaced
+            --pc;
+            m_op_pc = pc;
+            m_break = true;
+            m_stopped = true;
+            return;
     }
 
+    m_output_bytes += output.size();
     if (!trace_str.empty()) {
-        std::cout << std::setw(60) << std::left << printable_chars(output.str()) << trace_str << std::endl;
-    } else {
-        std::cout << output.str();
+        *m_output << std::setw(60) << std::left << printable_chars(output) << trace_str << std::endl;
+    } else if (!output.empty()) {
+        m_output->write(output.data(), static_cast<std::streamsize>(output.size()));
     }
 }
 
@@ -271,6 +473,25 @@ bool interpreter::is_stopped() const {
     return m_stopped;
 }
 
+channel *interpreter::blocked_on() const {
+    return m_blocked;
+}
+
+bool interpreter::blocked_sending() const {
+    return m_blocked_sending;
+}
+
+channel *interpreter::bound_channel(uint16_t number) const {
+    return number < m_channels.size() ? m_channels[number].get() : nullptr;
+}
+
+void interpreter::block(channel *ch, bool sending) {
+    // back to the opcode, the next step tries again
+    --pc;
+    m_blocked = ch;
+    m_blocked_sending = sending;
+}
+
 std::string interpreter::program() const {
     std::stringstream ss;
 
@@ -286,9 +507,100 @@ void interpreter::set_tracing(bool tracing) {
 }
 
 void interpreter::run() {
-    while (!m_stopped) {
-        step();
+    run_recorded(std::numeric_limits<uint64_t>::max(), true);
+}
+
+uint64_t interpreter::run(uint64_t budget) {
+    return run_recorded(budget, false);
+}
+
+uint64_t interpreter::run_recorded(uint64_t budget, bool until_stopped) {
+    sampling_scope sampled(*this);
+    m_sampled = sampled.active();
+    if (!m_metrics) {
+        return run_waiting(budget, until_stopped);
+    }
+
+    bool was_stopped = m_stopped;
+    auto output_bytes = m_output_bytes;
+    auto begin = std::chrono::steady_clock::now();
+    auto executed = run_waiting(budget, until_stopped);
+    auto end = std::chrono::steady_clock::now();
+
+    bool stopped = m_stopped && !was_stopped;
+    if (executed == 0 && !stopped) {
+        // a slice that found the VM blocked or stopped
+        return executed;
+    }
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    m_metrics->record_run(executed, static_cast<uint64_t>(nanoseconds), m_output_bytes - output_bytes, sp,
+                          stopped && !m_break, m_fault);
+    return executed;
+}
+
+uint64_t interpreter::run_waiting(uint64_t budget, bool until_stopped) {
+    uint64_t executed = 0;
+    for (;;) {
+        executed += run_budget(budget - executed);
+        if (!until_stopped || m_stopped) {
+            return executed;
+        }
+        if (m_blocked) {
+            // without a scheduler, let the other end of the channel run
+            std::this_thread::yield();
+        }
+    }
+}
+
+uint64_t interpreter::run_budget(uint64_t budget) {
+    if (m_guarded) {
+        return run_guarded(budget);
+    }
+    return m_sampled ? run_unguarded<true>(budget) : run_unguarded<false>(budget);
+}
+
+template <bool Publish>
+uint64_t interpreter::run_unguarded(uint64_t budget) {
+    uint64_t executed = 0;
+    while (!m_stopped && executed < budget) {
+        execute<Publish>();
+        if (m_blocked) {
+            break;
+        }
+        ++executed;
+    }
+    return executed;
+}
+
+uint64_t interpreter::run_guarded(uint64_t budget) {
+    trap_scope scope(*m_guarded);
+    // survives the jump back from the trap handler
+    volatile uint64_t executed = 0;
+
+    int signal = sigsetjmp(scope.buffer(), 1);
+    if (signal != 0) {
+        // whatever the interrupted step had on its own stack is abandoned
+        m_fault = signal == SIGFPE ? DIVISION_FAULT : STACK_FAULT;
+        pc = m_op_pc;
+        m_stopped = true;
+        return executed;
+    }
+
+    while (!m_stopped && executed < budget) {
+        execute<true>();
+        // the trap handler of a watchpoint may have set m_stopped
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        if (m_blocked) {
+            break;
+        }
+        executed = executed + 1;
+    }
+    // a write to a watched page stopped the VM from the trap handler
+    uint16_t slot;
+    if (m_guarded->watch_hit(slot)) {
+        m_break = true;
     }
+    return executed;
 }
 
 void interpreter::set_command_line_arguments(const std::vector<uint16_t> &args) {
@@ -297,9 +609,73 @@ void interpreter::set_command_line_arguments(const std::vector<uint16_t> &args)
 
 void interpreter::set_stack(const std::vector<uint16_t> &stack) {
     m_stack = stack;
+    if (m_guarded) {
+        auto words = std::min(m_stack.size(), guarded_stack::WORDS);
+        std::copy(m_stack.begin(), m_stack.begin() + words, m_words);
+        std::fill(m_words + words, m_words + guarded_stack::WORDS, 0);
+    } else {
+        m_words = m_stack.data();
+    }
+}
+
+void interpreter::set_safe_mode(bool safe) {
+    if (safe && !m_guarded) {
+        m_guarded.reset(new guarded_stack);
+        m_words = m_guarded->data();
+        set_stack(m_stack);
+    } else if (!safe && m_guarded) {
+        stack();
+        m_guarded.reset();
+        m_words = m_stack.data();
+    }
+}
+
+interpreter::fault_kind interpreter::fault() const {
+    return m_fault;
+}
+
+void interpreter::set_input_channel(std::shared_ptr<input_channel> channel) {
+    m_input = std::move(channel);
+}
+
+void interpreter::set_call_memo(std::shared_ptr<call_memo> memo) {
+    m_memo = std::move(memo);
+}
+
+void interpreter::set_branch_profile(std::shared_ptr<branch_profile> profile) {
+    m_profile = std::move(profile);
+}
+
+void interpreter::set_data_segment(std::shared_ptr<const data_segment> data) {
+    m_data = data ? std::move(data) : data_segment::empty();
+    m_data_words = m_data->words();
+    std::vector<uint16_t>().swap(m_own_data);
+}
+
+void interpreter::set_vector_isa(vector_isa isa) {
+    m_vector = &vector_kernels_for(isa);
+}
+
+void interpreter::set_metrics(std::shared_ptr<metrics_registry> metrics) {
+    m_metrics = std::move(metrics);
+}
+
+void interpreter::set_output(std::ostream &out) {
+    m_output = &out;
+}
+
+void interpreter::set_channel(uint16_t number, std::shared_ptr<channel> ch) {
+    if (number >= m_channels.size()) {
+        m_channels.resize(number + 1u);
+    }
+    m_channels[number] = std::move(ch);
 }
 
 const std::vector<uint16_t> &interpreter::stack() const {
+    if (m_guarded) {
+        auto words = std::min(m_stack.size(), guarded_stack::WORDS);
+        std::copy(m_words, m_words + words, m_stack.begin());
+    }
     return m_stack;
 }
 
@@ -2,13 +2,73 @@
 #define STACKMACHINE_INTERPRETER_H
 
 
+#include <memory>
+#include <ostream>
 #include "instructions.h"
+#include "input_channel.h"
+
+class branch_profile;
+class call_memo;
+class channel;
+class data_segment;
+class guarded_stack;
+class metrics_registry;
+struct vector_kernels;
+enum class vector_isa;
 
 class interpreter {
 public:
     interpreter(const std::vector<uint16_t>& instructions);
+    ~interpreter();
     void set_command_line_arguments(const std::vector<uint16_t>& args);
     void set_stack(const std::vector<uint16_t>& stack);
+    //! Attach the input channel read by READ and READN.
+    //! Without a channel the input is empty.
+    void set_input_channel(std::shared_ptr<input_channel> channel);
+    //! Answer calls of pure functions from a memo, see call_memo.
+    //! Without a memo every call runs.
+    void set_call_memo(std::shared_ptr<call_memo> memo);
+    //! Count which way every GOTO, IFZERO, IFNZERO and DJNZ goes, see relayout().
+    void set_branch_profile(std::shared_ptr<branch_profile> profile);
+    //! Send PRINTI, PRINTC, PRINTS, PRINTN and the trace to out instead of
+    //! std::cout.
+    //! The stream must outlive the interpreter.
+    void set_output(std::ostream& out);
+    //! Bind a channel number used by SEND, RECV and CLOSE. Words sent to an
+    //! unbound number are dropped, receiving from it reports the end.
+    void set_channel(uint16_t number, std::shared_ptr<channel> ch);
+    //! Map the data section read by LDD and written by STD. The segment is
+    //! shared, stores go to a private copy made by the first STD. Without a
+    //! segment, or with nullptr, all data words are 0.
+    void set_data_segment(std::shared_ptr<const data_segment> data);
+    //! Run the vector opcodes with isa instead of the best one of this CPU.
+    //! \throws std::domain_error if the CPU does not support isa
+    void set_vector_isa(vector_isa isa);
+    //! Record every run() call in a registry, which may be shared by many
+    //! interpreters, see metrics_registry. run() is recorded once however
+    //! often it waits for a channel, run(budget) unless it executed nothing.
+    //! step() is not recorded.
+    void set_metrics(std::shared_ptr<metrics_registry> metrics);
+
+    //! Place the stack between guard pages and turn stack accesses out of
+    //! range and division by zero into a fault that stops the VM, see
+    //! fault(). Nothing is checked per instruction: run() stores the pc of
+    //! every instruction for the trap handler and step() arms the handler on
+    //! every call. run() on a VM not in safe mode pays nothing.
+    //! \throws std::runtime_error if the stack cannot be mapped
+    void set_safe_mode(bool safe);
+
+    enum fault_kind {
+        NO_FAULT,
+        //! a stack access below slot 0 or above slot 0xFFFF
+        STACK_FAULT,
+        //! DIV or MOD by zero
+        DIVISION_FAULT
+    };
+
+    //! \return why a VM in safe mode stopped early. The pc register then
+    //! holds the faulting instruction, sp and bp are undefined.
+    fault_kind fault() const;
 
     struct configs {
         uint16_t pc;
@@ -21,20 +81,77 @@ public:
     const std::vector<uint16_t>& stack() const;
 
     void run();
+    //! Run until STOP or a fault, until budget instructions have been
+    //! executed or until a channel blocks, see blocked_on().
+    //! \return the number of instructions executed
+    uint64_t run(uint64_t budget);
     void step();
     bool is_stopped() const;
+    //! \return the channel the last step() had to wait for because it was
+    //! full or empty, or nullptr if the step executed. A blocked step leaves
+    //! every register unchanged and is repeated by the next one.
+    channel* blocked_on() const;
+    //! \return true if the last step() waited to send, false to receive
+    bool blocked_sending() const;
     void set_tracing(bool tracing);
     std::string program() const;
 
 private:
+    friend class register_engine;
+    friend class parallel_engine;
+    friend class compact_engine;
+    friend class sampling_profiler;
+    friend class debugger;
+
     bool m_tracing;
     bool m_stopped;
+    //! stopped by BREAK or a watchpoint rather than STOP or a fault
+    bool m_break;
     uint16_t pc;
     uint16_t sp;
     uint16_t bp;
     std::vector<uint16_t> code;
-    std::vector<uint16_t> m_stack;
+    //! in safe mode a copy of the guarded stack updated by stack()
+    mutable std::vector<uint16_t> m_stack;
     std::vector<uint16_t> cmd_args;
+    std::shared_ptr<input_channel> m_input;
+    std::shared_ptr<call_memo> m_memo;
+    std::shared_ptr<branch_profile> m_profile;
+    std::ostream* m_output;
+    std::vector<std::shared_ptr<channel>> m_channels;
+    std::shared_ptr<const data_segment> m_data;
+    //! the words LDD reads, those of m_data or m_own_data
+    const uint16_t* m_data_words;
+    //! the copy of m_data after the first STD
+    std::vector<uint16_t> m_own_data;
+    channel* m_blocked;
+    bool m_blocked_sending;
+    //! the stack step() works on, m_stack or the guarded stack
+    uint16_t* m_words;
+    std::unique_ptr<guarded_stack> m_guarded;
+    uint16_t m_op_pc;
+    //! a sampling_profiler was running when run() started, so the
+    //! unguarded loop publishes m_op_pc as well
+    bool m_sampled;
+    fault_kind m_fault;
+    const vector_kernels* m_vector;
+    std::shared_ptr<metrics_registry> m_metrics;
+    //! bytes written by the PRINT instructions so far
+    uint64_t m_output_bytes;
+
+    //! Execute the instruction at pc. Publish stores its pc in m_op_pc first
+    //! for the trap handler, the sampling profiler and for tools that look at
+    //! a VM between steps.
+    template <bool Publish>
+    void execute();
+    uint64_t run_recorded(uint64_t budget, bool until_stopped);
+    uint64_t run_waiting(uint64_t budget, bool until_stopped);
+    uint64_t run_budget(uint64_t budget);
+    template <bool Publish>
+    uint64_t run_unguarded(uint64_t budget);
+    uint64_t run_guarded(uint64_t budget);
+    channel* bound_channel(uint16_t number) const;
+    void block(channel* ch, bool sending);
 };
 
 #endif //STACKMACHINE_INTERPRETER_H
@@ -0,0 +1,121 @@
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include "control_flow.h"
+#include "lazy_program.h"
+
+namespace {
+    bool decodable(const std::vector<uint16_t>& code, size_t pc) {
+        return pc < code.size()
+            && is_mnemonic(code[pc])
+            && pc + argument_count(static_cast<mnemonic>(code[pc])) < code.size();
+    }
+
+    std::string failure(size_t pc, const char* reason) {
+        std::stringstream msg;
+        msg << reason << " at pc=0x" << std::hex << pc;
+        return msg.str();
+    }
+}
+
+lazy_program::lazy_program(const std::vector<uint16_t> &code)
+: m_code(code), m_functions(0), m_words(0)
+{
+    m_code.push_back(mk_stop());
+    m_flags.reset(new std::atomic<uint8_t>[m_code.size()]);
+    for (size_t pc = 0; pc < m_code.size(); ++pc) {
+        m_flags[pc].store(0, std::memory_order_relaxed);
+    }
+    load(0);
+}
+
+void lazy_program::load_slow(uint16_t entry) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (is_loaded(entry)) {
+        // another thread was first
+        return;
+    }
+    auto failed = m_failed.find(entry);
+    if (failed != m_failed.end()) {
+        throw std::domain_error(failed->second);
+    }
+
+    // the flags of this function, committed once all of it verifies
+    std::unordered_map<uint16_t, uint8_t> fresh;
+    auto walked = [&](size_t pc) {
+        auto found = fresh.find(static_cast<uint16_t>(pc));
+        return is_instruction(pc) || (found != fresh.end() && (found->second & INSTRUCTION) != 0);
+    };
+    auto fail = [&](size_t pc, const char* reason) {
+        auto message = failure(pc, reason);
+        m_failed[entry] = message;
+        throw std::domain_error(message);
+    };
+
+    if (!decodable(m_code, entry)) {
+        fail(entry, entry < m_code.size() ? "Invalid instruction" : "Jump target outside of code");
+    }
+    fresh[entry] |= LEADER;
+
+    std::vector<uint16_t> work = {entry};
+    size_t words = 0;
+    while (!work.empty()) {
+        size_t pc = work.back();
+        work.pop_back();
+
+        // follow the straight-line code until it ends or joins walked code
+        while (!walked(pc)) {
+            if (!decodable(m_code, pc)) {
+                fail(pc, pc < m_code.size() ? "Invalid instruction" : "Missing STOP");
+            }
+            fresh[static_cast<uint16_t>(pc)] |= INSTRUCTION;
+
+            auto m = static_cast<mnemonic>(m_code[pc]);
+            std::vector<uint16_t> args(m_code.begin() + pc + 1, m_code.begin() + pc + 1 + argument_count(m));
+            instruction instr(m, args);
+            size_t next_pc = pc + 1 + argument_count(m);
+            words += next_pc - pc;
+
+            uint16_t target;
+            if (static_target(instr, target)) {
+                if (target >= m_code.size()) {
+                    fail(pc, "Jump target outside of code");
+                }
+                fresh[target] |= LEADER;
+                // callees are loaded when they are entered
+                if (m != mnemonic::CALL && m != mnemonic::TCALL) {
+                    work.push_back(target);
+                }
+            }
+
+            bool branches = m == mnemonic::IFZERO || m == mnemonic::IFNZERO || m == mnemonic::DJNZ
+                         || m == mnemonic::CALL;
+            if (next_pc < m_code.size() && (branches || is_unconditional_transfer(m))) {
+                fresh[static_cast<uint16_t>(next_pc)] |= LEADER;
+            }
+
+            if (is_unconditional_transfer(m)) {
+                break;
+            }
+            pc = next_pc;
+        }
+    }
+
+    for (auto& f : fresh) {
+        m_flags[f.first].fetch_or(f.second, std::memory_order_relaxed);
+    }
+    m_flags[entry].fetch_or(LOADED, std::memory_order_release);
+    ++m_functions;
+    m_words += words;
+}
+
+size_t lazy_program::functions() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_functions;
+}
+
+size_t lazy_program::words() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_words;
+}
@@ -0,0 +1,92 @@
+#ifndef STACKMACHINE_LAZY_PROGRAM_H
+#define STACKMACHINE_LAZY_PROGRAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "instructions.h"
+
+//! A program whose functions are decoded and verified when they are first
+//! entered rather than all at load time.
+//!
+//! Loading a function walks the instructions reachable from its entry through
+//! fall-through, jumps and the return points of calls, but not into the
+//! functions it CALLs or TCALLs. Each walked instruction gets the checks of
+//! verify(); a call target only has to lie inside the code until the callee
+//! is loaded itself. The control flow flags of all loaded functions are kept
+//! together, so code shared by several functions is walked once.
+//!
+//! A lazy_program is shared by engines on several threads. Loading an entry
+//! that is already loaded costs one atomic load, the first load of a
+//! function runs under a mutex and the other threads wait for it.
+class lazy_program {
+public:
+    //! Loads the function at pc 0.
+    //! \param code the program as passed to the interpreter
+    //! \throws std::domain_error if the entry function does not verify
+    explicit lazy_program(const std::vector<uint16_t>& code);
+
+    lazy_program(const lazy_program&) = delete;
+    lazy_program& operator=(const lazy_program&) = delete;
+
+    //! \return the program with the trailing STOP the interpreter appends
+    const std::vector<uint16_t>& code() const {
+        return m_code;
+    }
+
+    //! Decode and verify the function at entry unless that happened before.
+    //! \throws std::domain_error if the function does not verify, on every
+    //!         attempt to load it
+    void load(uint16_t entry) {
+        if (entry < m_code.size() && (m_flags[entry].load(std::memory_order_acquire) & LOADED) != 0) {
+            return;
+        }
+        load_slow(entry);
+    }
+
+    //! \return true if a function starting at pc has been loaded
+    bool is_loaded(size_t pc) const {
+        return pc < m_code.size() && (m_flags[pc].load(std::memory_order_acquire) & LOADED) != 0;
+    }
+
+    //! \return true if an instruction of a loaded function starts at pc
+    bool is_instruction(size_t pc) const {
+        return pc < m_code.size() && (m_flags[pc].load(std::memory_order_relaxed) & INSTRUCTION) != 0;
+    }
+
+    //! \return true if a basic block of a loaded function starts at pc
+    bool is_leader(size_t pc) const {
+        return pc < m_code.size() && (m_flags[pc].load(std::memory_order_relaxed) & LEADER) != 0;
+    }
+
+    //! \return the number of functions loaded so far
+    size_t functions() const;
+
+    //! \return the number of code words walked so far
+    size_t words() const;
+
+private:
+    enum flag : uint8_t {
+        INSTRUCTION = 1,
+        LEADER = 2,
+        LOADED = 4
+    };
+
+    void load_slow(uint16_t entry);
+
+    std::vector<uint16_t> m_code;
+    std::unique_ptr<std::atomic<uint8_t>[]> m_flags;
+
+    mutable std::mutex m_mutex;
+    //! entry -> why it did not verify
+    std::map<uint16_t, std::string> m_failed;
+    size_t m_functions;
+    size_t m_words;
+};
+
+#endif //STACKMACHINE_LAZY_PROGRAM_H
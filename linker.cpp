@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <stdexcept>
+#include "control_flow.h"
+#include "linker.h"
+
+namespace {
+
+    //! \return the index of the argument holding the target of m, -1 if there is none
+    int target_argument(mnemonic m) {
+        switch (m) {
+            case mnemonic::GOTO:
+            case mnemonic::IFZERO:
+            case mnemonic::IFNZERO:
+            case mnemonic::DJNZ:
+                return 0;
+            case mnemonic::CALL:
+                return 1;
+            case mnemonic::TCALL:
+                return 2;
+            default:
+                return -1;
+        }
+    }
+
+    //! Where the labels and functions of a module are.
+    struct module_layout {
+        //! label -> instruction index
+        std::map<uint16_t, size_t> labels;
+        //! first instruction of every function, ascending
+        std::vector<size_t> starts;
+
+        size_t function_of(size_t index) const {
+            return static_cast<size_t>(std::upper_bound(starts.begin(), starts.end(), index) - starts.begin()) - 1;
+        }
+
+        size_t end_of(size_t function, size_t size) const {
+            return function + 1 < starts.size() ? starts[function + 1] : size;
+        }
+    };
+
+    module_layout analyze(const object_module& module) {
+        module_layout layout;
+        for (size_t i = 0; i < module.code.size(); ++i) {
+            auto label = module.code[i].first;
+            if (label == NO_LABEL) {
+                continue;
+            }
+            if (!layout.labels.emplace(label, i).second || module.imports.count(label) != 0) {
+                throw std::domain_error("Label defined twice in object module");
+            }
+        }
+
+        std::vector<size_t> starts;
+        if (!module.code.empty()) {
+            starts.push_back(0);
+        }
+        for (auto& exported : module.exports) {
+            auto found = layout.labels.find(exported.second);
+            if (found == layout.labels.end()) {
+                throw std::domain_error("Exported symbol " + exported.first + " has no label in its module");
+            }
+            starts.push_back(found->second);
+        }
+        for (auto& instr : module.code) {
+            auto m = instr.second.mnem();
+            if (m == mnemonic::CALL || m == mnemonic::TCALL) {
+                auto found = layout.labels.find(instr.second.arg(static_cast<size_t>(target_argument(m))));
+                if (found != layout.labels.end()) {
+                    starts.push_back(found->second);
+                }
+            }
+        }
+        std::sort(starts.begin(), starts.end());
+        starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+        layout.starts = starts;
+        return layout;
+    }
+
+    //! \return true if the last instruction of code[begin, end) may continue at end
+    bool falls_through(const symbolic_program& code, size_t begin, size_t end) {
+        return end > begin && !is_unconditional_transfer(code[end - 1].second.mnem());
+    }
+}
+
+linker::linker()
+: m_kept(0), m_dropped(0)
+{
+}
+
+void linker::add(const object_module &module) {
+    for (auto& exported : module.exports) {
+        if (m_symbols.count(exported.first) != 0) {
+            throw std::domain_error("Symbol " + exported.first + " exported twice");
+        }
+    }
+    for (auto& exported : module.exports) {
+        m_symbols[exported.first] = m_modules.size();
+    }
+    m_modules.push_back(module);
+}
+
+std::vector<uint16_t> linker::link(const std::string &entry) {
+    m_kept = 0;
+    m_dropped = 0;
+
+    std::vector<module_layout> layouts;
+    for (auto& module : m_modules) {
+        layouts.push_back(analyze(module));
+    }
+
+    // a label as used in module m, resolved to the module and label defining it
+    typedef std::pair<size_t, uint16_t> location;
+    auto resolve_symbol = [&](const std::string& symbol) -> location {
+        auto found = m_symbols.find(symbol);
+        if (found == m_symbols.end()) {
+            throw std::domain_error("Undefined symbol " + symbol);
+        }
+        return location(found->second, m_modules[found->second].exports.at(symbol));
+    };
+    auto resolve = [&](size_t m, uint16_t label) -> location {
+        if (layouts[m].labels.count(label) != 0) {
+            return location(m, label);
+        }
+        auto imported = m_modules[m].imports.find(label);
+        if (imported == m_modules[m].imports.end()) {
+            throw std::domain_error("Unknown label in object module");
+        }
+        return resolve_symbol(imported->second);
+    };
+
+    // functions reachable from the entry point
+    std::vector<std::vector<bool>> reachable;
+    for (size_t m = 0; m < m_modules.size(); ++m) {
+        reachable.emplace_back(layouts[m].starts.size(), false);
+    }
+    auto start = resolve_symbol(entry);
+    std::vector<std::pair<size_t, size_t>> work;
+    auto reach = [&](location target) {
+        auto function = layouts[target.first].function_of(layouts[target.first].labels.at(target.second));
+        if (!reachable[target.first][function]) {
+            reachable[target.first][function] = true;
+            work.push_back(std::make_pair(target.first, function));
+        }
+    };
+    reach(start);
+    while (!work.empty()) {
+        auto m = work.back().first;
+        auto function = work.back().second;
+        work.pop_back();
+
+        auto& code = m_modules[m].code;
+        auto begin = layouts[m].starts[function];
+        auto end = layouts[m].end_of(function, code.size());
+        for (auto i = begin; i < end; ++i) {
+            auto arg = target_argument(code[i].second.mnem());
+            if (arg >= 0) {
+                reach(resolve(m, code[i].second.arg(static_cast<size_t>(arg))));
+            }
+        }
+        if (end < code.size() && falls_through(code, begin, end) && !reachable[m][function + 1]) {
+            reachable[m][function + 1] = true;
+            work.push_back(std::make_pair(m, function + 1));
+        }
+    }
+
+    // every label of the program gets a number of its own
+    std::map<location, uint16_t> global;
+    auto global_label = [&](location l) -> uint16_t {
+        auto found = global.find(l);
+        if (found != global.end()) {
+            return found->second;
+        }
+        if (global.size() >= NO_LABEL) {
+            throw std::domain_error("Too many labels in linked program");
+        }
+        auto label = static_cast<uint16_t>(global.size());
+        global.emplace(l, label);
+        return label;
+    };
+
+    std::vector<size_t> order = {start.first};
+    for (size_t m = 0; m < m_modules.size(); ++m) {
+        if (m != start.first) {
+            order.push_back(m);
+        }
+    }
+
+    symbolic_program program;
+    for (auto m : order) {
+        auto& code = m_modules[m].code;
+        auto& layout = layouts[m];
+        for (size_t function = 0; function < layout.starts.size(); ++function) {
+            if (!reachable[m][function]) {
+                ++m_dropped;
+                continue;
+            }
+            ++m_kept;
+            auto begin = layout.starts[function];
+            auto end = layout.end_of(function, code.size());
+            for (auto i = begin; i < end; ++i) {
+                auto label = code[i].first == NO_LABEL ? NO_LABEL : global_label(location(m, code[i].first));
+                auto instr = code[i].second;
+                auto arg = target_argument(instr.mnem());
+                if (arg >= 0) {
+                    auto& target = instr.arg(static_cast<size_t>(arg));
+                    target = global_label(resolve(m, target));
+                }
+                program.push_back(std::make_pair(label, instr));
+            }
+            if (end == code.size() && falls_through(code, begin, end)) {
+                program.push_back(std::make_pair(NO_LABEL, instruction(mnemonic::STOP)));
+            }
+        }
+    }
+
+    auto entry_label = global_label(start);
+    if (program.empty() || program.front().first != entry_label) {
+        program.insert(program.begin(), std::make_pair(NO_LABEL, instruction(mnemonic::GOTO, {entry_label})));
+    }
+
+    size_t words = 0;
+    for (auto& instr : program) {
+        words += 1 + argument_count(instr.second.mnem());
+    }
+    if (words > 0xFFFF) {
+        throw std::domain_error("Linked program exceeds the address space");
+    }
+    return assemble(program);
+}
+
+unsigned linker::kept() const {
+    return m_kept;
+}
+
+unsigned linker::dropped() const {
+    return m_dropped;
+}
@@ -0,0 +1,66 @@
+#ifndef STACKMACHINE_LINKER_H
+#define STACKMACHINE_LINKER_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "assembler.h"
+
+//! A relocatable piece of a program.
+//!
+//! The code is a symbolic program whose labels are local to the module.
+//! Labels listed in exports can be used by other modules under their symbol
+//! name, labels listed in imports are not defined in the module but stand for
+//! a symbol another module exports. CALL, TCALL, GOTO, IFZERO, IFNZERO and
+//! DJNZ may target both.
+//!
+//! The module is split into functions: one starts at its first instruction,
+//! at every exported label and at every label the module CALLs or TCALLs.
+//! A function runs up to the start of the next one.
+struct object_module {
+    symbolic_program code;
+    //! symbol name -> label in code
+    std::map<std::string, uint16_t> exports;
+    //! label used as a target in code -> symbol name
+    std::map<uint16_t, std::string> imports;
+};
+
+//! Links object modules into a program for the interpreter.
+//!
+//! Only the functions reachable from the entry point through calls, jumps and
+//! fall-through are kept, in the order of the modules and of their code, and
+//! all targets are resolved to absolute addresses. The module of the entry
+//! point comes first; a GOTO at address 0 leads to the entry point if it is
+//! not the first function kept. A module whose code may fall off its end gets
+//! a STOP appended, as if it ran alone.
+class linker {
+public:
+    linker();
+
+    //! \param module a module to link, copied
+    //! \throws std::domain_error if it exports a symbol another module exports
+    void add(const object_module& module);
+
+    //! \param entry the exported symbol the program starts at
+    //! \return the program
+    //! \throws std::domain_error if a reachable import or the entry point is
+    //!         not exported, a label is unknown or defined twice, or the
+    //!         program exceeds the address space
+    std::vector<uint16_t> link(const std::string& entry);
+
+    //! \return the number of functions in the last linked program
+    unsigned kept() const;
+
+    //! \return the number of unreachable functions the last link dropped
+    unsigned dropped() const;
+
+private:
+    std::vector<object_module> m_modules;
+    //! symbol name -> module index
+    std::map<std::string, size_t> m_symbols;
+    unsigned m_kept;
+    unsigned m_dropped;
+};
+
+#endif //STACKMACHINE_LINKER_H
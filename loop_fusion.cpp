@@ -0,0 +1,65 @@
+#include "control_flow.h"
+#include "loop_fusion.h"
+
+loop_fusion::loop_fusion()
+: m_fused(0)
+{
+}
+
+std::vector<uint16_t> loop_fusion::run(const std::vector<uint16_t> &code) {
+
+    m_fused = 0;
+
+    auto full = code;
+    full.push_back(mk_stop());
+    verify(full);
+    control_flow cfg(full);
+
+    std::vector<bool> targeted(full.size(), false);
+    for (size_t pc = 0; pc < full.size(); ++pc) {
+        uint16_t target;
+        if (cfg.is_instruction(pc) && static_target(cfg.at(static_cast<uint16_t>(pc)), target)) {
+            targeted[target] = true;
+        }
+    }
+
+    // an instruction of its own that nothing else jumps to or into
+    auto is = [&](size_t pc, mnemonic m) {
+        if (!cfg.is_instruction(pc) || full[pc] != m) {
+            return false;
+        }
+        for (size_t arg = 1; arg <= argument_count(m); ++arg) {
+            if (cfg.is_instruction(pc + arg)) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    auto result = code;
+    for (size_t pc = 0; pc + 4 < code.size(); ++pc) {
+        if (!is(pc, mnemonic::CONST) || full[pc + 1] != 1
+            || !is(pc + 2, mnemonic::SUB) || targeted[pc + 2]
+            || !is(pc + 3, mnemonic::GOTO) || targeted[pc + 3]) {
+            continue;
+        }
+        auto top = full[pc + 4];
+        if (!is(top, mnemonic::DUP) || !is(top + 1u, mnemonic::IFZERO)) {
+            continue;
+        }
+        auto body = static_cast<uint16_t>(top + 3);
+        auto end = full[top + 2u];
+
+        result[pc] = mnemonic::DJNZ;
+        result[pc + 1] = body;
+        result[pc + 2] = mnemonic::GOTO;
+        result[pc + 3] = end;
+        result[pc + 4] = mnemonic::NOOP;
+        ++m_fused;
+    }
+    return result;
+}
+
+unsigned loop_fusion::fused() const {
+    return m_fused;
+}
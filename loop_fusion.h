@@ -0,0 +1,43 @@
+#ifndef STACKMACHINE_LOOP_FUSION_H
+#define STACKMACHINE_LOOP_FUSION_H
+
+#include <cstdint>
+#include <vector>
+
+//! Replaces the overhead of counted loops by DJNZ.
+//!
+//! A loop of the shape
+//!
+//!     top:  DUP; IFZERO end
+//!     body: ...
+//!           CONST 1; SUB; GOTO top
+//!
+//! dispatches five instructions per iteration to count down the value on top
+//! of the stack. Its latch is rewritten in place to
+//!
+//!           DJNZ body; GOTO end; NOOP
+//!
+//! which decrements the counter and jumps straight back to the body, so only
+//! the DJNZ runs per iteration. The entry test at top stays for the first
+//! iteration. A latch is left alone if anything jumps to its SUB or GOTO.
+//!
+//! The code keeps its size and addresses. The result behaves like the input
+//! on a fresh interpreter as far as the output, sp, bp and the slots 0..sp
+//! go; the slot above sp no longer receives the copies DUP and CONST made.
+class loop_fusion {
+public:
+    loop_fusion();
+
+    //! \param code the program as passed to the interpreter
+    //! \return the program with counted loops rewritten
+    //! \throws std::domain_error if the program does not verify
+    std::vector<uint16_t> run(const std::vector<uint16_t>& code);
+
+    //! \return the number of loops rewritten by the last run
+    unsigned fused() const;
+
+private:
+    unsigned m_fused;
+};
+
+#endif //STACKMACHINE_LOOP_FUSION_H
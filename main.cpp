@@ -1,7 +1,14 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include <map>
+#include <limits>
+#include <sstream>
+#include <string>
 #include "instructions.h"
 #include "interpreter.h"
+#include "assembler.h"
+#include "process_pool.h"
 
 
 using code = std::vector<uint16_t>;
@@ -49,12 +56,6 @@ std::vector<instruction> example_program1() {
     };
 }
 
-using symbolic_program = std::vector<std::pair<uint16_t, instruction>>;
-
-namespace {
-    const uint16_t NO_LABEL = 0xFFFF;
-}
-
 symbolic_program example_call() {
 
     return {
@@ -115,43 +116,68 @@ symbolic_program print_cmd_args() {
     };
 }
 
-
-std::vector<instruction> symbolic_program_to_instructions(const symbolic_program& sprog) {
-    std::map<uint16_t, uint16_t> labels;
-
-    uint16_t idx = 0;
-    for (auto& instr : sprog) {
-        if (instr.first != NO_LABEL) {
-            labels.emplace(instr.first, idx);
+//! Read one job per line, the program words and after a colon the command
+//! line arguments, in decimal or 0x hexadecimal.
+std::vector<job> read_jobs(std::istream& in) {
+    std::vector<job> jobs;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::stringstream words(line);
+        std::string word;
+        job j;
+        bool args = false;
+        while (words >> word) {
+            if (word == ":") {
+                args = true;
+                continue;
+            }
+            auto value = static_cast<uint16_t>(std::strtoul(word.c_str(), nullptr, 0));
+            (args ? j.args : j.code).push_back(value);
+        }
+        if (!j.code.empty()) {
+            jobs.push_back(j);
         }
-        ++idx;
     }
+    return jobs;
+}
 
-    std::vector<instruction> result;
-    // rewrite all labels
-    for (auto& instr : sprog) {
-        instruction i = instr.second;
-        if (i.mnem() == mnemonic::CALL) {
-            i.arg(1) = labels[i.arg(1)];
-        } else if (i.mnem() == mnemonic::TCALL) {
-            i.arg(2) = labels[i.arg(2)];
-
-        } else if (i.mnem() == mnemonic::GOTO
-                || i.mnem() == mnemonic::IFZERO
-                || i.mnem() == mnemonic::IFNZERO) {
-            i.arg(0) = labels[i.arg(0)];
+//! Run the jobs on stdin in worker processes and print their output in
+//! order, one line per job.
+int run_jobs(unsigned workers, uint64_t budget) {
+    auto jobs = read_jobs(std::cin);
+    process_pool pool(workers, budget);
+    auto results = pool.run(jobs);
+    int status = 0;
+    for (size_t i = 0; i < results.size(); ++i) {
+        if (results[i].crashed) {
+            std::cerr << "job " << i + 1 << " crashed its worker" << std::endl;
+            status = 1;
         }
-
-        result.push_back(i);
+        std::cout << results[i].output << std::endl;
     }
-
-    return result;
+    return status;
 }
 
-int main() {
+int main(int argc, char** argv) {
+    unsigned workers = 0;
+    uint64_t budget = std::numeric_limits<uint64_t>::max();
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            workers = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        } else if (std::strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            budget = std::strtoull(argv[++i], nullptr, 10);
+        } else {
+            std::cerr << "usage: stackmachine [-w workers [-b budget] < jobs]" << std::endl;
+            return 2;
+        }
+    }
+    if (workers > 0) {
+        return run_jobs(workers, budget);
+    }
+
     interpreter interp(binary_example_program1());
-    //interpreter interp(symbolic_program_to_instructions(example_call()));
-    //interpreter interp(symbolic_program_to_instructions(print_cmd_args()));
+    //interpreter interp(assemble(example_call()));
+    //interpreter interp(assemble(print_cmd_args()));
     interp.set_command_line_arguments({0x1,0x2,0x3,0x04,0x05});
     interp.set_command_line_arguments({5,4,3,2,1});
 
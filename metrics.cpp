@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include "metrics.h"
+
+const size_t latency_histogram::BUCKETS;
+const size_t metrics_registry::SHARDS;
+
+namespace {
+    const uint64_t SUB_BUCKETS = 8;
+
+    unsigned log2(uint64_t value) {
+        unsigned e = 0;
+        while (value >>= 1) {
+            ++e;
+        }
+        return e;
+    }
+
+    std::atomic<unsigned> g_next_shard(0);
+    thread_local unsigned t_shard = g_next_shard.fetch_add(1) % metrics_registry::SHARDS;
+
+    void raise_to(std::atomic<uint64_t>& maximum, uint64_t value) {
+        auto current = maximum.load(std::memory_order_relaxed);
+        while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+size_t latency_histogram::bucket(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+    auto e = log2(value);
+    return static_cast<size_t>((e - 2) * SUB_BUCKETS + ((value >> (e - 3)) & (SUB_BUCKETS - 1)));
+}
+
+uint64_t latency_histogram::lower_bound(size_t b) {
+    if (b < SUB_BUCKETS) {
+        return b;
+    }
+    auto e = b / SUB_BUCKETS + 2;
+    return (SUB_BUCKETS + b % SUB_BUCKETS) << (e - 3);
+}
+
+uint64_t latency_histogram::upper_bound(size_t b) {
+    if (b < SUB_BUCKETS) {
+        return b;
+    }
+    auto e = b / SUB_BUCKETS + 2;
+    return lower_bound(b) + ((uint64_t(1) << (e - 3)) - 1);
+}
+
+uint64_t latency_histogram::percentile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    auto rank = static_cast<uint64_t>(std::ceil(q * count));
+    rank = rank == 0 ? 1 : rank;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < counts.size(); ++b) {
+        seen += counts[b];
+        if (seen >= rank) {
+            return std::min(upper_bound(b), max);
+        }
+    }
+    return max;
+}
+
+struct metrics_registry::shard {
+    std::atomic<uint64_t> runs;
+    std::atomic<uint64_t> instructions;
+    std::atomic<uint64_t> stopped;
+    std::atomic<uint64_t> stack_faults;
+    std::atomic<uint64_t> division_faults;
+    std::atomic<uint64_t> output_bytes;
+    std::atomic<uint64_t> max_final_sp;
+    std::atomic<uint64_t> latency_sum;
+    std::atomic<uint64_t> latency_max;
+    std::atomic<uint64_t> latency[latency_histogram::BUCKETS];
+    //! keeps the counters of the next shard off the last cache line
+    char padding[64];
+};
+
+metrics_registry::metrics_registry()
+: m_shards(new shard[SHARDS])
+{
+    for (size_t i = 0; i < SHARDS; ++i) {
+        auto& s = m_shards[i];
+        for (auto counter : {&s.runs, &s.instructions, &s.stopped, &s.stack_faults, &s.division_faults,
+                             &s.output_bytes, &s.max_final_sp, &s.latency_sum, &s.latency_max}) {
+            counter->store(0, std::memory_order_relaxed);
+        }
+        for (auto& count : s.latency) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+metrics_registry::~metrics_registry() {
+}
+
+metrics_registry::shard &metrics_registry::local_shard() {
+    return m_shards[t_shard];
+}
+
+void metrics_registry::record_run(uint64_t instructions, uint64_t nanoseconds, uint64_t output_bytes, uint16_t sp,
+                                  bool stopped, interpreter::fault_kind fault) {
+    auto& s = local_shard();
+    const auto relaxed = std::memory_order_relaxed;
+    s.runs.fetch_add(1, relaxed);
+    s.instructions.fetch_add(instructions, relaxed);
+    if (output_bytes != 0) {
+        s.output_bytes.fetch_add(output_bytes, relaxed);
+    }
+    if (stopped) {
+        switch (fault) {
+            case interpreter::STACK_FAULT: s.stack_faults.fetch_add(1, relaxed); break;
+            case interpreter::DIVISION_FAULT: s.division_faults.fetch_add(1, relaxed); break;
+            default: s.stopped.fetch_add(1, relaxed); break;
+        }
+    }
+    raise_to(s.max_final_sp, sp);
+    s.latency[latency_histogram::bucket(nanoseconds)].fetch_add(1, relaxed);
+    s.latency_sum.fetch_add(nanoseconds, relaxed);
+    raise_to(s.latency_max, nanoseconds);
+}
+
+metrics_snapshot metrics_registry::snapshot() const {
+    metrics_snapshot result = {};
+    auto& h = result.run_nanoseconds;
+    h.counts.assign(latency_histogram::BUCKETS, 0);
+
+    for (size_t i = 0; i < SHARDS; ++i) {
+        auto& s = m_shards[i];
+        result.runs += s.runs.load();
+        result.instructions += s.instructions.load();
+        result.stopped += s.stopped.load();
+        result.stack_faults += s.stack_faults.load();
+        result.division_faults += s.division_faults.load();
+        result.output_bytes += s.output_bytes.load();
+        result.max_final_sp = std::max(result.max_final_sp, s.max_final_sp.load());
+        for (size_t b = 0; b < latency_histogram::BUCKETS; ++b) {
+            auto count = s.latency[b].load();
+            h.counts[b] += count;
+            h.count += count;
+        }
+        h.sum += s.latency_sum.load();
+        h.max = std::max(h.max, s.latency_max.load());
+    }
+    return result;
+}
+
+void metrics_snapshot::write_prometheus(std::ostream &out) const {
+    auto counter = [&](const char* name, const char* help, uint64_t value) {
+        out << "# HELP stackmachine_" << name << ' ' << help << '\n'
+            << "# TYPE stackmachine_" << name << " counter\n"
+            << "stackmachine_" << name << ' ' << value << '\n';
+    };
+    counter("runs_total", "Runs of interpreters until STOP and slices of run(budget).", runs);
+    counter("instructions_total", "Instructions executed.", instructions);
+    counter("stopped_total", "VMs that reached STOP.", stopped);
+    out << "# HELP stackmachine_faults_total VMs stopped by a fault.\n"
+        << "# TYPE stackmachine_faults_total counter\n"
+        << "stackmachine_faults_total{kind=\"stack\"} " << stack_faults << '\n'
+        << "stackmachine_faults_total{kind=\"division\"} " << division_faults << '\n';
+    counter("output_bytes_total", "Bytes printed by the PRINT instructions.", output_bytes);
+    out << "# HELP stackmachine_max_final_sp The largest sp a VM had when a run ended.\n"
+        << "# TYPE stackmachine_max_final_sp gauge\n"
+        << "stackmachine_max_final_sp " << max_final_sp << '\n';
+
+    // only the buckets that counted something, as cumulative counts
+    auto& h = run_nanoseconds;
+    out << "# HELP stackmachine_run_seconds The duration of run() calls.\n"
+        << "# TYPE stackmachine_run_seconds histogram\n";
+    uint64_t cumulative = 0;
+    for (size_t b = 0; b < h.counts.size(); ++b) {
+        if (h.counts[b] != 0) {
+            cumulative += h.counts[b];
+            out << "stackmachine_run_seconds_bucket{le=\"" << (latency_histogram::upper_bound(b) + 1) * 1e-9
+                << "\"} " << cumulative << '\n';
+        }
+    }
+    out << "stackmachine_run_seconds_bucket{le=\"+Inf\"} " << h.count << '\n'
+        << "stackmachine_run_seconds_sum " << h.sum * 1e-9 << '\n'
+        << "stackmachine_run_seconds_count " << h.count << '\n';
+}
+
+void metrics_snapshot::write_json(std::ostream &out) const {
+    auto& h = run_nanoseconds;
+    out << "{\"runs\":" << runs
+        << ",\"instructions\":" << instructions
+        << ",\"stopped\":" << stopped
+        << ",\"faults\":{\"stack\":" << stack_faults << ",\"division\":" << division_faults << '}'
+        << ",\"output_bytes\":" << output_bytes
+        << ",\"max_final_sp\":" << max_final_sp
+        << ",\"run_nanoseconds\":{\"count\":" << h.count
+        << ",\"sum\":" << h.sum
+        << ",\"p50\":" << h.percentile(0.5)
+        << ",\"p90\":" << h.percentile(0.9)
+        << ",\"p99\":" << h.percentile(0.99)
+        << ",\"max\":" << h.max
+        << "}}\n";
+}
+
+void metrics_registry::dump(const std::string &path, format f) const {
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        auto s = snapshot();
+        if (f == PROMETHEUS) {
+            s.write_prometheus(out);
+        } else {
+            s.write_json(out);
+        }
+        out.flush();
+        if (!out) {
+            throw std::runtime_error("Cannot write metrics to " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace " + path);
+    }
+}
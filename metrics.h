@@ -0,0 +1,106 @@
+#ifndef STACKMACHINE_METRICS_H
+#define STACKMACHINE_METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "interpreter.h"
+
+//! The durations of run() calls in nanoseconds, in log-linear buckets like
+//! an HDR histogram: values below 8 have a bucket each, above that every
+//! power of two is split into 8 buckets, so a bucket is at most 12.5% wide.
+struct latency_histogram {
+    static const size_t BUCKETS = 62 * 8;
+
+    //! \return the bucket counting value
+    static size_t bucket(uint64_t value);
+    //! \return the smallest value counted by bucket b
+    static uint64_t lower_bound(size_t b);
+    //! \return the largest value counted by bucket b
+    static uint64_t upper_bound(size_t b);
+
+    //! \return the upper bound of the bucket holding the value below which
+    //!         the fraction q of all values lie, at most max, 0 when empty
+    uint64_t percentile(double q) const;
+
+    std::vector<uint64_t> counts;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+//! The totals of all runs recorded in a metrics_registry.
+struct metrics_snapshot {
+    //! calls of interpreter::run() and of run(budget) that executed something
+    uint64_t runs;
+    uint64_t instructions;
+    //! VMs that reached STOP without a fault
+    uint64_t stopped;
+    uint64_t stack_faults;
+    uint64_t division_faults;
+    //! bytes written by the PRINT instructions
+    uint64_t output_bytes;
+    //! the largest sp any VM had when a run ended, not the deepest one
+    //! reached during a run, which would cost a check per instruction
+    uint64_t max_final_sp;
+    latency_histogram run_nanoseconds;
+
+    //! Write the snapshot in the Prometheus text exposition format, every
+    //! name prefixed with stackmachine_.
+    void write_prometheus(std::ostream& out) const;
+    void write_json(std::ostream& out) const;
+};
+
+//! Counts what interpreters with interpreter::set_metrics() do, updated
+//! once at the end of every run() call and never per instruction, so the
+//! cost does not depend on the budget.
+//!
+//! Updates are lock-free: every thread adds to one of SHARDS sets of
+//! relaxed atomic counters, chosen once per thread, so VMs on different
+//! scheduler workers do not share cache lines. snapshot() adds the shards
+//! up while they are updated; a run that ends meanwhile may show in some
+//! counters only.
+class metrics_registry {
+public:
+    static const size_t SHARDS = 16;
+
+    enum format {
+        PROMETHEUS,
+        JSON
+    };
+
+    metrics_registry();
+    ~metrics_registry();
+
+    metrics_registry(const metrics_registry&) = delete;
+    metrics_registry& operator=(const metrics_registry&) = delete;
+
+    //! Record the end of a run() call.
+    //! \param instructions the instructions it executed
+    //! \param nanoseconds how long it took
+    //! \param output_bytes the bytes it printed
+    //! \param sp the sp when it returned
+    //! \param stopped true if the VM stopped in this call
+    //! \param fault why it stopped, if it did
+    void record_run(uint64_t instructions, uint64_t nanoseconds, uint64_t output_bytes, uint16_t sp,
+                    bool stopped, interpreter::fault_kind fault);
+
+    metrics_snapshot snapshot() const;
+
+    //! Write a snapshot to path, replacing the file at once.
+    //! \throws std::runtime_error if the file cannot be written
+    void dump(const std::string& path, format f) const;
+
+private:
+    struct shard;
+
+    shard& local_shard();
+
+    std::unique_ptr<shard[]> m_shards;
+};
+
+#endif //STACKMACHINE_METRICS_H
@@ -0,0 +1,562 @@
+#include <algorithm>
+#include "control_flow.h"
+#include "parallel_engine.h"
+#include "purity.h"
+
+namespace {
+    const uint16_t NO_CALL = 0xFFFF;
+
+    //! A word of the predicted stack that depends on a call result.
+    const int32_t UNKNOWN = -1;
+
+    //! Most calls a run hands to the workers.
+    const size_t MAX_RUN = 16;
+
+    //! Instructions the argument code between the calls of a run may use.
+    bool is_argument_code(uint16_t word) {
+        switch (word) {
+            case mnemonic::CONST:
+            case mnemonic::ADD:
+            case mnemonic::SUB:
+            case mnemonic::MUL:
+            case mnemonic::EQ:
+            case mnemonic::LT:
+            case mnemonic::NOT:
+            case mnemonic::DUP:
+            case mnemonic::SWAP:
+            case mnemonic::LDI:
+            case mnemonic::GETBP:
+            case mnemonic::DECSP:
+            case mnemonic::NOOP:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    //! Evaluate the argument code from pc up to the CALL at end ahead of
+    //! time. above holds the slots from base up, slots below base are read
+    //! from the stack, which no call of the run writes.
+    //! \return false if the code depends on an unknown word
+    bool predict(const std::vector<uint16_t>& code, const std::vector<uint16_t>& stack,
+                 uint16_t bp, uint16_t base, uint16_t pc, uint16_t end, std::vector<int32_t>& above) {
+
+        auto known = [&above](size_t n) {
+            if (above.size() < n) {
+                return false;
+            }
+            for (size_t i = above.size() - n; i < above.size(); ++i) {
+                if (above[i] == UNKNOWN) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        while (pc != end) {
+            auto op = code[pc];
+            if (op == mnemonic::CONST || op == mnemonic::GETBP) {
+                above.push_back(op == mnemonic::CONST ? code[pc + 1] : bp);
+            } else if (op == mnemonic::NOT || op == mnemonic::DUP || op == mnemonic::LDI) {
+                if (!known(1)) {
+                    return false;
+                }
+                auto v = static_cast<uint16_t>(above.back());
+                if (op == mnemonic::NOT) {
+                    above.back() = v == 0 ? 1 : 0;
+                } else if (op == mnemonic::DUP) {
+                    above.push_back(v);
+                } else if (v < base) {
+                    above.back() = stack[v];
+                } else if (static_cast<size_t>(v - base) < above.size() && above[v - base] != UNKNOWN) {
+                    above.back() = above[v - base];
+                } else {
+                    return false;
+                }
+            } else if (op == mnemonic::DECSP) {
+                if (code[pc + 1] > above.size()) {
+                    return false;
+                }
+                above.resize(above.size() - code[pc + 1]);
+            } else if (op != mnemonic::NOOP) {
+                if (!known(2)) {
+                    return false;
+                }
+                auto b = static_cast<uint16_t>(above.back());
+                above.pop_back();
+                auto a = static_cast<uint16_t>(above.back());
+                switch (op) {
+                    case mnemonic::ADD:
+                        above.back() = static_cast<uint16_t>(a + b);
+                        break;
+                    case mnemonic::SUB:
+                        above.back() = static_cast<uint16_t>(a - b);
+                        break;
+                    case mnemonic::MUL:
+                        above.back() = static_cast<uint16_t>(static_cast<uint32_t>(a) * b);
+                        break;
+                    case mnemonic::EQ:
+                        above.back() = a == b ? 1 : 0;
+                        break;
+                    case mnemonic::LT:
+                        above.back() = a < b ? 1 : 0;
+                        break;
+                    default:
+                        // SWAP
+                        above.back() = b;
+                        above.push_back(a);
+                        break;
+                }
+            }
+            pc = static_cast<uint16_t>(pc + 1 + argument_count(static_cast<mnemonic>(op)));
+        }
+        return true;
+    }
+}
+
+//! A call computed ahead of time.
+struct parallel_engine::task {
+    enum status {
+        QUEUED,
+        RUNNING,
+        DONE,
+        CANCELLED
+    };
+
+    //! the CALL instruction
+    uint16_t call;
+    //! the slot of the first argument, which receives the result
+    uint16_t base;
+    //! bp of the caller
+    uint16_t bp;
+    std::vector<uint16_t> args;
+
+    status state;
+    //! every slot the call wrote with its final value
+    std::vector<std::pair<uint16_t, uint16_t>> writes;
+    uint64_t steps;
+};
+
+//! The calls of a run after the one running on this thread.
+struct parallel_engine::group {
+    std::vector<std::shared_ptr<task>> tasks;
+    size_t next;
+    //! the registers once the first call returned
+    uint16_t resume;
+    uint16_t bp;
+    uint16_t sp;
+};
+
+//! Executes a pure call on a private stack and records the slots it writes.
+//! Pure functions use only a few instructions, and none of them prints, so
+//! this loop is much cheaper than interpreter::step().
+class parallel_engine::pure_runner {
+public:
+    pure_runner() : m_stack(0x10000, 0), m_dirty(0x10000, 0) {}
+
+    void run(const std::vector<uint16_t>& code, task& t) {
+        uint16_t* s = m_stack.data();
+        uint16_t pc = t.call;
+        uint16_t bp = t.bp;
+        uint16_t sp = static_cast<uint16_t>(t.base + t.args.size() - 1);
+        uint64_t steps = 0;
+        m_low = 0xFFFF;
+        m_high = 0;
+
+        for (size_t i = 0; i < t.args.size(); ++i) {
+            s[static_cast<uint16_t>(t.base + i)] = t.args[i];
+        }
+
+        for (;;) {
+            auto op = code[pc];
+            ++pc;
+            ++steps;
+
+            switch (op) {
+                case mnemonic::CONST:
+                    ++sp;
+                    put(sp, code[pc]);
+                    ++pc;
+                    break;
+                case mnemonic::ADD:
+                    --sp;
+                    put(sp, static_cast<uint16_t>(s[sp] + s[static_cast<uint16_t>(sp + 1)]));
+                    break;
+                case mnemonic::SUB:
+                    --sp;
+                    put(sp, static_cast<uint16_t>(s[sp] - s[static_cast<uint16_t>(sp + 1)]));
+                    break;
+                case mnemonic::MUL:
+                    --sp;
+                    put(sp, static_cast<uint16_t>(static_cast<uint32_t>(s[sp]) * s[static_cast<uint16_t>(sp + 1)]));
+                    break;
+                case mnemonic::DIV:
+                    --sp;
+                    put(sp, static_cast<uint16_t>(s[sp] / s[static_cast<uint16_t>(sp + 1)]));
+                    break;
+                case mnemonic::MOD:
+                    --sp;
+                    put(sp, static_cast<uint16_t>(s[sp] % s[static_cast<uint16_t>(sp + 1)]));
+                    break;
+                case mnemonic::EQ:
+                    --sp;
+                    put(sp, s[sp] == s[static_cast<uint16_t>(sp + 1)] ? 1 : 0);
+                    break;
+                case mnemonic::LT:
+                    --sp;
+                    put(sp, s[sp] < s[static_cast<uint16_t>(sp + 1)] ? 1 : 0);
+                    break;
+                case mnemonic::NOT:
+                    put(sp, s[sp] == 0 ? 1 : 0);
+                    break;
+                case mnemonic::DUP:
+                    put(static_cast<uint16_t>(sp + 1), s[sp]);
+                    ++sp;
+                    break;
+                case mnemonic::SWAP: {
+                    auto v = s[sp];
+                    put(sp, s[static_cast<uint16_t>(sp - 1)]);
+                    put(static_cast<uint16_t>(sp - 1), v);
+                    break;
+                }
+                case mnemonic::LDI:
+                    put(sp, s[s[sp]]);
+                    break;
+                case mnemonic::STI: {
+                    auto i = s[static_cast<uint16_t>(sp - 1)];
+                    auto v = s[sp];
+                    put(i, v);
+                    put(static_cast<uint16_t>(sp - 1), v);
+                    --sp;
+                    break;
+                }
+                case mnemonic::GETBP:
+                    put(static_cast<uint16_t>(sp + 1), bp);
+                    ++sp;
+                    break;
+                case mnemonic::INCSP:
+                    sp = static_cast<uint16_t>(sp + code[pc]);
+                    ++pc;
+                    break;
+                case mnemonic::DECSP:
+                    sp = static_cast<uint16_t>(sp - code[pc]);
+                    ++pc;
+                    break;
+                case mnemonic::GOTO:
+                    pc = code[pc];
+                    break;
+                case mnemonic::IFZERO:
+                    pc = s[sp] == 0 ? code[pc] : static_cast<uint16_t>(pc + 1);
+                    --sp;
+                    break;
+                case mnemonic::IFNZERO:
+                    pc = s[sp] != 0 ? code[pc] : static_cast<uint16_t>(pc + 1);
+                    --sp;
+                    break;
+                case mnemonic::CALL: {
+                    // s,v1,...,vm => s,r,bp,v1,...,vm
+                    auto m = code[pc];
+                    auto a = code[pc + 1];
+                    pc = static_cast<uint16_t>(pc + 2);
+                    for (int idx = 0; idx < m; ++idx) {
+                        put(static_cast<uint16_t>(sp + 2 - idx), s[static_cast<uint16_t>(sp - idx)]);
+                    }
+                    auto stack_r = static_cast<uint16_t>(sp - m + 1);
+                    auto stack_bp = static_cast<uint16_t>(sp - m + 2);
+                    put(stack_r, pc);
+                    put(stack_bp, bp);
+                    bp = static_cast<uint16_t>(stack_bp + 1);
+                    sp = static_cast<uint16_t>(stack_bp + m);
+                    pc = a;
+                    break;
+                }
+                case mnemonic::RET: {
+                    // s,r,b,v1,...,vm,v => s,v
+                    auto old_bp = s[static_cast<uint16_t>(bp - 1)];
+                    pc = s[static_cast<uint16_t>(bp - 2)];
+                    auto v = s[sp];
+                    sp = static_cast<uint16_t>(bp - 2);
+                    put(sp, v);
+                    bp = old_bp;
+                    if (bp == t.bp) {
+                        collect(t, steps);
+                        return;
+                    }
+                    break;
+                }
+                default:
+                    // NOOP, purity_analysis admits nothing else
+                    break;
+            }
+        }
+    }
+
+private:
+    void put(uint16_t slot, uint16_t v) {
+        m_stack[slot] = v;
+        m_dirty[slot] = 1;
+        m_low = std::min(m_low, slot);
+        m_high = std::max(m_high, slot);
+    }
+
+    void collect(task& t, uint64_t steps) {
+        t.writes.clear();
+        for (uint32_t slot = m_low; slot <= m_high; ++slot) {
+            if (m_dirty[slot]) {
+                t.writes.push_back(std::make_pair(static_cast<uint16_t>(slot), m_stack[slot]));
+                m_dirty[slot] = 0;
+            }
+        }
+        t.steps = steps;
+    }
+
+    std::vector<uint16_t> m_stack;
+    std::vector<uint8_t> m_dirty;
+    uint16_t m_low;
+    uint16_t m_high;
+};
+
+parallel_engine::parallel_engine(const std::vector<uint16_t> &instructions, unsigned workers)
+: m_state(instructions), m_runner(new pure_runner), m_dispatches(0), m_speculated(0), m_shutdown(false)
+{
+    auto& code = m_state.code;
+    verify(code);
+
+    control_flow cfg(code);
+    purity_analysis purity(cfg);
+
+    auto pure_call = [&](size_t pc) {
+        return cfg.is_instruction(pc) && code[pc] == mnemonic::CALL
+               && purity.is_pure(code[pc + 2]) && purity.arguments(code[pc + 2]) == code[pc + 1];
+    };
+
+    m_chain.assign(code.size(), NO_CALL);
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (!pure_call(pc)) {
+            continue;
+        }
+        auto next = cfg.next(static_cast<uint16_t>(pc));
+        while (cfg.is_instruction(next) && is_argument_code(code[next])) {
+            next = cfg.next(next);
+        }
+        if (pure_call(next) && !purity.may_trap(code[next + 2])) {
+            m_chain[pc] = next;
+        }
+    }
+
+    for (unsigned i = 0; i < workers; ++i) {
+        m_workers.push_back(std::thread(&parallel_engine::work, this));
+    }
+}
+
+parallel_engine::~parallel_engine() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+        m_queue.clear();
+    }
+    m_work.notify_all();
+    for (auto& worker : m_workers) {
+        worker.join();
+    }
+}
+
+void parallel_engine::set_command_line_arguments(const std::vector<uint16_t> &args) {
+    m_state.set_command_line_arguments(args);
+}
+
+void parallel_engine::set_stack(const std::vector<uint16_t> &stack) {
+    m_state.set_stack(stack);
+}
+
+void parallel_engine::set_input_channel(std::shared_ptr<input_channel> channel) {
+    m_state.set_input_channel(std::move(channel));
+}
+
+void parallel_engine::set_channel(uint16_t number, std::shared_ptr<channel> ch) {
+    m_state.set_channel(number, std::move(ch));
+}
+
+void parallel_engine::set_data_segment(std::shared_ptr<const data_segment> data) {
+    m_state.set_data_segment(std::move(data));
+}
+
+void parallel_engine::set_output(std::ostream &out) {
+    m_state.set_output(out);
+}
+
+interpreter::configs parallel_engine::registers() const {
+    return m_state.registers();
+}
+
+const std::vector<uint16_t> &parallel_engine::stack() const {
+    return m_state.stack();
+}
+
+bool parallel_engine::is_stopped() const {
+    return m_state.is_stopped();
+}
+
+uint64_t parallel_engine::dispatches() const {
+    return m_dispatches;
+}
+
+uint64_t parallel_engine::speculated() const {
+    return m_speculated;
+}
+
+void parallel_engine::run() {
+    while (!m_state.m_stopped) {
+        if (!m_groups.empty()) {
+            auto& g = m_groups.back();
+            if (m_state.pc == g.resume && m_state.bp == g.bp && m_state.sp == g.sp) {
+                resume_group();
+                continue;
+            }
+        }
+        if (!m_workers.empty() && m_chain[m_state.pc] != NO_CALL) {
+            begin_group();
+        } else {
+            m_state.step();
+            if (m_state.m_blocked) {
+                // waits for the other end of a channel
+                std::this_thread::yield();
+            } else {
+                ++m_dispatches;
+            }
+        }
+    }
+}
+
+void parallel_engine::work() {
+    pure_runner runner;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_work.wait(lock, [this] { return m_shutdown || !m_queue.empty(); });
+        if (m_shutdown) {
+            return;
+        }
+        auto t = m_queue.front();
+        m_queue.pop_front();
+        if (t->state != task::QUEUED) {
+            continue;
+        }
+        t->state = task::RUNNING;
+        lock.unlock();
+        runner.run(m_state.code, *t);
+        lock.lock();
+        t->state = task::DONE;
+        m_done.notify_all();
+    }
+}
+
+void parallel_engine::begin_group() {
+    auto& code = m_state.code;
+    auto pc = m_state.pc;
+
+    group g;
+    g.next = 0;
+    g.resume = static_cast<uint16_t>(pc + 3);
+    g.bp = m_state.bp;
+    g.sp = static_cast<uint16_t>(m_state.sp - code[pc + 1] + 1);
+
+    bool busy;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        busy = m_queue.size() >= 4 * m_workers.size();
+    }
+
+    // the result of the first call is not known yet
+    std::vector<int32_t> above{UNKNOWN};
+    auto call = pc;
+    while (!busy && m_chain[call] != NO_CALL && g.tasks.size() < MAX_RUN) {
+        auto next = m_chain[call];
+        if (!predict(code, m_state.m_stack, g.bp, g.sp, static_cast<uint16_t>(call + 3), next, above)) {
+            break;
+        }
+        size_t m = code[next + 1];
+        if (above.size() < m || std::find(above.end() - m, above.end(), UNKNOWN) != above.end()) {
+            break;
+        }
+
+        std::shared_ptr<task> t(new task);
+        t->call = next;
+        t->base = static_cast<uint16_t>(g.sp + above.size() - m);
+        t->bp = g.bp;
+        t->args.assign(above.end() - m, above.end());
+        t->state = task::QUEUED;
+        t->steps = 0;
+        g.tasks.push_back(t);
+
+        above.resize(above.size() - m);
+        above.push_back(UNKNOWN);
+        call = next;
+    }
+
+    if (!g.tasks.empty()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queue.insert(m_queue.end(), g.tasks.begin(), g.tasks.end());
+        }
+        m_work.notify_all();
+        m_groups.push_back(g);
+    }
+
+    // the first call runs here
+    m_state.step();
+    ++m_dispatches;
+}
+
+void parallel_engine::resume_group() {
+    auto& code = m_state.code;
+    auto& g = m_groups.back();
+
+    while (g.next < g.tasks.size()) {
+        auto& t = *g.tasks[g.next];
+
+        // the argument code runs for real and must agree with the prediction
+        while (m_state.pc != t.call && !m_state.m_stopped) {
+            m_state.step();
+            ++m_dispatches;
+        }
+        uint16_t base = static_cast<uint16_t>(m_state.sp - code[t.call + 1] + 1);
+        if (base != t.base || m_state.bp != t.bp
+            || !std::equal(t.args.begin(), t.args.end(), m_state.m_stack.begin() + base)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t i = g.next; i < g.tasks.size(); ++i) {
+                if (g.tasks[i]->state == task::QUEUED) {
+                    g.tasks[i]->state = task::CANCELLED;
+                }
+            }
+            break;
+        }
+
+        finish(t);
+        for (auto& w : t.writes) {
+            if (w.first < m_state.m_stack.size()) {
+                m_state.m_stack[w.first] = w.second;
+            }
+        }
+        m_state.sp = t.base;
+        m_state.pc = static_cast<uint16_t>(t.call + 3);
+        m_dispatches += t.steps;
+        ++m_speculated;
+        ++g.next;
+    }
+
+    m_groups.pop_back();
+}
+
+void parallel_engine::finish(task& t) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (t.state == task::QUEUED) {
+        // no worker got to it yet
+        t.state = task::RUNNING;
+        lock.unlock();
+        m_runner->run(m_state.code, t);
+        lock.lock();
+        t.state = task::DONE;
+        return;
+    }
+    m_done.wait(lock, [&t] { return t.state == task::DONE; });
+}
@@ -0,0 +1,86 @@
+#ifndef STACKMACHINE_PARALLEL_ENGINE_H
+#define STACKMACHINE_PARALLEL_ENGINE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "interpreter.h"
+
+//! Runs a program on an interpreter and computes runs of independent pure
+//! calls on worker threads.
+//!
+//! A run is a CALL of a pure function followed by straight-line code that
+//! pushes the arguments of the next CALL of a pure function without looking
+//! at the result of the first, and so on, as in fib(n - 1) + fib(n - 2). When
+//! the interpreter reaches the first CALL, the engine evaluates the argument
+//! code ahead of time and hands the later calls to the workers, each with a
+//! private stack holding only its arguments. The first call runs on this
+//! thread. Afterwards the argument code runs again for real, and if it pushed
+//! the predicted arguments the slots the worker wrote are copied onto the
+//! stack in program order. Since a pure call writes the same words whatever
+//! the rest of the stack holds, output, registers and the whole stack are
+//! exactly those of interpreter::run(). Calls that may divide by zero are
+//! only ever made on this thread, in order.
+class parallel_engine {
+public:
+    //! \param workers number of worker threads, with none all calls run in order
+    //! \throws std::domain_error if the program does not verify
+    explicit parallel_engine(const std::vector<uint16_t>& instructions,
+                             unsigned workers = std::thread::hardware_concurrency());
+    ~parallel_engine();
+
+    parallel_engine(const parallel_engine&) = delete;
+    parallel_engine& operator=(const parallel_engine&) = delete;
+
+    void set_command_line_arguments(const std::vector<uint16_t>& args);
+    void set_stack(const std::vector<uint16_t>& stack);
+    void set_input_channel(std::shared_ptr<input_channel> channel);
+    void set_channel(uint16_t number, std::shared_ptr<channel> ch);
+    void set_data_segment(std::shared_ptr<const data_segment> data);
+    //! see interpreter::set_output()
+    void set_output(std::ostream& out);
+
+    interpreter::configs registers() const;
+    const std::vector<uint16_t>& stack() const;
+
+    void run();
+    bool is_stopped() const;
+
+    //! \return the number of instructions executed so far, on all threads,
+    //! counting only calls whose result was used
+    uint64_t dispatches() const;
+
+    //! \return the number of calls whose result was computed ahead of time
+    uint64_t speculated() const;
+
+private:
+    struct task;
+    struct group;
+    class pure_runner;
+
+    void work();
+    void begin_group();
+    void resume_group();
+    void finish(task& t);
+
+    interpreter m_state;
+    //! for every CALL of a pure function, the next CALL of a run or NO_CALL
+    std::vector<uint16_t> m_chain;
+    std::vector<group> m_groups;
+    std::unique_ptr<pure_runner> m_runner;
+    uint64_t m_dispatches;
+    uint64_t m_speculated;
+
+    std::vector<std::thread> m_workers;
+    std::deque<std::shared_ptr<task>> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_work;
+    std::condition_variable m_done;
+    bool m_shutdown;
+};
+
+#endif //STACKMACHINE_PARALLEL_ENGINE_H
@@ -0,0 +1,571 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "process_pool.h"
+
+namespace {
+
+    //! The start of every message, followed by the records.
+    struct frame_header {
+        uint32_t records;
+        uint32_t fds;
+    };
+
+    //! A record is followed by bytes of payload, or its payload is in the
+    //! next memfd passed with the frame.
+    struct record_header {
+        uint32_t index;
+        uint32_t shared;
+        uint64_t bytes;
+    };
+
+    //! A job payload is this followed by the code and argument words.
+    struct job_header {
+        uint32_t code_words;
+        uint32_t arg_words;
+    };
+
+    //! A result payload is this followed by the output.
+    struct result_header {
+        uint16_t pc;
+        uint16_t sp;
+        uint16_t bp;
+        uint16_t stopped;
+    };
+
+    //! memfds a frame may carry, well below the SCM_MAX_FD of Linux
+    const size_t MAX_FDS = 32;
+
+    //! the largest message: a frame just below FRAME_BYTES, one more record
+    //! just below SHARED_BYTES and their headers
+    const size_t MAX_MESSAGE = process_pool::FRAME_BYTES + process_pool::SHARED_BYTES + 64;
+
+    struct record {
+        uint32_t index;
+        std::vector<uint8_t> payload;
+    };
+
+    //! A message being put together.
+    class frame {
+    public:
+        frame() : m_bytes(sizeof(frame_header)), m_records(0) {
+        }
+
+        ~frame() {
+            clear();
+        }
+
+        frame(const frame&) = delete;
+        frame& operator=(const frame&) = delete;
+
+        //! \throws std::runtime_error if a shared payload cannot be created
+        void add(uint32_t index, const std::vector<uint8_t>& payload) {
+            record_header r;
+            r.index = index;
+            r.shared = payload.size() >= process_pool::SHARED_BYTES ? 1 : 0;
+            r.bytes = payload.size();
+            append(&r, sizeof(r));
+            if (r.shared) {
+                m_fds.push_back(share(payload));
+            } else {
+                append(payload.data(), payload.size());
+            }
+            ++m_records;
+        }
+
+        bool empty() const {
+            return m_records == 0;
+        }
+
+        bool full() const {
+            return m_bytes.size() >= process_pool::FRAME_BYTES || m_fds.size() >= MAX_FDS;
+        }
+
+        //! \return 1 if sent, 0 if the socket is full, -1 on an error
+        int send(int socket) {
+            frame_header h;
+            h.records = m_records;
+            h.fds = static_cast<uint32_t>(m_fds.size());
+            std::memcpy(m_bytes.data(), &h, sizeof(h));
+
+            struct iovec io;
+            io.iov_base = m_bytes.data();
+            io.iov_len = m_bytes.size();
+            struct msghdr message;
+            std::memset(&message, 0, sizeof(message));
+            message.msg_iov = &io;
+            message.msg_iovlen = 1;
+
+            std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_FDS));
+            if (!m_fds.empty()) {
+                message.msg_control = control.data();
+                message.msg_controllen = CMSG_SPACE(sizeof(int) * m_fds.size());
+                auto cmsg = CMSG_FIRSTHDR(&message);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int) * m_fds.size());
+                std::memcpy(CMSG_DATA(cmsg), m_fds.data(), sizeof(int) * m_fds.size());
+            }
+
+            while (true) {
+                if (::sendmsg(socket, &message, MSG_NOSIGNAL) >= 0) {
+                    clear();
+                    return 1;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0;
+                }
+                if (errno != EINTR) {
+                    return -1;
+                }
+            }
+        }
+
+        void clear() {
+            for (auto fd : m_fds) {
+                ::close(fd);
+            }
+            m_fds.clear();
+            m_bytes.resize(sizeof(frame_header));
+            m_records = 0;
+        }
+
+    private:
+        void append(const void* data, size_t size) {
+            auto bytes = static_cast<const uint8_t*>(data);
+            m_bytes.insert(m_bytes.end(), bytes, bytes + size);
+        }
+
+        static int share(const std::vector<uint8_t>& payload) {
+            int fd = ::memfd_create("stackmachine-payload", MFD_CLOEXEC);
+            if (fd < 0) {
+                throw std::runtime_error(std::string("Cannot create a shared payload: ") + std::strerror(errno));
+            }
+            size_t written = 0;
+            while (written < payload.size()) {
+                auto n = ::write(fd, payload.data() + written, payload.size() - written);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    auto error = errno;
+                    ::close(fd);
+                    throw std::runtime_error(std::string("Cannot write a shared payload: ") + std::strerror(error));
+                }
+                written += static_cast<size_t>(n);
+            }
+            return fd;
+        }
+
+        std::vector<uint8_t> m_bytes;
+        std::vector<int> m_fds;
+        uint32_t m_records;
+    };
+
+    //! Copy a payload out of a memfd.
+    bool read_shared(int fd, size_t bytes, std::vector<uint8_t>& payload) {
+        if (bytes == 0) {
+            payload.clear();
+            return true;
+        }
+        auto mapping = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        auto data = static_cast<const uint8_t*>(mapping);
+        payload.assign(data, data + bytes);
+        ::munmap(mapping, bytes);
+        return true;
+    }
+
+    //! Receive one message.
+    //! \return 1 with the records of the message, 0 if none is waiting on a
+    //!         non-blocking socket, -1 once the other end is gone or sent
+    //!         something malformed
+    int receive(int socket, std::vector<uint8_t>& buffer, std::vector<record>& records) {
+        buffer.resize(MAX_MESSAGE);
+        struct iovec io;
+        io.iov_base = buffer.data();
+        io.iov_len = buffer.size();
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * MAX_FDS));
+        struct msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control.data();
+        message.msg_controllen = control.size();
+
+        ssize_t n;
+        do {
+            n = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+
+        std::vector<int> fds;
+        for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                auto first = fds.size();
+                fds.resize(first + count);
+                std::memcpy(fds.data() + first, CMSG_DATA(cmsg), count * sizeof(int));
+            }
+        }
+
+        bool ok = n >= static_cast<ssize_t>(sizeof(frame_header)) && (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) == 0;
+        frame_header h;
+        size_t offset = sizeof(frame_header);
+        size_t next_fd = 0;
+        records.clear();
+        if (ok) {
+            std::memcpy(&h, buffer.data(), sizeof(h));
+            ok = h.fds == fds.size();
+        }
+        for (uint32_t i = 0; ok && i < h.records; ++i) {
+            record_header r;
+            ok = offset + sizeof(r) <= static_cast<size_t>(n);
+            if (!ok) {
+                break;
+            }
+            std::memcpy(&r, buffer.data() + offset, sizeof(r));
+            offset += sizeof(r);
+            records.push_back(record{r.index, {}});
+            if (r.shared) {
+                ok = next_fd < fds.size() && read_shared(fds[next_fd++], r.bytes, records.back().payload);
+            } else {
+                ok = offset + r.bytes <= static_cast<size_t>(n);
+                if (ok) {
+                    auto data = buffer.data() + offset;
+                    records.back().payload.assign(data, data + r.bytes);
+                    offset += r.bytes;
+                }
+            }
+        }
+
+        for (auto fd : fds) {
+            ::close(fd);
+        }
+        return ok ? 1 : -1;
+    }
+
+    std::vector<uint8_t> encode(const job& j) {
+        job_header h;
+        h.code_words = static_cast<uint32_t>(j.code.size());
+        h.arg_words = static_cast<uint32_t>(j.args.size());
+        std::vector<uint8_t> payload(sizeof(h) + (j.code.size() + j.args.size()) * sizeof(uint16_t));
+        std::memcpy(payload.data(), &h, sizeof(h));
+        std::memcpy(payload.data() + sizeof(h), j.code.data(), j.code.size() * sizeof(uint16_t));
+        std::memcpy(payload.data() + sizeof(h) + j.code.size() * sizeof(uint16_t), j.args.data(),
+                    j.args.size() * sizeof(uint16_t));
+        return payload;
+    }
+
+    bool decode(const std::vector<uint8_t>& payload, job& j) {
+        job_header h;
+        if (payload.size() < sizeof(h)) {
+            return false;
+        }
+        std::memcpy(&h, payload.data(), sizeof(h));
+        if (payload.size() != sizeof(h) + (static_cast<size_t>(h.code_words) + h.arg_words) * sizeof(uint16_t)) {
+            return false;
+        }
+        j.code.resize(h.code_words);
+        j.args.resize(h.arg_words);
+        std::memcpy(j.code.data(), payload.data() + sizeof(h), h.code_words * sizeof(uint16_t));
+        std::memcpy(j.args.data(), payload.data() + sizeof(h) + h.code_words * sizeof(uint16_t),
+                    h.arg_words * sizeof(uint16_t));
+        return true;
+    }
+
+    std::vector<uint8_t> encode(const job_result& r) {
+        result_header h;
+        h.pc = r.registers.pc;
+        h.sp = r.registers.sp;
+        h.bp = r.registers.bp;
+        h.stopped = r.stopped ? 1 : 0;
+        std::vector<uint8_t> payload(sizeof(h) + r.output.size());
+        std::memcpy(payload.data(), &h, sizeof(h));
+        std::memcpy(payload.data() + sizeof(h), r.output.data(), r.output.size());
+        return payload;
+    }
+
+    bool decode(const std::vector<uint8_t>& payload, job_result& r) {
+        result_header h;
+        if (payload.size() < sizeof(h)) {
+            return false;
+        }
+        std::memcpy(&h, payload.data(), sizeof(h));
+        r.output.assign(reinterpret_cast<const char*>(payload.data()) + sizeof(h), payload.size() - sizeof(h));
+        r.registers.pc = h.pc;
+        r.registers.sp = h.sp;
+        r.registers.bp = h.bp;
+        r.stopped = h.stopped != 0;
+        r.crashed = false;
+        return true;
+    }
+
+    //! Send a frame on a blocking socket.
+    bool flush(int socket, frame& f) {
+        return f.empty() || f.send(socket) == 1;
+    }
+
+    //! The loop of a worker process: run the jobs of every frame and send
+    //! their results back, until the coordinator closes the socket.
+    void serve(int socket, uint64_t budget) {
+        std::vector<uint8_t> buffer;
+        std::vector<record> records;
+        frame results;
+        while (receive(socket, buffer, records) == 1) {
+            for (auto& rec : records) {
+                job j;
+                if (!decode(rec.payload, j)) {
+                    return;
+                }
+                std::stringstream output;
+                interpreter interp(j.code);
+                interp.set_output(output);
+                interp.set_command_line_arguments(j.args);
+                interp.run(budget);
+
+                job_result r;
+                r.output = output.str();
+                r.registers = interp.registers();
+                r.stopped = interp.is_stopped();
+                results.add(rec.index, encode(r));
+                if (results.full() && !flush(socket, results)) {
+                    return;
+                }
+            }
+            if (!flush(socket, results)) {
+                return;
+            }
+        }
+    }
+}
+
+const size_t process_pool::FRAME_BYTES;
+const size_t process_pool::SHARED_BYTES;
+const unsigned process_pool::FRAMES_IN_FLIGHT;
+
+struct process_pool::worker {
+    pid_t pid;
+    int socket;
+    //! the jobs sent and not answered, in the order sent
+    std::deque<uint32_t> in_flight;
+    //! the last job of every frame sent and not answered
+    std::deque<uint32_t> frame_ends;
+    //! a frame the socket had no room for yet
+    frame pending;
+    std::vector<uint32_t> pending_jobs;
+};
+
+process_pool::process_pool(unsigned workers, uint64_t budget)
+: m_budget(budget), m_restarts(0)
+{
+    for (unsigned w = 0; w < std::max(workers, 1u); ++w) {
+        m_workers.push_back(std::unique_ptr<worker>(new worker));
+        m_workers.back()->pid = -1;
+        m_workers.back()->socket = -1;
+        start(w);
+    }
+}
+
+process_pool::~process_pool() {
+    for (auto& w : m_workers) {
+        if (w->socket >= 0) {
+            ::close(w->socket);
+        }
+    }
+    for (auto& w : m_workers) {
+        if (w->pid > 0) {
+            ::waitpid(w->pid, nullptr, 0);
+        }
+    }
+}
+
+void process_pool::start(size_t index) {
+    int sockets[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) != 0) {
+        throw std::runtime_error(std::string("Cannot create a worker socket: ") + std::strerror(errno));
+    }
+    // room for a few frames each way
+    int bytes = static_cast<int>(4 * MAX_MESSAGE);
+    for (auto s : sockets) {
+        ::setsockopt(s, SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+        ::setsockopt(s, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+    }
+
+    auto pid = ::fork();
+    if (pid < 0) {
+        auto error = errno;
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+        throw std::runtime_error(std::string("Cannot start a worker: ") + std::strerror(error));
+    }
+    if (pid == 0) {
+        // the other workers must see their sockets close with the coordinator
+        for (auto& w : m_workers) {
+            if (w->socket >= 0) {
+                ::close(w->socket);
+            }
+        }
+        ::close(sockets[0]);
+        serve(sockets[1], m_budget);
+        ::_exit(0);
+    }
+
+    ::close(sockets[1]);
+    ::fcntl(sockets[0], F_SETFL, ::fcntl(sockets[0], F_GETFL) | O_NONBLOCK);
+    auto& w = *m_workers[index];
+    w.pid = pid;
+    w.socket = sockets[0];
+    w.in_flight.clear();
+    w.frame_ends.clear();
+    w.pending.clear();
+    w.pending_jobs.clear();
+}
+
+void process_pool::sent(worker &w) {
+    w.in_flight.insert(w.in_flight.end(), w.pending_jobs.begin(), w.pending_jobs.end());
+    w.frame_ends.push_back(w.pending_jobs.back());
+    w.pending_jobs.clear();
+}
+
+void process_pool::restart(size_t index) {
+    auto& w = *m_workers[index];
+    ::close(w.socket);
+    w.socket = -1;
+    ::waitpid(w.pid, nullptr, 0);
+    w.pid = -1;
+    ++m_restarts;
+    start(index);
+}
+
+std::vector<job_result> process_pool::run(const std::vector<job> &jobs) {
+    std::vector<job_result> results(jobs.size());
+    std::deque<uint32_t> queue;
+    for (uint32_t i = 0; i < jobs.size(); ++i) {
+        queue.push_back(i);
+    }
+    // jobs a worker died with, each is sent in a frame of its own
+    std::deque<uint32_t> suspects;
+    std::vector<bool> suspect(jobs.size(), false);
+    auto remaining = jobs.size();
+
+    std::vector<uint8_t> buffer;
+    std::vector<record> records;
+    std::vector<struct pollfd> fds(m_workers.size());
+
+    while (remaining > 0) {
+        for (auto& wp : m_workers) {
+            auto& w = *wp;
+            while (w.pending.empty() && w.frame_ends.size() < FRAMES_IN_FLIGHT && (!suspects.empty() || !queue.empty())) {
+                if (!suspects.empty()) {
+                    w.pending_jobs.push_back(suspects.front());
+                    w.pending.add(suspects.front(), encode(jobs[suspects.front()]));
+                    suspects.pop_front();
+                } else {
+                    while (!queue.empty() && !w.pending.full()) {
+                        w.pending_jobs.push_back(queue.front());
+                        w.pending.add(queue.front(), encode(jobs[queue.front()]));
+                        queue.pop_front();
+                    }
+                }
+                if (w.pending.send(w.socket) != 1) {
+                    // full, or dead and noticed below
+                    break;
+                }
+                sent(w);
+            }
+        }
+
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            fds[i].fd = m_workers[i]->socket;
+            fds[i].events = POLLIN | (m_workers[i]->pending.empty() ? 0 : POLLOUT);
+            fds[i].revents = 0;
+        }
+        if (::poll(fds.data(), fds.size(), -1) < 0 && errno != EINTR) {
+            throw std::runtime_error(std::string("Cannot poll the workers: ") + std::strerror(errno));
+        }
+
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            auto& w = *m_workers[i];
+            bool dead = false;
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                int status;
+                while ((status = receive(w.socket, buffer, records)) == 1) {
+                    for (auto& r : records) {
+                        if (r.index >= jobs.size() || !decode(r.payload, results[r.index])) {
+                            dead = true;
+                            break;
+                        }
+                        auto job = std::find(w.in_flight.begin(), w.in_flight.end(), r.index);
+                        if (job != w.in_flight.end()) {
+                            w.in_flight.erase(job);
+                            --remaining;
+                        }
+                        // results come in the order the jobs were sent
+                        if (!w.frame_ends.empty() && w.frame_ends.front() == r.index) {
+                            w.frame_ends.pop_front();
+                        }
+                    }
+                }
+                dead = dead || status < 0;
+            }
+            if (!dead && !w.pending.empty() && (fds[i].revents & POLLOUT)) {
+                auto status = w.pending.send(w.socket);
+                if (status == 1) {
+                    sent(w);
+                }
+                dead = status < 0;
+            }
+            if (!dead) {
+                continue;
+            }
+
+            // the worker ran its jobs in order, so the first one unfinished
+            // killed it
+            if (!w.in_flight.empty() && suspect[w.in_flight.front()]) {
+                auto& r = results[w.in_flight.front()];
+                r.crashed = true;
+                r.stopped = false;
+                --remaining;
+                w.in_flight.pop_front();
+            }
+            for (auto index : w.in_flight) {
+                suspect[index] = true;
+                suspects.push_back(index);
+            }
+            queue.insert(queue.begin(), w.pending_jobs.begin(), w.pending_jobs.end());
+            restart(i);
+        }
+    }
+    return results;
+}
+
+size_t process_pool::size() const {
+    return m_workers.size();
+}
+
+std::vector<pid_t> process_pool::pids() const {
+    std::vector<pid_t> pids;
+    for (auto& w : m_workers) {
+        pids.push_back(w->pid);
+    }
+    return pids;
+}
+
+uint64_t process_pool::restarts() const {
+    return m_restarts;
+}
@@ -0,0 +1,88 @@
+#ifndef STACKMACHINE_PROCESS_POOL_H
+#define STACKMACHINE_PROCESS_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+#include "interpreter.h"
+
+//! A program and the command line arguments to run it with.
+struct job {
+    std::vector<uint16_t> code;
+    std::vector<uint16_t> args;
+};
+
+//! What a job produced in a worker process.
+struct job_result {
+    std::string output;
+    interpreter::configs registers;
+    //! false if the job ran out of budget before STOP
+    bool stopped;
+    //! true if the worker process died running the job, nothing else is set
+    bool crashed;
+};
+
+//! Runs jobs on interpreters in forked worker processes, so a program that
+//! crashes takes down its worker and not the caller or the other jobs.
+//!
+//! Every worker is connected to the coordinator by a Unix domain socket of
+//! SOCK_SEQPACKET type. The coordinator shards the jobs into frames of up to
+//! FRAME_BYTES, keeps up to FRAMES_IN_FLIGHT frames queued per worker and
+//! polls for the result frames the workers send back after every frame.
+//! Jobs and results of at least SHARED_BYTES are not copied through the
+//! socket but written to a memfd whose descriptor travels with the frame.
+//!
+//! A worker that dies is restarted. Its first unfinished job is resent
+//! alone in a frame of its own, as are all others it had, so a job that
+//! kills a worker it had to itself is reported as crashed and every other
+//! job still runs.
+class process_pool {
+public:
+    static const size_t FRAME_BYTES = 32 * 1024;
+    static const size_t SHARED_BYTES = 16 * 1024;
+    static const unsigned FRAMES_IN_FLIGHT = 2;
+
+    //! \param workers number of worker processes, at least one is started
+    //! \param budget instructions a job may execute, see interpreter::run()
+    //! \throws std::runtime_error if a worker cannot be started
+    explicit process_pool(unsigned workers = std::thread::hardware_concurrency(),
+                          uint64_t budget = std::numeric_limits<uint64_t>::max());
+    //! Closes the sockets and waits for the workers to exit.
+    ~process_pool();
+
+    process_pool(const process_pool&) = delete;
+    process_pool& operator=(const process_pool&) = delete;
+
+    //! Run all jobs and wait for them.
+    //! \return the results in the order of jobs
+    //! \throws std::runtime_error if a worker cannot be restarted
+    std::vector<job_result> run(const std::vector<job>& jobs);
+
+    //! \return the number of worker processes
+    size_t size() const;
+
+    //! \return the process ids of the workers
+    std::vector<pid_t> pids() const;
+
+    //! \return the number of workers restarted after they died
+    uint64_t restarts() const;
+
+private:
+    struct worker;
+
+    void start(size_t w);
+    void restart(size_t w);
+    //! Move the jobs of the pending frame of w in flight.
+    void sent(worker& w);
+
+    uint64_t m_budget;
+    std::vector<std::unique_ptr<worker>> m_workers;
+    uint64_t m_restarts;
+};
+
+#endif //STACKMACHINE_PROCESS_POOL_H
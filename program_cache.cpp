@@ -0,0 +1,230 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "program_cache.h"
+#include "ssa_passes.h"
+
+namespace {
+
+    //! The start of every cache file, followed by the program words, the
+    //! optimized words and one control flow flag per word of the program
+    //! with its trailing STOP. All numbers are in host byte order.
+    struct file_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t code_words;
+        uint64_t key;
+        uint32_t optimized_words;
+        uint32_t flag_bytes;
+    };
+
+    const char MAGIC[8] = {'S', 'M', 'C', 'A', 'C', 'H', 'E', '\0'};
+
+    const file_header& header_of(const uint8_t* data) {
+        return *reinterpret_cast<const file_header*>(data);
+    }
+
+    const uint16_t* words_of(const uint8_t* data) {
+        return reinterpret_cast<const uint16_t*>(data + sizeof(file_header));
+    }
+
+    //! Check that an image is complete and belongs to code.
+    bool valid(const uint8_t* data, size_t size, const std::vector<uint16_t>& code) {
+        if (size < sizeof(file_header)) {
+            return false;
+        }
+        auto& h = header_of(data);
+        size_t expected = sizeof(file_header)
+                          + (static_cast<size_t>(h.code_words) + h.optimized_words) * sizeof(uint16_t)
+                          + h.flag_bytes;
+        return std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0
+               && h.version == program_cache::VERSION
+               && h.key == program_cache::key(code)
+               && h.code_words == code.size()
+               && h.flag_bytes == code.size() + 1
+               && size == expected
+               && std::equal(code.begin(), code.end(), words_of(data));
+    }
+
+    //! Verify, analyze and optimize a program into the file format.
+    std::vector<uint8_t> build(const std::vector<uint16_t>& code) {
+        auto program = code;
+        program.push_back(mk_stop());
+        verify(program);
+        control_flow cfg(program);
+        auto optimized = optimize(code);
+        auto& flags = cfg.flags();
+
+        file_header h;
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = program_cache::VERSION;
+        h.code_words = static_cast<uint32_t>(code.size());
+        h.key = program_cache::key(code);
+        h.optimized_words = static_cast<uint32_t>(optimized.size());
+        h.flag_bytes = static_cast<uint32_t>(flags.size());
+
+        std::vector<uint8_t> image(sizeof(h) + (code.size() + optimized.size()) * sizeof(uint16_t) + flags.size());
+        auto out = image.data();
+        std::memcpy(out, &h, sizeof(h));
+        out += sizeof(h);
+        std::memcpy(out, code.data(), code.size() * sizeof(uint16_t));
+        out += code.size() * sizeof(uint16_t);
+        std::memcpy(out, optimized.data(), optimized.size() * sizeof(uint16_t));
+        out += optimized.size() * sizeof(uint16_t);
+        std::memcpy(out, flags.data(), flags.size());
+        return image;
+    }
+}
+
+cached_program::cached_program(void *mapping, size_t size)
+: m_data(static_cast<const uint8_t*>(mapping)), m_size(size), m_mapping(mapping)
+{
+}
+
+cached_program::cached_program(std::vector<uint8_t> image)
+: m_data(nullptr), m_size(image.size()), m_mapping(nullptr), m_image(std::move(image))
+{
+    m_data = m_image.data();
+}
+
+cached_program::~cached_program() {
+    if (m_mapping != nullptr) {
+        ::munmap(m_mapping, m_size);
+    }
+}
+
+std::vector<uint16_t> cached_program::code() const {
+    auto words = words_of(m_data);
+    return std::vector<uint16_t>(words, words + header_of(m_data).code_words);
+}
+
+std::vector<uint16_t> cached_program::optimized() const {
+    auto& h = header_of(m_data);
+    auto words = words_of(m_data) + h.code_words;
+    return std::vector<uint16_t>(words, words + h.optimized_words);
+}
+
+control_flow cached_program::flow() const {
+    auto& h = header_of(m_data);
+    auto program = code();
+    program.push_back(mk_stop());
+    auto flags = reinterpret_cast<const uint8_t*>(words_of(m_data) + h.code_words + h.optimized_words);
+    return control_flow(program, std::vector<uint8_t>(flags, flags + h.flag_bytes));
+}
+
+program_cache::program_cache(const std::string &directory)
+: m_directory(directory), m_hits(0), m_misses(0), m_write_failures(0)
+{
+    if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create cache directory " + directory + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (::stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        throw std::runtime_error("Cache directory " + directory + " is not a directory");
+    }
+}
+
+uint64_t program_cache::key(const std::vector<uint16_t> &code) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    auto mix = [&h](uint8_t byte) {
+        h = (h ^ byte) * 0x100000001b3ull;
+    };
+    for (int shift = 0; shift < 32; shift += 8) {
+        mix(static_cast<uint8_t>(VERSION >> shift));
+    }
+    for (auto word : code) {
+        mix(static_cast<uint8_t>(word));
+        mix(static_cast<uint8_t>(word >> 8));
+    }
+    return h;
+}
+
+std::string program_cache::path(const std::vector<uint16_t> &code) const {
+    std::stringstream name;
+    name << m_directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key(code) << ".smc";
+    return name.str();
+}
+
+std::shared_ptr<const cached_program> program_cache::load(const std::vector<uint16_t> &code) {
+    auto file = path(code);
+
+    auto cached = map(file, code);
+    if (cached) {
+        ++m_hits;
+        return cached;
+    }
+
+    ++m_misses;
+    auto image = build(code);
+    if (!store(file, image)) {
+        ++m_write_failures;
+    }
+    return std::shared_ptr<const cached_program>(new cached_program(std::move(image)));
+}
+
+std::shared_ptr<const cached_program> program_cache::map(const std::string &file, const std::vector<uint16_t> &code) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    auto size = static_cast<size_t>(0);
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        size = static_cast<size_t>(st.st_size);
+        mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+    if (!valid(static_cast<const uint8_t*>(mapping), size, code)) {
+        ::munmap(mapping, size);
+        return nullptr;
+    }
+    return std::shared_ptr<const cached_program>(new cached_program(mapping, size));
+}
+
+bool program_cache::store(const std::string &file, const std::vector<uint8_t> &image) {
+    static std::atomic<unsigned> counter(0);
+
+    // a name no other process or thread uses, in the same directory so
+    // that the rename is atomic
+    std::stringstream tmp_name;
+    tmp_name << file << ".tmp." << ::getpid() << "." << counter++;
+    auto tmp = tmp_name.str();
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    while (ok && written < image.size()) {
+        auto n = ::write(fd, image.data() + written, image.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = n > 0;
+        written += ok ? static_cast<size_t>(n) : 0;
+    }
+    ok = ::fsync(fd) == 0 && ok;
+    ok = ::close(fd) == 0 && ok;
+
+    if (!ok || ::rename(tmp.c_str(), file.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
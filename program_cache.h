@@ -0,0 +1,101 @@
+#ifndef STACKMACHINE_PROGRAM_CACHE_H
+#define STACKMACHINE_PROGRAM_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "control_flow.h"
+
+//! The analysis results of a verified program: its control flow and the
+//! output of optimize(). The words are read straight out of a cache file
+//! mapped into memory, or out of a buffer in the same format after a miss.
+class cached_program {
+public:
+    ~cached_program();
+
+    cached_program(const cached_program&) = delete;
+    cached_program& operator=(const cached_program&) = delete;
+
+    //! \return the program as passed to the interpreter
+    std::vector<uint16_t> code() const;
+
+    //! \return the program after optimize()
+    std::vector<uint16_t> optimized() const;
+
+    //! \return the control flow of the program with the trailing STOP the
+    //! interpreter appends
+    control_flow flow() const;
+
+    //! \return true if the results came from the cache directory
+    bool from_cache() const {
+        return m_mapping != nullptr;
+    }
+
+private:
+    friend class program_cache;
+
+    cached_program(void* mapping, size_t size);
+    explicit cached_program(std::vector<uint8_t> image);
+
+    const uint8_t* m_data;
+    size_t m_size;
+    void* m_mapping;
+    std::vector<uint8_t> m_image;
+};
+
+//! A directory of analysis results keyed by a hash of the program words and
+//! VERSION. An entry is one file that is mapped read-only on a hit, so a
+//! warm start neither verifies nor optimizes. On a miss the results are
+//! computed and written to a temporary file that is renamed into place, so
+//! readers never see a partial entry and processes filling the same entry
+//! at once each write a complete copy. Entries that do not match the
+//! program, for example after a hash collision or a crash of an old version,
+//! count as a miss and are replaced. A directory that cannot be written only
+//! disables storing.
+class program_cache {
+public:
+    //! Bump whenever the verifier, the control flow analysis or the
+    //! optimizer produce different results, old entries become misses.
+    static const uint32_t VERSION = 2;
+
+    //! \param directory created if it does not exist
+    //! \throws std::runtime_error if the directory cannot be created
+    explicit program_cache(const std::string& directory);
+
+    //! Get the analysis results of a program.
+    //! \param code the program as passed to the interpreter
+    //! \throws std::domain_error if the program does not verify
+    std::shared_ptr<const cached_program> load(const std::vector<uint16_t>& code);
+
+    //! \return the file that holds the entry of a program
+    std::string path(const std::vector<uint16_t>& code) const;
+
+    //! \return the 64-bit FNV-1a hash of VERSION and the program words
+    static uint64_t key(const std::vector<uint16_t>& code);
+
+    uint64_t hits() const {
+        return m_hits;
+    }
+
+    uint64_t misses() const {
+        return m_misses;
+    }
+
+    //! \return the number of entries that could not be stored
+    uint64_t write_failures() const {
+        return m_write_failures;
+    }
+
+private:
+    std::shared_ptr<const cached_program> map(const std::string& file, const std::vector<uint16_t>& code);
+    bool store(const std::string& file, const std::vector<uint8_t>& image);
+
+    std::string m_directory;
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_write_failures;
+};
+
+#endif //STACKMACHINE_PROGRAM_CACHE_H
@@ -0,0 +1,326 @@
+#include "purity.h"
+
+namespace {
+
+    //! What the analysis knows about a stack slot of the frame.
+    struct value {
+        enum kind : uint8_t {
+            //! not written since INCSP made room for it
+            UNDEFINED,
+            //! any word that does not depend on bp
+            DATA,
+            //! a known word
+            CONSTANT,
+            //! bp plus offset
+            FRAME
+        };
+
+        kind k;
+        int32_t n;
+
+        bool operator==(const value& other) const {
+            return k == other.k && (k == DATA || k == UNDEFINED || n == other.n);
+        }
+
+        bool operator!=(const value& other) const {
+            return !(*this == other);
+        }
+    };
+
+    const value UNDEFINED_VALUE = {value::UNDEFINED, 0};
+    const value DATA_VALUE = {value::DATA, 0};
+
+    value constant(int32_t c) {
+        return {value::CONSTANT, c & 0xFFFF};
+    }
+
+    value frame(int32_t offset) {
+        return {value::FRAME, offset};
+    }
+
+    //! The slots from the first argument up to sp.
+    typedef std::vector<value> frame_state;
+
+    //! Largest frame and body the analysis looks at.
+    const size_t MAX_DEPTH = 1024;
+    const size_t MAX_INSTRUCTIONS = 4096;
+
+    //! Merge the state of another path into the state at a join point.
+    //! \return false if the paths disagree on the depth or on a frame address
+    bool join(frame_state& into, const frame_state& from) {
+        if (into.size() != from.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < into.size(); ++i) {
+            auto& a = into[i];
+            auto& b = from[i];
+            if (a == b) {
+                continue;
+            }
+            if (a.k == value::FRAME || b.k == value::FRAME) {
+                return false;
+            }
+            a = a.k == value::UNDEFINED || b.k == value::UNDEFINED ? UNDEFINED_VALUE : DATA_VALUE;
+        }
+        return true;
+    }
+
+    //! A value an instruction may compute with or branch on.
+    bool is_data(const value& v) {
+        return v.k == value::DATA || v.k == value::CONSTANT;
+    }
+
+    //! \return true if the state holds an address of a slot that may be accessed
+    bool accessible(const frame_state& s, const value& address) {
+        return address.k == value::FRAME && address.n >= 0 && static_cast<size_t>(address.n) < s.size();
+    }
+}
+
+purity_analysis::purity_analysis(const control_flow& cfg) {
+
+    auto& code = cfg.code();
+
+    // the argument count of every CALL target, a target called with
+    // different counts is never pure
+    std::map<uint16_t, bool> consistent;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (!cfg.is_instruction(pc) || code[pc] != mnemonic::CALL) {
+            continue;
+        }
+        uint16_t m = code[pc + 1];
+        uint16_t entry = code[pc + 2];
+        auto found = m_functions.find(entry);
+        if (found == m_functions.end()) {
+            m_functions[entry] = summary{m, true, false, {}};
+            consistent[entry] = true;
+        } else if (found->second.arguments != m) {
+            consistent[entry] = false;
+        }
+    }
+
+    for (auto& f : m_functions) {
+        auto entry = f.first;
+        auto& sum = f.second;
+        sum.pure = consistent[entry];
+
+        std::map<uint16_t, frame_state> states;
+        std::vector<uint16_t> work{entry};
+        states[entry] = frame_state(sum.arguments, DATA_VALUE);
+
+        while (sum.pure && !work.empty()) {
+            auto pc = work.back();
+            work.pop_back();
+
+            auto s = states[pc];
+            auto instr = cfg.at(pc);
+            bool ok = true;
+            bool falls_through = true;
+            uint16_t target = 0;
+            bool jumps = false;
+
+            auto pop = [&s, &ok]() {
+                if (s.empty()) {
+                    ok = false;
+                    return UNDEFINED_VALUE;
+                }
+                auto v = s.back();
+                s.pop_back();
+                return v;
+            };
+
+            switch (instr.mnem()) {
+                case mnemonic::CONST:
+                    s.push_back(constant(instr.arg(0)));
+                    break;
+                case mnemonic::ADD: {
+                    auto b = pop();
+                    auto a = pop();
+                    if (a.k == value::FRAME && b.k == value::CONSTANT) {
+                        s.push_back(frame(a.n + (b.n >= 0x8000 ? b.n - 0x10000 : b.n)));
+                    } else if (a.k == value::CONSTANT && b.k == value::FRAME) {
+                        s.push_back(frame(b.n + (a.n >= 0x8000 ? a.n - 0x10000 : a.n)));
+                    } else if (a.k == value::CONSTANT && b.k == value::CONSTANT) {
+                        s.push_back(constant(a.n + b.n));
+                    } else {
+                        ok = ok && is_data(a) && is_data(b);
+                        s.push_back(DATA_VALUE);
+                    }
+                    break;
+                }
+                case mnemonic::SUB: {
+                    auto b = pop();
+                    auto a = pop();
+                    if (a.k == value::FRAME && b.k == value::CONSTANT) {
+                        s.push_back(frame(a.n - (b.n >= 0x8000 ? b.n - 0x10000 : b.n)));
+                    } else if (a.k == value::CONSTANT && b.k == value::CONSTANT) {
+                        s.push_back(constant(a.n - b.n));
+                    } else {
+                        ok = ok && is_data(a) && is_data(b);
+                        s.push_back(DATA_VALUE);
+                    }
+                    break;
+                }
+                case mnemonic::DIV:
+                case mnemonic::MOD: {
+                    auto b = pop();
+                    auto a = pop();
+                    ok = ok && is_data(a) && is_data(b);
+                    if (b.k != value::CONSTANT || b.n == 0) {
+                        sum.traps = true;
+                    }
+                    s.push_back(DATA_VALUE);
+                    break;
+                }
+                case mnemonic::MUL:
+                case mnemonic::EQ:
+                case mnemonic::LT: {
+                    auto b = pop();
+                    auto a = pop();
+                    ok = ok && is_data(a) && is_data(b);
+                    s.push_back(DATA_VALUE);
+                    break;
+                }
+                case mnemonic::NOT:
+                    ok = is_data(pop());
+                    s.push_back(DATA_VALUE);
+                    break;
+                case mnemonic::DUP: {
+                    auto v = pop();
+                    ok = ok && v.k != value::UNDEFINED;
+                    s.push_back(v);
+                    s.push_back(v);
+                    break;
+                }
+                case mnemonic::SWAP: {
+                    auto b = pop();
+                    auto a = pop();
+                    ok = ok && a.k != value::UNDEFINED && b.k != value::UNDEFINED;
+                    s.push_back(b);
+                    s.push_back(a);
+                    break;
+                }
+                case mnemonic::LDI: {
+                    auto address = pop();
+                    ok = ok && accessible(s, address) && s[address.n].k != value::UNDEFINED;
+                    s.push_back(ok ? s[address.n] : DATA_VALUE);
+                    break;
+                }
+                case mnemonic::STI: {
+                    // s,i,v => s,v, the slot of i or v itself may be the target
+                    auto v = pop();
+                    auto address = pop();
+                    ok = ok && v.k != value::UNDEFINED && address.k == value::FRAME
+                         && address.n >= 0 && static_cast<size_t>(address.n) < s.size() + 2;
+                    if (ok && static_cast<size_t>(address.n) < s.size()) {
+                        s[address.n] = v;
+                    }
+                    s.push_back(v);
+                    break;
+                }
+                case mnemonic::GETBP:
+                    s.push_back(frame(0));
+                    break;
+                case mnemonic::INCSP:
+                    s.insert(s.end(), instr.arg(0), UNDEFINED_VALUE);
+                    break;
+                case mnemonic::DECSP:
+                    ok = instr.arg(0) <= s.size();
+                    if (ok) {
+                        s.resize(s.size() - instr.arg(0));
+                    }
+                    break;
+                case mnemonic::GOTO:
+                    target = instr.arg(0);
+                    jumps = true;
+                    falls_through = false;
+                    break;
+                case mnemonic::IFZERO:
+                case mnemonic::IFNZERO:
+                    ok = is_data(pop());
+                    target = instr.arg(0);
+                    jumps = true;
+                    break;
+                case mnemonic::CALL: {
+                    auto m = instr.arg(0);
+                    for (uint16_t i = 0; ok && i < m; ++i) {
+                        ok = is_data(pop());
+                    }
+                    sum.calls.push_back(std::make_pair(instr.arg(1), m));
+                    s.push_back(DATA_VALUE);
+                    break;
+                }
+                case mnemonic::RET:
+                    ok = is_data(pop());
+                    falls_through = false;
+                    break;
+                case mnemonic::NOOP:
+                    break;
+                default:
+                    // GETSP, TCALL, output, input and STOP
+                    ok = false;
+                    break;
+            }
+
+            auto advance = [&](uint16_t to) {
+                auto known = states.find(to);
+                if (known == states.end()) {
+                    states[to] = s;
+                    work.push_back(to);
+                } else {
+                    auto merged = known->second;
+                    if (!join(merged, s)) {
+                        ok = false;
+                    } else if (merged != known->second) {
+                        known->second = merged;
+                        work.push_back(to);
+                    }
+                }
+            };
+
+            if (ok && jumps) {
+                advance(target);
+            }
+            if (ok && falls_through) {
+                advance(cfg.next(pc));
+            }
+            sum.pure = ok && s.size() <= MAX_DEPTH && states.size() <= MAX_INSTRUCTIONS;
+        }
+    }
+
+    // a function is pure only if everything it calls is, with the same
+    // number of arguments
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto& f : m_functions) {
+            auto& sum = f.second;
+            for (auto& call : sum.calls) {
+                auto& callee = m_functions.at(call.first);
+                bool pure = callee.pure && callee.arguments == call.second;
+                if (sum.pure && !pure) {
+                    sum.pure = false;
+                    changed = true;
+                }
+                if (!sum.traps && callee.traps) {
+                    sum.traps = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+bool purity_analysis::is_pure(uint16_t entry) const {
+    auto found = m_functions.find(entry);
+    return found != m_functions.end() && found->second.pure;
+}
+
+bool purity_analysis::may_trap(uint16_t entry) const {
+    auto found = m_functions.find(entry);
+    return found == m_functions.end() || found->second.traps;
+}
+
+uint16_t purity_analysis::arguments(uint16_t entry) const {
+    auto found = m_functions.find(entry);
+    return found == m_functions.end() ? 0 : found->second.arguments;
+}
@@ -0,0 +1,42 @@
+#ifndef STACKMACHINE_PURITY_H
+#define STACKMACHINE_PURITY_H
+
+#include <cstdint>
+#include <map>
+#include "control_flow.h"
+
+//! Classifies the targets of CALL. A function is pure if its result depends
+//! only on its arguments and it writes nothing but its own frame: it reads
+//! and writes slots only through GETBP based addresses at or above its first
+//! argument and below sp, never reads a slot it has not written since INCSP
+//! made room for it, has no output or input, and calls only pure functions.
+//! A pure call therefore writes the same words to the same slots whatever
+//! the rest of the stack holds.
+class purity_analysis {
+public:
+    //! \param cfg the control flow of a verified program
+    explicit purity_analysis(const control_flow& cfg);
+
+    //! \return true if the function at entry is pure when called by CALL
+    //! with arguments() arguments
+    bool is_pure(uint16_t entry) const;
+
+    //! \return true if the function or one it calls may divide by zero
+    bool may_trap(uint16_t entry) const;
+
+    //! \return the number of arguments every CALL of entry passes
+    uint16_t arguments(uint16_t entry) const;
+
+private:
+    struct summary {
+        uint16_t arguments;
+        bool pure;
+        bool traps;
+        //! entry and argument count of every CALL in the body
+        std::vector<std::pair<uint16_t, uint16_t>> calls;
+    };
+
+    std::map<uint16_t, summary> m_functions;
+};
+
+#endif //STACKMACHINE_PURITY_H
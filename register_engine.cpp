@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <ostream>
+#include <thread>
+#include "decimal.h"
+#include "register_engine.h"
+
+register_engine::register_engine(const std::vector<uint16_t> &instructions)
+: m_state(instructions), m_translator(m_state.code), m_dispatches(0)
+{
+}
+
+register_engine::register_engine(std::shared_ptr<lazy_program> program)
+: m_state(std::vector<uint16_t>(program->code().begin(), program->code().end() - 1)),
+  m_translator(std::move(program)), m_dispatches(0)
+{
+}
+
+void register_engine::set_command_line_arguments(const std::vector<uint16_t> &args) {
+    m_state.set_command_line_arguments(args);
+}
+
+void register_engine::set_stack(const std::vector<uint16_t> &stack) {
+    m_state.set_stack(stack);
+}
+
+void register_engine::set_input_channel(std::shared_ptr<input_channel> channel) {
+    m_state.set_input_channel(std::move(channel));
+}
+
+void register_engine::set_channel(uint16_t number, std::shared_ptr<channel> ch) {
+    m_state.set_channel(number, std::move(ch));
+}
+
+void register_engine::set_data_segment(std::shared_ptr<const data_segment> data) {
+    m_state.set_data_segment(std::move(data));
+}
+
+void register_engine::set_output(std::ostream &out) {
+    m_state.set_output(out);
+}
+
+interpreter::configs register_engine::registers() const {
+    return m_state.registers();
+}
+
+const std::vector<uint16_t> &register_engine::stack() const {
+    return m_state.stack();
+}
+
+bool register_engine::is_stopped() const {
+    return m_state.is_stopped();
+}
+
+uint64_t register_engine::dispatches() const {
+    return m_dispatches;
+}
+
+// slot x relative to the current sp
+#define S(x) s[sp + (x)]
+
+#define BINARY(NAME, EXPR) \
+        case register_op::NAME##_SS: { \
+            uint16_t x = S(r.a); uint16_t y = S(r.b); \
+            S(r.dst) = static_cast<uint16_t>(EXPR); \
+            ++ip; break; \
+        } \
+        case register_op::NAME##_SK: { \
+            uint16_t x = S(r.a); uint16_t y = static_cast<uint16_t>(r.b); \
+            S(r.dst + 1) = y; \
+            S(r.dst) = static_cast<uint16_t>(EXPR); \
+            ++ip; break; \
+        } \
+        case register_op::NAME##_KS: { \
+            uint16_t x = static_cast<uint16_t>(r.a); uint16_t y = S(r.b); \
+            S(r.dst) = static_cast<uint16_t>(EXPR); \
+            ++ip; break; \
+        }
+
+void register_engine::run() {
+
+    if (m_state.m_stopped) {
+        return;
+    }
+
+    uint16_t* s = m_state.m_stack.data();
+    uint16_t sp = m_state.sp;
+    uint16_t bp = m_state.bp;
+
+    uint32_t ip = m_translator.entry(m_state.pc);
+    const register_instruction* code = m_translator.code().data();
+    uint64_t dispatches = 0;
+    std::ostream& out = *m_state.m_output;
+    char digits[MAX_DECIMAL_DIGITS];
+    std::string text;
+
+    for (;;) {
+        auto& r = code[ip];
+        ++dispatches;
+
+        switch (r.op) {
+            case register_op::MOV_S:
+                S(r.dst) = S(r.a);
+                ++ip;
+                break;
+            case register_op::MOV_K:
+                S(r.dst) = static_cast<uint16_t>(r.a);
+                ++ip;
+                break;
+            case register_op::MOV_BP:
+                S(r.dst) = static_cast<uint16_t>(bp + r.a);
+                ++ip;
+                break;
+            case register_op::MOV_SP:
+                S(r.dst) = static_cast<uint16_t>(sp + r.a);
+                ++ip;
+                break;
+            BINARY(ADD, x + y)
+            BINARY(SUB, x - y)
+            BINARY(MUL, static_cast<uint32_t>(x) * y)
+            BINARY(DIV, x / y)
+            BINARY(MOD, x % y)
+            BINARY(EQ, x == y ? 1 : 0)
+            BINARY(LT, x < y ? 1 : 0)
+            case register_op::NOT_S:
+                S(r.dst) = static_cast<uint16_t>(S(r.a) == 0 ? 1 : 0);
+                ++ip;
+                break;
+            case register_op::SWAP_S:
+                std::swap(S(r.dst), S(r.a));
+                ++ip;
+                break;
+            case register_op::LD_S:
+            case register_op::LD_K:
+            case register_op::LD_BP:
+            case register_op::LD_SP: {
+                uint16_t i;
+                switch (r.op) {
+                    case register_op::LD_S: i = S(r.a); break;
+                    case register_op::LD_K: i = static_cast<uint16_t>(r.a); break;
+                    case register_op::LD_BP: i = static_cast<uint16_t>(bp + r.a); break;
+                    default: i = static_cast<uint16_t>(sp + r.a); break;
+                }
+                // LDI reads its own slot, which holds the address, when it points there
+                S(r.dst) = i == sp + r.dst ? i : s[i];
+                ++ip;
+                break;
+            }
+            case register_op::LDD_S:
+                S(r.dst) = m_state.m_data_words[S(r.a)];
+                ++ip;
+                break;
+            case register_op::LDD_K:
+                S(r.dst) = m_state.m_data_words[static_cast<uint16_t>(r.a)];
+                ++ip;
+                break;
+            case register_op::ST_SS:
+            case register_op::ST_SK:
+            case register_op::ST_KS:
+            case register_op::ST_KK:
+            case register_op::ST_BS:
+            case register_op::ST_BK:
+            case register_op::ST_PS:
+            case register_op::ST_PK: {
+                uint16_t i;
+                uint16_t v;
+                bool k = false;
+                switch (r.op) {
+                    case register_op::ST_SS: i = S(r.a); v = S(r.b); break;
+                    case register_op::ST_SK: i = S(r.a); v = static_cast<uint16_t>(r.b); k = true; break;
+                    case register_op::ST_KS: i = static_cast<uint16_t>(r.a); v = S(r.b); break;
+                    case register_op::ST_KK: i = static_cast<uint16_t>(r.a); v = static_cast<uint16_t>(r.b); k = true; break;
+                    case register_op::ST_BS: i = static_cast<uint16_t>(bp + r.a); v = S(r.b); break;
+                    case register_op::ST_BK: i = static_cast<uint16_t>(bp + r.a); v = static_cast<uint16_t>(r.b); k = true; break;
+                    case register_op::ST_PS: i = static_cast<uint16_t>(sp + r.a); v = S(r.b); break;
+                    default: i = static_cast<uint16_t>(sp + r.a); v = static_cast<uint16_t>(r.b); k = true; break;
+                }
+                if (k) {
+                    S(r.dst + 1) = v;
+                }
+                s[i] = v;
+                S(r.dst) = v;
+                ++ip;
+                break;
+            }
+            case register_op::PRINTI_S:
+                out.write(digits, format_decimal(S(r.a), digits) - digits);
+                ++ip;
+                break;
+            case register_op::PRINTI_K:
+                S(r.dst) = static_cast<uint16_t>(r.a);
+                out.write(digits, format_decimal(static_cast<uint16_t>(r.a), digits) - digits);
+                ++ip;
+                break;
+            case register_op::PRINTC_S:
+                out.put(static_cast<char>(S(r.a)));
+                ++ip;
+                break;
+            case register_op::PRINTC_K:
+                S(r.dst) = static_cast<uint16_t>(r.a);
+                out.put(static_cast<char>(r.a));
+                ++ip;
+                break;
+            case register_op::PRINTS:
+                text.resize(static_cast<size_t>(r.a));
+                for (int32_t k = 0; k < r.a; ++k) {
+                    text[k] = static_cast<char>(S(r.dst + k));
+                }
+                out.write(text.data(), r.a);
+                ++ip;
+                break;
+            case register_op::PRINT_K: {
+                auto& printout = m_translator.printouts()[r.b];
+                std::copy(printout.words.begin(), printout.words.end(), &S(r.dst));
+                out.write(printout.text.data(), static_cast<std::streamsize>(printout.text.size()));
+                ++ip;
+                break;
+            }
+            case register_op::PRINTN:
+                text.clear();
+                for (int32_t k = 0; k < r.a; ++k) {
+                    if (k != 0) {
+                        text += ' ';
+                    }
+                    append_decimal(text, S(r.dst + k));
+                }
+                out.write(text.data(), static_cast<std::streamsize>(text.size()));
+                ++ip;
+                break;
+            case register_op::ADJ:
+                sp = static_cast<uint16_t>(sp + r.adj);
+                ++ip;
+                break;
+            case register_op::JMP:
+                sp = static_cast<uint16_t>(sp + r.adj);
+                ip = static_cast<uint32_t>(r.b);
+                break;
+            case register_op::JZ:
+            case register_op::JNZ: {
+                uint16_t v = S(r.a);
+                S(r.dst) = v;
+                sp = static_cast<uint16_t>(sp + r.adj);
+                if ((v == 0) == (r.op == register_op::JZ)) {
+                    ip = static_cast<uint32_t>(r.b);
+                } else {
+                    ++ip;
+                }
+                break;
+            }
+            case register_op::DJNZ: {
+                auto v = static_cast<uint16_t>(S(r.a) - 1);
+                S(r.dst) = v;
+                sp = static_cast<uint16_t>(sp + r.adj);
+                if (v != 0) {
+                    ip = static_cast<uint32_t>(r.b);
+                } else {
+                    ++ip;
+                }
+                break;
+            }
+            case register_op::CALL: {
+                // s,v1,...,vm => s,r,bp,v1,...,vm
+                sp = static_cast<uint16_t>(sp + r.adj);
+                auto m = static_cast<uint16_t>(r.a);
+                for (int idx = 0; idx < m; ++idx) {
+                    s[sp + 2 - idx] = s[sp - idx];
+                }
+                uint16_t stack_r  = static_cast<uint16_t>(sp - m + 1);
+                uint16_t stack_bp = static_cast<uint16_t>(sp - m + 2);
+
+                s[stack_r] = static_cast<uint16_t>(r.dst);
+                s[stack_bp] = bp;
+
+                bp = static_cast<uint16_t>(stack_bp + 1);
+                sp = static_cast<uint16_t>(stack_bp + m);
+                ip = static_cast<uint32_t>(r.b);
+                break;
+            }
+            case register_op::TCALL: {
+                // s,r,b,u1,...,un,v1,...,vm => s,r,b,v1,...,vm
+                sp = static_cast<uint16_t>(sp + r.adj);
+                auto m = static_cast<uint16_t>(r.a);
+                auto n = static_cast<uint16_t>(r.dst);
+                for (int idx = 0; idx < m; ++idx) {
+                    s[sp - n - idx] = s[sp - idx];
+                }
+                sp = static_cast<uint16_t>(sp - n);
+                ip = static_cast<uint32_t>(r.b);
+                break;
+            }
+            case register_op::RET: {
+                // s,r,b,v1,...,vm,v => s,v
+                sp = static_cast<uint16_t>(sp + r.adj);
+                auto old_bp = s[bp - 1];
+                auto pc = s[bp - 2];
+                auto v = s[sp];
+                sp = static_cast<uint16_t>(bp - 2u);
+                s[sp] = v;
+                bp = old_bp;
+                ip = m_translator.entry(pc);
+                code = m_translator.code().data();
+                break;
+            }
+            case register_op::STOP:
+                sp = static_cast<uint16_t>(sp + r.adj);
+                m_state.sp = sp;
+                m_state.bp = bp;
+                m_state.pc = static_cast<uint16_t>(r.dst);
+                m_state.m_stopped = true;
+                m_dispatches += dispatches;
+                return;
+            case register_op::FALLBACK: {
+                sp = static_cast<uint16_t>(sp + r.adj);
+                m_state.sp = sp;
+                m_state.bp = bp;
+                m_state.pc = static_cast<uint16_t>(r.dst);
+                auto next = r.b;
+
+                m_state.step();
+                if (m_state.m_blocked) {
+                    // waits for the other end of a channel
+                    std::this_thread::yield();
+                }
+
+                sp = m_state.sp;
+                bp = m_state.bp;
+                if (m_state.m_stopped) {
+                    m_dispatches += dispatches;
+                    return;
+                }
+                if (m_state.pc == next) {
+                    ++ip;
+                } else {
+                    ip = m_translator.entry(m_state.pc);
+                    code = m_translator.code().data();
+                }
+                break;
+            }
+            case register_op::ENTER:
+                // the first call of a function of a lazy program
+                m_state.sp = sp;
+                m_state.bp = bp;
+                m_state.pc = static_cast<uint16_t>(r.a);
+                m_dispatches += dispatches;
+                dispatches = 0;
+                ip = m_translator.enter(static_cast<uint16_t>(r.a));
+                code = m_translator.code().data();
+                break;
+        }
+    }
+}
+
+#undef BINARY
+#undef S
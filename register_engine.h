@@ -0,0 +1,50 @@
+#ifndef STACKMACHINE_REGISTER_ENGINE_H
+#define STACKMACHINE_REGISTER_ENGINE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "interpreter.h"
+#include "register_translator.h"
+
+//! Runs a program translated into register form. The machine state lives in
+//! an interpreter, so after a run registers() and stack() are exactly those
+//! of interpreter::run() on the same program and input. Instructions without
+//! a register form are executed by that interpreter one step at a time.
+class register_engine {
+public:
+    //! \throws std::domain_error if the program does not verify
+    explicit register_engine(const std::vector<uint16_t>& instructions);
+
+    //! Run a program that is loaded function by function. Engines on other
+    //! threads may share it.
+    //! \throws std::domain_error if the function at pc 0 does not verify
+    explicit register_engine(std::shared_ptr<lazy_program> program);
+
+    void set_command_line_arguments(const std::vector<uint16_t>& args);
+    void set_stack(const std::vector<uint16_t>& stack);
+    void set_input_channel(std::shared_ptr<input_channel> channel);
+    void set_channel(uint16_t number, std::shared_ptr<channel> ch);
+    void set_data_segment(std::shared_ptr<const data_segment> data);
+    //! see interpreter::set_output()
+    void set_output(std::ostream& out);
+
+    interpreter::configs registers() const;
+    const std::vector<uint16_t>& stack() const;
+
+    //! \throws std::domain_error if a function of a lazy program entered
+    //!         for the first time does not verify, the registers then point
+    //!         at its entry
+    void run();
+    bool is_stopped() const;
+
+    //! \return the number of register instructions executed so far
+    uint64_t dispatches() const;
+
+private:
+    interpreter m_state;
+    register_translator m_translator;
+    uint64_t m_dispatches;
+};
+
+#endif //STACKMACHINE_REGISTER_ENGINE_H
@@ -0,0 +1,658 @@
+#include <limits>
+#include <cstdlib>
+#include "decimal.h"
+#include "register_translator.h"
+
+namespace {
+    const int32_t NONE = std::numeric_limits<int32_t>::min();
+
+    //! Blocks moving sp further than this are split, which keeps
+    //! slot offsets small enough to behave like the uint16 sp.
+    const int32_t MAX_DEPTH = 1024;
+
+    bool decodable(const std::vector<uint16_t>& code, size_t pc) {
+        return pc < code.size()
+            && is_mnemonic(code[pc])
+            && pc + argument_count(static_cast<mnemonic>(code[pc])) < code.size();
+    }
+
+    uint16_t fold(mnemonic m, uint16_t a, uint16_t b) {
+        switch (m) {
+            case mnemonic::ADD: return static_cast<uint16_t>(a + b);
+            case mnemonic::SUB: return static_cast<uint16_t>(a - b);
+            case mnemonic::MUL: return static_cast<uint16_t>(static_cast<uint32_t>(a) * b);
+            case mnemonic::DIV: return static_cast<uint16_t>(a / b);
+            case mnemonic::MOD: return static_cast<uint16_t>(a % b);
+            case mnemonic::EQ: return static_cast<uint16_t>(a == b ? 1 : 0);
+            case mnemonic::LT: return static_cast<uint16_t>(a < b ? 1 : 0);
+            default: return 0;
+        }
+    }
+
+    enum operand_kinds { SS = 0, SK = 1, KS = 2 };
+
+    register_op binary_op(mnemonic m, operand_kinds kinds) {
+        auto base = static_cast<uint32_t>(register_op::ADD_SS);
+        auto idx = static_cast<uint32_t>(m) - static_cast<uint32_t>(mnemonic::ADD);
+        return static_cast<register_op>(base + 3 * idx + kinds);
+    }
+}
+
+register_translator::register_translator(const std::vector<uint16_t> &code)
+: m_cfg(code), m_pc_map(code.size(), -1), m_depth(0)
+{
+    verify(code);
+    translate(0);
+}
+
+register_translator::register_translator(std::shared_ptr<lazy_program> program)
+: m_cfg(std::vector<uint16_t>(), std::vector<uint8_t>()), m_lazy(std::move(program)),
+  m_pc_map(m_lazy->code().size(), -1), m_depth(0)
+{
+    m_lazy->load(0);
+    translate(0);
+}
+
+uint32_t register_translator::enter(uint16_t pc) {
+    m_lazy->load(pc);
+    auto index = entry(pc);
+
+    auto stub = m_stubs.find(pc);
+    if (stub != m_stubs.end()) {
+        m_out[stub->second].op = register_op::JMP;
+        m_out[stub->second].b = static_cast<int32_t>(index);
+        m_stubs.erase(stub);
+    }
+    for (auto idx : m_callers[pc]) {
+        m_out[idx].b = static_cast<int32_t>(index);
+    }
+    m_callers.erase(pc);
+    return index;
+}
+
+instruction register_translator::at(uint16_t pc) const {
+    auto& code = words();
+    auto m = static_cast<mnemonic>(code[pc]);
+    return instruction(m, std::vector<uint16_t>(code.begin() + pc + 1, code.begin() + pc + 1 + argument_count(m)));
+}
+
+uint32_t register_translator::translate(uint16_t start) {
+
+    auto start_index = static_cast<uint32_t>(m_out.size());
+
+    m_work.push_back(start);
+    while (!m_work.empty()) {
+        auto pc = m_work.back();
+        m_work.pop_back();
+
+        if (pc < m_pc_map.size() && m_pc_map[pc] >= 0) {
+            continue;
+        }
+        translate_block(pc);
+    }
+
+    for (auto idx : m_unresolved) {
+        auto target = static_cast<uint16_t>(m_out[idx].b);
+        if (target < m_pc_map.size()) {
+            m_out[idx].b = m_pc_map[target];
+        } else {
+            // outside of the code, the stack interpreter raises the error
+            m_out[idx].b = static_cast<int32_t>(m_out.size());
+            emit(register_op::FALLBACK, target, 0, -1);
+        }
+    }
+    m_unresolved.clear();
+
+    for (auto idx : m_deferred) {
+        auto target = static_cast<uint16_t>(m_out[idx].b);
+        if (m_pc_map[target] >= 0) {
+            m_out[idx].b = m_pc_map[target];
+            continue;
+        }
+        auto stub = m_stubs.find(target);
+        if (stub == m_stubs.end()) {
+            stub = m_stubs.emplace(target, static_cast<uint32_t>(m_out.size())).first;
+            emit(register_op::ENTER, 0, target, 0);
+        }
+        m_out[idx].b = static_cast<int32_t>(stub->second);
+        m_callers[target].push_back(idx);
+    }
+    m_deferred.clear();
+
+    return start_index;
+}
+
+void register_translator::translate_block(uint16_t pc) {
+
+    begin_block(pc);
+    uint16_t block_start = pc;
+
+    for (;;) {
+        bool mapped = pc < m_pc_map.size() && m_pc_map[pc] >= 0;
+
+        if (pc != block_start && (mapped || is_leader(pc))) {
+            // join the next block with an empty symbolic state
+            flush(NONE, NONE);
+            if (mapped) {
+                emit_transfer(register_op::JMP, 0, 0, pc);
+                return;
+            }
+            if (m_depth != 0) {
+                emit(register_op::ADJ, 0, 0, 0);
+                m_out.back().adj = m_depth;
+            }
+            begin_block(pc);
+            block_start = pc;
+        }
+
+        if (!decodable(words(), pc)) {
+            // let the stack interpreter report whatever happens here
+            flush(NONE, NONE);
+            emit(register_op::FALLBACK, pc, 0, -1);
+            m_out.back().adj = m_depth;
+            return;
+        }
+
+        auto instr = at(pc);
+        auto m = instr.mnem();
+        auto next = static_cast<uint16_t>(pc + 1 + argument_count(m));
+        auto d = m_depth;
+        bool falls_through = true;
+
+        switch (m) {
+            case mnemonic::CONST:
+                set(d + 1, {value_desc::CONST, instr.arg(0)});
+                ++m_depth;
+                break;
+            case mnemonic::ADD:
+            case mnemonic::SUB:
+            case mnemonic::MUL:
+            case mnemonic::DIV:
+            case mnemonic::MOD:
+            case mnemonic::EQ:
+            case mnemonic::LT:
+                binary(m);
+                break;
+            case mnemonic::NOT: {
+                auto v = get(d);
+                if (v.kind == value_desc::CONST) {
+                    set(d, {value_desc::CONST, v.v == 0 ? 1 : 0});
+                    break;
+                }
+                materialize_address(d);
+                prepare_write(d, NONE);
+                int32_t src;
+                operand(d, src);
+                emit(register_op::NOT_S, d, src, 0);
+                set(d, {value_desc::MAT, 0});
+                break;
+            }
+            case mnemonic::LDD: {
+                // the data segment is no stack memory, nothing to flush
+                materialize_address(d);
+                prepare_write(d, NONE);
+                int32_t src;
+                auto op = operand(d, src) ? register_op::LDD_K : register_op::LDD_S;
+                emit(op, d, src, 0);
+                set(d, {value_desc::MAT, 0});
+                break;
+            }
+            case mnemonic::DUP:
+                set(d + 1, ref(d));
+                ++m_depth;
+                break;
+            case mnemonic::SWAP: {
+                auto a = get(d - 1);
+                auto b = get(d);
+                bool a_memory = a.kind == value_desc::MAT || a.kind == value_desc::SLOT;
+                bool b_memory = b.kind == value_desc::MAT || b.kind == value_desc::SLOT;
+                if (a_memory && b_memory) {
+                    materialize(d - 1);
+                    materialize(d);
+                    prepare_write(d - 1, d);
+                    emit(register_op::SWAP_S, d - 1, d, 0);
+                } else {
+                    auto new_a = ref(d);
+                    auto new_b = ref(d - 1);
+                    set(d - 1, new_a);
+                    set(d, new_b);
+                }
+                break;
+            }
+            case mnemonic::LDI:
+                load();
+                break;
+            case mnemonic::STI:
+                store();
+                break;
+            case mnemonic::GETBP:
+                set(d + 1, {value_desc::BPREL, 0});
+                ++m_depth;
+                break;
+            case mnemonic::GETSP:
+                set(d + 1, {value_desc::SPREL, d});
+                ++m_depth;
+                break;
+            case mnemonic::INCSP:
+            case mnemonic::DECSP:
+                m_depth += m == mnemonic::INCSP ? instr.arg(0) : -instr.arg(0);
+                if (std::abs(m_depth) > MAX_DEPTH) {
+                    flush(NONE, NONE);
+                    emit(register_op::ADJ, 0, 0, 0);
+                    m_out.back().adj = m_depth;
+                    m_want.clear();
+                    m_depth = 0;
+                }
+                break;
+            case mnemonic::GOTO:
+                flush(NONE, NONE);
+                emit_transfer(register_op::JMP, 0, 0, instr.arg(0));
+                return;
+            case mnemonic::IFZERO:
+            case mnemonic::IFNZERO: {
+                auto c = get(d);
+                if (c.kind == value_desc::CONST) {
+                    --m_depth;
+                    if ((m == mnemonic::IFZERO) == (c.v == 0)) {
+                        flush(NONE, NONE);
+                        emit_transfer(register_op::JMP, 0, 0, instr.arg(0));
+                        return;
+                    }
+                    break;
+                }
+                materialize_address(d);
+                flush(d, NONE);
+                prepare_write(d, NONE);
+                int32_t src;
+                operand(d, src);
+                --m_depth;
+                emit_transfer(m == mnemonic::IFZERO ? register_op::JZ : register_op::JNZ, d, src, instr.arg(0));
+                falls_through = false;
+                break;
+            }
+            case mnemonic::DJNZ: {
+                auto c = get(d);
+                if (c.kind == value_desc::CONST) {
+                    auto v = static_cast<uint16_t>(c.v - 1);
+                    set(d, {value_desc::CONST, v});
+                    if (v != 0) {
+                        flush(NONE, NONE);
+                        emit_transfer(register_op::JMP, 0, 0, instr.arg(0));
+                        return;
+                    }
+                    break;
+                }
+                // the counter stays in its slot, only its latest value is written
+                materialize_address(d);
+                flush(d, NONE);
+                prepare_write(d, NONE);
+                int32_t src;
+                operand(d, src);
+                emit_transfer(register_op::DJNZ, d, src, instr.arg(0));
+                falls_through = false;
+                break;
+            }
+            case mnemonic::CALL:
+                flush(NONE, NONE);
+                emit_transfer(register_op::CALL, next, instr.arg(0), instr.arg(1));
+                falls_through = false;
+                break;
+            case mnemonic::TCALL:
+                flush(NONE, NONE);
+                emit_transfer(register_op::TCALL, instr.arg(1), instr.arg(0), instr.arg(2));
+                return;
+            case mnemonic::RET:
+                flush(NONE, NONE);
+                emit(register_op::RET, 0, 0, 0);
+                m_out.back().adj = m_depth;
+                return;
+            case mnemonic::PRINTI:
+            case mnemonic::PRINTC:
+                print(m);
+                break;
+            case mnemonic::PRINTS:
+            case mnemonic::PRINTN:
+                if (print_block(m)) {
+                    break;
+                }
+                // a count known only at run time leaves the depth unknown
+                flush(NONE, NONE);
+                emit(register_op::FALLBACK, pc, 0, next);
+                m_out.back().adj = m_depth;
+                falls_through = false;
+                break;
+            case mnemonic::STOP:
+                flush(NONE, NONE);
+                emit(register_op::STOP, next, 0, 0);
+                m_out.back().adj = m_depth;
+                return;
+            case mnemonic::NOOP:
+                break;
+            default:
+                // everything else runs on the stack interpreter
+                flush(NONE, NONE);
+                emit(register_op::FALLBACK, pc, 0, next);
+                m_out.back().adj = m_depth;
+                falls_through = false;
+                break;
+        }
+
+        if (!falls_through) {
+            // the block ended with a transfer that may continue at next
+            if (next < m_pc_map.size() && m_pc_map[next] >= 0) {
+                m_want.clear();
+                m_depth = 0;
+                emit_transfer(register_op::JMP, 0, 0, next);
+                return;
+            }
+            begin_block(next);
+            block_start = next;
+        }
+
+        pc = next;
+    }
+}
+
+register_translator::value_desc register_translator::get(int32_t pos) const {
+    auto it = m_want.find(pos);
+    if (it == m_want.end()) {
+        return {value_desc::MAT, 0};
+    }
+    return it->second;
+}
+
+void register_translator::set(int32_t pos, value_desc d) {
+    if (d.kind == value_desc::MAT || (d.kind == value_desc::SLOT && d.v == pos)) {
+        m_want.erase(pos);
+    } else {
+        m_want[pos] = d;
+    }
+}
+
+register_translator::value_desc register_translator::ref(int32_t pos) const {
+    auto d = get(pos);
+    if (d.kind == value_desc::MAT) {
+        return {value_desc::SLOT, pos};
+    }
+    return d;
+}
+
+void register_translator::materialize(int32_t pos) {
+    auto d = get(pos);
+    if (d.kind == value_desc::MAT) {
+        return;
+    }
+
+    prepare_write(pos, NONE);
+
+    switch (d.kind) {
+        case value_desc::CONST: emit(register_op::MOV_K, pos, d.v, 0); break;
+        case value_desc::SLOT: emit(register_op::MOV_S, pos, d.v, 0); break;
+        case value_desc::BPREL: emit(register_op::MOV_BP, pos, d.v, 0); break;
+        case value_desc::SPREL: emit(register_op::MOV_SP, pos, d.v, 0); break;
+        case value_desc::MAT: break;
+    }
+
+    set(pos, {value_desc::MAT, 0});
+}
+
+void register_translator::materialize_address(int32_t pos) {
+    auto d = get(pos);
+    if (d.kind == value_desc::BPREL || d.kind == value_desc::SPREL) {
+        materialize(pos);
+    }
+}
+
+void register_translator::prepare_write(int32_t w1, int32_t w2) {
+    // copies of the slots about to be written must be made real first
+    std::vector<int32_t> readers;
+    for (auto& entry : m_want) {
+        auto pos = entry.first;
+        auto& d = entry.second;
+        if (pos != w1 && pos != w2 && d.kind == value_desc::SLOT && (d.v == w1 || d.v == w2)) {
+            readers.push_back(pos);
+        }
+    }
+    for (auto pos : readers) {
+        materialize(pos);
+    }
+}
+
+void register_translator::flush(int32_t keep1, int32_t keep2) {
+    std::vector<int32_t> pending;
+    for (auto& entry : m_want) {
+        if (entry.first != keep1 && entry.first != keep2) {
+            pending.push_back(entry.first);
+        }
+    }
+    for (auto pos : pending) {
+        materialize(pos);
+    }
+}
+
+bool register_translator::operand(int32_t pos, int32_t &value) {
+    auto d = get(pos);
+    switch (d.kind) {
+        case value_desc::CONST:
+            value = d.v;
+            return true;
+        case value_desc::SLOT:
+            value = d.v;
+            return false;
+        default:
+            value = pos;
+            return false;
+    }
+}
+
+void register_translator::begin_block(uint16_t pc) {
+    if (pc < m_pc_map.size()) {
+        m_pc_map[pc] = static_cast<int32_t>(m_out.size());
+    }
+    m_want.clear();
+    m_depth = 0;
+}
+
+void register_translator::emit(register_op op, int32_t dst, int32_t a, int32_t b) {
+    m_out.push_back({op, 0, dst, a, b});
+}
+
+void register_translator::emit_transfer(register_op op, int32_t dst, int32_t a, uint16_t target) {
+    emit(op, dst, a, target);
+    m_out.back().adj = m_depth;
+    bool call = op == register_op::CALL || op == register_op::TCALL;
+    if (m_lazy && call && target < m_pc_map.size() && m_pc_map[target] < 0) {
+        // translated on the first call
+        m_deferred.push_back(m_out.size() - 1);
+    } else {
+        m_unresolved.push_back(m_out.size() - 1);
+        m_work.push_back(target);
+    }
+
+    m_want.clear();
+    m_depth = 0;
+}
+
+void register_translator::binary(mnemonic m) {
+    auto ap = m_depth - 1;
+    auto bp = m_depth;
+    auto a = get(ap);
+    auto b = get(bp);
+
+    bool divides = m == mnemonic::DIV || m == mnemonic::MOD;
+    bool a_addr = a.kind == value_desc::BPREL || a.kind == value_desc::SPREL;
+    bool b_addr = b.kind == value_desc::BPREL || b.kind == value_desc::SPREL;
+
+    // the result stays symbolic, the slot of b keeps b as the stack interpreter leaves it
+    if (a.kind == value_desc::CONST && b.kind == value_desc::CONST && !(divides && b.v == 0)) {
+        set(ap, {value_desc::CONST, fold(m, static_cast<uint16_t>(a.v), static_cast<uint16_t>(b.v))});
+        --m_depth;
+        return;
+    }
+    if ((m == mnemonic::ADD || m == mnemonic::SUB) && a_addr && b.kind == value_desc::CONST) {
+        set(ap, {a.kind, m == mnemonic::ADD ? a.v + b.v : a.v - b.v});
+        --m_depth;
+        return;
+    }
+    if (m == mnemonic::ADD && a.kind == value_desc::CONST && b_addr) {
+        set(ap, {b.kind, b.v + a.v});
+        --m_depth;
+        return;
+    }
+
+    materialize_address(ap);
+    materialize_address(bp);
+    if (get(ap).kind == value_desc::CONST && get(bp).kind == value_desc::CONST) {
+        materialize(ap);
+    }
+
+    bool b_const = get(bp).kind == value_desc::CONST;
+    prepare_write(ap, b_const ? bp : NONE);
+
+    int32_t av, bv;
+    bool a_const = operand(ap, av);
+    operand(bp, bv);
+
+    emit(binary_op(m, a_const ? KS : (b_const ? SK : SS)), ap, av, bv);
+    set(ap, {value_desc::MAT, 0});
+    if (b_const) {
+        set(bp, {value_desc::MAT, 0});
+    }
+    --m_depth;
+}
+
+void register_translator::load() {
+    auto d = m_depth;
+
+    // the address is only known at run time, so memory must be up to date
+    flush(d, NONE);
+    prepare_write(d, NONE);
+
+    auto i = get(d);
+    switch (i.kind) {
+        case value_desc::CONST: emit(register_op::LD_K, d, i.v, 0); break;
+        case value_desc::BPREL: emit(register_op::LD_BP, d, i.v, 0); break;
+        case value_desc::SPREL: emit(register_op::LD_SP, d, i.v, 0); break;
+        case value_desc::SLOT: emit(register_op::LD_S, d, i.v, 0); break;
+        case value_desc::MAT: emit(register_op::LD_S, d, d, 0); break;
+    }
+    set(d, {value_desc::MAT, 0});
+}
+
+void register_translator::store() {
+    auto ip = m_depth - 1;
+    auto vp = m_depth;
+
+    flush(ip, vp);
+    materialize_address(vp);
+
+    bool v_const = get(vp).kind == value_desc::CONST;
+    prepare_write(ip, v_const ? vp : NONE);
+
+    int32_t iv, vv;
+    operand(vp, vv);
+
+    auto i = get(ip);
+    register_op op;
+    switch (i.kind) {
+        case value_desc::CONST:
+            op = v_const ? register_op::ST_KK : register_op::ST_KS;
+            iv = i.v;
+            break;
+        case value_desc::BPREL:
+            op = v_const ? register_op::ST_BK : register_op::ST_BS;
+            iv = i.v;
+            break;
+        case value_desc::SPREL:
+            op = v_const ? register_op::ST_PK : register_op::ST_PS;
+            iv = i.v;
+            break;
+        default:
+            operand(ip, iv);
+            op = v_const ? register_op::ST_SK : register_op::ST_SS;
+            break;
+    }
+
+    emit(op, ip, iv, vv);
+    set(ip, {value_desc::MAT, 0});
+    if (v_const) {
+        set(vp, {value_desc::MAT, 0});
+    }
+    --m_depth;
+}
+
+void register_translator::print(mnemonic m) {
+    auto d = m_depth;
+
+    materialize_address(d);
+
+    int32_t v;
+    if (operand(d, v)) {
+        prepare_write(d, NONE);
+        emit(m == mnemonic::PRINTI ? register_op::PRINTI_K : register_op::PRINTC_K, d, v, 0);
+        set(d, {value_desc::MAT, 0});
+    } else {
+        emit(m == mnemonic::PRINTI ? register_op::PRINTI_S : register_op::PRINTC_S, d, v, 0);
+    }
+    --m_depth;
+}
+
+bool register_translator::print_block(mnemonic m) {
+    auto d = m_depth;
+    auto count = get(d);
+    if (count.kind != value_desc::CONST) {
+        return false;
+    }
+
+    auto first = d - count.v;
+    register_printout printout;
+    for (auto pos = first; pos <= d; ++pos) {
+        auto v = get(pos);
+        if (v.kind != value_desc::CONST) {
+            break;
+        }
+        printout.words.push_back(static_cast<uint16_t>(v.v));
+    }
+
+    std::vector<int32_t> pending;
+    if (printout.words.size() == static_cast<size_t>(count.v) + 1) {
+        // all constants, one instruction writes them and the formatted text
+        for (auto& entry : m_want) {
+            auto& v = entry.second;
+            if ((entry.first < first || entry.first > d) && v.kind == value_desc::SLOT && v.v >= first && v.v <= d) {
+                pending.push_back(entry.first);
+            }
+        }
+        for (auto pos : pending) {
+            materialize(pos);
+        }
+        for (auto pos = first; pos <= d; ++pos) {
+            set(pos, {value_desc::MAT, 0});
+        }
+        for (int32_t k = 0; k < count.v; ++k) {
+            if (m == mnemonic::PRINTS) {
+                printout.text += static_cast<char>(printout.words[k]);
+            } else {
+                if (k != 0) {
+                    printout.text += ' ';
+                }
+                append_decimal(printout.text, printout.words[k]);
+            }
+        }
+        emit(register_op::PRINT_K, first, count.v, static_cast<int32_t>(m_printouts.size()));
+        m_printouts.push_back(std::move(printout));
+    } else {
+        // the words and their count are printed from memory
+        for (auto& entry : m_want) {
+            if (entry.first >= first && entry.first <= d) {
+                pending.push_back(entry.first);
+            }
+        }
+        for (auto pos : pending) {
+            materialize(pos);
+        }
+        emit(m == mnemonic::PRINTS ? register_op::PRINTS : register_op::PRINTN, first, count.v, 0);
+    }
+    m_depth = first - 1;
+    return true;
+}
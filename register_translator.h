@@ -0,0 +1,172 @@
+#ifndef STACKMACHINE_REGISTER_TRANSLATOR_H
+#define STACKMACHINE_REGISTER_TRANSLATOR_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "control_flow.h"
+#include "lazy_program.h"
+
+//! Operations of the three-address register form.
+//! Registers are stack slots addressed relative to the current sp,
+//! operands are either such a slot (S) or an immediate constant (K).
+//! Below, S(x) is the slot sp+x.
+enum class register_op : uint32_t {
+    MOV_S,      // S(dst) = S(a)
+    MOV_K,      // S(dst) = a
+    MOV_BP,     // S(dst) = bp + a
+    MOV_SP,     // S(dst) = sp + a
+    ADD_SS, ADD_SK, ADD_KS,
+    SUB_SS, SUB_SK, SUB_KS,
+    MUL_SS, MUL_SK, MUL_KS,
+    DIV_SS, DIV_SK, DIV_KS,
+    MOD_SS, MOD_SK, MOD_KS,
+    EQ_SS, EQ_SK, EQ_KS,
+    LT_SS, LT_SK, LT_KS,
+                // S(dst) = a op b, the K operand of _SK is also stored in S(dst+1)
+    NOT_S,      // S(dst) = !S(a)
+    SWAP_S,     // swap S(dst) and S(a)
+    LD_S,       // S(dst) = stack[S(a)]
+    LD_K,       // S(dst) = stack[a]
+    LD_BP,      // S(dst) = stack[bp + a]
+    LD_SP,      // S(dst) = stack[sp + a]
+    LDD_S,      // S(dst) = data[S(a)]
+    LDD_K,      // S(dst) = data[a]
+    ST_SS, ST_SK, ST_KS, ST_KK, ST_BS, ST_BK, ST_PS, ST_PK,
+                // stack[i] = v, S(dst) = v with the index i taken from S(a), a, bp + a
+                // or sp + a and the value v from S(b) or b, a K value is also stored in S(dst+1)
+    PRINTI_S,   // print S(a)
+    PRINTI_K,   // print a, S(dst) = a
+    PRINTC_S,
+    PRINTC_K,
+    PRINTS,     // print S(dst),...,S(dst+a-1) as chars
+    PRINTN,     // print S(dst),...,S(dst+a-1) as integers separated by spaces
+    PRINT_K,    // S(dst),...,S(dst+a) = the words of printout b, print its text
+    ADJ,        // sp += adj
+    JMP,        // sp += adj, continue at b
+    JZ,         // S(dst) = S(a), sp += adj, continue at b if the value is zero
+    JNZ,
+    DJNZ,       // S(dst) = S(a) - 1, sp += adj, continue at b if the result is not zero
+    CALL,       // sp += adj, CALL a with return address dst, continue at b
+    TCALL,      // sp += adj, TCALL a dst, continue at b
+    RET,        // sp += adj, RET
+    STOP,       // sp += adj, STOP with pc = dst
+    FALLBACK,   // sp += adj, execute the stack instruction at pc = dst,
+                // continue with the next register instruction if it returns to pc = b
+    ENTER       // continue at the function starting at pc a of a lazy program, CALL
+                // and TCALL go here until the function is loaded and translated
+};
+
+struct register_instruction {
+    register_op op;
+    int32_t adj;
+    int32_t dst;
+    int32_t a;
+    int32_t b;
+};
+
+//! A PRINTS or PRINTN whose words are all constants, formatted once at
+//! translation time.
+struct register_printout {
+    //! the printed words followed by their count
+    std::vector<uint16_t> words;
+    std::string text;
+};
+
+//! Translates stack bytecode into the register form one basic block at a
+//! time. Within a block the stack is simulated symbolically: constants,
+//! copies and bp/sp relative addresses stay virtual until an instruction
+//! needs them in memory, so most pushes and pops disappear. Every slot a stack
+//! instruction would have written is still written, which keeps the stack
+//! contents identical to the stack interpreter.
+class register_translator {
+public:
+    //! \param code the program including its trailing STOP
+    //! \throws std::domain_error if the program does not verify
+    explicit register_translator(const std::vector<uint16_t>& code);
+
+    //! Translate a program function by function: a callee is loaded and
+    //! translated when it is entered for the first time, see enter().
+    //! \param program the program, possibly shared with other translators
+    explicit register_translator(std::shared_ptr<lazy_program> program);
+
+    //! Get the register code index of the block starting at pc,
+    //! translating it on first use.
+    uint32_t entry(uint16_t pc) {
+        if (pc < m_pc_map.size() && m_pc_map[pc] >= 0) {
+            return static_cast<uint32_t>(m_pc_map[pc]);
+        }
+        return translate(pc);
+    }
+
+    //! Load and translate the function starting at pc on its first call and
+    //! point the calls waiting for it at the translation.
+    //! \return the register code index of the function
+    //! \throws std::domain_error if the function does not verify
+    uint32_t enter(uint16_t pc);
+
+    const std::vector<register_instruction>& code() const {
+        return m_out;
+    }
+
+    //! \return the printouts PRINT_K refers to
+    const std::vector<register_printout>& printouts() const {
+        return m_printouts;
+    }
+
+private:
+    struct value_desc {
+        enum kind_t { MAT, CONST, SLOT, BPREL, SPREL } kind;
+        int32_t v;
+    };
+
+    uint32_t translate(uint16_t start);
+    void translate_block(uint16_t pc);
+
+    value_desc get(int32_t pos) const;
+    void set(int32_t pos, value_desc d);
+    value_desc ref(int32_t pos) const;
+    void materialize(int32_t pos);
+    void materialize_address(int32_t pos);
+    void prepare_write(int32_t w1, int32_t w2);
+    void flush(int32_t keep1, int32_t keep2);
+    bool operand(int32_t pos, int32_t& value);
+    void begin_block(uint16_t pc);
+    void emit(register_op op, int32_t dst, int32_t a, int32_t b);
+    void emit_transfer(register_op op, int32_t dst, int32_t a, uint16_t target);
+
+    const std::vector<uint16_t>& words() const {
+        return m_lazy ? m_lazy->code() : m_cfg.code();
+    }
+    bool is_leader(uint16_t pc) const {
+        return m_lazy ? m_lazy->is_leader(pc) : m_cfg.is_leader(pc);
+    }
+    instruction at(uint16_t pc) const;
+
+    void binary(mnemonic m);
+    void load();
+    void store();
+    void print(mnemonic m);
+    bool print_block(mnemonic m);
+
+    control_flow m_cfg;
+    std::shared_ptr<lazy_program> m_lazy;
+    std::vector<int32_t> m_pc_map;
+    std::vector<register_instruction> m_out;
+    std::vector<register_printout> m_printouts;
+    std::vector<size_t> m_unresolved;
+    std::vector<uint16_t> m_work;
+    //! calls of functions not translated yet, found by the current translate()
+    std::vector<size_t> m_deferred;
+    //! function entry -> its ENTER instruction and the calls that go there
+    std::map<uint16_t, uint32_t> m_stubs;
+    std::map<uint16_t, std::vector<size_t>> m_callers;
+
+    // symbolic state of the current block, positions are relative to the engine's sp
+    std::map<int32_t, value_desc> m_want;
+    int32_t m_depth;
+};
+
+#endif //STACKMACHINE_REGISTER_TRANSLATOR_H
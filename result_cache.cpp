@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "result_cache.h"
+
+namespace {
+
+    //! The start of every result file, followed by the program words, the
+    //! argument words and the output. All numbers are in host byte order.
+    struct file_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t code_words;
+        uint64_t key;
+        uint32_t arg_words;
+        uint32_t output_bytes;
+        uint16_t pc;
+        uint16_t sp;
+        uint16_t bp;
+        uint16_t stopped;
+    };
+
+    const char MAGIC[8] = {'S', 'M', 'R', 'E', 'S', 'U', 'L', 'T'};
+
+    const uint16_t* words_of(const uint8_t* data) {
+        return reinterpret_cast<const uint16_t*>(data + sizeof(file_header));
+    }
+
+    //! Check that an image is complete and belongs to code and args.
+    bool valid(const uint8_t* data, size_t size, const std::vector<uint16_t>& code,
+               const std::vector<uint16_t>& args) {
+        if (size < sizeof(file_header)) {
+            return false;
+        }
+        file_header h;
+        std::memcpy(&h, data, sizeof(h));
+        size_t expected = sizeof(file_header)
+                          + (static_cast<size_t>(h.code_words) + h.arg_words) * sizeof(uint16_t)
+                          + h.output_bytes;
+        return std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0
+               && h.version == result_cache::VERSION
+               && h.key == result_cache::key(code, args)
+               && h.code_words == code.size()
+               && h.arg_words == args.size()
+               && size == expected
+               && std::equal(code.begin(), code.end(), words_of(data))
+               && std::equal(args.begin(), args.end(), words_of(data) + code.size());
+    }
+
+    std::vector<uint8_t> build(uint64_t key, const std::vector<uint16_t>& code, const std::vector<uint16_t>& args,
+                               const program_result& result) {
+        file_header h;
+        std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+        h.version = result_cache::VERSION;
+        h.code_words = static_cast<uint32_t>(code.size());
+        h.key = key;
+        h.arg_words = static_cast<uint32_t>(args.size());
+        h.output_bytes = static_cast<uint32_t>(result.output.size());
+        h.pc = result.registers.pc;
+        h.sp = result.registers.sp;
+        h.bp = result.registers.bp;
+        h.stopped = result.stopped ? 1 : 0;
+
+        std::vector<uint8_t> image(sizeof(h) + (code.size() + args.size()) * sizeof(uint16_t) + result.output.size());
+        auto out = image.data();
+        std::memcpy(out, &h, sizeof(h));
+        out += sizeof(h);
+        std::memcpy(out, code.data(), code.size() * sizeof(uint16_t));
+        out += code.size() * sizeof(uint16_t);
+        std::memcpy(out, args.data(), args.size() * sizeof(uint16_t));
+        out += args.size() * sizeof(uint16_t);
+        std::memcpy(out, result.output.data(), result.output.size());
+        return image;
+    }
+}
+
+const uint32_t result_cache::VERSION;
+
+result_cache::result_cache(size_t capacity, const std::string &directory)
+: m_capacity(std::max<size_t>(capacity, 1)), m_directory(directory), m_hits(0), m_disk_hits(0), m_misses(0),
+  m_evictions(0), m_write_failures(0)
+{
+    if (directory.empty()) {
+        return;
+    }
+    if (::mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("Cannot create cache directory " + directory + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (::stat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+        throw std::runtime_error("Cache directory " + directory + " is not a directory");
+    }
+}
+
+uint64_t result_cache::key(const std::vector<uint16_t> &code, const std::vector<uint16_t> &args) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    auto mix = [&h](uint8_t byte) {
+        h = (h ^ byte) * 0x100000001b3ull;
+    };
+    auto mix_word = [&mix](uint32_t word) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            mix(static_cast<uint8_t>(word >> shift));
+        }
+    };
+    mix_word(VERSION);
+    mix_word(sizeof(uint16_t) * 8);
+    // the lengths keep the split between program and arguments apart
+    mix_word(static_cast<uint32_t>(code.size()));
+    for (auto word : code) {
+        mix(static_cast<uint8_t>(word));
+        mix(static_cast<uint8_t>(word >> 8));
+    }
+    mix_word(static_cast<uint32_t>(args.size()));
+    for (auto word : args) {
+        mix(static_cast<uint8_t>(word));
+        mix(static_cast<uint8_t>(word >> 8));
+    }
+    return h;
+}
+
+std::string result_cache::path(const std::vector<uint16_t> &code, const std::vector<uint16_t> &args) const {
+    std::stringstream name;
+    name << m_directory << "/" << std::hex << std::setw(16) << std::setfill('0') << key(code, args) << ".smr";
+    return name.str();
+}
+
+bool result_cache::lookup(const std::vector<uint16_t> &code, const std::vector<uint16_t> &args, program_result &result) {
+    auto k = key(code, args);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto found = m_index.find(k);
+        if (found != m_index.end() && found->second->code == code && found->second->args == args) {
+            m_entries.splice(m_entries.begin(), m_entries, found->second);
+            result = found->second->result;
+            ++m_hits;
+            return true;
+        }
+    }
+
+    // the files are never changed in place, no lock needed
+    bool on_disk = !m_directory.empty() && load(path(code, args), code, args, result);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (on_disk) {
+        remember(k, code, args, result);
+        ++m_disk_hits;
+    } else {
+        ++m_misses;
+    }
+    return on_disk;
+}
+
+void result_cache::store(const std::vector<uint16_t> &code, const std::vector<uint16_t> &args,
+                         const program_result &result) {
+    auto k = key(code, args);
+    bool saved = m_directory.empty() || save(path(code, args), build(k, code, args, result));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    remember(k, code, args, result);
+    if (!saved) {
+        ++m_write_failures;
+    }
+}
+
+program_result result_cache::run(const std::vector<uint16_t> &code, const std::vector<uint16_t> &args,
+                                 uint64_t budget) {
+    program_result result;
+    if (lookup(code, args, result)) {
+        return result;
+    }
+
+    std::stringstream output;
+    interpreter interp(code);
+    interp.set_output(output);
+    interp.set_command_line_arguments(args);
+    interp.run(budget);
+
+    result.output = output.str();
+    result.registers = interp.registers();
+    result.stopped = interp.is_stopped();
+    if (result.stopped) {
+        store(code, args, result);
+    }
+    return result;
+}
+
+void result_cache::remember(uint64_t key, const std::vector<uint16_t> &code, const std::vector<uint16_t> &args,
+                            const program_result &result) {
+    auto found = m_index.find(key);
+    if (found != m_index.end()) {
+        // a newer result or one of another program with the same key
+        m_entries.erase(found->second);
+        m_index.erase(found);
+    } else if (m_entries.size() >= m_capacity) {
+        m_index.erase(m_entries.back().key);
+        m_entries.pop_back();
+        ++m_evictions;
+    }
+    m_entries.push_front(entry{key, code, args, result});
+    m_index[key] = m_entries.begin();
+}
+
+bool result_cache::load(const std::string &file, const std::vector<uint16_t> &code, const std::vector<uint16_t> &args,
+                        program_result &result) const {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    void* mapping = MAP_FAILED;
+    auto size = static_cast<size_t>(0);
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+        size = static_cast<size_t>(st.st_size);
+        mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    auto data = static_cast<const uint8_t*>(mapping);
+    bool ok = valid(data, size, code, args);
+    if (ok) {
+        file_header h;
+        std::memcpy(&h, data, sizeof(h));
+        auto output = reinterpret_cast<const char*>(words_of(data) + h.code_words + h.arg_words);
+        result.output.assign(output, h.output_bytes);
+        result.registers.pc = h.pc;
+        result.registers.sp = h.sp;
+        result.registers.bp = h.bp;
+        result.stopped = h.stopped != 0;
+    }
+    ::munmap(mapping, size);
+    return ok;
+}
+
+bool result_cache::save(const std::string &file, const std::vector<uint8_t> &image) const {
+    static std::atomic<unsigned> counter(0);
+
+    // a name no other process or thread uses, in the same directory so
+    // that the rename is atomic
+    std::stringstream tmp_name;
+    tmp_name << file << ".tmp." << ::getpid() << "." << counter++;
+    auto tmp = tmp_name.str();
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    while (ok && written < image.size()) {
+        auto n = ::write(fd, image.data() + written, image.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = n > 0;
+        written += ok ? static_cast<size_t>(n) : 0;
+    }
+    ok = ::fsync(fd) == 0 && ok;
+    ok = ::close(fd) == 0 && ok;
+
+    if (!ok || ::rename(tmp.c_str(), file.c_str()) != 0) {
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+uint64_t result_cache::hits() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+uint64_t result_cache::disk_hits() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_disk_hits;
+}
+
+uint64_t result_cache::misses() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_misses;
+}
+
+uint64_t result_cache::evictions() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_evictions;
+}
+
+uint64_t result_cache::write_failures() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_write_failures;
+}
+
+size_t result_cache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
@@ -0,0 +1,109 @@
+#ifndef STACKMACHINE_RESULT_CACHE_H
+#define STACKMACHINE_RESULT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "interpreter.h"
+
+//! What a run of a program produced.
+struct program_result {
+    std::string output;
+    interpreter::configs registers;
+    //! false if the run ran out of budget before STOP
+    bool stopped;
+};
+
+//! Remembers the results of whole program runs keyed on the program words,
+//! the command line arguments, the 16-bit word width and VERSION. A program
+//! that reads neither input, channels nor a data segment depends on nothing
+//! else, so a repeated request is answered without an interpreter.
+//!
+//! The memory tier keeps the most recently used results up to a capacity.
+//! The optional disk tier keeps one file per result in a directory like
+//! program_cache: it is mapped read-only on a lookup that misses in memory,
+//! written to a temporary file and renamed into place, and entries that do
+//! not match the program and arguments count as a miss. A directory that
+//! cannot be written only disables storing. Safe to share between threads.
+class result_cache {
+public:
+    //! Bump whenever an opcode changes what a program outputs or its final
+    //! registers, old entries on disk become misses.
+    static const uint32_t VERSION = 2;
+
+    //! \param capacity the number of results kept in memory
+    //! \param directory the disk tier, none if empty, created if it does
+    //!        not exist
+    //! \throws std::runtime_error if the directory cannot be created
+    explicit result_cache(size_t capacity = 1024, const std::string& directory = std::string());
+
+    result_cache(const result_cache&) = delete;
+    result_cache& operator=(const result_cache&) = delete;
+
+    //! Look up a run.
+    //! \param result receives the result on a hit
+    //! \return true on a hit
+    bool lookup(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args, program_result& result);
+
+    //! Keep the result of a run in both tiers.
+    void store(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args, const program_result& result);
+
+    //! Run a program with args on a fresh interpreter without input,
+    //! channels or data segment, or answer from the cache. Runs that do not
+    //! reach STOP within budget are not stored.
+    program_result run(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args,
+                       uint64_t budget = std::numeric_limits<uint64_t>::max());
+
+    //! \return the 64-bit FNV-1a hash of VERSION, the word width, the
+    //!         program words and the arguments
+    static uint64_t key(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args);
+
+    //! \return the file of the disk tier that holds the entry of a run
+    std::string path(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args) const;
+
+    //! \return lookups answered from memory
+    uint64_t hits() const;
+    //! \return lookups answered from the disk tier
+    uint64_t disk_hits() const;
+    uint64_t misses() const;
+    //! \return results dropped from memory for newer ones
+    uint64_t evictions() const;
+    //! \return the number of entries that could not be written to disk
+    uint64_t write_failures() const;
+    //! \return the number of results kept in memory
+    size_t size() const;
+
+private:
+    struct entry {
+        uint64_t key;
+        std::vector<uint16_t> code;
+        std::vector<uint16_t> args;
+        program_result result;
+    };
+
+    //! Put a result at the front of the memory tier. Call with the lock held.
+    void remember(uint64_t key, const std::vector<uint16_t>& code, const std::vector<uint16_t>& args,
+                  const program_result& result);
+    bool load(const std::string& file, const std::vector<uint16_t>& code, const std::vector<uint16_t>& args,
+              program_result& result) const;
+    bool save(const std::string& file, const std::vector<uint8_t>& image) const;
+
+    size_t m_capacity;
+    std::string m_directory;
+    mutable std::mutex m_mutex;
+    //! the most recently used first
+    std::list<entry> m_entries;
+    std::unordered_map<uint64_t, std::list<entry>::iterator> m_index;
+    uint64_t m_hits;
+    uint64_t m_disk_hits;
+    uint64_t m_misses;
+    uint64_t m_evictions;
+    uint64_t m_write_failures;
+};
+
+#endif //STACKMACHINE_RESULT_CACHE_H
@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "interpreter.h"
+#include "sampling_profiler.h"
+
+namespace {
+    thread_local const interpreter* t_running = nullptr;
+
+    std::atomic<sampling_profiler*> g_active(nullptr);
+    //! handlers between entry and exit, stop() waits for them to leave
+    std::atomic<unsigned> g_in_handler(0);
+    std::once_flag g_installed;
+    std::mutex g_start;
+}
+
+const unsigned sampling_profiler::MAX_DEPTH;
+
+sampling_profiler::sampling_profiler(size_t capacity)
+: m_samples(capacity), m_next(0), m_missed(0), m_timer(nullptr), m_running(false)
+{
+}
+
+sampling_profiler::~sampling_profiler() {
+    stop();
+}
+
+void sampling_profiler::start(unsigned hz) {
+    std::lock_guard<std::mutex> lock(g_start);
+    if (g_active.load() != nullptr) {
+        throw std::runtime_error("Another sampling profiler is running");
+    }
+
+    // the handler stays, a SIGPROF still pending after stop() must not
+    // terminate the process
+    std::call_once(g_installed, [] {
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = &sampling_profiler::handle;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        ::sigaction(SIGPROF, &action, nullptr);
+    });
+
+    struct sigevent event;
+    std::memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_SIGNAL;
+    event.sigev_signo = SIGPROF;
+    timer_t timer;
+    if (::timer_create(CLOCK_PROCESS_CPUTIME_ID, &event, &timer) != 0) {
+        throw std::runtime_error(std::string("Cannot create the profiling timer: ") + std::strerror(errno));
+    }
+
+    long period = 1000000000L / (hz == 0 ? 1 : hz);
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = period / 1000000000L;
+    spec.it_interval.tv_nsec = period % 1000000000L;
+    spec.it_value = spec.it_interval;
+
+    g_active.store(this);
+    if (::timer_settime(timer, 0, &spec, nullptr) != 0) {
+        auto error = errno;
+        g_active.store(nullptr);
+        ::timer_delete(timer);
+        throw std::runtime_error(std::string("Cannot start the profiling timer: ") + std::strerror(error));
+    }
+    m_timer = timer;
+    m_running = true;
+}
+
+void sampling_profiler::stop() {
+    std::lock_guard<std::mutex> lock(g_start);
+    if (!m_running) {
+        return;
+    }
+    ::timer_delete(static_cast<timer_t>(m_timer));
+    g_active.store(nullptr);
+    while (g_in_handler.load() != 0) {
+        std::this_thread::yield();
+    }
+    m_timer = nullptr;
+    m_running = false;
+}
+
+void sampling_profiler::handle(int, siginfo_t*, void*) {
+    auto saved_errno = errno;
+    g_in_handler.fetch_add(1);
+    auto profiler = g_active.load();
+    if (profiler != nullptr) {
+        auto vm = t_running;
+        // a run that does not publish its pc would be sampled at a stale one
+        if (vm != nullptr && (vm->m_sampled || vm->m_guarded)) {
+            profiler->sample(*vm);
+        } else {
+            profiler->m_missed.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    g_in_handler.fetch_sub(1);
+    errno = saved_errno;
+}
+
+void sampling_profiler::sample(const interpreter &vm) {
+    auto index = m_next.fetch_add(1, std::memory_order_relaxed);
+    if (index >= m_samples.size()) {
+        return;
+    }
+    auto& s = m_samples[index];
+    s.frames[0] = vm.m_op_pc;
+    s.depth = 1;
+
+    // the outermost code runs with bp 0xFFFF, every frame lies below the
+    // one that called it
+    const uint16_t* words = vm.m_words;
+    uint32_t bp = vm.bp;
+    while (s.depth <= MAX_DEPTH && bp != 0xFFFF && bp >= 2) {
+        s.frames[s.depth++] = words[bp - 2];
+        uint32_t outer = words[bp - 1];
+        if (outer >= bp && outer != 0xFFFF) {
+            break;
+        }
+        bp = outer;
+    }
+}
+
+size_t sampling_profiler::samples() const {
+    return std::min(m_next.load(), m_samples.size());
+}
+
+uint64_t sampling_profiler::dropped() const {
+    auto next = m_next.load();
+    return next > m_samples.size() ? next - m_samples.size() : 0;
+}
+
+uint64_t sampling_profiler::missed() const {
+    return m_missed.load();
+}
+
+void sampling_profiler::write_collapsed(std::ostream &out) const {
+    std::map<std::string, uint64_t> stacks;
+    for (size_t i = 0; i < samples(); ++i) {
+        auto& s = m_samples[i];
+        std::stringstream line;
+        line << std::hex << std::setfill('0');
+        for (auto d = s.depth - 1; d > 0; --d) {
+            // the CALL is the three words before its return address
+            line << std::setw(4) << static_cast<uint16_t>(s.frames[d] - 3) << ';';
+        }
+        line << std::setw(4) << s.frames[0];
+        ++stacks[line.str()];
+    }
+    for (auto& stack : stacks) {
+        out << stack.first << ' ' << stack.second << '\n';
+    }
+}
+
+void sampling_profiler::clear() {
+    m_next.store(0);
+    m_missed.store(0);
+}
+
+sampling_scope::sampling_scope(const interpreter &vm)
+: m_outer(t_running), m_active(g_active.load() != nullptr)
+{
+    t_running = &vm;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+sampling_scope::~sampling_scope() {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    t_running = m_outer;
+}
+
+bool sampling_scope::active() const {
+    return m_active;
+}
@@ -0,0 +1,108 @@
+#ifndef STACKMACHINE_SAMPLING_PROFILER_H
+#define STACKMACHINE_SAMPLING_PROFILER_H
+
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+class interpreter;
+
+//! Samples the pc and call stack of the running interpreters from a SIGPROF
+//! timer instead of counting every instruction, cheap enough to stay on in
+//! production.
+//!
+//! While a profiler is started, a timer on the CPU time of the process
+//! interrupts whichever thread is running. If that thread is inside
+//! interpreter::run(), the handler reads the pc of the current instruction
+//! and walks up to MAX_DEPTH frames of the bp chain, the return address and
+//! old bp that RET reads at bp-2 and bp-1. The pc is the one run() stores
+//! ahead of every instruction while a profiler runs, so runs that started
+//! before the profiler are not sampled. The handler only reads memory
+//! and stores into a buffer allocated up front; once it is full further
+//! samples are dropped. Engines that keep the registers to themselves, such
+//! as the register and compact engines, are not sampled.
+//!
+//! One profiler runs at a time.
+class sampling_profiler {
+public:
+    static const unsigned MAX_DEPTH = 15;
+
+    //! \param capacity the number of samples to keep
+    explicit sampling_profiler(size_t capacity = 1 << 16);
+    //! stops the profiler
+    ~sampling_profiler();
+
+    sampling_profiler(const sampling_profiler&) = delete;
+    sampling_profiler& operator=(const sampling_profiler&) = delete;
+
+    //! Start sampling hz times per second of CPU time.
+    //! \throws std::runtime_error if another profiler runs or the timer
+    //!         cannot be created
+    void start(unsigned hz = 1000);
+
+    //! Stop sampling. When this returns no sample is being recorded.
+    void stop();
+
+    //! Record one sample of vm now, as the timer does. Safe in a signal
+    //! handler.
+    void sample(const interpreter& vm);
+
+    //! \return the number of samples recorded
+    size_t samples() const;
+
+    //! \return the number of samples dropped because the buffer was full
+    uint64_t dropped() const;
+
+    //! \return the number of timer ticks on threads not running a VM, or
+    //!         running one whose run() started before the profiler
+    uint64_t missed() const;
+
+    //! Write the samples as collapsed stacks, one line per distinct stack,
+    //! "f1;f2;...;pc count" from the outermost frame to the sampled pc. A
+    //! frame is the pc of the CALL that built it, all in hexadecimal.
+    //! Call after stop().
+    void write_collapsed(std::ostream& out) const;
+
+    //! Forget all samples. Call after stop().
+    void clear();
+
+private:
+    friend class sampling_scope;
+
+    struct stack_sample {
+        uint16_t depth;
+        //! the pc, then the return addresses from the innermost frame out
+        uint16_t frames[MAX_DEPTH + 1];
+    };
+
+    static void handle(int signal, siginfo_t* info, void* context);
+
+    std::vector<stack_sample> m_samples;
+    std::atomic<size_t> m_next;
+    std::atomic<uint64_t> m_missed;
+    void* m_timer;
+    bool m_running;
+};
+
+//! Publishes the interpreter running on this thread to a started
+//! sampling_profiler for its lifetime; interpreter::run() opens one.
+class sampling_scope {
+public:
+    explicit sampling_scope(const interpreter& vm);
+    ~sampling_scope();
+
+    //! \return true if a profiler was running when the scope opened
+    bool active() const;
+
+    sampling_scope(const sampling_scope&) = delete;
+    sampling_scope& operator=(const sampling_scope&) = delete;
+
+private:
+    const interpreter* m_outer;
+    bool m_active;
+};
+
+#endif //STACKMACHINE_SAMPLING_PROFILER_H
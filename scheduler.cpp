@@ -0,0 +1,289 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <time.h>
+#include "scheduler.h"
+
+namespace {
+    //! \return the CPU time the calling thread used so far
+    double thread_cpu_seconds() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+    }
+}
+
+struct scheduler::task : channel_waiter {
+    scheduler* owner;
+    std::unique_ptr<interpreter> vm;
+    priority level;
+    clock::time_point spawned;
+    clock::time_point queued;
+
+    //! the queue to return to and since when, while parked on a channel
+    size_t home;
+    clock::time_point parked;
+    std::atomic<channel*> parked_on;
+
+    void channel_ready() override {
+        owner->wake(*this);
+    }
+
+    //! guards the accounting, which a worker updates after every slice
+    mutable std::mutex mutex;
+    vm_stats stats;
+};
+
+struct scheduler::run_queue {
+    std::mutex mutex;
+    std::deque<task*> levels[PRIORITY_COUNT];
+};
+
+scheduler::scheduler(unsigned workers, uint64_t slice)
+: m_slice(std::max<uint64_t>(slice, 1)), m_next_queue(0), m_runnable(0), m_sleeping(0), m_steals(0),
+  m_live(0), m_shutdown(false)
+{
+    workers = std::max(workers, 1u);
+    for (unsigned w = 0; w < workers; ++w) {
+        m_queues.push_back(std::unique_ptr<run_queue>(new run_queue));
+    }
+    for (unsigned w = 0; w < workers; ++w) {
+        m_workers.push_back(std::thread(&scheduler::work, this, w));
+    }
+}
+
+scheduler::~scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_idle.notify_all();
+    for (auto& w : m_workers) {
+        w.join();
+    }
+
+    // channels may outlive the scheduler, so no VM may stay registered
+    std::vector<task*> tasks;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& t : m_tasks) {
+            tasks.push_back(t.get());
+        }
+    }
+    for (auto t : tasks) {
+        auto ch = t->parked_on.load();
+        if (ch != nullptr) {
+            ch->unpark(t);
+        }
+    }
+}
+
+scheduler::vm_id scheduler::spawn(std::unique_ptr<interpreter> vm, priority p) {
+    if (!vm) {
+        throw std::domain_error("Cannot spawn an empty VM");
+    }
+    if (p < LOW || p >= PRIORITY_COUNT) {
+        throw std::domain_error("Invalid priority");
+    }
+
+    std::unique_ptr<task> t(new task);
+    t->owner = this;
+    t->home = 0;
+    t->parked_on = nullptr;
+    t->vm = std::move(vm);
+    t->level = p;
+    t->spawned = clock::now();
+    t->stats = vm_stats();
+
+    auto raw = t.get();
+    vm_id id;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        id = m_tasks.size();
+        m_tasks.push_back(std::move(t));
+        ++m_live;
+    }
+
+    push(m_next_queue++ % m_queues.size(), raw);
+    return id;
+}
+
+void scheduler::wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finished.wait(lock, [this] { return m_live == 0; });
+}
+
+size_t scheduler::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_tasks.size();
+}
+
+const interpreter &scheduler::vm(vm_id id) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return *m_tasks.at(id)->vm;
+}
+
+scheduler::vm_stats scheduler::stats(vm_id id) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& t = *m_tasks.at(id);
+    std::lock_guard<std::mutex> task_lock(t.mutex);
+    return t.stats;
+}
+
+double scheduler::latency_percentile(double fraction) const {
+    std::vector<double> latencies;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& t : m_tasks) {
+            std::lock_guard<std::mutex> task_lock(t->mutex);
+            if (t->stats.stopped) {
+                latencies.push_back(t->stats.latency_seconds);
+            }
+        }
+    }
+    if (latencies.empty()) {
+        return 0;
+    }
+
+    // nearest rank
+    fraction = std::min(std::max(fraction, 0.0), 1.0);
+    auto rank = static_cast<size_t>(std::ceil(fraction * latencies.size()));
+    auto nth = latencies.begin() + (rank == 0 ? 0 : rank - 1);
+    std::nth_element(latencies.begin(), nth, latencies.end());
+    return *nth;
+}
+
+uint64_t scheduler::steals() const {
+    return m_steals;
+}
+
+void scheduler::push(size_t queue, task *t) {
+    t->queued = clock::now();
+    // counted first so that a pop never takes the count below zero
+    ++m_runnable;
+    {
+        auto& q = *m_queues[queue];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.levels[t->level].push_back(t);
+    }
+
+    // a worker going to sleep counts itself before it checks m_runnable,
+    // so either it sees this VM or this sees it
+    if (m_sleeping > 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_idle.notify_one();
+    }
+}
+
+scheduler::task *scheduler::pop(size_t queue) {
+    auto& q = *m_queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    for (int level = PRIORITY_COUNT - 1; level >= 0; --level) {
+        auto& fifo = q.levels[level];
+        if (!fifo.empty()) {
+            auto t = fifo.front();
+            fifo.pop_front();
+            --m_runnable;
+            return t;
+        }
+    }
+    return nullptr;
+}
+
+scheduler::task *scheduler::steal(size_t self) {
+    for (size_t i = 1; i < m_queues.size(); ++i) {
+        auto t = pop((self + i) % m_queues.size());
+        if (t) {
+            ++m_steals;
+            return t;
+        }
+    }
+    return nullptr;
+}
+
+void scheduler::work(size_t self) {
+    for (;;) {
+        auto t = pop(self);
+        if (t == nullptr) {
+            t = steal(self);
+        }
+        if (t == nullptr) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            ++m_sleeping;
+            while (!m_shutdown && m_runnable == 0) {
+                m_idle.wait(lock);
+            }
+            --m_sleeping;
+            if (m_shutdown) {
+                return;
+            }
+            continue;
+        }
+
+        if (run_slice(*t)) {
+            finish();
+        } else if (t->vm->blocked_on() != nullptr) {
+            park(self, *t);
+        } else {
+            push(self, t);
+        }
+    }
+}
+
+bool scheduler::run_slice(task &t) {
+    auto start = clock::now();
+    auto cpu_start = thread_cpu_seconds();
+
+    uint64_t executed = 0;
+    bool failed = false;
+    try {
+        executed = t.vm->run(m_slice);
+    } catch (std::exception&) {
+        failed = true;
+    }
+
+    auto cpu = thread_cpu_seconds() - cpu_start;
+    auto end = clock::now();
+
+    std::lock_guard<std::mutex> lock(t.mutex);
+    t.stats.instructions += executed;
+    t.stats.slices += 1;
+    t.stats.cpu_seconds += cpu;
+    t.stats.wait_seconds += std::chrono::duration<double>(start - t.queued).count();
+    if (failed || t.vm->is_stopped()) {
+        t.stats.failed = failed || t.vm->fault() != interpreter::NO_FAULT;
+        t.stats.stopped = true;
+        t.stats.latency_seconds = std::chrono::duration<double>(end - t.spawned).count();
+    }
+    return t.stats.stopped;
+}
+
+void scheduler::park(size_t self, task &t) {
+    auto ch = t.vm->blocked_on();
+    t.home = self;
+    t.parked = clock::now();
+    t.parked_on = ch;
+    // from here on another thread may resume the VM at any time
+    if (!ch->park(&t, t.vm->blocked_sending())) {
+        t.parked_on = nullptr;
+        push(self, &t);
+    }
+}
+
+void scheduler::wake(task &t) {
+    // the channel dropped the registration, which it holds locked
+    t.parked_on = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(t.mutex);
+        t.stats.blocked_seconds += std::chrono::duration<double>(clock::now() - t.parked).count();
+    }
+    push(t.home, &t);
+}
+
+void scheduler::finish() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_live;
+    }
+    m_finished.notify_all();
+}
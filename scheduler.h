@@ -0,0 +1,129 @@
+#ifndef STACKMACHINE_SCHEDULER_H
+#define STACKMACHINE_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "channel.h"
+#include "interpreter.h"
+
+//! Runs many interpreters as green threads on a fixed pool of worker
+//! threads.
+//!
+//! Every worker owns a run queue with one FIFO per priority. A worker takes
+//! the first VM of its highest non-empty priority, runs it for one slice of
+//! at most `slice` instructions and, unless it stopped, appends it to its
+//! own queue again. A worker whose queue is empty steals the VM that waited
+//! longest in the highest priority of another queue, so a worker never idles
+//! while VMs are runnable. Priorities are strict within a queue: a VM only
+//! runs while its worker has nothing more urgent.
+//!
+//! A VM whose SEND or RECV finds its channel full or empty is parked on the
+//! channel and takes no worker until another VM or thread sends, receives or
+//! closes there. VMs waiting for each other in a cycle are never resumed and
+//! keep wait() from returning.
+//!
+//! For every VM the scheduler accounts the instructions, slices and thread
+//! CPU time it used, the time it spent runnable in a queue and the latency
+//! from spawn() to STOP.
+class scheduler {
+public:
+    enum priority {
+        LOW,
+        NORMAL,
+        HIGH,
+        PRIORITY_COUNT
+    };
+
+    typedef size_t vm_id;
+
+    struct vm_stats {
+        uint64_t instructions;
+        uint64_t slices;
+        //! CPU time of the worker threads while they ran the VM
+        double cpu_seconds;
+        //! time spent runnable in a queue
+        double wait_seconds;
+        //! time spent parked on a channel
+        double blocked_seconds;
+        //! time from spawn() to STOP
+        double latency_seconds;
+        bool stopped;
+        //! true if the VM ended with an exception or a fault instead of STOP
+        bool failed;
+    };
+
+    //! \param workers number of worker threads, at least one is started
+    //! \param slice instructions a VM runs before it is preempted
+    explicit scheduler(unsigned workers = std::thread::hardware_concurrency(), uint64_t slice = 10000);
+    //! Stops the workers. VMs that did not stop yet are discarded.
+    ~scheduler();
+
+    scheduler(const scheduler&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+
+    //! Queue a VM, it starts running at once.
+    //! The VM should write its output to a stream of its own, see
+    //! interpreter::set_output().
+    vm_id spawn(std::unique_ptr<interpreter> vm, priority p = NORMAL);
+
+    //! Block until every VM spawned so far stopped.
+    void wait();
+
+    //! \return the number of VMs spawned so far
+    size_t size() const;
+
+    //! \return the state of a VM, only to be looked at once it stopped
+    const interpreter& vm(vm_id id) const;
+
+    //! \return the accounting of a VM, complete once it stopped
+    vm_stats stats(vm_id id) const;
+
+    //! \param fraction between 0 and 1, e.g. 0.99 for the 99th percentile
+    //! \return the latency from spawn() to STOP in seconds that the given
+    //! fraction of the stopped VMs did not exceed, or 0 without any
+    double latency_percentile(double fraction) const;
+
+    //! \return the number of VMs a worker took from another queue
+    uint64_t steals() const;
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    struct task;
+    struct run_queue;
+
+    void work(size_t self);
+    void push(size_t queue, task* t);
+    task* pop(size_t queue);
+    task* steal(size_t self);
+    //! \return true if the VM is done
+    bool run_slice(task& t);
+    void park(size_t self, task& t);
+    void wake(task& t);
+    void finish();
+
+    uint64_t m_slice;
+    std::vector<std::unique_ptr<run_queue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<size_t> m_next_queue;
+    std::atomic<size_t> m_runnable;
+    std::atomic<unsigned> m_sleeping;
+    std::atomic<uint64_t> m_steals;
+
+    //! guards the VM table, the live count and sleeping workers
+    mutable std::mutex m_mutex;
+    std::deque<std::unique_ptr<task>> m_tasks;
+    size_t m_live;
+    std::condition_variable m_idle;
+    std::condition_variable m_finished;
+    bool m_shutdown;
+};
+
+#endif //STACKMACHINE_SCHEDULER_H
@@ -0,0 +1,708 @@
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include "control_flow.h"
+#include "specializer.h"
+
+namespace {
+
+    //! The residual program has to leave room for the STOP the interpreter appends.
+    const size_t MAX_RESIDUAL = 0xFFF0;
+
+    struct slot {
+        bool known;
+        //! the residual program holds the value in its stack, always true
+        //! for unknown slots
+        bool phys;
+        uint16_t value;
+
+        bool operator==(const slot& other) const {
+            return known == other.known && phys == other.phys && (!known || value == other.value);
+        }
+    };
+
+    //! What the specializer knows about the original program's stack at a
+    //! point, and where sp of the residual program stands.
+    struct machine {
+        int32_t sp;
+        //! sp of the residual program
+        int32_t reg;
+        //! the slots behind slots are 0 rather than unknown
+        bool tail_known;
+        std::vector<slot> slots;
+
+        slot tail() const {
+            return slot{tail_known, true, 0};
+        }
+
+        slot at(int32_t i) const {
+            return static_cast<size_t>(i) < slots.size() ? slots[i] : tail();
+        }
+
+        slot& ref(int32_t i) {
+            if (static_cast<size_t>(i) >= slots.size()) {
+                slots.resize(static_cast<size_t>(i) + 1, tail());
+            }
+            return slots[i];
+        }
+
+        void trim() {
+            while (!slots.empty() && slots.back() == tail()) {
+                slots.pop_back();
+            }
+        }
+
+        bool operator==(const machine& other) const {
+            return sp == other.sp && reg == other.reg && tail_known == other.tail_known && slots == other.slots;
+        }
+    };
+
+    bool fold(mnemonic m, uint16_t a, uint16_t b, uint16_t& result) {
+        switch (m) {
+            case mnemonic::ADD:
+                result = static_cast<uint16_t>(a + b);
+                return true;
+            case mnemonic::SUB:
+                result = static_cast<uint16_t>(a - b);
+                return true;
+            case mnemonic::MUL:
+                result = static_cast<uint16_t>(static_cast<uint32_t>(a) * b);
+                return true;
+            case mnemonic::DIV:
+                result = b == 0 ? 0 : static_cast<uint16_t>(a / b);
+                return b != 0;
+            case mnemonic::MOD:
+                result = b == 0 ? 0 : static_cast<uint16_t>(a % b);
+                return b != 0;
+            case mnemonic::EQ:
+                result = a == b ? 1 : 0;
+                return true;
+            case mnemonic::LT:
+                result = a < b ? 1 : 0;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    //! Builds the residual program, one version per jump target and state.
+    class builder {
+    public:
+        builder(const std::vector<uint16_t>& code, const control_flow& cfg, unsigned unroll)
+        : m_code(code), m_cfg(cfg), m_unroll(std::max(unroll, 1u)), m_folded(0)
+        {
+        }
+
+        std::vector<uint16_t> run(const std::vector<uint16_t>& known, uint16_t rest) {
+            m_known = known;
+            m_rest = rest;
+
+            machine start{0, 0, true, {slot{true, true, 0xFFFF}}};
+            m_work.push_back(resolve(0, start));
+            while (!m_work.empty()) {
+                auto id = m_work.back();
+                m_work.pop_back();
+                if (m_versions[id].address < 0) {
+                    m_versions[id].address = static_cast<long>(m_out.size());
+                    trace(id);
+                }
+            }
+            for (auto& p : m_patches) {
+                m_out[p.first] = static_cast<uint16_t>(m_versions[p.second].address);
+            }
+            return m_out;
+        }
+
+        unsigned versions() const {
+            return static_cast<unsigned>(m_versions.size());
+        }
+
+        unsigned folded() const {
+            return m_folded;
+        }
+
+    private:
+        struct version {
+            uint16_t pc;
+            machine state;
+            bool general;
+            //! where the version starts in the residual program, -1 until emitted
+            long address;
+        };
+
+        void trace(size_t id) {
+            auto pc = m_versions[id].pc;
+            auto st = m_versions[id].state;
+
+            for (;;) {
+                auto m = static_cast<mnemonic>(m_code[pc]);
+                auto next = static_cast<uint16_t>(pc + 1 + argument_count(m));
+                auto arg = argument_count(m) > 0 ? m_code[pc + 1u] : static_cast<uint16_t>(0);
+                auto sp = st.sp;
+
+                switch (m) {
+                    case mnemonic::CONST:
+                        push(st, 1);
+                        write(st, sp + 1, arg);
+                        ++m_folded;
+                        break;
+                    case mnemonic::ADD:
+                    case mnemonic::SUB:
+                    case mnemonic::MUL:
+                    case mnemonic::DIV:
+                    case mnemonic::MOD:
+                    case mnemonic::EQ:
+                    case mnemonic::LT: {
+                        auto a = at(st, sp - 1);
+                        auto b = at(st, sp);
+                        uint16_t result;
+                        if (a.known && b.known && fold(m, a.value, b.value, result)) {
+                            write(st, sp - 1, result);
+                            ++m_folded;
+                        } else {
+                            prepare(st, {sp - 1, sp});
+                            copy(pc, next);
+                            forget(st, sp - 1);
+                            --st.reg;
+                        }
+                        pop(st, 1);
+                        break;
+                    }
+                    case mnemonic::NOT: {
+                        auto v = at(st, sp);
+                        if (v.known) {
+                            write(st, sp, v.value == 0 ? 1 : 0);
+                            ++m_folded;
+                        } else {
+                            prepare(st, {});
+                            copy(pc, next);
+                        }
+                        break;
+                    }
+                    case mnemonic::DUP: {
+                        auto v = at(st, sp);
+                        if (v.known) {
+                            push(st, 1);
+                            write(st, sp + 1, v.value);
+                            ++m_folded;
+                        } else {
+                            prepare(st, {});
+                            copy(pc, next);
+                            push(st, 1);
+                            forget(st, sp + 1);
+                            ++st.reg;
+                        }
+                        break;
+                    }
+                    case mnemonic::SWAP: {
+                        auto a = at(st, sp - 1);
+                        auto b = at(st, sp);
+                        if (a.known && b.known) {
+                            write(st, sp - 1, b.value);
+                            write(st, sp, a.value);
+                            ++m_folded;
+                        } else {
+                            prepare(st, {sp - 1, sp});
+                            copy(pc, next);
+                            st.ref(sp - 1) = slot{b.known, true, b.value};
+                            st.ref(sp) = slot{a.known, true, a.value};
+                        }
+                        break;
+                    }
+                    case mnemonic::LDI: {
+                        auto i = at(st, sp);
+                        if (i.known && i.value < specializer::MAX_SLOTS && st.at(i.value).known) {
+                            write(st, sp, st.at(i.value).value);
+                            ++m_folded;
+                            break;
+                        }
+                        if (i.known) {
+                            // the slot read is unknown and thus in place
+                            prepare(st, {sp});
+                        } else {
+                            sync_all(st);
+                        }
+                        copy(pc, next);
+                        forget(st, sp);
+                        break;
+                    }
+                    case mnemonic::STI: {
+                        auto i = at(st, sp - 1);
+                        auto v = at(st, sp);
+                        bool tracked = i.known && i.value < specializer::MAX_SLOTS;
+                        if (tracked && v.known) {
+                            write(st, i.value, v.value);
+                            write(st, sp - 1, v.value);
+                            ++m_folded;
+                        } else {
+                            if (i.known) {
+                                prepare(st, {sp - 1, sp});
+                            } else {
+                                sync_all(st);
+                            }
+                            copy(pc, next);
+                            if (tracked) {
+                                st.ref(i.value) = slot{v.known, true, v.value};
+                            } else if (!i.known) {
+                                forget_all(st);
+                            }
+                            st.ref(sp - 1) = slot{v.known, true, v.value};
+                            --st.reg;
+                        }
+                        pop(st, 1);
+                        break;
+                    }
+                    case mnemonic::LDD:
+                        prepare(st, {sp});
+                        copy(pc, next);
+                        forget(st, sp);
+                        break;
+                    case mnemonic::STD: {
+                        auto v = at(st, sp);
+                        prepare(st, {sp - 1, sp});
+                        copy(pc, next);
+                        st.ref(sp - 1) = slot{v.known, true, v.value};
+                        --st.reg;
+                        pop(st, 1);
+                        break;
+                    }
+                    case mnemonic::VADD:
+                    case mnemonic::VSUB:
+                    case mnemonic::VMUL:
+                    case mnemonic::VEQ:
+                    case mnemonic::VLT:
+                        // writes a slice anywhere on the stack
+                        at(st, sp - 4);
+                        sync_all(st);
+                        copy(pc, next);
+                        forget_all(st);
+                        st.reg -= 4;
+                        pop(st, 4);
+                        break;
+                    case mnemonic::VDOT:
+                        at(st, sp - 2);
+                        sync_all(st);
+                        copy(pc, next);
+                        forget(st, sp - 2);
+                        st.reg -= 2;
+                        pop(st, 2);
+                        break;
+                    case mnemonic::VMAX:
+                        at(st, sp - 1);
+                        sync_all(st);
+                        copy(pc, next);
+                        forget(st, sp - 1);
+                        --st.reg;
+                        pop(st, 1);
+                        break;
+                    case mnemonic::GETBP:
+                        // only CALL and RET move bp
+                        push(st, 1);
+                        write(st, sp + 1, 0xFFFF);
+                        ++m_folded;
+                        break;
+                    case mnemonic::GETSP:
+                        push(st, 1);
+                        write(st, sp + 1, static_cast<uint16_t>(sp));
+                        ++m_folded;
+                        break;
+                    case mnemonic::INCSP:
+                        push(st, arg);
+                        ++m_folded;
+                        break;
+                    case mnemonic::DECSP:
+                        pop(st, arg);
+                        ++m_folded;
+                        break;
+                    case mnemonic::GOTO:
+                        ++m_folded;
+                        if (!enter(arg, st)) {
+                            return;
+                        }
+                        pc = arg;
+                        continue;
+                    case mnemonic::IFZERO:
+                    case mnemonic::IFNZERO:
+                    case mnemonic::DJNZ: {
+                        auto v = at(st, sp);
+                        if (v.known) {
+                            auto value = v.value;
+                            if (m == mnemonic::DJNZ) {
+                                --value;
+                                write(st, sp, value);
+                            } else {
+                                pop(st, 1);
+                            }
+                            ++m_folded;
+                            if ((m == mnemonic::IFZERO) == (value == 0)) {
+                                if (!enter(arg, st)) {
+                                    return;
+                                }
+                                pc = arg;
+                                continue;
+                            }
+                            break;
+                        }
+                        prepare(st, {});
+                        auto after = branched(st, m);
+                        if (needs_merge(arg, after)) {
+                            // the merged target expects every slot in place,
+                            // which has to happen before the branch
+                            sync_all(st);
+                            after = branched(st, m);
+                        }
+                        auto target = resolve(arg, after);
+                        emit({m, 0});
+                        m_patches.push_back(std::make_pair(m_out.size() - 1, target));
+                        m_work.push_back(target);
+                        st = after;
+                        break;
+                    }
+                    case mnemonic::PRINTI:
+                    case mnemonic::PRINTC: {
+                        auto v = at(st, sp);
+                        auto above = st.at(st.reg + 1);
+                        if (v.known && !above.phys) {
+                            // the slot above the residual sp is free to print from
+                            emit({mnemonic::CONST, v.value});
+                            st.ref(st.reg + 1).phys = above.value == v.value;
+                        } else {
+                            prepare(st, {sp});
+                            --st.reg;
+                        }
+                        copy(pc, next);
+                        pop(st, 1);
+                        break;
+                    }
+                    case mnemonic::PRINTS:
+                    case mnemonic::PRINTN: {
+                        // s,v1,...,vn,n => s
+                        auto n = at(st, sp);
+                        if (!n.known) {
+                            std::stringstream message;
+                            message << "Cannot specialize " << m << " of an unknown count at " << pc;
+                            throw std::domain_error(message.str());
+                        }
+                        for (int32_t i = sp - n.value; i <= sp; ++i) {
+                            check(i);
+                            materialize(st, i);
+                        }
+                        move(st, sp);
+                        copy(pc, next);
+                        st.reg -= n.value + 1;
+                        pop(st, n.value + 1);
+                        break;
+                    }
+                    case mnemonic::LDARGS:
+                        ldargs(st);
+                        break;
+                    case mnemonic::READ:
+                    case mnemonic::RECV:
+                        // s => s,v,f
+                        prepare(st, {});
+                        copy(pc, next);
+                        push(st, 2);
+                        forget(st, sp + 1);
+                        forget(st, sp + 2);
+                        st.reg += 2;
+                        break;
+                    case mnemonic::SEND:
+                        prepare(st, {sp});
+                        copy(pc, next);
+                        --st.reg;
+                        pop(st, 1);
+                        break;
+                    case mnemonic::CLOSE:
+                        copy(pc, next);
+                        break;
+                    case mnemonic::NOOP:
+                        ++m_folded;
+                        break;
+                    case mnemonic::STOP:
+                        for (int32_t i = 0; i <= sp; ++i) {
+                            materialize(st, i);
+                        }
+                        move(st, sp);
+                        copy(pc, next);
+                        return;
+                    default: {
+                        std::stringstream message;
+                        message << "Cannot specialize " << m << " at " << pc;
+                        throw std::domain_error(message.str());
+                    }
+                }
+
+                pc = next;
+                if (m_cfg.is_leader(pc) && !enter(pc, st)) {
+                    return;
+                }
+            }
+        }
+
+        //! Continue the current trace at pc with st.
+        //! \return false if the version at pc was emitted before, a jump to it ends the trace
+        bool enter(uint16_t pc, machine& st) {
+            auto id = resolve(pc, st);
+            auto& v = m_versions[id];
+            if (v.address >= 0) {
+                emit({mnemonic::GOTO, 0});
+                m_patches.push_back(std::make_pair(m_out.size() - 1, id));
+                return false;
+            }
+            v.address = static_cast<long>(m_out.size());
+            st = v.state;
+            return true;
+        }
+
+        //! Find or create the version of pc for st. Merging into a general
+        //! version may emit code that puts every slot in place first.
+        size_t resolve(uint16_t pc, machine& st) {
+            st.trim();
+            auto& ids = m_at[pc];
+            size_t specific = 0;
+            for (auto id : ids) {
+                if (m_versions[id].state == st) {
+                    return id;
+                }
+                specific += m_versions[id].general ? 0 : 1;
+            }
+            if (specific < m_unroll) {
+                return add(pc, st, false);
+            }
+
+            sync_all(st);
+            st.trim();
+            auto key = std::make_pair(pc, st.sp);
+            auto found = m_general.find(key);
+            machine merged = st;
+            if (found != m_general.end()) {
+                merged = meet(m_versions[found->second].state, st);
+            } else {
+                for (auto id : ids) {
+                    if (m_versions[id].state.sp == st.sp) {
+                        merged = meet(m_versions[id].state, merged);
+                    }
+                }
+            }
+            for (auto id : ids) {
+                if (m_versions[id].state == merged) {
+                    return id;
+                }
+            }
+            auto id = add(pc, merged, true);
+            m_general[key] = id;
+            return id;
+        }
+
+        bool needs_merge(uint16_t pc, machine st) {
+            st.trim();
+            size_t specific = 0;
+            for (auto id : m_at[pc]) {
+                if (m_versions[id].state == st) {
+                    return false;
+                }
+                specific += m_versions[id].general ? 0 : 1;
+            }
+            return specific >= m_unroll;
+        }
+
+        size_t add(uint16_t pc, const machine& st, bool general) {
+            if (m_versions.size() >= specializer::MAX_VERSIONS) {
+                throw std::domain_error("The program does not specialize within the version limit");
+            }
+            m_versions.push_back(version{pc, st, general, -1});
+            m_at[pc].push_back(m_versions.size() - 1);
+            return m_versions.size() - 1;
+        }
+
+        //! The slots both states agree on, all in place.
+        static machine meet(const machine& a, const machine& b) {
+            machine result{a.sp, a.sp, a.tail_known && b.tail_known, {}};
+            auto size = std::max(a.slots.size(), b.slots.size());
+            for (size_t i = 0; i < size; ++i) {
+                auto x = a.at(static_cast<int32_t>(i));
+                auto y = b.at(static_cast<int32_t>(i));
+                bool same = x.known && y.known && x.value == y.value;
+                result.slots.push_back(slot{same, true, same ? x.value : static_cast<uint16_t>(0)});
+            }
+            result.trim();
+            return result;
+        }
+
+        //! The state after a dynamic branch with st, the same on both edges.
+        static machine branched(const machine& st, mnemonic m) {
+            auto after = st;
+            if (m == mnemonic::DJNZ) {
+                after.ref(st.sp) = slot{false, true, 0};
+            } else {
+                --after.sp;
+                --after.reg;
+            }
+            return after;
+        }
+
+        void ldargs(machine& st) {
+            auto n = static_cast<int32_t>(m_known.size());
+            auto sp = st.sp;
+            push(st, n + m_rest + 1);
+            auto count = static_cast<uint16_t>(n + m_rest);
+            for (int32_t k = 0; k < n; ++k) {
+                write(st, sp + 1 + k, m_known[k]);
+            }
+            if (m_rest == 0) {
+                write(st, st.sp, count);
+                ++m_folded;
+                return;
+            }
+            // the residual program loads the rest behind the known arguments
+            // and counts only them
+            move(st, sp + n);
+            emit({mnemonic::LDARGS});
+            for (int32_t k = 0; k < m_rest; ++k) {
+                forget(st, sp + n + 1 + k);
+            }
+            st.ref(st.sp) = slot{true, n == 0, count};
+            st.reg = st.sp;
+        }
+
+        slot at(const machine& st, int32_t i) const {
+            check(i);
+            return st.at(i);
+        }
+
+        void write(machine& st, int32_t i, uint16_t value) {
+            auto& s = st.ref(i);
+            bool in_place = s.phys && s.known && s.value == value;
+            s = slot{true, in_place, value};
+        }
+
+        void forget(machine& st, int32_t i) {
+            st.ref(i) = slot{false, true, 0};
+        }
+
+        void forget_all(machine& st) {
+            st.tail_known = false;
+            for (auto& s : st.slots) {
+                s = slot{false, true, 0};
+            }
+        }
+
+        void push(machine& st, int32_t n) {
+            st.sp += n;
+            check(st.sp);
+        }
+
+        void pop(machine& st, int32_t n) {
+            st.sp -= n;
+            check(st.sp);
+        }
+
+        static void check(int32_t i) {
+            if (i < 0 || i >= specializer::MAX_SLOTS) {
+                throw std::domain_error("The stack leaves the slots the specializer tracks");
+            }
+        }
+
+        //! Write the known value of slot i into the residual stack.
+        void materialize(machine& st, int32_t i) {
+            auto s = st.at(i);
+            if (s.phys) {
+                return;
+            }
+            move(st, i - 1);
+            emit({mnemonic::CONST, s.value});
+            st.reg = i;
+            st.ref(i).phys = true;
+        }
+
+        //! Put the slots read by the next instruction in place and move the
+        //! residual sp to sp.
+        void prepare(machine& st, std::initializer_list<int32_t> reads) {
+            for (auto i : reads) {
+                check(i);
+                materialize(st, i);
+            }
+            move(st, st.sp);
+        }
+
+        //! Put every slot in place, for instructions that may read any of them.
+        void sync_all(machine& st) {
+            for (size_t i = 0; i < st.slots.size(); ++i) {
+                materialize(st, static_cast<int32_t>(i));
+            }
+            move(st, st.sp);
+        }
+
+        void move(machine& st, int32_t reg) {
+            if (reg > st.reg) {
+                emit({mnemonic::INCSP, static_cast<uint16_t>(reg - st.reg)});
+            } else if (reg < st.reg) {
+                emit({mnemonic::DECSP, static_cast<uint16_t>(st.reg - reg)});
+            }
+            st.reg = reg;
+        }
+
+        void copy(uint16_t from, uint16_t to) {
+            if (m_out.size() + (to - from) > MAX_RESIDUAL) {
+                throw std::domain_error("The residual program is too large");
+            }
+            m_out.insert(m_out.end(), m_code.begin() + from, m_code.begin() + to);
+        }
+
+        void emit(std::initializer_list<uint16_t> words) {
+            if (m_out.size() + words.size() > MAX_RESIDUAL) {
+                throw std::domain_error("The residual program is too large");
+            }
+            m_out.insert(m_out.end(), words);
+        }
+
+        const std::vector<uint16_t>& m_code;
+        const control_flow& m_cfg;
+        unsigned m_unroll;
+        unsigned m_folded;
+        std::vector<uint16_t> m_known;
+        int32_t m_rest;
+
+        std::vector<version> m_versions;
+        std::map<uint16_t, std::vector<size_t>> m_at;
+        std::map<std::pair<uint16_t, int32_t>, size_t> m_general;
+        std::vector<size_t> m_work;
+        //! jump arguments in the residual program and the version they go to
+        std::vector<std::pair<size_t, size_t>> m_patches;
+        std::vector<uint16_t> m_out;
+    };
+}
+
+const int32_t specializer::MAX_SLOTS;
+const unsigned specializer::MAX_VERSIONS;
+
+specializer::specializer(unsigned unroll)
+: m_unroll(unroll), m_versions(0), m_folded(0)
+{
+}
+
+std::vector<uint16_t> specializer::run(const std::vector<uint16_t> &code, const std::vector<uint16_t> &known,
+                                       uint16_t rest) {
+    m_versions = 0;
+    m_folded = 0;
+
+    auto full = code;
+    full.push_back(mk_stop());
+    verify(full);
+    control_flow cfg(full);
+
+    builder b(full, cfg, m_unroll);
+    auto residual = b.run(known, rest);
+    m_versions = b.versions();
+    m_folded = b.folded();
+    return residual;
+}
+
+unsigned specializer::versions() const {
+    return m_versions;
+}
+
+unsigned specializer::folded() const {
+    return m_folded;
+}
@@ -0,0 +1,59 @@
+#ifndef STACKMACHINE_SPECIALIZER_H
+#define STACKMACHINE_SPECIALIZER_H
+
+#include <cstdint>
+#include <vector>
+
+//! Specializes a program to the leading command line arguments.
+//!
+//! The specializer executes the program on an abstract machine that knows
+//! the value of some stack slots. LDARGS pushes the known arguments, and
+//! every instruction whose operands are known is evaluated on the spot:
+//! arithmetic, stack shuffling, loads and stores at known addresses and
+//! branches on known conditions. Everything else is emitted into a residual
+//! program, after the known operands it reads have been written with CONST.
+//!
+//! Every jump target is specialized once per abstract state it is reached
+//! with, so a loop whose counter is known unrolls into straight-line code.
+//! Once an instruction has `unroll` versions, the next state reaching it is
+//! merged with the others, keeping only the slots that agree, so loops that
+//! depend on the remaining arguments still end up as loops.
+//!
+//! Running the residual program with the remaining arguments gives the same
+//! output as the original with all of them, and it stops with the same sp
+//! and slots 0..sp. CALL, TCALL, RET, READN and BREAK are not supported,
+//! PRINTS and PRINTN only with a known count, and the stack must stay below
+//! MAX_SLOTS along every path.
+class specializer {
+public:
+    static const int32_t MAX_SLOTS = 4096;
+    static const unsigned MAX_VERSIONS = 16384;
+
+    //! \param unroll versions of a jump target before they are merged
+    explicit specializer(unsigned unroll = 32);
+
+    //! \param code the program as passed to the interpreter
+    //! \param known the first command line arguments
+    //! \param rest the number of arguments that follow them, the residual
+    //!        program expects exactly that many
+    //! \return the residual program
+    //! \throws std::domain_error if the program does not verify, executes an
+    //!         unsupported instruction or moves sp out of the tracked slots,
+    //!         or if the residual program would not fit the address space
+    std::vector<uint16_t> run(const std::vector<uint16_t>& code, const std::vector<uint16_t>& known,
+                              uint16_t rest);
+
+    //! \return the number of specialized blocks in the last residual program
+    unsigned versions() const;
+
+    //! \return the number of instructions the last run evaluated instead of
+    //!         emitting them
+    unsigned folded() const;
+
+private:
+    unsigned m_unroll;
+    unsigned m_versions;
+    unsigned m_folded;
+};
+
+#endif //STACKMACHINE_SPECIALIZER_H
@@ -0,0 +1,717 @@
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include "control_flow.h"
+#include "ssa.h"
+
+namespace {
+    //! Deeper stacks are rejected, every block keeps one value per slot.
+    const int32_t MAX_DEPTH = 4096;
+
+    [[noreturn]] void unsupported(const char* reason, size_t pc) {
+        std::stringstream msg;
+        msg << reason << " at pc=0x" << std::hex << pc;
+        throw std::domain_error(msg.str());
+    }
+
+    ssa_op binary_op(mnemonic m) {
+        switch (m) {
+            case mnemonic::ADD: return ssa_op::ADD;
+            case mnemonic::SUB: return ssa_op::SUB;
+            case mnemonic::MUL: return ssa_op::MUL;
+            case mnemonic::DIV: return ssa_op::DIV;
+            case mnemonic::MOD: return ssa_op::MOD;
+            case mnemonic::EQ: return ssa_op::EQ;
+            default: return ssa_op::LT;
+        }
+    }
+
+    const char* op_name(ssa_op op) {
+        switch (op) {
+            case ssa_op::UNDEF: return "undef";
+            case ssa_op::CONST: return "const";
+            case ssa_op::PHI: return "phi";
+            case ssa_op::READ_VALUE: return "read.value";
+            case ssa_op::READ_FLAG: return "read.flag";
+            case ssa_op::ADD: return "add";
+            case ssa_op::SUB: return "sub";
+            case ssa_op::MUL: return "mul";
+            case ssa_op::DIV: return "div";
+            case ssa_op::MOD: return "mod";
+            case ssa_op::EQ: return "eq";
+            case ssa_op::LT: return "lt";
+            case ssa_op::NOT: return "not";
+        }
+        return "?";
+    }
+
+    //! Symbolic execution of one block on a vector of slot values.
+    class block_lifter {
+    public:
+        block_lifter(ssa_function& f, uint32_t block, bool zero_shadow)
+        : m_f(f), m_block(block), m_zero_shadow(zero_shadow),
+          m_slots(f.blocks[block].entry),
+          m_depth(static_cast<int32_t>(f.blocks[block].entry.size()) - 1)
+        {
+        }
+
+        void run();
+
+    private:
+        uint32_t slot(int32_t pos) {
+            while (static_cast<int32_t>(m_slots.size()) <= pos) {
+                // slots above sp keep what was popped, a fresh stack is zero
+                m_slots.push_back(m_zero_shadow ? m_f.constant(0) : m_f.undef());
+            }
+            return m_slots[pos];
+        }
+
+        void set(int32_t pos, uint32_t v) {
+            slot(pos);
+            m_slots[pos] = v;
+            m_f.max_slot = std::max(m_f.max_slot, static_cast<uint32_t>(pos));
+        }
+
+        uint16_t address(int32_t pos, uint16_t pc) {
+            auto& v = m_f.values[slot(pos)];
+            if (v.op != ssa_op::CONST) {
+                unsupported("Computed stack address", pc);
+            }
+            if (v.constant > MAX_DEPTH) {
+                unsupported("Stack address out of range", pc);
+            }
+            return v.constant;
+        }
+
+        void adjust(int32_t delta, uint16_t pc) {
+            m_depth += delta;
+            if (m_depth < 0) {
+                unsupported("Stack underflow", pc);
+            }
+            if (m_depth > MAX_DEPTH) {
+                unsupported("Stack too deep", pc);
+            }
+        }
+
+        uint32_t make(ssa_op op, const std::vector<uint32_t>& args);
+
+        ssa_function& m_f;
+        uint32_t m_block;
+        bool m_zero_shadow;
+        std::vector<uint32_t> m_slots;
+        int32_t m_depth;
+    };
+
+    uint32_t block_lifter::make(ssa_op op, const std::vector<uint32_t> &args) {
+        bool constant = true;
+        for (auto a : args) {
+            constant = constant && m_f.values[a].op == ssa_op::CONST;
+        }
+        uint16_t result;
+        if (constant && ssa_fold(op, m_f.values[args[0]].constant,
+                                 args.size() > 1 ? m_f.values[args[1]].constant : 0, result)) {
+            return m_f.constant(result);
+        }
+        return m_f.add_value(op, m_block, args);
+    }
+
+    void block_lifter::run() {
+
+        auto& code = m_f.code;
+        auto pc = m_f.blocks[m_block].pc;
+        auto end = m_f.blocks[m_block].end;
+
+        while (pc < end) {
+            auto m = static_cast<mnemonic>(code[pc]);
+            auto arg = argument_count(m) > 0 ? code[pc + 1] : 0;
+
+            switch (m) {
+                case mnemonic::CONST:
+                    adjust(1, pc);
+                    set(m_depth, m_f.constant(arg));
+                    break;
+                case mnemonic::ADD:
+                case mnemonic::SUB:
+                case mnemonic::MUL:
+                case mnemonic::DIV:
+                case mnemonic::MOD:
+                case mnemonic::EQ:
+                case mnemonic::LT: {
+                    adjust(-1, pc);
+                    auto v = make(binary_op(m), {slot(m_depth), slot(m_depth + 1)});
+                    set(m_depth, v);
+                    if (!m_f.is_pure(v) && m_f.values[v].op != ssa_op::CONST) {
+                        // a division by zero traps, even if the result is never used
+                        m_f.blocks[m_block].effects.push_back({ssa_effect::CHECK, v, NO_SSA});
+                    }
+                    break;
+                }
+                case mnemonic::NOT:
+                    set(m_depth, make(ssa_op::NOT, {slot(m_depth)}));
+                    break;
+                case mnemonic::DUP:
+                    adjust(1, pc);
+                    set(m_depth, slot(m_depth - 1));
+                    break;
+                case mnemonic::SWAP: {
+                    if (m_depth < 1) {
+                        unsupported("Stack underflow", pc);
+                    }
+                    auto a = slot(m_depth - 1);
+                    set(m_depth - 1, slot(m_depth));
+                    set(m_depth, a);
+                    break;
+                }
+                case mnemonic::LDI:
+                    set(m_depth, slot(address(m_depth, pc)));
+                    break;
+                case mnemonic::STI: {
+                    adjust(-1, pc);
+                    auto i = address(m_depth, pc);
+                    auto v = slot(m_depth + 1);
+                    set(i, v);
+                    set(m_depth, v);
+                    break;
+                }
+                case mnemonic::GETBP:
+                    adjust(1, pc);
+                    set(m_depth, m_f.constant(0xFFFF));
+                    break;
+                case mnemonic::GETSP:
+                    adjust(1, pc);
+                    set(m_depth, m_f.constant(static_cast<uint16_t>(m_depth - 1)));
+                    break;
+                case mnemonic::INCSP:
+                    adjust(arg, pc);
+                    break;
+                case mnemonic::DECSP:
+                    adjust(-static_cast<int32_t>(arg), pc);
+                    break;
+                case mnemonic::PRINTI:
+                case mnemonic::PRINTC: {
+                    auto kind = m == mnemonic::PRINTI ? ssa_effect::PRINTI : ssa_effect::PRINTC;
+                    m_f.blocks[m_block].effects.push_back({kind, slot(m_depth), NO_SSA});
+                    adjust(-1, pc);
+                    break;
+                }
+                case mnemonic::READ: {
+                    auto value = m_f.add_value(ssa_op::READ_VALUE, m_block, {});
+                    auto flag = m_f.add_value(ssa_op::READ_FLAG, m_block, {});
+                    m_f.blocks[m_block].effects.push_back({ssa_effect::READ, value, flag});
+                    adjust(2, pc);
+                    set(m_depth - 1, value);
+                    set(m_depth, flag);
+                    break;
+                }
+                case mnemonic::IFZERO:
+                case mnemonic::IFNZERO:
+                    m_f.blocks[m_block].cond = slot(m_depth);
+                    adjust(-1, pc);
+                    break;
+                case mnemonic::GOTO:
+                case mnemonic::STOP:
+                case mnemonic::NOOP:
+                    break;
+                default:
+                    unsupported("Instruction not supported by the SSA form", pc);
+            }
+
+            pc = static_cast<uint16_t>(pc + 1 + argument_count(m));
+        }
+
+        m_slots.resize(static_cast<size_t>(m_depth) + 1);
+        m_f.blocks[m_block].exit = m_slots;
+    }
+}
+
+bool ssa_fold(ssa_op op, uint16_t a, uint16_t b, uint16_t &result) {
+    switch (op) {
+        case ssa_op::ADD: result = static_cast<uint16_t>(a + b); return true;
+        case ssa_op::SUB: result = static_cast<uint16_t>(a - b); return true;
+        case ssa_op::MUL: result = static_cast<uint16_t>(static_cast<uint32_t>(a) * b); return true;
+        case ssa_op::DIV:
+            if (b == 0) {
+                return false;
+            }
+            result = static_cast<uint16_t>(a / b);
+            return true;
+        case ssa_op::MOD:
+            if (b == 0) {
+                return false;
+            }
+            result = static_cast<uint16_t>(a % b);
+            return true;
+        case ssa_op::EQ: result = static_cast<uint16_t>(a == b ? 1 : 0); return true;
+        case ssa_op::LT: result = static_cast<uint16_t>(a < b ? 1 : 0); return true;
+        case ssa_op::NOT: result = static_cast<uint16_t>(a == 0 ? 1 : 0); return true;
+        default: return false;
+    }
+}
+
+std::vector<uint32_t> ssa_block::successors() const {
+    switch (terminator) {
+        case GOTO: return {succ[0]};
+        case IFZERO:
+        case IFNZERO: return {succ[0], succ[1]};
+        default: return {};
+    }
+}
+
+uint32_t ssa_function::constant(uint16_t v) {
+    auto it = m_constants.find(v);
+    if (it != m_constants.end()) {
+        return it->second;
+    }
+    auto id = add_value(ssa_op::CONST, NO_SSA, {});
+    values[id].constant = v;
+    m_constants[v] = id;
+    return id;
+}
+
+uint32_t ssa_function::undef() {
+    if (m_undef == NO_SSA) {
+        m_undef = add_value(ssa_op::UNDEF, NO_SSA, {});
+    }
+    return m_undef;
+}
+
+uint32_t ssa_function::add_value(ssa_op op, uint32_t block, const std::vector<uint32_t> &args) {
+    values.push_back({op, 0, block, args, false});
+    return static_cast<uint32_t>(values.size() - 1);
+}
+
+void ssa_function::substitute(std::vector<uint32_t> map) {
+
+    auto resolve = [&map](uint32_t v) {
+        if (v == NO_SSA) {
+            return v;
+        }
+        auto r = v;
+        while (map[r] != r) {
+            r = map[r];
+        }
+        // shorten the chain for the next lookup
+        while (map[v] != r) {
+            auto next = map[v];
+            map[v] = r;
+            v = next;
+        }
+        return r;
+    };
+
+    for (auto& value : values) {
+        for (auto& a : value.args) {
+            a = resolve(a);
+        }
+    }
+
+    for (auto& block : blocks) {
+        for (auto& v : block.entry) {
+            v = resolve(v);
+        }
+        for (auto& v : block.exit) {
+            v = resolve(v);
+        }
+        for (auto& e : block.effects) {
+            if (e.kind != ssa_effect::READ) {
+                e.a = resolve(e.a);
+            }
+        }
+        block.cond = resolve(block.cond);
+
+        // a replaced value loses its home and is computed where it is used
+        std::vector<uint32_t> homes;
+        for (auto v : block.homes) {
+            if (resolve(v) == v) {
+                homes.push_back(v);
+            } else {
+                values[v].hoisted = false;
+            }
+        }
+        block.homes = homes;
+    }
+}
+
+void ssa_function::remove_edge(uint32_t pred, uint32_t block) {
+    auto& preds = blocks[block].preds;
+    auto it = std::find(preds.begin(), preds.end(), pred);
+    if (it == preds.end()) {
+        return;
+    }
+    auto idx = static_cast<size_t>(it - preds.begin());
+    preds.erase(it);
+
+    for (auto& value : values) {
+        if (value.op == ssa_op::PHI && value.block == block && idx < value.args.size()) {
+            value.args.erase(value.args.begin() + idx);
+        }
+    }
+}
+
+std::vector<uint32_t> ssa_function::reverse_postorder() const {
+
+    std::vector<uint32_t> order;
+    std::vector<bool> visited(blocks.size(), false);
+    std::vector<std::pair<uint32_t, size_t>> stack;
+
+    stack.push_back({0, 0});
+    visited[0] = true;
+
+    while (!stack.empty()) {
+        auto b = stack.back().first;
+        auto succs = blocks[b].successors();
+        auto& next = stack.back().second;
+
+        if (next < succs.size()) {
+            auto s = succs[next++];
+            if (!visited[s] && !blocks[s].removed) {
+                visited[s] = true;
+                stack.push_back({s, 0});
+            }
+        } else {
+            order.push_back(b);
+            stack.pop_back();
+        }
+    }
+
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+std::vector<uint32_t> ssa_function::immediate_dominators() const {
+
+    auto order = reverse_postorder();
+    std::vector<uint32_t> index(blocks.size(), NO_SSA);
+    for (size_t i = 0; i < order.size(); ++i) {
+        index[order[i]] = static_cast<uint32_t>(i);
+    }
+
+    std::vector<uint32_t> idom(blocks.size(), NO_SSA);
+    idom[0] = 0;
+
+    auto intersect = [&](uint32_t a, uint32_t b) {
+        while (a != b) {
+            while (index[a] > index[b]) {
+                a = idom[a];
+            }
+            while (index[b] > index[a]) {
+                b = idom[b];
+            }
+        }
+        return a;
+    };
+
+    // Cooper, Harvey and Kennedy: iterate over the reverse postorder until stable
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); ++i) {
+            auto b = order[i];
+            auto new_idom = NO_SSA;
+            for (auto p : blocks[b].preds) {
+                if (index[p] == NO_SSA || idom[p] == NO_SSA) {
+                    continue;
+                }
+                new_idom = new_idom == NO_SSA ? p : intersect(p, new_idom);
+            }
+            if (new_idom != idom[b]) {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+
+    idom[0] = NO_SSA;
+    return idom;
+}
+
+bool ssa_function::remove_trivial_phis() {
+
+    bool any = false;
+    for (bool changed = true; changed; ) {
+        changed = false;
+        std::vector<uint32_t> map(values.size());
+        for (uint32_t v = 0; v < map.size(); ++v) {
+            map[v] = v;
+            auto& value = values[v];
+            if (value.op != ssa_op::PHI) {
+                continue;
+            }
+            auto same = NO_SSA;
+            bool trivial = true;
+            for (auto a : value.args) {
+                if (a == v || a == same) {
+                    continue;
+                }
+                trivial = trivial && same == NO_SSA;
+                same = a;
+            }
+            if (trivial && same != NO_SSA) {
+                map[v] = same;
+                kill(v);
+                changed = true;
+            }
+        }
+        if (changed) {
+            substitute(map);
+            any = true;
+        }
+    }
+    return any;
+}
+
+void ssa_function::kill(uint32_t v) {
+    auto& value = values[v];
+    value.op = ssa_op::UNDEF;
+    value.block = NO_SSA;
+    value.args.clear();
+    value.hoisted = false;
+}
+
+bool ssa_function::is_pure(uint32_t v) const {
+    auto& value = values[v];
+    switch (value.op) {
+        case ssa_op::ADD:
+        case ssa_op::SUB:
+        case ssa_op::MUL:
+        case ssa_op::EQ:
+        case ssa_op::LT:
+        case ssa_op::NOT:
+            return true;
+        case ssa_op::DIV:
+        case ssa_op::MOD: {
+            auto& divisor = values[value.args[1]];
+            return divisor.op == ssa_op::CONST && divisor.constant != 0;
+        }
+        default:
+            return false;
+    }
+}
+
+ssa_function lift(const std::vector<uint16_t> &code) {
+
+    ssa_function f;
+    f.code = code;
+    f.code.push_back(mk_stop());
+    f.max_slot = 0;
+
+    verify(f.code);
+    control_flow cfg(f.code);
+
+    // block 0 holds the initial state, the original blocks follow
+    std::map<uint16_t, uint32_t> block_at;
+    f.blocks.push_back({0, 0, {}, {}, {}, ssa_block::GOTO, NO_SSA, {1, NO_SSA}, {}, {}, false});
+    for (auto pc : cfg.leaders()) {
+        block_at[pc] = static_cast<uint32_t>(f.blocks.size());
+        f.blocks.push_back({pc, pc, {}, {}, {}, ssa_block::GOTO, NO_SSA, {NO_SSA, NO_SSA}, {}, {}, false});
+    }
+
+    for (size_t b = 1; b < f.blocks.size(); ++b) {
+        auto& block = f.blocks[b];
+        auto pc = block.pc;
+        for (;;) {
+            auto instr = cfg.at(pc);
+            auto m = instr.mnem();
+            auto next = cfg.next(pc);
+
+            if (m == mnemonic::GOTO || m == mnemonic::STOP) {
+                block.terminator = m == mnemonic::GOTO ? ssa_block::GOTO : ssa_block::STOP;
+                block.succ[0] = m == mnemonic::GOTO ? block_at[instr.arg(0)] : NO_SSA;
+                block.end = next;
+                break;
+            }
+            if (m == mnemonic::IFZERO || m == mnemonic::IFNZERO) {
+                block.terminator = m == mnemonic::IFZERO ? ssa_block::IFZERO : ssa_block::IFNZERO;
+                block.succ[0] = block_at[instr.arg(0)];
+                block.succ[1] = block_at[next];
+                block.end = next;
+                break;
+            }
+            if (cfg.is_leader(next)) {
+                block.succ[0] = block_at[next];
+                block.end = next;
+                break;
+            }
+            pc = next;
+        }
+    }
+
+    for (uint32_t b = 0; b < f.blocks.size(); ++b) {
+        for (auto s : f.blocks[b].successors()) {
+            f.blocks[s].preds.push_back(b);
+        }
+    }
+
+    // lift in reverse postorder, so all forward predecessors are done
+    std::vector<bool> lifted(f.blocks.size(), false);
+    for (auto b : f.reverse_postorder()) {
+        auto& block = f.blocks[b];
+
+        if (b == 0) {
+            block.entry = {f.constant(0xFFFF)};
+            block.exit = block.entry;
+            lifted[b] = true;
+            continue;
+        }
+
+        bool zero_shadow = false;
+        if (block.preds.size() == 1 && lifted[block.preds[0]]) {
+            block.entry = f.blocks[block.preds[0]].exit;
+            zero_shadow = block.preds[0] == 0;
+        } else {
+            size_t depth = 0;
+            for (auto p : block.preds) {
+                if (lifted[p]) {
+                    depth = f.blocks[p].exit.size();
+                    break;
+                }
+            }
+            for (size_t pos = 0; pos < depth; ++pos) {
+                f.blocks[b].entry.push_back(f.add_value(ssa_op::PHI, b, {}));
+            }
+        }
+
+        block_lifter(f, b, zero_shadow).run();
+        lifted[b] = true;
+    }
+
+    for (uint32_t b = 1; b < f.blocks.size(); ++b) {
+        auto& block = f.blocks[b];
+        for (auto p : block.preds) {
+            if (f.blocks[p].exit.size() != block.entry.size()) {
+                unsupported("Inconsistent stack depth", block.pc);
+            }
+        }
+        for (size_t pos = 0; pos < block.entry.size(); ++pos) {
+            auto& phi = f.values[block.entry[pos]];
+            if (phi.op != ssa_op::PHI || phi.block != b || !phi.args.empty()) {
+                continue;
+            }
+            for (auto p : block.preds) {
+                phi.args.push_back(f.blocks[p].exit[pos]);
+            }
+        }
+    }
+
+    f.remove_trivial_phis();
+
+    // content of slots that were never written must not be observable
+    std::vector<bool> maybe_undef(f.values.size(), false);
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (size_t v = 0; v < f.values.size(); ++v) {
+            auto& value = f.values[v];
+            bool undef = value.op == ssa_op::UNDEF;
+            if (value.op == ssa_op::PHI) {
+                for (auto a : value.args) {
+                    undef = undef || maybe_undef[a];
+                }
+            }
+            if (undef && !maybe_undef[v]) {
+                maybe_undef[v] = true;
+                changed = true;
+            }
+        }
+    }
+    for (size_t v = 0; v < f.values.size(); ++v) {
+        auto& value = f.values[v];
+        if (value.op == ssa_op::PHI || value.block == NO_SSA) {
+            continue;
+        }
+        for (auto a : value.args) {
+            if (maybe_undef[a]) {
+                unsupported("Read of an uninitialized stack slot", f.blocks[value.block].pc);
+            }
+        }
+    }
+    for (auto& block : f.blocks) {
+        bool used = block.cond != NO_SSA && maybe_undef[block.cond];
+        for (auto& e : block.effects) {
+            used = used || (e.kind != ssa_effect::READ && maybe_undef[e.a]);
+        }
+        if (block.terminator == ssa_block::STOP) {
+            for (auto v : block.exit) {
+                used = used || maybe_undef[v];
+            }
+        }
+        if (used) {
+            unsupported("Read of an uninitialized stack slot", block.pc);
+        }
+    }
+
+    return f;
+}
+
+std::ostream& operator<<(std::ostream& str, const ssa_function& f) {
+
+    auto name = [&f](uint32_t v) {
+        std::stringstream s;
+        if (v == NO_SSA) {
+            s << "-";
+        } else if (f.values[v].op == ssa_op::CONST) {
+            s << f.values[v].constant;
+        } else if (f.values[v].op == ssa_op::UNDEF) {
+            s << "undef";
+        } else {
+            s << "%" << v;
+        }
+        return s.str();
+    };
+
+    auto slots = [&](const std::vector<uint32_t>& state) {
+        std::stringstream s;
+        s << "[";
+        for (size_t pos = 0; pos < state.size(); ++pos) {
+            s << (pos > 0 ? " " : "") << name(state[pos]);
+        }
+        s << "]";
+        return s.str();
+    };
+
+    for (auto b : f.reverse_postorder()) {
+        auto& block = f.blocks[b];
+        str << "block " << b << " (pc=0x" << std::hex << block.pc << std::dec << ") preds";
+        for (auto p : block.preds) {
+            str << " " << p;
+        }
+        str << std::endl << "  entry " << slots(block.entry) << std::endl;
+
+        for (size_t v = 0; v < f.values.size(); ++v) {
+            auto& value = f.values[v];
+            if (value.block != b || value.op == ssa_op::UNDEF) {
+                continue;
+            }
+            str << "  %" << v << " = " << op_name(value.op);
+            for (auto a : value.args) {
+                str << " " << name(a);
+            }
+            str << (value.hoisted ? " (home)" : "") << std::endl;
+        }
+
+        for (auto& e : block.effects) {
+            static const char* kinds[] = {"printi", "printc", "read", "check"};
+            str << "  " << kinds[e.kind] << " " << name(e.a);
+            if (e.kind == ssa_effect::READ) {
+                str << " " << name(e.b);
+            }
+            str << std::endl;
+        }
+
+        str << "  exit " << slots(block.exit) << std::endl;
+        switch (block.terminator) {
+            case ssa_block::GOTO:
+                str << "  goto " << block.succ[0] << std::endl;
+                break;
+            case ssa_block::IFZERO:
+            case ssa_block::IFNZERO:
+                str << (block.terminator == ssa_block::IFZERO ? "  ifzero " : "  ifnzero ")
+                    << name(block.cond) << " " << block.succ[0] << " else " << block.succ[1] << std::endl;
+                break;
+            case ssa_block::STOP:
+                str << "  stop" << std::endl;
+                break;
+        }
+    }
+
+    return str;
+}
@@ -0,0 +1,138 @@
+#ifndef STACKMACHINE_SSA_H
+#define STACKMACHINE_SSA_H
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <vector>
+#include "instructions.h"
+
+//! Operations of SSA values. Arithmetic wraps around like uint16.
+enum class ssa_op : uint8_t {
+    UNDEF,      // a stack slot whose content does not matter
+    CONST,
+    PHI,        // one argument per predecessor of the block
+    READ_VALUE, // the value word of a READ effect
+    READ_FLAG,  // the flag word of a READ effect
+    ADD, SUB, MUL, DIV, MOD, EQ, LT, NOT
+};
+
+const uint32_t NO_SSA = 0xFFFFFFFFu;
+
+struct ssa_value {
+    ssa_op op;
+    uint16_t constant;
+    //! the defining block, NO_SSA for constants and UNDEF
+    uint32_t block;
+    std::vector<uint32_t> args;
+    //! the value is computed once into a home slot of its block, see licm_pass
+    bool hoisted;
+};
+
+//! Side effects of a block, kept in program order.
+struct ssa_effect {
+    enum kind_t { PRINTI, PRINTC, READ, CHECK } kind;
+    //! the printed or checked value, or the READ_VALUE of a READ
+    uint32_t a;
+    //! the READ_FLAG of a READ
+    uint32_t b;
+};
+
+//! A basic block. Its state is the content of the stack slots 0..depth,
+//! which are absolute addresses since the stack depth at every block is
+//! known statically.
+struct ssa_block {
+    enum terminator_t { GOTO, IFZERO, IFNZERO, STOP };
+
+    //! the leader and end of the original code, pc == end for the start block
+    uint16_t pc;
+    uint16_t end;
+    std::vector<uint32_t> preds;
+    //! value of each stack slot when the block is entered
+    std::vector<uint32_t> entry;
+    std::vector<ssa_effect> effects;
+    terminator_t terminator;
+    uint32_t cond;
+    //! the jump target and, for IFZERO/IFNZERO, the fall-through block
+    uint32_t succ[2];
+    //! value of each stack slot when the block is left, without the condition
+    std::vector<uint32_t> exit;
+    //! values computed into their home slot at the end of the block
+    std::vector<uint32_t> homes;
+    bool removed;
+
+    std::vector<uint32_t> successors() const;
+};
+
+//! A program in SSA form. Block 0 is an artificial start block holding the
+//! initial machine state, the other blocks follow the original basic blocks.
+struct ssa_function {
+    std::vector<ssa_value> values;
+    std::vector<ssa_block> blocks;
+    //! the original program including its trailing STOP
+    std::vector<uint16_t> code;
+    //! highest stack slot the original program writes
+    uint32_t max_slot;
+
+    uint32_t constant(uint16_t v);
+    uint32_t undef();
+    uint32_t add_value(ssa_op op, uint32_t block, const std::vector<uint32_t>& args);
+
+    //! Replace every use of value v by map[v]. Chains are followed.
+    void substitute(std::vector<uint32_t> map);
+
+    //! Replace phis whose arguments are a single value besides themselves
+    //! by that value.
+    //! \return true if a phi was removed
+    bool remove_trivial_phis();
+
+    //! Turn a value without uses into UNDEF.
+    void kill(uint32_t v);
+
+    //! Drop the edge pred -> block together with its phi arguments.
+    void remove_edge(uint32_t pred, uint32_t block);
+
+    //! Reachable blocks in reverse postorder starting at block 0.
+    std::vector<uint32_t> reverse_postorder() const;
+
+    //! Immediate dominators, NO_SSA for block 0 and unreachable blocks.
+    std::vector<uint32_t> immediate_dominators() const;
+
+    //! Check whether v is an arithmetic value that can be computed anywhere
+    //! its arguments are available. DIV and MOD only qualify once their
+    //! divisor is a known non-zero constant, before that they may trap.
+    bool is_pure(uint32_t v) const;
+
+private:
+    std::map<uint16_t, uint32_t> m_constants;
+    uint32_t m_undef = NO_SSA;
+};
+
+//! Evaluate an arithmetic operation.
+//! \param op the operation, ADD to NOT
+//! \param a the first argument
+//! \param b the second argument, ignored by NOT
+//! \param result receives the result
+//! \return false for a division by zero
+bool ssa_fold(ssa_op op, uint16_t a, uint16_t b, uint16_t& result);
+
+//! Lift verified bytecode into SSA form. Supported are programs whose stack
+//! depth is the same on every path to an instruction and whose LDI/STI
+//! addresses are constants within the block, which covers straight
+//! arithmetic, loops, READ and output. The optimized program must start on
+//! a fresh interpreter; only the output and stack slots 0..sp at STOP are
+//! guaranteed, slots above sp may differ.
+//! \param code the program as passed to the interpreter
+//! \throws std::domain_error if the program does not verify or uses
+//!         CALL, TCALL, RET, LDARGS, READN, channel instructions or
+//!         computed stack addresses
+ssa_function lift(const std::vector<uint16_t>& code);
+
+//! Generate bytecode from SSA form. Every block keeps its stack slots in
+//! place; a block whose generated code would be longer than the original
+//! one reuses the original code.
+std::vector<uint16_t> lower(const ssa_function& f);
+
+std::ostream& operator<<(std::ostream& str, const ssa_function& f);
+
+#endif //STACKMACHINE_SSA_H
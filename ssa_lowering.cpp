@@ -0,0 +1,529 @@
+#include <algorithm>
+#include <stdexcept>
+#include "ssa.h"
+
+namespace {
+    const uint32_t UNKNOWN = NO_SSA;
+
+    //! Values nested deeper are not recomputed but taken from a slot.
+    const int MAX_NESTING = 32;
+
+    //! Rebuilding the exit state is tried from this many slots below the top.
+    const int32_t REBUILD_WINDOW = 32;
+
+    mnemonic op_mnemonic(ssa_op op) {
+        switch (op) {
+            case ssa_op::ADD: return mnemonic::ADD;
+            case ssa_op::SUB: return mnemonic::SUB;
+            case ssa_op::MUL: return mnemonic::MUL;
+            case ssa_op::DIV: return mnemonic::DIV;
+            case ssa_op::MOD: return mnemonic::MOD;
+            case ssa_op::EQ: return mnemonic::EQ;
+            case ssa_op::LT: return mnemonic::LT;
+            default: return mnemonic::NOT;
+        }
+    }
+
+    bool is_arithmetic(ssa_op op) {
+        return op >= ssa_op::ADD && op <= ssa_op::NOT;
+    }
+
+    //! Code of one block whose jump targets and home slots are filled in later.
+    struct block_code {
+        std::vector<uint16_t> code;
+        std::vector<std::pair<size_t, uint32_t>> jumps;
+        std::vector<std::pair<size_t, uint32_t>> homes;
+        size_t instructions = 0;
+        uint32_t max_slot = 0;
+    };
+
+    //! Generates the stack code of one block while tracking which value each
+    //! slot holds. Pops are lazy: slots between the logical and the physical
+    //! sp still hold their values and can be pushed again for free.
+    class emitter {
+    public:
+        emitter(const ssa_function& f, uint32_t block, const std::vector<uint32_t>& slots, int32_t depth)
+        : m_f(f), m_block(block), m_slots(slots), m_lsp(depth), m_psp(depth)
+        {
+        }
+
+        bool push(uint32_t v, int nesting = 0);
+        bool store(int32_t pos, uint32_t v);
+        bool store_home(uint32_t v);
+        bool rebuild(const std::vector<uint32_t>& target, int32_t k, bool ascending);
+
+        //! Make the physical sp the logical one.
+        void sync() {
+            if (m_psp > m_lsp) {
+                emit(mnemonic::DECSP, static_cast<uint16_t>(m_psp - m_lsp));
+                m_psp = m_lsp;
+            }
+        }
+
+        void pop() {
+            --m_lsp;
+        }
+
+        void emit(mnemonic m) {
+            m_out.code.push_back(m);
+            ++m_out.instructions;
+        }
+
+        void emit(mnemonic m, uint16_t arg) {
+            emit(m);
+            m_out.code.push_back(arg);
+        }
+
+        void emit_jump(mnemonic m, uint32_t block) {
+            emit(m, 0);
+            m_out.jumps.push_back({m_out.code.size() - 1, block});
+        }
+
+        //! Account for an instruction executed at the synced sp.
+        void executed(int32_t delta) {
+            m_lsp += delta;
+            m_psp = m_lsp;
+        }
+
+        uint32_t at(int32_t slot) const {
+            return slot >= 0 && slot < static_cast<int32_t>(m_slots.size()) ? m_slots[slot] : UNKNOWN;
+        }
+
+        void write(int32_t slot, uint32_t v) {
+            if (slot >= static_cast<int32_t>(m_slots.size())) {
+                m_slots.resize(static_cast<size_t>(slot) + 1, UNKNOWN);
+            }
+            m_slots[slot] = v;
+            m_out.max_slot = std::max(m_out.max_slot, static_cast<uint32_t>(slot));
+        }
+
+        int32_t lsp() const {
+            return m_lsp;
+        }
+
+        block_code& out() {
+            return m_out;
+        }
+
+    private:
+        const ssa_function& m_f;
+        uint32_t m_block;
+        std::vector<uint32_t> m_slots;
+        std::vector<uint32_t> m_stored;
+        int32_t m_lsp;
+        int32_t m_psp;
+        block_code m_out;
+    };
+
+    bool emitter::push(uint32_t v, int nesting) {
+
+        auto& value = m_f.values[v];
+
+        if (value.op == ssa_op::UNDEF) {
+            if (m_psp > m_lsp) {
+                ++m_lsp;
+            } else {
+                emit(mnemonic::INCSP, 1);
+                executed(1);
+            }
+            return true;
+        }
+
+        if (at(m_lsp + 1) == v) {
+            if (m_psp <= m_lsp) {
+                emit(mnemonic::INCSP, 1);
+                m_psp = m_lsp + 1;
+            }
+            ++m_lsp;
+            return true;
+        }
+
+        // arguments of a recomputed value may still be in place, so every
+        // other way of pushing syncs by itself
+        if (value.op == ssa_op::CONST) {
+            sync();
+            emit(mnemonic::CONST, value.constant);
+            write(m_lsp + 1, v);
+            executed(1);
+            return true;
+        }
+
+        // a hoisted value is in its home outside its block or once stored
+        if (value.hoisted && (value.block != m_block
+                              || std::find(m_stored.begin(), m_stored.end(), v) != m_stored.end())) {
+            sync();
+            emit(mnemonic::CONST, 0);
+            m_out.homes.push_back({m_out.code.size() - 1, v});
+            emit(mnemonic::LDI);
+            write(m_lsp + 1, v);
+            executed(1);
+            return true;
+        }
+
+        // a copy in a slot, CONST j would overwrite the slot right above sp
+        if (at(m_lsp) == v) {
+            sync();
+            emit(mnemonic::DUP);
+            write(m_lsp + 1, v);
+            executed(1);
+            return true;
+        }
+        for (int32_t j = static_cast<int32_t>(m_slots.size()) - 1; j >= 0; --j) {
+            if (j != m_lsp + 1 && m_slots[j] == v) {
+                sync();
+                emit(mnemonic::CONST, static_cast<uint16_t>(j));
+                emit(mnemonic::LDI);
+                write(m_lsp + 1, v);
+                executed(1);
+                return true;
+            }
+        }
+
+        if (!is_arithmetic(value.op) || nesting > MAX_NESTING) {
+            return false;
+        }
+
+        for (auto a : value.args) {
+            if (!push(a, nesting + 1)) {
+                return false;
+            }
+        }
+        sync();
+        emit(op_mnemonic(value.op));
+        if (value.op == ssa_op::NOT) {
+            write(m_lsp, v);
+        } else {
+            write(m_lsp - 1, v);
+            executed(-1);
+        }
+        return true;
+    }
+
+    bool emitter::store(int32_t pos, uint32_t v) {
+        // s => s,i,v => s,v
+        sync();
+        emit(mnemonic::CONST, static_cast<uint16_t>(pos));
+        write(m_lsp + 1, UNKNOWN);
+        executed(1);
+        if (!push(v)) {
+            return false;
+        }
+        sync();
+        emit(mnemonic::STI);
+        write(pos, v);
+        write(m_lsp - 1, v);
+        executed(-1);
+        pop();
+        return true;
+    }
+
+    bool emitter::store_home(uint32_t v) {
+        sync();
+        emit(mnemonic::CONST, 0);
+        m_out.homes.push_back({m_out.code.size() - 1, v});
+        write(m_lsp + 1, UNKNOWN);
+        executed(1);
+
+        // computed here, so not loaded from the home
+        auto& value = m_f.values[v];
+        if (!is_arithmetic(value.op)) {
+            return false;
+        }
+        for (auto a : value.args) {
+            if (!push(a)) {
+                return false;
+            }
+        }
+        sync();
+        emit(op_mnemonic(value.op));
+        executed(value.op == ssa_op::NOT ? 0 : -1);
+        write(m_lsp, v);
+
+        emit(mnemonic::STI);
+        write(m_lsp - 1, v);
+        executed(-1);
+        pop();
+        m_stored.push_back(v);
+        return true;
+    }
+
+    bool emitter::rebuild(const std::vector<uint32_t>& target, int32_t k, bool ascending) {
+
+        auto depth = static_cast<int32_t>(target.size()) - 1;
+
+        // slots below k that change are stored
+        std::vector<int32_t> stores;
+        for (int32_t pos = 0; pos < k; ++pos) {
+            auto v = target[pos];
+            if (m_f.values[v].op != ssa_op::UNDEF && at(pos) != v) {
+                stores.push_back(pos);
+            }
+        }
+        if (!ascending) {
+            std::reverse(stores.begin(), stores.end());
+        }
+        for (auto pos : stores) {
+            // every store must see the old values it reads
+            if (!store(pos, target[pos])) {
+                return false;
+            }
+        }
+        for (auto pos : stores) {
+            if (at(pos) != target[pos]) {
+                return false;
+            }
+        }
+
+        // the rest is pushed again, values still in place cost nothing
+        m_lsp = k - 1;
+        for (int32_t pos = k; pos <= depth; ++pos) {
+            if (m_psp == m_lsp) {
+                int32_t run = 0;
+                while (pos + run <= depth && (at(pos + run) == target[pos + run]
+                                              || m_f.values[target[pos + run]].op == ssa_op::UNDEF)) {
+                    ++run;
+                }
+                if (run > 1) {
+                    emit(mnemonic::INCSP, static_cast<uint16_t>(run));
+                    executed(run);
+                    pos += run - 1;
+                    continue;
+                }
+            }
+            if (!push(target[pos])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<uint32_t> entry_slots(const ssa_function& f, uint32_t b, uint32_t zero) {
+        auto& block = f.blocks[b];
+        std::vector<uint32_t> slots = block.entry;
+        // a fresh stack is zero above slot 0
+        if (block.preds.size() == 1 && block.preds[0] == 0 && zero != NO_SSA) {
+            slots.resize(f.max_slot + 1, zero);
+        }
+        return slots;
+    }
+
+    //! Lower the effects and the exit state of a block.
+    bool lower_block(const ssa_function& f, uint32_t b, uint32_t zero, block_code& result) {
+
+        auto& block = f.blocks[b];
+        auto depth_in = static_cast<int32_t>(block.entry.size()) - 1;
+        emitter e(f, b, entry_slots(f, b, zero), depth_in);
+
+        for (auto& effect : block.effects) {
+            switch (effect.kind) {
+                case ssa_effect::PRINTI:
+                case ssa_effect::PRINTC:
+                    if (!e.push(effect.a)) {
+                        return false;
+                    }
+                    e.sync();
+                    e.emit(effect.kind == ssa_effect::PRINTI ? mnemonic::PRINTI : mnemonic::PRINTC);
+                    e.executed(-1);
+                    break;
+                case ssa_effect::CHECK:
+                    if (!e.push(effect.a)) {
+                        return false;
+                    }
+                    e.pop();
+                    break;
+                case ssa_effect::READ:
+                    e.sync();
+                    e.emit(mnemonic::READ);
+                    e.write(e.lsp() + 1, effect.a);
+                    e.write(e.lsp() + 2, effect.b);
+                    e.executed(2);
+                    break;
+            }
+        }
+
+        // try rebuilding from the slots near the top and keep the shortest code
+        auto depth_out = static_cast<int32_t>(block.exit.size()) - 1;
+        auto top = std::min(e.lsp(), depth_out) + 1;
+        bool found = false;
+        for (int32_t k = top; k >= std::max(0, top - REBUILD_WINDOW); --k) {
+            for (int order = 0; order < 2; ++order) {
+                emitter attempt = e;
+                if (!attempt.rebuild(block.exit, k, order == 0)) {
+                    continue;
+                }
+                for (auto h : block.homes) {
+                    if (!attempt.store_home(h)) {
+                        return false;
+                    }
+                }
+                if (block.terminator == ssa_block::IFZERO || block.terminator == ssa_block::IFNZERO) {
+                    if (!attempt.push(block.cond)) {
+                        continue;
+                    }
+                    attempt.sync();
+                    attempt.emit_jump(block.terminator == ssa_block::IFZERO ? mnemonic::IFZERO : mnemonic::IFNZERO,
+                                      block.succ[0]);
+                    attempt.executed(-1);
+                } else {
+                    attempt.sync();
+                }
+                if (!found || attempt.out().instructions < result.instructions) {
+                    result = attempt.out();
+                    found = true;
+                }
+            }
+        }
+        return found;
+    }
+
+    //! The original code of a block, for when it is shorter.
+    block_code original_block(const ssa_function& f, uint32_t b) {
+
+        auto& block = f.blocks[b];
+        block_code result;
+
+        auto pc = block.pc;
+        mnemonic last = mnemonic::NOOP;
+        while (pc < block.end) {
+            auto m = static_cast<mnemonic>(f.code[pc]);
+            auto next = static_cast<uint16_t>(pc + 1 + argument_count(m));
+            last = m;
+            if (next == block.end && (m == mnemonic::GOTO || m == mnemonic::IFZERO
+                                      || m == mnemonic::IFNZERO || m == mnemonic::STOP)) {
+                break;
+            }
+            result.code.insert(result.code.end(), f.code.begin() + pc, f.code.begin() + next);
+            ++result.instructions;
+            pc = next;
+        }
+        result.max_slot = f.max_slot;
+
+        bool branches = last == mnemonic::IFZERO || last == mnemonic::IFNZERO;
+        bool keeps_branch = block.terminator == ssa_block::IFZERO || block.terminator == ssa_block::IFNZERO;
+
+        // the original code leaves the condition on top of the exit state
+        auto state = block.exit;
+        if (branches && keeps_branch) {
+            state.push_back(block.cond);
+        }
+        emitter e(f, b, state, static_cast<int32_t>(state.size()) - 1);
+        if (branches && !keeps_branch) {
+            // the condition turned out constant
+            e.emit(mnemonic::DECSP, 1);
+        }
+        for (auto h : block.homes) {
+            if (!e.store_home(h)) {
+                throw std::domain_error("Hoisted value is not computable in its block");
+            }
+        }
+        e.sync();
+        if (keeps_branch) {
+            e.emit_jump(block.terminator == ssa_block::IFZERO ? mnemonic::IFZERO : mnemonic::IFNZERO,
+                        block.succ[0]);
+        }
+
+        auto& tail = e.out();
+        auto offset = result.code.size();
+        result.code.insert(result.code.end(), tail.code.begin(), tail.code.end());
+        for (auto& j : tail.jumps) {
+            result.jumps.push_back({j.first + offset, j.second});
+        }
+        for (auto& h : tail.homes) {
+            result.homes.push_back({h.first + offset, h.second});
+        }
+        result.instructions += tail.instructions;
+        result.max_slot = std::max(result.max_slot, tail.max_slot);
+        return result;
+    }
+}
+
+std::vector<uint16_t> lower(const ssa_function &f) {
+
+    uint32_t zero = NO_SSA;
+    for (uint32_t v = 0; v < f.values.size(); ++v) {
+        if (f.values[v].op == ssa_op::CONST && f.values[v].constant == 0) {
+            zero = v;
+        }
+    }
+
+    // blocks keep the order of the original code
+    auto order = f.reverse_postorder();
+    std::sort(order.begin(), order.end());
+
+    std::vector<block_code> codes;
+    for (auto b : order) {
+        block_code lowered;
+        auto original = original_block(f, b);
+        if (lower_block(f, b, zero, lowered) && lowered.instructions < original.instructions) {
+            codes.push_back(lowered);
+        } else {
+            codes.push_back(original);
+        }
+    }
+
+    std::vector<uint16_t> out;
+    std::vector<std::pair<size_t, uint32_t>> jumps;
+    std::vector<std::pair<size_t, uint32_t>> homes;
+    std::vector<size_t> address(f.blocks.size(), 0);
+    uint32_t max_slot = f.max_slot;
+
+    for (size_t i = 0; i < order.size(); ++i) {
+        auto b = order[i];
+        auto& block = f.blocks[b];
+        auto& c = codes[i];
+        auto next = i + 1 < order.size() ? order[i + 1] : NO_SSA;
+
+        address[b] = out.size();
+        for (auto& j : c.jumps) {
+            jumps.push_back({j.first + out.size(), j.second});
+        }
+        for (auto& h : c.homes) {
+            homes.push_back({h.first + out.size(), h.second});
+        }
+        out.insert(out.end(), c.code.begin(), c.code.end());
+        max_slot = std::max(max_slot, c.max_slot);
+
+        switch (block.terminator) {
+            case ssa_block::STOP:
+                out.push_back(mk_stop());
+                break;
+            case ssa_block::GOTO:
+                if (block.succ[0] != next) {
+                    out.push_back(mnemonic::GOTO);
+                    jumps.push_back({out.size(), block.succ[0]});
+                    out.push_back(0);
+                }
+                break;
+            case ssa_block::IFZERO:
+            case ssa_block::IFNZERO:
+                if (block.succ[1] != next) {
+                    out.push_back(mnemonic::GOTO);
+                    jumps.push_back({out.size(), block.succ[1]});
+                    out.push_back(0);
+                }
+                break;
+        }
+    }
+
+    for (auto& j : jumps) {
+        out[j.first] = static_cast<uint16_t>(address[j.second]);
+    }
+
+    // home slots lie above everything the program touches
+    std::vector<uint32_t> home_of(f.values.size(), 0);
+    uint32_t next_home = max_slot + 1;
+    for (auto& h : homes) {
+        if (home_of[h.second] == 0) {
+            home_of[h.second] = next_home++;
+        }
+        out[h.first] = static_cast<uint16_t>(home_of[h.second]);
+    }
+    if (next_home >= 0xFFFF) {
+        throw std::domain_error("No room for the home slots of hoisted values");
+    }
+    if (out.size() > 0xFFFF) {
+        throw std::domain_error("Optimized program too large");
+    }
+
+    return out;
+}
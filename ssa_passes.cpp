@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include "inliner.h"
+#include "loop_fusion.h"
+#include "ssa_passes.h"
+
+namespace {
+    //! Values defined in each block, in order of definition.
+    std::vector<std::vector<uint32_t>> values_by_block(const ssa_function& f) {
+        std::vector<std::vector<uint32_t>> result(f.blocks.size());
+        for (uint32_t v = 0; v < f.values.size(); ++v) {
+            auto b = f.values[v].block;
+            if (b != NO_SSA) {
+                result[b].push_back(v);
+            }
+        }
+        return result;
+    }
+
+    bool dominates(const std::vector<uint32_t>& idom, uint32_t a, uint32_t b) {
+        while (b != NO_SSA) {
+            if (a == b) {
+                return true;
+            }
+            b = idom[b];
+        }
+        return false;
+    }
+
+    bool contains(const std::vector<uint32_t>& v, uint32_t x) {
+        return std::find(v.begin(), v.end(), x) != v.end();
+    }
+
+    //! Lattice of the constant propagation: unknown yet, a constant, or varying.
+    struct lattice {
+        enum { TOP, CONSTANT, BOTTOM } state;
+        uint16_t constant;
+
+        bool operator!=(const lattice& other) const {
+            return state != other.state || (state == CONSTANT && constant != other.constant);
+        }
+    };
+
+    lattice meet(const lattice& a, const lattice& b) {
+        if (a.state == lattice::TOP) {
+            return b;
+        }
+        if (b.state == lattice::TOP) {
+            return a;
+        }
+        if (a.state == lattice::BOTTOM || b.state == lattice::BOTTOM || a.constant != b.constant) {
+            return {lattice::BOTTOM, 0};
+        }
+        return a;
+    }
+}
+
+std::string sccp_pass::name() const {
+    return "sccp";
+}
+
+bool sccp_pass::run(ssa_function &f) {
+
+    auto defined = values_by_block(f);
+    auto order = f.reverse_postorder();
+
+    std::vector<lattice> cell(f.values.size(), lattice{lattice::TOP, 0});
+    for (uint32_t v = 0; v < f.values.size(); ++v) {
+        auto& value = f.values[v];
+        if (value.op == ssa_op::CONST) {
+            cell[v] = {lattice::CONSTANT, value.constant};
+        } else if (value.op == ssa_op::UNDEF || value.block == NO_SSA) {
+            cell[v] = {lattice::BOTTOM, 0};
+        }
+    }
+
+    std::vector<bool> executable(f.blocks.size(), false);
+    std::set<std::pair<uint32_t, uint32_t>> edges;
+    executable[0] = true;
+
+    auto evaluate = [&](uint32_t b, uint32_t v) {
+        auto& value = f.values[v];
+        switch (value.op) {
+            case ssa_op::PHI: {
+                lattice result{lattice::TOP, 0};
+                auto& preds = f.blocks[b].preds;
+                for (size_t i = 0; i < preds.size() && i < value.args.size(); ++i) {
+                    if (edges.count({preds[i], b}) != 0) {
+                        result = meet(result, cell[value.args[i]]);
+                    }
+                }
+                return result;
+            }
+            case ssa_op::READ_VALUE:
+            case ssa_op::READ_FLAG:
+                return lattice{lattice::BOTTOM, 0};
+            default: {
+                uint16_t args[2] = {0, 0};
+                for (size_t i = 0; i < value.args.size(); ++i) {
+                    auto& a = cell[value.args[i]];
+                    if (a.state != lattice::CONSTANT) {
+                        return a;
+                    }
+                    args[i] = a.constant;
+                }
+                uint16_t result;
+                if (!ssa_fold(value.op, args[0], args[1], result)) {
+                    return lattice{lattice::BOTTOM, 0};
+                }
+                return lattice{lattice::CONSTANT, result};
+            }
+        }
+    };
+
+    // the lattice only descends, so sweeping until nothing changes terminates
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto b : order) {
+            if (!executable[b]) {
+                continue;
+            }
+            for (auto v : defined[b]) {
+                auto l = evaluate(b, v);
+                if (l != cell[v]) {
+                    cell[v] = l;
+                    changed = true;
+                }
+            }
+
+            auto& block = f.blocks[b];
+            std::vector<uint32_t> taken;
+            if (block.terminator == ssa_block::GOTO) {
+                taken.push_back(block.succ[0]);
+            } else if (block.terminator != ssa_block::STOP) {
+                auto& c = cell[block.cond];
+                if (c.state == lattice::BOTTOM) {
+                    taken = {block.succ[0], block.succ[1]};
+                } else if (c.state == lattice::CONSTANT) {
+                    bool jumps = (c.constant == 0) == (block.terminator == ssa_block::IFZERO);
+                    taken.push_back(block.succ[jumps ? 0 : 1]);
+                }
+            }
+            for (auto s : taken) {
+                if (edges.insert({b, s}).second) {
+                    executable[s] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    bool result = false;
+
+    // branches on constants become jumps
+    for (auto b : order) {
+        auto& block = f.blocks[b];
+        if (!executable[b] || (block.terminator != ssa_block::IFZERO && block.terminator != ssa_block::IFNZERO)) {
+            continue;
+        }
+        if (cell[block.cond].state != lattice::CONSTANT) {
+            continue;
+        }
+        bool jumps = (cell[block.cond].constant == 0) == (block.terminator == ssa_block::IFZERO);
+        auto target = block.succ[jumps ? 0 : 1];
+        auto other = block.succ[jumps ? 1 : 0];
+        f.remove_edge(b, other);
+        block.terminator = ssa_block::GOTO;
+        block.succ[0] = target;
+        block.succ[1] = NO_SSA;
+        block.cond = NO_SSA;
+        result = true;
+    }
+
+    // blocks that never execute disappear with their outgoing edges
+    for (auto b : order) {
+        if (executable[b]) {
+            continue;
+        }
+        for (auto s : f.blocks[b].successors()) {
+            f.remove_edge(b, s);
+        }
+        f.blocks[b].removed = true;
+        f.blocks[b].preds.clear();
+        f.blocks[b].effects.clear();
+        f.blocks[b].homes.clear();
+        result = true;
+    }
+
+    std::vector<uint32_t> constants(f.values.size(), NO_SSA);
+    for (uint32_t v = 0; v < cell.size(); ++v) {
+        if (cell[v].state == lattice::CONSTANT && f.values[v].op != ssa_op::CONST) {
+            constants[v] = f.constant(cell[v].constant);
+        }
+    }
+    std::vector<uint32_t> map(f.values.size());
+    for (uint32_t v = 0; v < map.size(); ++v) {
+        map[v] = v < constants.size() && constants[v] != NO_SSA ? constants[v] : v;
+        if (map[v] != v) {
+            f.kill(v);
+            result = true;
+        }
+    }
+    f.substitute(map);
+
+    // a constant division that was not folded does not trap
+    for (auto& block : f.blocks) {
+        auto& effects = block.effects;
+        auto end = std::remove_if(effects.begin(), effects.end(), [&f](const ssa_effect& e) {
+            return e.kind == ssa_effect::CHECK && f.values[e.a].op == ssa_op::CONST;
+        });
+        result = result || end != effects.end();
+        effects.erase(end, effects.end());
+    }
+
+    return f.remove_trivial_phis() || result;
+}
+
+std::string dce_pass::name() const {
+    return "dce";
+}
+
+bool dce_pass::run(ssa_function &f) {
+
+    bool result = false;
+
+    // a division whose divisor became a non-zero constant cannot trap
+    for (auto& block : f.blocks) {
+        auto& effects = block.effects;
+        auto end = std::remove_if(effects.begin(), effects.end(), [&f](const ssa_effect& e) {
+            return e.kind == ssa_effect::CHECK && f.is_pure(e.a);
+        });
+        result = result || end != effects.end();
+        effects.erase(end, effects.end());
+    }
+
+    std::vector<bool> live(f.values.size(), false);
+    std::vector<uint32_t> work;
+    auto mark = [&](uint32_t v) {
+        if (v != NO_SSA && !live[v]) {
+            live[v] = true;
+            work.push_back(v);
+        }
+    };
+
+    for (auto b : f.reverse_postorder()) {
+        auto& block = f.blocks[b];
+        for (auto& e : block.effects) {
+            mark(e.a);
+            mark(e.b);
+        }
+        mark(block.cond);
+        if (block.terminator == ssa_block::STOP) {
+            for (auto v : block.exit) {
+                mark(v);
+            }
+        }
+    }
+    while (!work.empty()) {
+        auto v = work.back();
+        work.pop_back();
+        for (auto a : f.values[v].args) {
+            mark(a);
+        }
+    }
+
+    auto undef = f.undef();
+    live.resize(f.values.size(), true);
+
+    std::vector<uint32_t> map(f.values.size());
+    for (uint32_t v = 0; v < map.size(); ++v) {
+        auto& value = f.values[v];
+        map[v] = v;
+        if (live[v] || value.op == ssa_op::UNDEF || value.op == ssa_op::CONST) {
+            continue;
+        }
+        map[v] = undef;
+        f.kill(v);
+        result = true;
+    }
+    if (result) {
+        f.substitute(map);
+    }
+    return result;
+}
+
+std::string cse_pass::name() const {
+    return "cse";
+}
+
+bool cse_pass::run(ssa_function &f) {
+
+    auto defined = values_by_block(f);
+    auto idom = f.immediate_dominators();
+
+    std::vector<uint32_t> map(f.values.size());
+    for (uint32_t v = 0; v < map.size(); ++v) {
+        map[v] = v;
+    }
+    auto resolve = [&map](uint32_t v) {
+        while (map[v] != v) {
+            v = map[v];
+        }
+        return v;
+    };
+
+    typedef std::pair<ssa_op, std::vector<uint32_t>> key_t;
+    std::vector<std::map<key_t, uint32_t>> available(f.blocks.size());
+
+    bool result = false;
+
+    // dominators come first in reverse postorder
+    for (auto b : f.reverse_postorder()) {
+        for (auto v : defined[b]) {
+            auto& value = f.values[v];
+            if (!f.is_pure(v) || value.hoisted) {
+                continue;
+            }
+            key_t key{value.op, {}};
+            for (auto a : value.args) {
+                key.second.push_back(resolve(a));
+            }
+            if (value.op == ssa_op::ADD || value.op == ssa_op::MUL || value.op == ssa_op::EQ) {
+                std::sort(key.second.begin(), key.second.end());
+            }
+
+            auto found = NO_SSA;
+            for (auto d = b; d != NO_SSA && found == NO_SSA; d = idom[d]) {
+                auto it = available[d].find(key);
+                if (it != available[d].end()) {
+                    found = it->second;
+                }
+            }
+            if (found != NO_SSA) {
+                map[v] = found;
+                result = true;
+            } else {
+                available[b][key] = v;
+            }
+        }
+    }
+
+    if (result) {
+        f.substitute(map);
+        for (uint32_t v = 0; v < map.size(); ++v) {
+            if (map[v] != v) {
+                f.kill(v);
+            }
+        }
+    }
+    return result;
+}
+
+std::string licm_pass::name() const {
+    return "licm";
+}
+
+bool licm_pass::run(ssa_function &f) {
+
+    auto idom = f.immediate_dominators();
+    auto order = f.reverse_postorder();
+
+    // natural loops, merged per header
+    std::map<uint32_t, std::vector<uint32_t>> loops;
+    for (auto b : order) {
+        for (auto h : f.blocks[b].successors()) {
+            if (!dominates(idom, h, b)) {
+                continue;
+            }
+            auto& body = loops[h];
+            if (body.empty()) {
+                body.push_back(h);
+            }
+            std::vector<uint32_t> work{b};
+            while (!work.empty()) {
+                auto x = work.back();
+                work.pop_back();
+                if (contains(body, x)) {
+                    continue;
+                }
+                body.push_back(x);
+                for (auto p : f.blocks[x].preds) {
+                    work.push_back(p);
+                }
+            }
+        }
+    }
+
+    bool result = false;
+
+    for (auto& loop : loops) {
+        auto h = loop.first;
+        auto& body = loop.second;
+
+        uint32_t preheader = NO_SSA;
+        size_t outside = 0;
+        for (auto p : f.blocks[h].preds) {
+            if (!contains(body, p)) {
+                preheader = p;
+                ++outside;
+            }
+        }
+        if (outside != 1 || f.blocks[preheader].terminator != ssa_block::GOTO) {
+            continue;
+        }
+        auto& exit = f.blocks[preheader].exit;
+
+        // an argument must be at hand at the end of the preheader
+        auto available = [&](uint32_t a) {
+            auto& arg = f.values[a];
+            return arg.op == ssa_op::CONST || contains(exit, a)
+                   || (arg.hoisted && dominates(idom, arg.block, preheader));
+        };
+
+        // instructions needed to compute v inside the loop
+        auto cost = [&](uint32_t v) {
+            unsigned c = 1;
+            for (auto a : f.values[v].args) {
+                c += f.values[a].op == ssa_op::CONST ? 1 : 2;
+            }
+            return c;
+        };
+
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (uint32_t v = 0; v < f.values.size(); ++v) {
+                auto& value = f.values[v];
+                if (value.hoisted || !contains(body, value.block) || !f.is_pure(v)) {
+                    continue;
+                }
+                bool invariant = true;
+                bool cheap_args = true;
+                for (auto a : value.args) {
+                    invariant = invariant && available(a);
+                    cheap_args = cheap_args && !f.values[a].hoisted;
+                }
+                // loading the home slot costs two instructions
+                if (!invariant || (cheap_args && cost(v) <= 3)) {
+                    continue;
+                }
+                value.block = preheader;
+                value.hoisted = true;
+                f.blocks[preheader].homes.push_back(v);
+                changed = true;
+                result = true;
+            }
+        }
+    }
+
+    return result;
+}
+
+ssa_pass_manager::ssa_pass_manager(unsigned max_rounds)
+: m_max_rounds(max_rounds)
+{
+}
+
+void ssa_pass_manager::add(std::unique_ptr<ssa_pass> pass) {
+    m_passes.push_back(std::move(pass));
+}
+
+bool ssa_pass_manager::run(ssa_function &f) {
+    bool result = false;
+    for (unsigned round = 0; round < m_max_rounds; ++round) {
+        bool changed = false;
+        for (auto& pass : m_passes) {
+            changed = pass->run(f) || changed;
+        }
+        if (!changed) {
+            break;
+        }
+        result = true;
+    }
+    return result;
+}
+
+std::vector<uint16_t> optimize(const std::vector<uint16_t> &code) {
+    try {
+        // inlined calls no longer keep the program from being lifted
+        auto f = lift(inliner().run(code));
+
+        ssa_pass_manager passes;
+        passes.add(std::unique_ptr<ssa_pass>(new sccp_pass));
+        passes.add(std::unique_ptr<ssa_pass>(new cse_pass));
+        passes.add(std::unique_ptr<ssa_pass>(new licm_pass));
+        passes.add(std::unique_ptr<ssa_pass>(new dce_pass));
+        passes.run(f);
+
+        return loop_fusion().run(lower(f));
+    } catch (std::domain_error&) {
+        return code;
+    }
+}
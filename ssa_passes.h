@@ -0,0 +1,78 @@
+#ifndef STACKMACHINE_SSA_PASSES_H
+#define STACKMACHINE_SSA_PASSES_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "ssa.h"
+
+//! A transformation of a program in SSA form.
+class ssa_pass {
+public:
+    virtual ~ssa_pass() = default;
+
+    virtual std::string name() const = 0;
+
+    //! \return true if the function changed
+    virtual bool run(ssa_function& f) = 0;
+};
+
+//! Sparse conditional constant propagation (Wegman and Zadeck). Values that
+//! are constant on all executable paths become constants, branches on
+//! constants become jumps and blocks that are never executed are removed.
+//! Arithmetic wraps around like uint16, a division by zero is never folded.
+class sccp_pass : public ssa_pass {
+public:
+    std::string name() const override;
+    bool run(ssa_function& f) override;
+};
+
+//! Dead code elimination. Values that reach no output, branch condition,
+//! possible trap or final stack slot are removed.
+class dce_pass : public ssa_pass {
+public:
+    std::string name() const override;
+    bool run(ssa_function& f) override;
+};
+
+//! Common subexpression elimination over the dominator tree. A pure value
+//! computed again in a dominated block is replaced by the first one.
+class cse_pass : public ssa_pass {
+public:
+    std::string name() const override;
+    bool run(ssa_function& f) override;
+};
+
+//! Loop-invariant code motion. Pure values of a loop whose arguments are
+//! available before the loop are computed once in the preheader and kept in
+//! a home slot above the stack.
+class licm_pass : public ssa_pass {
+public:
+    std::string name() const override;
+    bool run(ssa_function& f) override;
+};
+
+//! Runs passes in order, repeating the sequence while any of them changes
+//! the function.
+class ssa_pass_manager {
+public:
+    explicit ssa_pass_manager(unsigned max_rounds = 8);
+
+    void add(std::unique_ptr<ssa_pass> pass);
+
+    //! \return true if any pass changed the function
+    bool run(ssa_function& f);
+
+private:
+    std::vector<std::unique_ptr<ssa_pass>> m_passes;
+    unsigned m_max_rounds;
+};
+
+//! Inline small functions, then lift, optimize and lower a program and fuse
+//! its counted loops, see loop_fusion. The result behaves like the input on
+//! a fresh interpreter, see lift() for what is preserved.
+//! \param code the program as passed to the interpreter
+//! \return the optimized program, or the input if it cannot be lifted
+std::vector<uint16_t> optimize(const std::vector<uint16_t>& code);
+
+#endif //STACKMACHINE_SSA_PASSES_H
@@ -0,0 +1,29 @@
+#include <gtest/gtest.h>
+
+#include "../assembler.h"
+
+TEST(Assembler, LabelTest) {
+    symbolic_program sprog = {
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {0x1000  , instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::IFZERO, {0x2000})},
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x1000})},
+            {0x2000  , instruction(mnemonic::STOP)}
+    };
+
+    std::vector<uint16_t> expected = {CONST, 1, DUP, IFZERO, 7, GOTO, 2, STOP};
+    ASSERT_EQ(expected, assemble(sprog));
+}
+
+TEST(Assembler, UnknownLabelTest) {
+    symbolic_program sprog = {
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x1000})}
+    };
+
+    ASSERT_THROW(assemble(sprog), std::domain_error);
+}
+
+TEST(Assembler, RoundTripTest) {
+    std::vector<uint16_t> code = {CONST, 0x4711, CALL, 1, 9, TCALL, 1, 2, 3, RET, 0, STOP};
+    ASSERT_EQ(code, to_binary_list(from_binary_list(code)));
+}
@@ -0,0 +1,175 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <stdexcept>
+
+#include "../assembler.h"
+#include "../block_layout.h"
+#include "../interpreter.h"
+#include "test_harness.h"
+
+namespace {
+
+    run_result run(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args,
+                   const std::shared_ptr<branch_profile>& profile) {
+        interpreter interp(code);
+        interp.set_branch_profile(profile);
+        return run_machine(interp, args);
+    }
+
+    //! The branches of code the profile saw taken.
+    uint64_t taken(const std::vector<uint16_t>& code, const branch_profile& profile) {
+        uint64_t taken = 0;
+        for (size_t pc = 0; pc < code.size(); ++pc) {
+            taken += profile.taken(static_cast<uint16_t>(pc));
+        }
+        return taken;
+    }
+
+    //! Counts down from 100 and adds 100 to slot 1 for every tenth number,
+    //! 1 otherwise. A check that never fails sits in the middle of the loop.
+    symbolic_program loop() {
+        return {
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},
+                {NO_LABEL, instruction(mnemonic::CONST, {100})},
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0004})},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1000})},
+                {NO_LABEL, instruction(mnemonic::LT)},
+                {NO_LABEL, instruction(mnemonic::IFNZERO, {0x0005})},
+                {NO_LABEL, instruction(mnemonic::CONST, {'E'})},
+                {NO_LABEL, instruction(mnemonic::PRINTC)},
+                {NO_LABEL, instruction(mnemonic::STOP)},
+                {0x0005  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {10})},
+                {NO_LABEL, instruction(mnemonic::MOD)},
+                {NO_LABEL, instruction(mnemonic::IFNZERO, {0x0002})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {100})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0003})},
+                {0x0002  , instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {0x0003  , instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0004  , instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)}
+        };
+    }
+
+    //! fib() with the base case behind the recursion, the branch to it is
+    //! taken on every leaf call until relayout makes it the fall through.
+    symbolic_program fib_base_case_last() {
+        return {
+                {NO_LABEL, instruction(mnemonic::LDARGS)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)},
+                {0x1000  , instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LT)},
+                {NO_LABEL, instruction(mnemonic::IFNZERO, {0x2000})},
+                {NO_LABEL, instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+                {NO_LABEL, instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::RET, {0})},
+                {0x2000  , instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::RET, {0})}
+        };
+    }
+}
+
+TEST(BlockLayout, ProfileTest) {
+    auto code = assemble(loop());
+    auto profile = std::make_shared<branch_profile>();
+    run(code, {}, profile);
+
+    // pc 5 is the IFZERO of the loop, pc 11 the check
+    ASSERT_EQ(1u, profile->taken(5));
+    ASSERT_EQ(100u, profile->not_taken(5));
+    ASSERT_EQ(100u, profile->taken(11));
+    ASSERT_EQ(0u, profile->not_taken(11));
+    ASSERT_EQ(0u, profile->taken(0xFFFF));
+
+    std::stringstream text;
+    profile->write(text);
+    branch_profile twice;
+    twice.read(text);
+    text.clear();
+    text.seekg(0);
+    twice.read(text);
+    ASSERT_EQ(200u, twice.not_taken(5));
+    ASSERT_EQ(200u, twice.taken(11));
+
+    std::stringstream bad("5 1\n");
+    ASSERT_THROW(twice.read(bad), std::domain_error);
+    std::stringstream beyond("65536 1 1\n");
+    ASSERT_THROW(twice.read(beyond), std::domain_error);
+}
+
+TEST(BlockLayout, RelayoutTest) {
+    auto code = assemble(loop());
+    auto profile = std::make_shared<branch_profile>();
+    auto before = run(code, {}, profile);
+
+    auto relaid = relayout(code, *profile);
+    auto relaid_profile = std::make_shared<branch_profile>();
+    auto after = run(relaid, {}, relaid_profile);
+
+    ASSERT_EQ("1090", before.output);
+    expect_equivalent(before, after);
+    ASSERT_LT(taken(relaid, *relaid_profile), taken(code, *profile) / 2);
+
+    // the check that never failed moved to the end
+    std::vector<uint16_t> cold = {CONST, 'E', PRINTC, STOP};
+    ASSERT_TRUE(std::equal(cold.begin(), cold.end(), relaid.end() - 4));
+
+    // without a profile every block but the first is cold and stays in place
+    auto unprofiled = relayout(code, branch_profile());
+    auto plain = run(unprofiled, {}, std::make_shared<branch_profile>());
+    ASSERT_EQ(before.output, plain.output);
+}
+
+TEST(BlockLayout, CallTest) {
+    auto code = assemble(fib_base_case_last());
+    auto profile = std::make_shared<branch_profile>();
+    auto before = run(code, {12}, profile);
+
+    auto relaid = relayout(code, *profile);
+    auto relaid_profile = std::make_shared<branch_profile>();
+    auto after = run(relaid, {12}, relaid_profile);
+
+    ASSERT_EQ("144", before.output);
+    expect_equivalent(before, after);
+    ASSERT_LT(taken(relaid, *relaid_profile), taken(code, *profile));
+}
+
+TEST(BlockLayout, UnchangedTest) {
+    // a jump into the operand of CONST
+    std::vector<uint16_t> code = {CONST, NOOP, IFZERO, 1, PRINTI};
+    ASSERT_TRUE(relayout(code, branch_profile()) == code);
+
+    ASSERT_THROW(relayout({GOTO, 100}, branch_profile()), std::domain_error);
+}
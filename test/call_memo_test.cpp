@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include "../assembler.h"
+#include "../call_memo.h"
+#include "../interpreter.h"
+#include "test_harness.h"
+#include "test_programs.h"
+
+namespace {
+
+    run_result run(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args,
+                   std::shared_ptr<call_memo> memo) {
+        interpreter interp(code);
+        interp.set_call_memo(memo);
+        return run_machine(interp, args);
+    }
+
+    //! Run with and without the memo and compare.
+    //! \return the run with the memo
+    run_result expect_same(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args,
+                           std::shared_ptr<call_memo> memo) {
+        auto expected = run(code, args, nullptr);
+        auto actual = run(code, args, memo);
+        expect_equivalent(expected, actual);
+        EXPECT_EQ(expected.registers.pc, actual.registers.pc);
+        return actual;
+    }
+}
+
+TEST(CallMemo, FibTest) {
+    auto code = assemble(fib());
+    auto memo = std::make_shared<call_memo>(code);
+    ASSERT_TRUE(memo->memoizes(code[5], 1));
+
+    auto plain = run(code, {22}, nullptr);
+    auto memoized = expect_same(code, {22}, memo);
+    ASSERT_EQ("17711", memoized.output);
+
+    // every fib(k) is computed once, fib(k - 2) hits for k = 3..22
+    ASSERT_EQ(23u, memo->size());
+    ASSERT_EQ(20u, memo->hits());
+    ASSERT_EQ(0u, memo->evictions());
+    ASSERT_LT(100 * memoized.steps, plain.steps);
+    ASSERT_GT(memo->hit_rate(), 0.4);
+    ASSERT_GE(memo->memory_bytes(), 64 * memo->capacity() / 4);
+}
+
+TEST(CallMemo, CapacityTest) {
+    auto code = assemble(fib());
+    auto memo = std::make_shared<call_memo>(code, 4);
+    ASSERT_EQ(4u, memo->capacity());
+
+    expect_same(code, {16}, memo);
+    ASSERT_LT(0u, memo->evictions());
+    ASSERT_LT(0u, memo->hits());
+    ASSERT_GE(4u, memo->size());
+
+    memo->clear();
+    ASSERT_EQ(0u, memo->size());
+    ASSERT_EQ(0u, memo->lookups());
+}
+
+TEST(CallMemo, ImpureTest) {
+    // the callee prints, every call must run
+    auto code = assemble({
+            {NO_LABEL, instruction(mnemonic::CONST, {'a'})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    });
+    auto memo = std::make_shared<call_memo>(code);
+    ASSERT_FALSE(memo->memoizes(code[4], 1));
+    ASSERT_EQ("aaa", expect_same(code, {}, memo).output);
+    ASSERT_EQ(0u, memo->lookups());
+}
@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "../channel.h"
+#include "../interpreter.h"
+
+TEST(Channel, RingTest) {
+    channel ch(3);
+    ASSERT_EQ(4u, ch.capacity());
+    ASSERT_FALSE(ch.can_receive());
+
+    for (uint16_t v = 1; v <= 4; ++v) {
+        ASSERT_TRUE(ch.try_send(v));
+    }
+    ASSERT_FALSE(ch.can_send());
+    ASSERT_FALSE(ch.try_send(5));
+
+    // several rounds through the ring keep the order
+    uint16_t v = 0;
+    for (uint16_t expected = 1; expected <= 20; ++expected) {
+        ASSERT_TRUE(ch.try_receive(v));
+        ASSERT_EQ(expected, v);
+        ASSERT_TRUE(ch.try_send(static_cast<uint16_t>(expected + 4)));
+    }
+    ASSERT_TRUE(ch.try_receive(v));
+    ASSERT_EQ(21, v);
+}
+
+TEST(Channel, CloseTest) {
+    channel ch(4, 2);
+    ASSERT_TRUE(ch.try_send(7));
+    ch.close();
+    ASSERT_FALSE(ch.is_closed());
+    ch.close();
+    ASSERT_TRUE(ch.is_closed());
+
+    // what was sent before stays readable, later words are dropped
+    ASSERT_TRUE(ch.try_send(8));
+    uint16_t v = 0;
+    ASSERT_TRUE(ch.try_receive(v));
+    ASSERT_EQ(7, v);
+    ASSERT_FALSE(ch.try_receive(v));
+    ASSERT_TRUE(ch.can_receive());
+}
+
+TEST(Channel, ConcurrentTest) {
+    const unsigned senders = 4;
+    const uint16_t count = 2000;
+    channel ch(64, senders);
+
+    std::vector<std::thread> threads;
+    for (unsigned s = 0; s < senders; ++s) {
+        threads.push_back(std::thread([&ch, s, count] {
+            for (uint16_t i = 0; i < count; ++i) {
+                // the sender in the upper bits, the sequence below
+                while (!ch.try_send(static_cast<uint16_t>(s << 14 | i))) {
+                    std::this_thread::yield();
+                }
+            }
+            ch.close();
+        }));
+    }
+
+    std::vector<int> next(senders, 0);
+    uint16_t v;
+    for (;;) {
+        // once closed, an empty ring stays empty
+        bool closed = ch.is_closed();
+        if (ch.try_receive(v)) {
+            auto s = v >> 14;
+            ASSERT_EQ(next[s], v & 0x3FFF);
+            ++next[s];
+        } else if (closed) {
+            break;
+        }
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (auto n : next) {
+        ASSERT_EQ(count, n);
+    }
+}
+
+TEST(Channel, InterpreterTest) {
+    auto ch = std::make_shared<channel>(2);
+    interpreter sender({CONST, 1, SEND, 0, CONST, 2, SEND, 0, CONST, 3, SEND, 0, CLOSE, 0});
+    sender.set_channel(0, ch);
+
+    // the third word does not fit, so SEND waits without changing anything
+    ASSERT_EQ(5u, sender.run(100));
+    ASSERT_EQ(ch.get(), sender.blocked_on());
+    ASSERT_TRUE(sender.blocked_sending());
+    ASSERT_EQ(10, sender.registers().pc);
+    ASSERT_EQ(1, sender.registers().sp);
+
+    interpreter receiver({RECV, 0, RECV, 0, RECV, 0, RECV, 0, RECV, 1});
+    receiver.set_channel(0, ch);
+    ASSERT_EQ(2u, receiver.run(100));
+    ASSERT_EQ(ch.get(), receiver.blocked_on());
+    ASSERT_FALSE(receiver.blocked_sending());
+
+    ASSERT_EQ(3u, sender.run(100));
+    ASSERT_TRUE(sender.is_stopped());
+    ASSERT_EQ(nullptr, sender.blocked_on());
+
+    // the last word, then the end of the stream and an unbound channel
+    ASSERT_EQ(4u, receiver.run(100));
+    ASSERT_TRUE(receiver.is_stopped());
+    std::vector<uint16_t> expected = {1, 1, 2, 1, 3, 1, 0, 0, 0, 0};
+    ASSERT_TRUE(std::equal(expected.begin(), expected.end(), receiver.stack().begin() + 1));
+}
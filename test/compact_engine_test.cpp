@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+#include "../assembler.h"
+#include "../compact_code.h"
+#include "../compact_engine.h"
+#include "../interpreter.h"
+#include "test_harness.h"
+#include "test_programs.h"
+
+namespace {
+
+    void expect_same(const std::vector<uint16_t>& code,
+                     const std::vector<uint16_t>& args = {},
+                     const std::vector<uint16_t>& input = {}) {
+        ASSERT_TRUE(expand(compact(code)) == code);
+
+        auto expected = run_interpreter(code, args, input);
+
+        compact_engine bytes(code);
+        compact_engine words(code, compact_engine::WORDS);
+        compact_engine decoded(compact(code));
+        for (compact_engine* engine : {&bytes, &words, &decoded}) {
+            expect_same_state(expected, run_machine(*engine, args, input));
+            EXPECT_TRUE(engine->is_stopped());
+        }
+    }
+}
+
+TEST(CompactCode, RoundTripTest) {
+    std::vector<uint16_t> code = {CONST, 7, CONST, 0x1234, CALL, 1, 0x0100, PRINTI, STOP};
+    auto bytes = compact(code);
+    // 2 + 3 + 5 + 1 + 1 bytes
+    ASSERT_EQ(12u, bytes.size());
+    ASSERT_TRUE(expand(bytes) == code);
+
+    // data, opcodes above the mask and a cut off instruction
+    code = {0xBEEF, NOOP, 0x3F, 0xFFFF, GOTO};
+    bytes = compact(code);
+    ASSERT_EQ(3u + 1 + 3 + 3 + 3, bytes.size());
+    ASSERT_TRUE(expand(bytes) == code);
+
+    ASSERT_TRUE(compact({}).empty());
+    ASSERT_TRUE(expand({}).empty());
+}
+
+TEST(CompactCode, OffsetTest) {
+    std::vector<uint32_t> offsets;
+    auto bytes = compact({CONST, 7, GOTO, 0x0100, NOOP}, &offsets);
+    std::vector<uint32_t> expected = {0, NO_OFFSET, 2, NO_OFFSET, 5, 6};
+    ASSERT_TRUE(expected == offsets);
+    ASSERT_EQ(6u, bytes.size());
+}
+
+TEST(CompactCode, MalformedTest) {
+    // ends within an operand
+    ASSERT_THROW(expand({CONST}), std::domain_error);
+    ASSERT_THROW(expand({CONST | COMPACT_LONG, 1}), std::domain_error);
+    ASSERT_THROW(expand({COMPACT_RAW, 1}), std::domain_error);
+    // no instruction
+    ASSERT_THROW(expand({0x3F}), std::domain_error);
+    ASSERT_THROW(compact_engine(std::vector<uint8_t>{0x3F}), std::domain_error);
+}
+
+TEST(CompactEngine, SameTest) {
+    expect_same({CONST, 1, CONST, 2, ADD, CONST, 0x1000, MUL, PRINTI});
+    expect_same({CONST, 0xFFFF, CONST, 0xB505, MUL, PRINTI});
+    expect_same(assemble(fib()), {10});
+
+    // a loop with targets and constants above 255
+    expect_same({
+            CONST, 0, CONST, 300,
+            DUP, IFZERO, 17,
+            SWAP, CONST, 1000, ADD, SWAP, CONST, 1, SUB, GOTO, 4,
+            DECSP, 1, PRINTI, CONST, 'x', PRINTC
+    });
+
+    // TCALL and data the engine leaves to the interpreter
+    expect_same({
+            CONST, 5, CALL, 1, 8, PRINTI, STOP, 0xBEEF,
+            // 8: f(n) = n == 0 ? 42 : f(n - 1)
+            GETBP, LDI, IFZERO, 21, GETBP, LDI, CONST, 1, SUB, TCALL, 1, 1, 8,
+            // 21
+            CONST, 42, RET, 1
+    });
+}
+
+TEST(CompactEngine, FallbackTest) {
+    // input
+    expect_same({READ, READ, ADD, PRINTI}, {}, {3, 4});
+    expect_same({LDARGS, ADD, PRINTI}, {5, 6});
+    expect_same({LDARGS, PRINTN, CONST, 'a', CONST, 'b', CONST, 2, PRINTS, CONST, 12345, PRINTI}, {1, 2, 3});
+
+    // a jump into the operand of CONST executes the operand as NOOP
+    expect_same({GOTO, 3, CONST, NOOP, CONST, 9, PRINTI});
+}
+
+TEST(CompactEngine, SizeTest) {
+    std::vector<uint16_t> code;
+    for (int i = 0; i < 100; ++i) {
+        code.insert(code.end(), {CONST, 1, CONST, 1, LDI, CONST, 2, ADD, STI, DECSP, 1});
+    }
+
+    compact_engine bytes(code);
+    compact_engine words(code, compact_engine::WORDS);
+    ASSERT_EQ(2 * (code.size() + 1), words.code_bytes());
+    ASSERT_EQ(code.size() + 1, bytes.code_bytes());
+
+    bytes.run();
+    words.run();
+    ASSERT_EQ(words.dispatches(), bytes.dispatches());
+    ASSERT_EQ(700u + 1, bytes.dispatches());
+}
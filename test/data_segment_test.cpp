@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+#include "../compact_engine.h"
+#include "../data_segment.h"
+#include "../interpreter.h"
+#include "../register_engine.h"
+#include "test_harness.h"
+
+namespace {
+
+    std::string run(const std::vector<uint16_t>& code, const std::shared_ptr<const data_segment>& data) {
+        interpreter interp(code);
+        interp.set_data_segment(data);
+        return run_machine(interp).output;
+    }
+
+    //! Prints the words 3, 2, 1 and 0 of the data segment, placed at pc at.
+    std::vector<uint16_t> print_table(uint16_t at = 0) {
+        return {
+                CONST, 3,
+                DUP, LDD, PRINTI, CONST, ' ', PRINTC,
+                DUP, IFZERO, static_cast<uint16_t>(at + 16),
+                CONST, 1, SUB, GOTO, static_cast<uint16_t>(at + 2)
+        };
+    }
+}
+
+TEST(DataSegment, LookupTest) {
+    auto data = std::make_shared<const data_segment>(std::vector<uint16_t>{10, 11, 12, 13});
+    ASSERT_EQ(4u, data->size());
+    ASSERT_EQ(0, data->words()[4]);
+    ASSERT_EQ(0, data->words()[data_segment::WORDS - 1]);
+
+    auto code = print_table();
+    ASSERT_EQ("13 12 11 10 ", run(code, data));
+
+    register_engine reg(code);
+    reg.set_data_segment(data);
+    ASSERT_EQ("13 12 11 10 ", run_machine(reg).output);
+    compact_engine compact(code);
+    compact.set_data_segment(data);
+    ASSERT_EQ("13 12 11 10 ", run_machine(compact).output);
+    register_engine constant_index({CONST, 2, LDD, PRINTI});
+    constant_index.set_data_segment(data);
+    ASSERT_EQ("12", run_machine(constant_index).output);
+
+    // without a data section every word is 0
+    ASSERT_EQ("0 0 0 0 ", run(code, nullptr));
+    ASSERT_EQ("0 0 0 0 ", run(code, data_segment::empty()));
+}
+
+TEST(DataSegment, CopyOnWriteTest) {
+    auto data = std::make_shared<const data_segment>(std::vector<uint16_t>{10, 11, 12, 13});
+
+    // d[2] = 42, d[0xFFFF] = 7, then print the table and d[0xFFFF]
+    std::vector<uint16_t> code = {CONST, 2, CONST, 42, STD, CONST, 0xFFFF, CONST, 7, STD, DECSP, 2};
+    auto table = print_table(static_cast<uint16_t>(code.size()));
+    code.insert(code.end(), table.begin(), table.end());
+    code.insert(code.end(), {CONST, 0xFFFF, LDD, PRINTI});
+
+    interpreter first(code);
+    first.set_data_segment(data);
+    auto result = run_machine(first);
+    ASSERT_EQ("13 42 11 10 7", result.output);
+    ASSERT_EQ(1, result.registers.sp);
+
+    // the stores of the first interpreter stay private
+    ASSERT_EQ(12, data->words()[2]);
+    ASSERT_EQ(0, data->words()[0xFFFF]);
+    ASSERT_EQ("13 12 11 10 ", run(print_table(), data));
+
+    compact_engine compact(code);
+    compact.set_data_segment(data);
+    ASSERT_EQ("13 42 11 10 7", run_machine(compact).output);
+    ASSERT_EQ(12, data->words()[2]);
+}
+
+TEST(DataSegment, SizeTest) {
+    ASSERT_EQ(0u, data_segment::empty()->size());
+    ASSERT_NO_THROW(data_segment(std::vector<uint16_t>(data_segment::WORDS, 1)));
+    ASSERT_THROW(data_segment(std::vector<uint16_t>(data_segment::WORDS + 1, 1)), std::domain_error);
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include <stdexcept>
+
+#include "../debugger.h"
+#include "../interpreter.h"
+
+namespace {
+    //! prints 3 2 1 and leaves 0 on the stack, the loop body starts at 5
+    std::vector<uint16_t> countdown() {
+        return {CONST, 3, DUP, IFZERO, 12, DUP, PRINTI, CONST, 1, SUB, GOTO, 2};
+    }
+}
+
+TEST(Debugger, BreakpointTest) {
+    std::stringstream out;
+    interpreter interp(countdown());
+    interp.set_output(out);
+    debugger dbg(interp);
+
+    ASSERT_THROW(dbg.set_breakpoint(1), std::domain_error);
+    ASSERT_THROW(dbg.set_breakpoint(100), std::domain_error);
+
+    dbg.set_breakpoint(5);
+    ASSERT_EQ(DUP, dbg.code_word(5));
+    for (uint16_t counter = 3; counter > 0; --counter) {
+        ASSERT_EQ(debugger::BREAKPOINT, dbg.run());
+        ASSERT_EQ(5, dbg.registers().pc);
+        ASSERT_EQ(counter, dbg.word(dbg.registers().sp));
+        ASSERT_FALSE(interp.is_stopped() && interp.fault() != interpreter::NO_FAULT);
+    }
+    ASSERT_EQ("32", out.str());
+
+    dbg.clear_breakpoint(5);
+    ASSERT_EQ(debugger::STOPPED, dbg.run());
+    ASSERT_EQ("321", out.str());
+    ASSERT_EQ(debugger::STOPPED, dbg.run());
+}
+
+TEST(Debugger, StepTest) {
+    std::stringstream out;
+    interpreter interp(countdown());
+    interp.set_output(out);
+    debugger dbg(interp);
+    dbg.set_breakpoint(2);
+
+    // steps execute the instruction under a breakpoint
+    ASSERT_EQ(debugger::STEPPED, dbg.step());
+    ASSERT_EQ(2, dbg.registers().pc);
+    ASSERT_EQ(debugger::STEPPED, dbg.step());
+    ASSERT_EQ(3, dbg.registers().pc);
+    ASSERT_EQ(3, dbg.word(dbg.registers().sp));
+
+    ASSERT_EQ(debugger::BREAKPOINT, dbg.run());
+    ASSERT_EQ(2, dbg.registers().pc);
+    ASSERT_EQ(debugger::STEPPED, dbg.step());
+    ASSERT_EQ(3, dbg.registers().pc);
+    ASSERT_EQ("3", out.str());
+}
+
+TEST(Debugger, DetachTest) {
+    std::stringstream out;
+    interpreter interp(countdown());
+    interp.set_output(out);
+    {
+        debugger dbg(interp);
+        dbg.set_breakpoint(5);
+        ASSERT_EQ(debugger::BREAKPOINT, dbg.run());
+        ASSERT_TRUE(interp.is_stopped());
+    }
+    // the breakpoint is gone with the debugger
+    ASSERT_FALSE(interp.is_stopped());
+    interp.run();
+    ASSERT_EQ("321", out.str());
+
+    // attached without breakpoints it runs as before
+    std::stringstream again;
+    interpreter plain(countdown());
+    plain.set_output(again);
+    debugger dbg(plain);
+    ASSERT_EQ(debugger::STOPPED, dbg.run());
+    ASSERT_EQ("321", again.str());
+}
+
+TEST(Debugger, WatchTest) {
+    std::stringstream out;
+    interpreter interp(countdown());
+    interp.set_output(out);
+    debugger dbg(interp);
+
+    interp.step();
+    auto counter = interp.registers().sp;
+    dbg.watch(counter);
+
+    // DUP and CONST write the slot above on the same page, SUB changes it
+    ASSERT_EQ(debugger::WATCHPOINT, dbg.run());
+    ASSERT_EQ(counter, dbg.watch_slot());
+    ASSERT_EQ(10, dbg.registers().pc);
+    ASSERT_EQ(2, dbg.word(counter));
+    ASSERT_EQ("3", out.str());
+
+    ASSERT_EQ(debugger::STEPPED, dbg.step());
+    ASSERT_EQ(debugger::WATCHPOINT, dbg.run());
+    ASSERT_EQ(1, dbg.word(counter));
+
+    // a step that changes the slot stops too
+    dbg.set_breakpoint(9);
+    ASSERT_EQ(debugger::BREAKPOINT, dbg.run());
+    ASSERT_EQ(debugger::WATCHPOINT, dbg.step());
+    ASSERT_EQ(0, dbg.word(counter));
+
+    dbg.unwatch(counter);
+    dbg.clear_breakpoint(9);
+    ASSERT_EQ(debugger::STOPPED, dbg.run());
+    ASSERT_EQ("321", out.str());
+    ASSERT_EQ(interpreter::NO_FAULT, interp.fault());
+}
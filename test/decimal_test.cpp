@@ -0,0 +1,22 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "../decimal.h"
+
+TEST(Decimal, FormatTest) {
+    char digits[MAX_DECIMAL_DIGITS];
+    for (uint32_t v = 0; v <= 0xFFFF; ++v) {
+        auto end = format_decimal(static_cast<uint16_t>(v), digits);
+        ASSERT_EQ(std::to_string(v), std::string(digits, end));
+    }
+}
+
+TEST(Decimal, AppendTest) {
+    std::string out = "n=";
+    append_decimal(out, 0);
+    out += ',';
+    append_decimal(out, 100);
+    out += ',';
+    append_decimal(out, 65535);
+    ASSERT_EQ("n=0,100,65535", out);
+}
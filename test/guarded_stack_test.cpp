@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "../guarded_stack.h"
+#include "../interpreter.h"
+#include "../scheduler.h"
+
+namespace {
+    interpreter::fault_kind run_safe(const std::vector<uint16_t>& code, uint16_t& pc) {
+        interpreter interp(code);
+        interp.set_safe_mode(true);
+        interp.run();
+        EXPECT_TRUE(interp.is_stopped());
+        pc = interp.registers().pc;
+        return interp.fault();
+    }
+}
+
+TEST(GuardedStack, GuardTest) {
+    guarded_stack stack;
+    auto words = stack.data();
+    words[0] = 1;
+    words[guarded_stack::WORDS - 1] = 2;
+
+    ASSERT_FALSE(stack.guards(words));
+    ASSERT_FALSE(stack.guards(words + guarded_stack::WORDS - 1));
+    ASSERT_TRUE(stack.guards(words - 1));
+    ASSERT_TRUE(stack.guards(words - guarded_stack::GUARD_WORDS));
+    ASSERT_TRUE(stack.guards(words + guarded_stack::WORDS));
+    ASSERT_TRUE(stack.guards(words + guarded_stack::WORDS + guarded_stack::GUARD_WORDS - 1));
+}
+
+TEST(GuardedStack, FaultTest) {
+    uint16_t pc = 0;
+
+    // nothing below slot 0
+    ASSERT_EQ(interpreter::STACK_FAULT, run_safe({NOOP, ADD}, pc));
+    ASSERT_EQ(1, pc);
+
+    ASSERT_EQ(interpreter::DIVISION_FAULT, run_safe({CONST, 1, CONST, 0, DIV}, pc));
+    ASSERT_EQ(4, pc);
+    ASSERT_EQ(interpreter::DIVISION_FAULT, run_safe({CONST, 1, CONST, 0, MOD}, pc));
+    ASSERT_EQ(4, pc);
+
+    // slot 0xFFFF is the last one
+    ASSERT_EQ(interpreter::STACK_FAULT, run_safe({INCSP, 0xFFFE, DUP, DUP}, pc));
+    ASSERT_EQ(3, pc);
+
+    // a tail call that drops more than the stack holds
+    ASSERT_EQ(interpreter::STACK_FAULT, run_safe({CONST, 7, TCALL, 1, 0xFFFF, 8, STOP}, pc));
+    ASSERT_EQ(2, pc);
+
+    ASSERT_EQ(interpreter::NO_FAULT, run_safe({CONST, 1, CONST, 2, DIV}, pc));
+}
+
+TEST(GuardedStack, SameTest) {
+    std::vector<uint16_t> code = {
+            CONST, 0, CONST, 100,
+            DUP, IFZERO, 17,
+            SWAP, CONST, 3, ADD, SWAP, CONST, 1, SUB, GOTO, 4,
+            DECSP, 1, PRINTI
+    };
+
+    std::stringstream plain_out, safe_out;
+    interpreter plain(code);
+    plain.set_output(plain_out);
+    plain.run();
+
+    interpreter safe(code);
+    safe.set_output(safe_out);
+    safe.set_safe_mode(true);
+    for (int i = 0; i < 10; ++i) {
+        safe.step();
+    }
+    safe.run();
+
+    ASSERT_EQ(plain_out.str(), safe_out.str());
+    ASSERT_EQ(interpreter::NO_FAULT, safe.fault());
+    ASSERT_EQ(plain.registers().pc, safe.registers().pc);
+    ASSERT_EQ(plain.registers().sp, safe.registers().sp);
+    ASSERT_TRUE(plain.stack() == safe.stack());
+
+    // and back, keeping the stack
+    safe.set_safe_mode(false);
+    ASSERT_TRUE(plain.stack() == safe.stack());
+}
+
+TEST(GuardedStack, SchedulerTest) {
+    scheduler s(2);
+    std::unique_ptr<interpreter> bad(new interpreter({CONST, 5, CONST, 0, DIV, PRINTI}));
+    bad->set_safe_mode(true);
+    std::unique_ptr<interpreter> good(new interpreter({CONST, 5, CONST, 1, DIV}));
+    good->set_safe_mode(true);
+
+    auto b = s.spawn(std::move(bad));
+    auto g = s.spawn(std::move(good));
+    s.wait();
+
+    ASSERT_TRUE(s.stats(b).failed);
+    ASSERT_EQ(interpreter::DIVISION_FAULT, s.vm(b).fault());
+    ASSERT_FALSE(s.stats(g).failed);
+    ASSERT_EQ(5, s.vm(g).stack()[1]);
+}
+
+TEST(GuardedStackDeathTest, ForeignFaultTest) {
+    // faults outside a guarded stack still end the process
+    ASSERT_DEATH({
+        uint16_t pc;
+        run_safe({CONST, 1, CONST, 0, DIV}, pc);
+        *static_cast<volatile int*>(nullptr) = 1;
+    }, "");
+}
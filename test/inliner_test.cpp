@@ -0,0 +1,238 @@
+#include <gtest/gtest.h>
+
+#include "../assembler.h"
+#include "../inliner.h"
+#include "../interpreter.h"
+#include "../ssa_passes.h"
+#include "test_harness.h"
+
+namespace {
+
+    bool has_call(const std::vector<uint16_t>& code) {
+        for (auto& instr : from_binary_list(code)) {
+            if (instr.mnem() == mnemonic::CALL) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //! Inline all calls and compare with the original program.
+    std::vector<uint16_t> expect_inlined(const symbolic_program& sprog, unsigned sites) {
+        auto code = assemble(sprog);
+        inliner inl;
+        auto inlined = inl.run(code);
+        EXPECT_EQ(sites, inl.inlined());
+        expect_equivalent(run_interpreter(code), run_interpreter(inlined));
+        return inlined;
+    }
+
+    //! a * b by repeated addition in a local, with a loop inside the callee
+    //! and a RET in the middle of the body
+    symbolic_program multiply() {
+        return {
+                {NO_LABEL, instruction(mnemonic::CONST, {100})},
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::CONST, {4})},
+                {NO_LABEL, instruction(mnemonic::CALL, {2, 0x1000})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::STOP)},
+                {0x1000  , instruction(mnemonic::CONST, {0})},
+                {0x1001  , instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::IFNZERO, {0x1002})},
+                {NO_LABEL, instruction(mnemonic::RET, {2})},
+                {0x1002  , instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::GETBP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x1001})}
+        };
+    }
+}
+
+TEST(Inliner, CallTest) {
+    // two arguments read through bp, the callee prints
+    auto inlined = expect_inlined({
+            {NO_LABEL, instruction(mnemonic::CONST, {'B'})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::CONST, {'1'})},
+            {NO_LABEL, instruction(mnemonic::CONST, {'2'})},
+            {NO_LABEL, instruction(mnemonic::CALL, {2, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::CONST, {'R'})},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    }, 1);
+    ASSERT_FALSE(has_call(inlined));
+}
+
+TEST(Inliner, RetTest) {
+    expect_inlined({
+            {NO_LABEL, instruction(mnemonic::CONST, {5})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::CONST, {9})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::RET, {1})}
+    }, 2);
+}
+
+TEST(Inliner, FrameTest) {
+    // too large for the default limit
+    expect_inlined(multiply(), 0);
+
+    auto code = assemble(multiply());
+    inliner inl(64);
+    auto inlined = inl.run(code);
+    ASSERT_EQ(1u, inl.inlined());
+    ASSERT_FALSE(has_call(inlined));
+    expect_equivalent(run_interpreter(code), run_interpreter(inlined));
+}
+
+TEST(Inliner, RejectTest) {
+    // recursion, a frame address below bp and a callee that stops
+    expect_inlined({
+            {NO_LABEL, instruction(mnemonic::CONST, {3})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1002})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1003})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::IFZERO, {0x1001})},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {0x1001  , instruction(mnemonic::RET, {0})},
+            {0x1002  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})},
+            {0x1003  , instruction(mnemonic::STOP)}
+    }, 0);
+}
+
+TEST(Inliner, ReturnAddressTest) {
+    // bp - 2 through a constant that wraps around and bp plus an argument
+    // both reach the return address, which an inlined body does not have
+    expect_inlined({
+            {NO_LABEL, instruction(mnemonic::CONST, {0})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {0xFFFE})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1001})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {0xFFFE})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::RET, {1})},
+            {0x1001  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::RET, {1})}
+    }, 0);
+}
+
+TEST(Inliner, BudgetTest) {
+    auto code = assemble({
+            {NO_LABEL, instruction(mnemonic::CONST, {5})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::MUL)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    });
+
+    // each copy grows the program by eight words
+    inliner one(16, 8);
+    auto inlined = one.run(code);
+    ASSERT_EQ(1u, one.inlined());
+    ASSERT_TRUE(has_call(inlined));
+    ASSERT_EQ("625", run_interpreter(inlined).output);
+
+    inliner none(16, 0);
+    ASSERT_TRUE(none.run(code) == code);
+}
+
+TEST(Inliner, OptimizeTest) {
+    // once the helper is inlined the whole loop can be lifted and folded
+    auto code = assemble({
+            {NO_LABEL, instruction(mnemonic::CONST, {0})},
+            {NO_LABEL, instruction(mnemonic::CONST, {1000})},
+            {0x1000  , instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::IFZERO, {0x1001})},
+            {NO_LABEL, instruction(mnemonic::SWAP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {3})},
+            {NO_LABEL, instruction(mnemonic::CALL, {2, 0x1002})},
+            {NO_LABEL, instruction(mnemonic::SWAP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x1000})},
+            {0x1001  , instruction(mnemonic::DECSP, {1})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            // a + b
+            {0x1002  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    });
+
+    auto optimized = optimize(code);
+    ASSERT_FALSE(has_call(optimized));
+    ASSERT_EQ(run_interpreter(code).output, run_interpreter(optimized).output);
+    ASSERT_LT(4 * run_interpreter(optimized).steps, 3 * run_interpreter(code).steps);
+}
@@ -0,0 +1,64 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+#include "../input_channel.h"
+
+namespace {
+    std::string write_temp_file(const std::string& content) {
+        char name[] = "/tmp/stackmachine_input_XXXXXX";
+        int fd = mkstemp(name);
+        close(fd);
+        std::ofstream out(name, std::ios::binary);
+        out << content;
+        return name;
+    }
+}
+
+TEST(InputChannel, BufferTest) {
+    std::vector<uint16_t> input = {1,2,3,4};
+    input_channel channel(input.data(), input.size());
+
+    uint16_t v = 0;
+    ASSERT_TRUE(channel.read(v));
+    ASSERT_EQ(1, v);
+
+    uint16_t block[8];
+    ASSERT_EQ(3u, channel.read(block, 8));
+    ASSERT_EQ(2, block[0]);
+    ASSERT_EQ(4, block[2]);
+
+    ASSERT_TRUE(channel.eof());
+    ASSERT_FALSE(channel.read(v));
+}
+
+TEST(InputChannel, FileTest) {
+    uint16_t words[] = {0x4711, 0x0815};
+    auto path = write_temp_file(std::string(reinterpret_cast<const char*>(words), sizeof(words)) + "x");
+    auto channel = input_channel::from_file(path);
+    std::remove(path.c_str());
+
+    // the trailing odd byte is not part of the input
+    ASSERT_EQ(2u, channel->remaining());
+
+    uint16_t v = 0;
+    ASSERT_TRUE(channel->read(v));
+    ASSERT_EQ(0x4711, v);
+    ASSERT_TRUE(channel->read(v));
+    ASSERT_EQ(0x0815, v);
+    ASSERT_FALSE(channel->read(v));
+}
+
+TEST(InputChannel, EmptyFileTest) {
+    auto path = write_temp_file("");
+    auto channel = input_channel::from_file(path);
+    std::remove(path.c_str());
+
+    ASSERT_TRUE(channel->eof());
+}
+
+TEST(InputChannel, MissingFileTest) {
+    ASSERT_THROW(input_channel::from_file("/nonexistent/stackmachine_input"), std::runtime_error);
+}
@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <sstream>
 
 #include "../instructions.h"
 #include "../interpreter.h"
@@ -400,6 +401,41 @@ TEST(Interpreter, PrintcTest) {
     ASSERT_EQ(0x0003, interp.registers().pc);
 }
 
+TEST(Interpreter, PrintsTest) {
+    program p;
+    p.append(mk_const('o'));
+    p.append(mk_const('k'));
+    p.append(mk_const('!'));
+    p.append(mk_const(2));
+    p.append(mk_prints());
+    std::stringstream out;
+    interpreter interp(p.code());
+    interp.set_output(out);
+    interp.run();
+
+    ASSERT_EQ("k!", out.str());
+    ASSERT_EQ(0x0001, interp.registers().sp);
+    ASSERT_EQ('o', interp.stack()[1]);
+}
+
+TEST(Interpreter, PrintnTest) {
+    program p;
+    p.append(mk_const(7));
+    p.append(mk_const(0));
+    p.append(mk_const(65535));
+    p.append(mk_const(3));
+    p.append(mk_printn());
+    p.append(mk_const(0));
+    p.append(mk_printn());
+    std::stringstream out;
+    interpreter interp(p.code());
+    interp.set_output(out);
+    interp.run();
+
+    ASSERT_EQ("7 0 65535", out.str());
+    ASSERT_EQ(0x0000, interp.registers().sp);
+}
+
 TEST(Interpreter, LdargsTest) {
     program p;
     p.append(mk_ldargs());
@@ -415,13 +451,178 @@ TEST(Interpreter, LdargsTest) {
 }
 
 TEST(Interpreter, CallTest) {
-    FAIL();
+    program p;
+    p.append(mk_const(0x0005));
+    p.append(mk_const(0x0007));
+    p.append(mk_call(2, 0x0008));
+    p.append(mk_stop());
+    p.append(mk_noop());
+    interpreter interp(p.code());
+    interp.step();
+    interp.step();
+    interp.step();
+
+    ASSERT_EQ(0x0007, interp.stack()[1]);
+    ASSERT_EQ(0xffff, interp.stack()[2]);
+    ASSERT_EQ(0x0005, interp.stack()[3]);
+    ASSERT_EQ(0x0007, interp.stack()[4]);
+    ASSERT_EQ(0x0004, interp.registers().sp);
+    ASSERT_EQ(0x0003, interp.registers().bp);
+    ASSERT_EQ(0x0008, interp.registers().pc);
 }
 
 TEST(Interpreter, TCallTest) {
-    FAIL();
+    program p;
+    p.append(mk_const(0x0005));
+    p.append(mk_call(1, 0x0006));
+    p.append(mk_stop());
+    // 0x0006
+    p.append(mk_const(0x0009));
+    p.append(mk_tcall(1, 1, 0x000C));
+    // 0x000C
+    p.append(mk_getbp());
+    p.append(mk_ldi());
+    p.append(mk_ret(1));
+    interpreter interp(p.code());
+    interp.step();
+    interp.step();
+    interp.step();
+    interp.step();
+
+    ASSERT_EQ(0x0009, interp.stack()[3]);
+    ASSERT_EQ(0x0003, interp.registers().sp);
+    ASSERT_EQ(0x0003, interp.registers().bp);
+    ASSERT_EQ(0x000C, interp.registers().pc);
+
+    interp.run();
+
+    ASSERT_EQ(0x0009, interp.stack()[1]);
+    ASSERT_EQ(0x0001, interp.registers().sp);
+    ASSERT_EQ(0xffff, interp.registers().bp);
+    ASSERT_EQ(0x0006, interp.registers().pc);
 }
 
 TEST(Interpreter, RetTest) {
-    FAIL();
-}
\ No newline at end of file
+    program p;
+    p.append(mk_const(0x0005));
+    p.append(mk_call(1, 0x0006));
+    p.append(mk_stop());
+    // 0x0006
+    p.append(mk_getbp());
+    p.append(mk_ldi());
+    p.append(mk_const(0x0001));
+    p.append(mk_add());
+    p.append(mk_ret(1));
+    interpreter interp(p.code());
+    for (int i = 0; i < 7; ++i) {
+        interp.step();
+    }
+
+    ASSERT_EQ(0x0006, interp.stack()[1]);
+    ASSERT_EQ(0x0001, interp.registers().sp);
+    ASSERT_EQ(0xffff, interp.registers().bp);
+    ASSERT_EQ(0x0005, interp.registers().pc);
+}
+
+TEST(Interpreter, ReadTest) {
+    std::vector<uint16_t> input = {0x1234};
+    program p;
+    p.append(mk_read());
+    interpreter interp(p.code());
+    interp.set_input_channel(std::make_shared<input_channel>(input.data(), input.size()));
+    interp.step();
+
+    ASSERT_EQ(0x1234, interp.stack()[1]);
+    ASSERT_EQ(0x0001, interp.stack()[2]);
+    ASSERT_EQ(0x0002, interp.registers().sp);
+    ASSERT_EQ(0x0001, interp.registers().pc);
+}
+
+TEST(Interpreter, ReadEofTest) {
+    program p;
+    p.append(mk_read());
+    interpreter interp(p.code());
+    interp.step();
+
+    ASSERT_EQ(0x0000, interp.stack()[1]);
+    ASSERT_EQ(0x0000, interp.stack()[2]);
+    ASSERT_EQ(0x0002, interp.registers().sp);
+    ASSERT_EQ(0x0001, interp.registers().pc);
+}
+
+TEST(Interpreter, ReadnTest) {
+    std::vector<uint16_t> input = {1,2,3};
+    program p;
+    p.append(mk_const(0x0005));
+    p.append(mk_readn());
+    interpreter interp(p.code());
+    interp.set_input_channel(std::make_shared<input_channel>(input.data(), input.size()));
+    interp.step();
+    interp.step();
+
+    ASSERT_EQ(0x0001, interp.stack()[1]);
+    ASSERT_EQ(0x0002, interp.stack()[2]);
+    ASSERT_EQ(0x0003, interp.stack()[3]);
+    ASSERT_EQ(0x0003, interp.stack()[4]);
+    ASSERT_EQ(0x0004, interp.registers().sp);
+    ASSERT_EQ(0x0003, interp.registers().pc);
+}
+
+TEST(Interpreter, ReadnTopTest) {
+    std::vector<uint16_t> input = {1,2,3};
+    program p;
+    p.append(mk_incsp(0xFFFC));
+    p.append(mk_const(0x0005));
+    p.append(mk_readn());
+    interpreter interp(p.code());
+    interp.set_input_channel(std::make_shared<input_channel>(input.data(), input.size()));
+    interp.step();
+    interp.step();
+    interp.step();
+
+    // one word fits below the count in the last stack word
+    ASSERT_EQ(0x0001, interp.stack()[0xFFFD]);
+    ASSERT_EQ(0x0001, interp.stack()[0xFFFE]);
+    ASSERT_EQ(0xFFFE, interp.registers().sp);
+}
+
+TEST(Interpreter, ReadnShortStackTest) {
+    std::vector<uint16_t> input = {1,2,3};
+    program p;
+    p.append(mk_incsp(0x0004));
+    p.append(mk_const(0x0005));
+    p.append(mk_readn());
+    interpreter interp(p.code());
+    interp.set_stack(std::vector<uint16_t>(8, 0));
+    interp.set_input_channel(std::make_shared<input_channel>(input.data(), input.size()));
+    interp.step();
+    interp.step();
+    interp.step();
+
+    ASSERT_EQ(8u, interp.stack().size());
+    ASSERT_EQ(0x0001, interp.stack()[5]);
+    ASSERT_EQ(0x0002, interp.stack()[6]);
+    ASSERT_EQ(0x0002, interp.stack()[7]);
+    ASSERT_EQ(0x0007, interp.registers().sp);
+}
+
+TEST(Interpreter, BudgetTest) {
+    program p;
+    p.append(mk_const(0x0007));
+    p.append(mk_printi());
+    p.append(mk_const(0x0008));
+    p.append(mk_printi());
+    interpreter interp(p.code());
+    std::stringstream out;
+    interp.set_output(out);
+
+    ASSERT_EQ(3u, interp.run(3));
+    ASSERT_FALSE(interp.is_stopped());
+    ASSERT_EQ("7", out.str());
+
+    // the budget ends at STOP
+    ASSERT_EQ(2u, interp.run(10));
+    ASSERT_TRUE(interp.is_stopped());
+    ASSERT_EQ("78", out.str());
+    ASSERT_EQ(0u, interp.run(10));
+}
@@ -0,0 +1,126 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "../assembler.h"
+#include "../interpreter.h"
+#include "../lazy_program.h"
+#include "../register_engine.h"
+
+namespace {
+
+    //! Leaves f(a) on the stack for the first argument a, with one of three
+    //! functions f picked by a % 3.
+    std::vector<uint16_t> pick_function() {
+        return assemble({
+                {NO_LABEL, instruction(mnemonic::LDARGS)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::MOD)},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0001})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x0012})},
+                {NO_LABEL, instruction(mnemonic::STOP)},
+                {0x0001  , instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x0010})},
+                {NO_LABEL, instruction(mnemonic::STOP)},
+                {0x0002  , instruction(mnemonic::CALL, {1, 0x0011})},
+                {NO_LABEL, instruction(mnemonic::STOP)},
+                {0x0010  , instruction(mnemonic::GETBP)},                   // a * a
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::RET, {1})},
+                {0x0011  , instruction(mnemonic::GETBP)},                   // a + 1
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::RET, {1})},
+                {0x0012  , instruction(mnemonic::GETBP)},                   // 2 * a * a
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x0010})},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::RET, {1})}
+        });
+    }
+
+    uint16_t expected_result(const std::vector<uint16_t>& code, uint16_t a) {
+        interpreter interp(code);
+        interp.set_command_line_arguments({a});
+        interp.run();
+        return interp.stack()[interp.registers().sp];
+    }
+}
+
+TEST(LazyProgram, LoadTest) {
+    auto code = pick_function();
+    auto program = std::make_shared<lazy_program>(code);
+    ASSERT_EQ(1u, program->functions());
+    ASSERT_TRUE(program->is_loaded(0));
+    ASSERT_LT(program->words(), code.size());
+
+    // a % 3 == 1 calls a + 1 only
+    register_engine engine(program);
+    engine.set_command_line_arguments({7});
+    engine.run();
+    ASSERT_EQ(8, engine.stack()[engine.registers().sp]);
+    ASSERT_EQ(2u, program->functions());
+
+    // a % 3 == 2 calls 2 * a * a, which calls a * a
+    register_engine other(program);
+    other.set_command_line_arguments({5});
+    other.run();
+    ASSERT_EQ(50, other.stack()[other.registers().sp]);
+    ASSERT_EQ(4u, program->functions());
+    // all but the STOP the interpreter appends
+    ASSERT_EQ(code.size(), program->words());
+}
+
+TEST(LazyProgram, VerifyTest) {
+    // the callee holds no valid instruction
+    std::vector<uint16_t> code = {LDARGS, DECSP, 1, IFZERO, 8, CALL, 0, 12, CONST, 'k', PRINTC, STOP, 0x7777};
+    ASSERT_THROW(register_engine{code}, std::domain_error);
+
+    auto program = std::make_shared<lazy_program>(code);
+    register_engine engine(program);
+    engine.set_command_line_arguments({0});
+    testing::internal::CaptureStdout();
+    engine.run();
+    ASSERT_EQ("k", testing::internal::GetCapturedStdout());
+
+    register_engine failing(program);
+    failing.set_command_line_arguments({1});
+    ASSERT_THROW(failing.run(), std::domain_error);
+    ASSERT_EQ(12, failing.registers().pc);
+    ASSERT_THROW(program->load(12), std::domain_error);
+
+    ASSERT_THROW(lazy_program({GOTO, 100}), std::domain_error);
+}
+
+TEST(LazyProgram, ThreadTest) {
+    auto code = pick_function();
+    for (int round = 0; round < 20; ++round) {
+        auto program = std::make_shared<lazy_program>(code);
+        std::vector<uint16_t> results(12);
+        std::vector<std::thread> threads;
+        for (uint16_t t = 0; t < results.size(); ++t) {
+            threads.emplace_back([&program, &results, t] {
+                register_engine engine(program);
+                engine.set_command_line_arguments({t});
+                engine.run();
+                results[t] = engine.stack()[engine.registers().sp];
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (uint16_t t = 0; t < results.size(); ++t) {
+            ASSERT_EQ(expected_result(code, t), results[t]);
+        }
+        ASSERT_EQ(4u, program->functions());
+    }
+}
@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include "../interpreter.h"
+#include "../linker.h"
+#include "test_harness.h"
+
+namespace {
+
+    //! A library of arithmetic functions of one argument.
+    object_module math_library() {
+        object_module module;
+        module.code = {
+                {0x0010  , instruction(mnemonic::GETBP)},                   // square
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::RET, {1})},
+                {0x0020  , instruction(mnemonic::GETBP)},                   // cube
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x0010})},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::RET, {1})},
+                {0x0030  , instruction(mnemonic::GETBP)},                   // twice
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::RET, {1})}
+        };
+        module.exports = {{"square", 0x0010}, {"cube", 0x0020}, {"twice", 0x0030}};
+        return module;
+    }
+
+    //! Prints function(a) for the first argument a, function is imported.
+    object_module main_module(const std::string& function) {
+        object_module module;
+        module.code = {
+                {0x0001  , instruction(mnemonic::LDARGS)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CALL, {1, 0x0100})},
+                {NO_LABEL, instruction(mnemonic::PRINTI)}
+        };
+        module.exports = {{"main", 0x0001}};
+        module.imports = {{0x0100, function}};
+        return module;
+    }
+}
+
+TEST(Linker, LinkTest) {
+    linker l;
+    l.add(math_library());
+    l.add(main_module("square"));
+    auto code = l.link("main");
+
+    ASSERT_EQ("49", run_interpreter(code, {7}).output);
+    // square is kept, cube and twice are dropped
+    ASSERT_EQ(2u, l.kept());
+    ASSERT_EQ(2u, l.dropped());
+    // the entry module comes first and falls into a STOP of its own
+    std::vector<uint16_t> expected = {LDARGS, DECSP, 1, CALL, 1, 8, PRINTI, STOP, GETBP, LDI, DUP, MUL, RET, 1};
+    ASSERT_EQ(expected, code);
+}
+
+TEST(Linker, CallChainTest) {
+    linker l;
+    l.add(main_module("cube"));
+    l.add(math_library());
+    ASSERT_EQ("27", run_interpreter(l.link("main"), {3}).output);
+    ASSERT_EQ(3u, l.kept());
+    ASSERT_EQ(1u, l.dropped());
+}
+
+TEST(Linker, EntryTest) {
+    // the entry point is not the first function of its module
+    object_module module;
+    module.code = {
+            {0x0001  , instruction(mnemonic::CONST, {'a'})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x0003})},
+            {0x0002  , instruction(mnemonic::CONST, {'b'})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+            {0x0004  , instruction(mnemonic::CONST, {'d'})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)}
+    };
+    module.exports = {{"start", 0x0002}, {"unused", 0x0004}};
+    module.imports = {{0x0003, "finish"}};
+
+    object_module other;
+    other.code = {
+            {0x0001  , instruction(mnemonic::CONST, {'c'})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)}
+    };
+    other.exports = {{"finish", 0x0001}};
+
+    linker l;
+    l.add(module);
+    l.add(other);
+    auto code = l.link("start");
+    ASSERT_EQ(GOTO, code[0]);
+    ASSERT_EQ("bac", run_interpreter(code).output);
+    ASSERT_EQ(3u, l.kept());
+    ASSERT_EQ(1u, l.dropped());
+}
+
+TEST(Linker, ErrorTest) {
+    linker l;
+    l.add(math_library());
+    ASSERT_THROW(l.add(math_library()), std::domain_error);
+    ASSERT_THROW(l.link("main"), std::domain_error);
+
+    // an import nobody exports
+    l.add(main_module("sqrt"));
+    ASSERT_THROW(l.link("main"), std::domain_error);
+
+    // unknown labels in dropped functions do not matter
+    linker dead;
+    auto module = math_library();
+    module.code.push_back({0x0040, instruction(mnemonic::GOTO, {0x4711})});
+    module.exports["broken"] = 0x0040;
+    dead.add(module);
+    dead.add(main_module("twice"));
+    ASSERT_EQ("10", run_interpreter(dead.link("main"), {5}).output);
+}
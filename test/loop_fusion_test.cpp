@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include "../assembler.h"
+#include "../block_layout.h"
+#include "../compact_engine.h"
+#include "../interpreter.h"
+#include "../loop_fusion.h"
+#include "../register_engine.h"
+#include "test_harness.h"
+
+namespace {
+
+    void expect_same(const std::vector<uint16_t>& code, const std::vector<uint16_t>& fused,
+                     const std::vector<uint16_t>& args) {
+        expect_equivalent(run_interpreter(code, args), run_interpreter(fused, args));
+    }
+
+    //! Prints the numbers from the first command line argument down to 1.
+    symbolic_program countdown() {
+        return {
+                {NO_LABEL, instruction(mnemonic::LDARGS)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {0x0001  , instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x0002})},
+                {NO_LABEL, instruction(mnemonic::DUP)},
+                {NO_LABEL, instruction(mnemonic::PRINTI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {' '})},
+                {NO_LABEL, instruction(mnemonic::PRINTC)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x0001})},
+                {0x0002  , instruction(mnemonic::CONST, {'.'})},
+                {NO_LABEL, instruction(mnemonic::PRINTC)}
+        };
+    }
+}
+
+TEST(LoopFusion, FuseTest) {
+    auto code = assemble(countdown());
+    loop_fusion fusion;
+    auto fused = fusion.run(code);
+
+    ASSERT_EQ(1u, fusion.fused());
+    ASSERT_EQ(code.size(), fused.size());
+    std::vector<uint16_t> latch = {DJNZ, 6, GOTO, 16, NOOP};
+    ASSERT_TRUE(std::equal(latch.begin(), latch.end(), fused.begin() + 11));
+
+    expect_same(code, fused, {5});
+    expect_same(code, fused, {0});
+    expect_same(code, fused, {1});
+    ASSERT_EQ("5 4 3 2 1 .", run_interpreter(fused, {5}).output);
+
+    // four dispatches less per iteration, one GOTO more to leave the loop
+    ASSERT_EQ(run_interpreter(code, {100}).steps - (4 * 100 - 1), run_interpreter(fused, {100}).steps);
+
+    // a second run finds nothing left
+    fusion.run(fused);
+    ASSERT_EQ(0u, fusion.fused());
+}
+
+TEST(LoopFusion, EngineTest) {
+    auto fused = loop_fusion().run(assemble(countdown()));
+    auto expected = run_interpreter(fused, {7});
+    ASSERT_EQ(0, expected.stack[expected.registers.sp]);
+
+    register_engine reg(fused);
+    expect_same_state(expected, run_machine(reg, {7}));
+    compact_engine compact(fused);
+    expect_same_state(expected, run_machine(compact, {7}));
+
+    // DJNZ is a branch to the profile and the layout
+    auto profile = std::make_shared<branch_profile>();
+    interpreter interp(fused);
+    interp.set_branch_profile(profile);
+    run_machine(interp, {7});
+    ASSERT_EQ(6u, profile->taken(11));
+    ASSERT_EQ(1u, profile->not_taken(11));
+    expect_same(fused, relayout(fused, *profile), {7});
+}
+
+TEST(LoopFusion, UnchangedTest) {
+    loop_fusion fusion;
+
+    // a jump to the SUB of the latch
+    std::vector<uint16_t> code = {
+            CONST, 3,
+            DUP, IFZERO, 20,
+            DUP, CONST, 2, LT, IFZERO, 15, CONST, 1, GOTO, 17,
+            CONST, 1, SUB, GOTO, 2,
+            PRINTI
+    };
+    ASSERT_TRUE(fusion.run(code) == code);
+    ASSERT_EQ(0u, fusion.fused());
+
+    // the loop head does not test a copy of the counter
+    code = {CONST, 3, IFZERO, 9, CONST, 1, SUB, GOTO, 2, PRINTI};
+    ASSERT_TRUE(fusion.run(code) == code);
+}
@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "../channel.h"
+#include "../interpreter.h"
+#include "../metrics.h"
+
+namespace {
+
+    std::string read_file(const std::string& path) {
+        std::ifstream in(path);
+        std::stringstream text;
+        text << in.rdbuf();
+        return text.str();
+    }
+}
+
+TEST(Metrics, HistogramTest) {
+    ASSERT_EQ(0u, latency_histogram::bucket(0));
+    ASSERT_EQ(7u, latency_histogram::bucket(7));
+    ASSERT_EQ(8u, latency_histogram::bucket(8));
+    ASSERT_EQ(15u, latency_histogram::bucket(15));
+    ASSERT_EQ(16u, latency_histogram::bucket(16));
+    ASSERT_EQ(16u, latency_histogram::bucket(17));
+    ASSERT_EQ(latency_histogram::BUCKETS - 1, latency_histogram::bucket(std::numeric_limits<uint64_t>::max()));
+
+    for (uint64_t v : {1ull, 9ull, 100ull, 1000ull, 123456ull, 1ull << 40, (1ull << 40) + 12345}) {
+        auto b = latency_histogram::bucket(v);
+        ASSERT_LE(latency_histogram::lower_bound(b), v);
+        ASSERT_GE(latency_histogram::upper_bound(b), v);
+        // at most one eighth wide
+        ASSERT_LE(latency_histogram::upper_bound(b) - latency_histogram::lower_bound(b), v / 8);
+        ASSERT_EQ(latency_histogram::upper_bound(b) + 1, latency_histogram::lower_bound(b + 1));
+    }
+
+    latency_histogram h;
+    h.counts.assign(latency_histogram::BUCKETS, 0);
+    h.count = 0;
+    h.sum = 0;
+    h.max = 0;
+    ASSERT_EQ(0u, h.percentile(0.5));
+    for (uint64_t v = 1; v <= 100; ++v) {
+        ++h.counts[latency_histogram::bucket(v * 1000)];
+        ++h.count;
+        h.max = v * 1000;
+    }
+    ASSERT_NEAR(50000.0, static_cast<double>(h.percentile(0.5)), 50000 / 8.0);
+    ASSERT_NEAR(99000.0, static_cast<double>(h.percentile(0.99)), 99000 / 8.0);
+    ASSERT_EQ(100000u, h.percentile(1.0));
+}
+
+TEST(Metrics, InterpreterTest) {
+    auto metrics = std::make_shared<metrics_registry>();
+
+    std::stringstream out;
+    // prints 3 2 1 and leaves 0 on the stack
+    interpreter countdown({CONST, 3, DUP, IFZERO, 12, DUP, PRINTI, CONST, 1, SUB, GOTO, 2});
+    countdown.set_output(out);
+    countdown.set_metrics(metrics);
+    auto executed = countdown.run(10);
+    executed += countdown.run(std::numeric_limits<uint64_t>::max());
+    ASSERT_TRUE(countdown.is_stopped());
+    ASSERT_EQ("321", out.str());
+
+    interpreter division({CONST, 1, CONST, 0, DIV});
+    division.set_safe_mode(true);
+    division.set_metrics(metrics);
+    executed += division.run(std::numeric_limits<uint64_t>::max());
+    ASSERT_EQ(interpreter::DIVISION_FAULT, division.fault());
+
+    // step() is not recorded
+    interpreter stepped({CONST, 1});
+    stepped.set_metrics(metrics);
+    stepped.step();
+
+    auto s = metrics->snapshot();
+    ASSERT_EQ(3u, s.runs);
+    ASSERT_EQ(executed, s.instructions);
+    ASSERT_EQ(1u, s.stopped);
+    ASSERT_EQ(1u, s.division_faults);
+    ASSERT_EQ(0u, s.stack_faults);
+    ASSERT_EQ(3u, s.output_bytes);
+    // the sp of a faulted VM is undefined
+    ASSERT_GE(s.max_final_sp, 1u);
+    ASSERT_EQ(3u, s.run_nanoseconds.count);
+    ASSERT_GT(s.run_nanoseconds.sum, 0u);
+}
+
+TEST(Metrics, BlockedTest) {
+    auto metrics = std::make_shared<metrics_registry>();
+    auto ch = std::make_shared<channel>(4);
+
+    // waits for the sender, run() yields until it is done
+    interpreter receiver({RECV, 0, DECSP, 1, RECV, 0, DECSP, 1});
+    receiver.set_channel(0, ch);
+    receiver.set_metrics(metrics);
+    std::thread sender([&ch] {
+        for (uint16_t v = 1; v <= 2; ++v) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            ASSERT_TRUE(ch->try_send(v));
+        }
+    });
+    receiver.run();
+    sender.join();
+
+    auto s = metrics->snapshot();
+    ASSERT_EQ(1u, s.runs);
+    ASSERT_EQ(5u, s.instructions);
+    ASSERT_EQ(1u, s.stopped);
+
+    // a slice that only finds the VM stopped is not a run
+    receiver.run(10);
+    ASSERT_EQ(1u, metrics->snapshot().runs);
+}
+
+TEST(Metrics, ThreadTest) {
+    metrics_registry metrics;
+    std::vector<std::thread> threads;
+    for (uint16_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&metrics, t] {
+            for (int i = 0; i < 10000; ++i) {
+                metrics.record_run(5, 100, 1, t, i % 2 == 0, interpreter::NO_FAULT);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    auto s = metrics.snapshot();
+    ASSERT_EQ(40000u, s.runs);
+    ASSERT_EQ(200000u, s.instructions);
+    ASSERT_EQ(20000u, s.stopped);
+    ASSERT_EQ(40000u, s.output_bytes);
+    ASSERT_EQ(3u, s.max_final_sp);
+    ASSERT_EQ(40000u, s.run_nanoseconds.counts[latency_histogram::bucket(100)]);
+    ASSERT_EQ(100u, s.run_nanoseconds.max);
+}
+
+TEST(Metrics, DumpTest) {
+    metrics_registry metrics;
+    metrics.record_run(7, 1500, 2, 4, true, interpreter::STACK_FAULT);
+    auto path = testing::TempDir() + "stackmachine_metrics";
+
+    metrics.dump(path, metrics_registry::PROMETHEUS);
+    auto text = read_file(path);
+    ASSERT_NE(std::string::npos, text.find("# TYPE stackmachine_instructions_total counter\n"));
+    ASSERT_NE(std::string::npos, text.find("stackmachine_instructions_total 7\n"));
+    ASSERT_NE(std::string::npos, text.find("stackmachine_faults_total{kind=\"stack\"} 1\n"));
+    ASSERT_NE(std::string::npos, text.find("stackmachine_run_seconds_bucket{le=\"+Inf\"} 1\n"));
+    ASSERT_NE(std::string::npos, text.find("stackmachine_run_seconds_count 1\n"));
+
+    metrics.dump(path, metrics_registry::JSON);
+    text = read_file(path);
+    ASSERT_EQ("{\"runs\":1,\"instructions\":7,\"stopped\":0,\"faults\":{\"stack\":1,\"division\":0},"
+              "\"output_bytes\":2,\"max_final_sp\":4,"
+              "\"run_nanoseconds\":{\"count\":1,\"sum\":1500,\"p50\":1500,\"p90\":1500,\"p99\":1500,\"max\":1500}}\n",
+              text);
+    std::remove(path.c_str());
+
+    ASSERT_THROW(metrics.dump("/nonexistent/directory/metrics", metrics_registry::JSON), std::runtime_error);
+}
@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+
+#include "../assembler.h"
+#include "../interpreter.h"
+#include "../parallel_engine.h"
+#include "../purity.h"
+#include "test_harness.h"
+#include "test_programs.h"
+
+namespace {
+
+    //! Run on the engine and compare everything with the interpreter.
+    //! \return the number of calls computed ahead of time
+    uint64_t expect_same(const symbolic_program& sprog, const std::vector<uint16_t>& args = {},
+                         unsigned workers = 4) {
+        auto code = assemble(sprog);
+        interpreter interp(code);
+        parallel_engine engine(code, workers);
+        expect_same_state(run_machine(interp, args), run_machine(engine, args));
+        return engine.speculated();
+    }
+}
+
+TEST(ParallelEngine, PurityTest) {
+    auto code = assemble({
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1001})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1002})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1003})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1004})},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            // a local, then 100 / a
+            {0x1000  , instruction(mnemonic::INCSP, {1})},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::CONST, {100})},
+            {NO_LABEL, instruction(mnemonic::STI)},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::DIV)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})},
+            // prints
+            {0x1001  , instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})},
+            // stores into slot 1
+            {0x1002  , instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::CONST, {7})},
+            {NO_LABEL, instruction(mnemonic::STI)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})},
+            // reads a slot it never wrote
+            {0x1003  , instruction(mnemonic::INCSP, {1})},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})},
+            // calls an impure function
+            {0x1004  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1001})},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    });
+
+    control_flow cfg(code);
+    purity_analysis purity(cfg);
+    std::vector<uint16_t> entries;
+    for (size_t pc = 0; pc < code.size(); ++pc) {
+        if (cfg.is_instruction(pc) && code[pc] == mnemonic::CALL) {
+            entries.push_back(code[pc + 2]);
+        }
+    }
+    ASSERT_EQ(6u, entries.size());
+
+    ASSERT_TRUE(purity.is_pure(entries[0]));
+    ASSERT_TRUE(purity.may_trap(entries[0]));
+    ASSERT_EQ(1u, purity.arguments(entries[0]));
+    for (size_t i = 1; i < entries.size(); ++i) {
+        ASSERT_FALSE(purity.is_pure(entries[i])) << i;
+    }
+
+    // LDARGS, DECSP 1, CALL 1 fib
+    auto fib_code = assemble(fib());
+    control_flow fib_cfg(fib_code);
+    purity_analysis fib_purity(fib_cfg);
+    ASSERT_TRUE(fib_purity.is_pure(fib_code[5]));
+    ASSERT_FALSE(fib_purity.may_trap(fib_code[5]));
+}
+
+TEST(ParallelEngine, FibTest) {
+    ASSERT_LT(0u, expect_same(fib(), {18}));
+    ASSERT_LT(0u, expect_same(fib(), {12}, 1));
+    ASSERT_EQ(0u, expect_same(fib(), {12}, 0));
+}
+
+TEST(ParallelEngine, WrapTest) {
+    // products of large words wrap around in argument code and callees
+    ASSERT_EQ(1u, expect_same({
+            {NO_LABEL, instruction(mnemonic::CONST, {0xFFFF})},
+            {NO_LABEL, instruction(mnemonic::CONST, {0xFFFF})},
+            {NO_LABEL, instruction(mnemonic::MUL)},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::CONST, {0xB505})},
+            {NO_LABEL, instruction(mnemonic::CONST, {0xC001})},
+            {NO_LABEL, instruction(mnemonic::MUL)},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {0xFFFE})},
+            {NO_LABEL, instruction(mnemonic::MUL)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    }));
+}
+
+TEST(ParallelEngine, ArgumentTest) {
+    // the second argument code reads the first result, the third does not
+    ASSERT_EQ(1u, expect_same({
+            {NO_LABEL, instruction(mnemonic::CONST, {3})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {5})},
+            {NO_LABEL, instruction(mnemonic::SWAP)},
+            {NO_LABEL, instruction(mnemonic::CALL, {2, 0x1001})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            // a * a with a local
+            {0x1000  , instruction(mnemonic::INCSP, {1})},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::MUL)},
+            {NO_LABEL, instruction(mnemonic::STI)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})},
+            // a - b
+            {0x1001  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    }));
+}
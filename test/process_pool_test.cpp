@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "../process_pool.h"
+#include "test_programs.h"
+
+namespace {
+    //! prints n times x
+    std::vector<uint16_t> print_xs(uint16_t n) {
+        return {CONST, n, DUP, IFZERO, 13, CONST, 'x', PRINTC, CONST, 1, SUB, GOTO, 2};
+    }
+}
+
+TEST(ProcessPool, OrderTest) {
+    process_pool pool(3);
+    ASSERT_EQ(3u, pool.size());
+
+    std::vector<job> jobs;
+    for (uint16_t i = 0; i < 500; ++i) {
+        jobs.push_back(i % 7 == 0 ? job{print_xs(i), {}} : job{print_args(), {i}});
+    }
+    auto results = pool.run(jobs);
+    ASSERT_EQ(jobs.size(), results.size());
+    for (uint16_t i = 0; i < 500; ++i) {
+        auto expected = i % 7 == 0 ? std::string(i, 'x') : "1" + std::to_string(i);
+        ASSERT_EQ(expected, results[i].output);
+        ASSERT_TRUE(results[i].stopped);
+        ASSERT_FALSE(results[i].crashed);
+    }
+    ASSERT_EQ(0u, pool.restarts());
+
+    // the workers stay for the next batch
+    ASSERT_EQ("17", pool.run({{print_args(), {7}}})[0].output);
+}
+
+TEST(ProcessPool, SharedTest) {
+    process_pool pool(2);
+
+    // a program and an output above SHARED_BYTES
+    std::vector<uint16_t> code(process_pool::SHARED_BYTES, NOOP);
+    auto tail = print_xs(20000);
+    // the jump targets move behind the NOOPs
+    tail[4] = static_cast<uint16_t>(tail[4] + code.size());
+    tail[12] = static_cast<uint16_t>(tail[12] + code.size());
+    code.insert(code.end(), tail.begin(), tail.end());
+
+    auto results = pool.run({{code, {}}, {print_args(), {3}}, {code, {}}});
+    ASSERT_EQ(std::string(20000, 'x'), results[0].output);
+    ASSERT_EQ("13", results[1].output);
+    ASSERT_EQ(std::string(20000, 'x'), results[2].output);
+}
+
+TEST(ProcessPool, CrashTest) {
+    process_pool pool(2);
+    auto first = pool.pids();
+
+    // division by zero outside safe mode kills the worker with SIGFPE
+    std::vector<job> jobs;
+    for (uint16_t i = 0; i < 100; ++i) {
+        jobs.push_back(i == 42 ? job{{CONST, 1, CONST, 0, DIV, PRINTI}, {}} : job{print_args(), {i}});
+    }
+    auto results = pool.run(jobs);
+    for (uint16_t i = 0; i < 100; ++i) {
+        ASSERT_EQ(i == 42, results[i].crashed);
+        if (i != 42) {
+            ASSERT_EQ("1" + std::to_string(i), results[i].output);
+        }
+    }
+    ASSERT_GE(pool.restarts(), 1u);
+    ASSERT_NE(first, pool.pids());
+}
+
+TEST(ProcessPool, BudgetTest) {
+    process_pool pool(1, 1000);
+    auto results = pool.run({{{GOTO, 0}, {}}, {print_args(), {1}}});
+    ASSERT_FALSE(results[0].stopped);
+    ASSERT_FALSE(results[0].crashed);
+    ASSERT_EQ("11", results[1].output);
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+
+#include "../assembler.h"
+#include "../program_cache.h"
+#include "../ssa_passes.h"
+#include "test_programs.h"
+
+namespace {
+    std::vector<std::string> list_directory(const std::string& directory) {
+        std::vector<std::string> names;
+        auto dir = opendir(directory.c_str());
+        while (auto entry = readdir(dir)) {
+            std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                names.push_back(name);
+            }
+        }
+        closedir(dir);
+        return names;
+    }
+
+    void remove_directory(const std::string& directory) {
+        for (auto& name : list_directory(directory)) {
+            unlink((directory + "/" + name).c_str());
+        }
+        rmdir(directory.c_str());
+    }
+
+    //! A loop that optimize() shortens.
+    std::vector<uint16_t> loop_program() {
+        return {
+                CONST, 0, CONST, 100,
+                DUP, IFZERO, 22,
+                SWAP, CONST, 3, CONST, 4, MUL, ADD, SWAP, CONST, 1, SUB, GOTO, 4,
+                NOOP, NOOP,
+                DECSP, 1, PRINTI
+        };
+    }
+}
+
+TEST(ProgramCache, HitTest) {
+    auto directory = make_temp_directory();
+    auto code = loop_program();
+
+    program_cache cold(directory);
+    auto computed = cold.load(code);
+    ASSERT_FALSE(computed->from_cache());
+    ASSERT_EQ(1u, cold.misses());
+    ASSERT_EQ(0u, cold.write_failures());
+    ASSERT_TRUE(computed->optimized() == optimize(code));
+
+    // a new process would find the entry
+    program_cache warm(directory);
+    auto cached = warm.load(code);
+    ASSERT_TRUE(cached->from_cache());
+    ASSERT_EQ(1u, warm.hits());
+    ASSERT_TRUE(cached->code() == code);
+    ASSERT_TRUE(cached->optimized() == computed->optimized());
+
+    auto program = code;
+    program.push_back(STOP);
+    ASSERT_TRUE(cached->flow().flags() == control_flow(program).flags());
+    ASSERT_TRUE(cached->flow().is_leader(4));
+
+    // another program is another entry
+    auto other = code;
+    other[3] = 50;
+    ASSERT_NE(warm.path(code), warm.path(other));
+    ASSERT_FALSE(warm.load(other)->from_cache());
+    ASSERT_EQ(2u, list_directory(directory).size());
+
+    remove_directory(directory);
+}
+
+TEST(ProgramCache, CorruptTest) {
+    auto directory = make_temp_directory();
+    auto code = loop_program();
+    program_cache cache(directory);
+    cache.load(code);
+
+    // a truncated entry is a miss and gets replaced
+    auto file = cache.path(code);
+    ASSERT_EQ(0, truncate(file.c_str(), 40));
+    ASSERT_FALSE(cache.load(code)->from_cache());
+    ASSERT_TRUE(cache.load(code)->from_cache());
+
+    // so is an entry of another program under the same name
+    std::ofstream(file, std::ios::binary | std::ios::trunc) << "SMCACHE";
+    ASSERT_FALSE(cache.load(code)->from_cache());
+    ASSERT_EQ(3u, cache.misses());
+
+    ASSERT_THROW(cache.load({GOTO, 7}), std::domain_error);
+
+    remove_directory(directory);
+}
+
+TEST(ProgramCache, ConcurrentTest) {
+    auto directory = make_temp_directory();
+    auto code = loop_program();
+    auto expected = optimize(code);
+
+    std::vector<std::thread> threads;
+    std::vector<int> same(8, 0);
+    for (size_t i = 0; i < same.size(); ++i) {
+        threads.push_back(std::thread([&, i] {
+            program_cache cache(directory);
+            for (int round = 0; round < 20; ++round) {
+                auto p = cache.load(code);
+                same[i] += p->optimized() == expected ? 1 : 0;
+            }
+        }));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    for (auto count : same) {
+        ASSERT_EQ(20, count);
+    }
+    // no temporary file is left behind
+    ASSERT_EQ(1u, list_directory(directory).size());
+    ASSERT_TRUE(program_cache(directory).load(code)->from_cache());
+
+    remove_directory(directory);
+}
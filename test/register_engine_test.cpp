@@ -0,0 +1,224 @@
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "../assembler.h"
+#include "../interpreter.h"
+#include "../register_engine.h"
+#include "test_harness.h"
+#include "test_programs.h"
+
+namespace {
+
+    void expect_same(const symbolic_program& sprog,
+                     const std::vector<uint16_t>& args = {},
+                     const std::vector<uint16_t>& input = {}) {
+        auto code = assemble(sprog);
+        interpreter interp(code);
+        register_engine engine(code);
+        expect_same_state(run_machine(interp, args, input), run_machine(engine, args, input));
+    }
+}
+
+TEST(RegisterEngine, HelloTest) {
+    expect_same({
+            {NO_LABEL, instruction(mnemonic::CONST, {'H'})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::CONST, {'i'})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::CONST, {4711})},
+            {NO_LABEL, instruction(mnemonic::CONST, {89})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)}
+    });
+}
+
+TEST(RegisterEngine, ArithmeticTest) {
+    expect_same({
+            {NO_LABEL, instruction(mnemonic::CONST, {7})},
+            {NO_LABEL, instruction(mnemonic::CONST, {3})},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::MUL)},
+            {NO_LABEL, instruction(mnemonic::SWAP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {2})},
+            {NO_LABEL, instruction(mnemonic::MOD)},
+            {NO_LABEL, instruction(mnemonic::SWAP)},
+            {NO_LABEL, instruction(mnemonic::DIV)},
+            {NO_LABEL, instruction(mnemonic::NOT)},
+            {NO_LABEL, instruction(mnemonic::CONST, {300})},
+            {NO_LABEL, instruction(mnemonic::CONST, {300})},
+            {NO_LABEL, instruction(mnemonic::MUL)},
+            {NO_LABEL, instruction(mnemonic::EQ)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)}
+    });
+}
+
+TEST(RegisterEngine, MemoryTest) {
+    // fill slots 1..20 with i * i and sum them up through a GETSP based address
+    expect_same({
+            {NO_LABEL, instruction(mnemonic::INCSP, {20})},
+            {NO_LABEL, instruction(mnemonic::CONST, {20})},
+            {0x1000  , instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::IFZERO, {0x1001})},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::MUL)},
+            {NO_LABEL, instruction(mnemonic::STI)},
+            {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x1000})},
+            {0x1001  , instruction(mnemonic::DECSP, {1})},
+            {NO_LABEL, instruction(mnemonic::CONST, {0})},     // slot 21: sum
+            {NO_LABEL, instruction(mnemonic::CONST, {20})},    // slot 22: counter
+            {0x1002  , instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::IFZERO, {0x1003})},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::GETSP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {2})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::CONST, {21})},
+            {NO_LABEL, instruction(mnemonic::SWAP)},
+            {NO_LABEL, instruction(mnemonic::STI)},
+            {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x1002})},
+            {0x1003  , instruction(mnemonic::DECSP, {1})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            // addresses pointing at the slot of the address itself
+            {NO_LABEL, instruction(mnemonic::GETSP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::GETSP)},
+            {NO_LABEL, instruction(mnemonic::GETSP)},
+            {NO_LABEL, instruction(mnemonic::STI)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)}
+    });
+}
+
+TEST(RegisterEngine, CallTest) {
+    expect_same({
+            {NO_LABEL, instruction(mnemonic::CONST, {'B'})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::CONST, {'1'})},
+            {NO_LABEL, instruction(mnemonic::CONST, {'2'})},
+            {NO_LABEL, instruction(mnemonic::CALL, {2, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::PRINTC)},
+            {NO_LABEL, instruction(mnemonic::CONST, {'R'})},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    });
+}
+
+TEST(RegisterEngine, RecursionTest) {
+    expect_same(fib(), {15});
+}
+
+TEST(RegisterEngine, TCallTest) {
+    // count down from 10 in a tail recursive function
+    expect_same({
+            {NO_LABEL, instruction(mnemonic::CONST, {10})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::IFNZERO, {0x1001})},
+            {NO_LABEL, instruction(mnemonic::RET, {0})},
+            {0x1001  , instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::TCALL, {1, 1, 0x1000})}
+    });
+}
+
+TEST(RegisterEngine, FallbackTest) {
+    // LDARGS and READ run on the stack interpreter
+    expect_same({
+            {NO_LABEL, instruction(mnemonic::LDARGS)},
+            {0x1000  , instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::IFZERO, {0x1001})},
+            {NO_LABEL, instruction(mnemonic::SWAP)},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x1000})},
+            {0x1001  , instruction(mnemonic::READ)},
+            {NO_LABEL, instruction(mnemonic::IFZERO, {0x1002})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::GOTO, {0x1001})},
+            {0x1002  , instruction(mnemonic::STOP)}
+    }, {3, 2, 1}, {10, 20, 30});
+}
+
+TEST(RegisterEngine, PrintTest) {
+    expect_same({
+            // a count known only at run time
+            {NO_LABEL, instruction(mnemonic::LDARGS)},
+            {NO_LABEL, instruction(mnemonic::PRINTN)},
+            // constant words
+            {NO_LABEL, instruction(mnemonic::CONST, {':'})},
+            {NO_LABEL, instruction(mnemonic::CONST, {' '})},
+            {NO_LABEL, instruction(mnemonic::CONST, {2})},
+            {NO_LABEL, instruction(mnemonic::PRINTS)},
+            {NO_LABEL, instruction(mnemonic::CONST, {40000})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            // words in memory and copies of them
+            {NO_LABEL, instruction(mnemonic::GETSP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {'a'})},
+            {NO_LABEL, instruction(mnemonic::SWAP)},
+            {NO_LABEL, instruction(mnemonic::DUP)},
+            {NO_LABEL, instruction(mnemonic::CONST, {3})},
+            {NO_LABEL, instruction(mnemonic::PRINTN)},
+            {NO_LABEL, instruction(mnemonic::CONST, {'b'})},
+            {NO_LABEL, instruction(mnemonic::CONST, {2})},
+            {NO_LABEL, instruction(mnemonic::PRINTS)},
+            {NO_LABEL, instruction(mnemonic::STOP)}
+    }, {3, 20, 100});
+}
+
+TEST(RegisterEngine, OutputTest) {
+    // register instructions and the interpreter steps print to one stream
+    std::vector<uint16_t> code = {
+            CONST, 'a', PRINTC, LDARGS, PRINTN, CONST, 7, PRINTI,
+            CONST, 'b', CONST, 'c', CONST, 2, PRINTS
+    };
+    std::stringstream out;
+    register_engine engine(code);
+    engine.set_output(out);
+    engine.set_command_line_arguments({1, 2});
+    testing::internal::CaptureStdout();
+    engine.run();
+    ASSERT_EQ("", testing::internal::GetCapturedStdout());
+    ASSERT_EQ("a1 27bc", out.str());
+}
+
+TEST(RegisterEngine, DispatchTest) {
+    auto code = assemble(fib());
+    std::vector<uint16_t> args = {15};
+
+    auto steps = run_interpreter(code, args).steps;
+    register_engine engine(code);
+    run_machine(engine, args);
+
+    ASSERT_LT(4 * engine.dispatches(), 3 * steps);
+}
+
+TEST(RegisterEngine, VerifyTest) {
+    std::vector<uint16_t> code = {GOTO, 0x0100};
+    ASSERT_THROW(register_engine engine(code), std::domain_error);
+}
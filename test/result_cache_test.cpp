@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+#include "../result_cache.h"
+#include "test_programs.h"
+
+TEST(ResultCache, MemoryTest) {
+    result_cache cache(2);
+    auto code = print_args();
+
+    auto first = cache.run(code, {7});
+    ASSERT_EQ("17", first.output);
+    ASSERT_TRUE(first.stopped);
+    ASSERT_EQ(1u, cache.misses());
+
+    std::stringstream out;
+    interpreter interp(code);
+    interp.set_output(out);
+    interp.set_command_line_arguments({7});
+    interp.run();
+
+    auto again = cache.run(code, {7});
+    ASSERT_EQ(1u, cache.hits());
+    ASSERT_EQ(out.str(), again.output);
+    ASSERT_EQ(interp.registers().pc, again.registers.pc);
+    ASSERT_EQ(interp.registers().sp, again.registers.sp);
+    ASSERT_EQ(interp.registers().bp, again.registers.bp);
+
+    ASSERT_EQ("18", cache.run(code, {8}).output);
+    // the least recently used result goes
+    ASSERT_EQ("19", cache.run(code, {9}).output);
+    ASSERT_EQ(2u, cache.size());
+    ASSERT_EQ(1u, cache.evictions());
+    ASSERT_EQ("17", cache.run(code, {7}).output);
+    ASSERT_EQ(4u, cache.misses());
+
+    // the arguments are part of the key
+    ASSERT_NE(result_cache::key(code, {7}), result_cache::key(code, {8}));
+    ASSERT_NE(result_cache::key({LDARGS, 1}, {}), result_cache::key({LDARGS}, {1}));
+}
+
+TEST(ResultCache, BudgetTest) {
+    result_cache cache;
+    auto result = cache.run({GOTO, 0}, {}, 100);
+    ASSERT_FALSE(result.stopped);
+    ASSERT_EQ(0u, cache.size());
+}
+
+TEST(ResultCache, DiskTest) {
+    auto directory = make_temp_directory();
+    auto code = print_args();
+
+    result_cache cold(4, directory);
+    ASSERT_EQ("15", cold.run(code, {5}).output);
+    ASSERT_EQ(1u, cold.misses());
+    ASSERT_EQ(0u, cold.write_failures());
+    auto file = cold.path(code, {5});
+    ASSERT_EQ(0, access(file.c_str(), R_OK));
+
+    result_cache warm(4, directory);
+    program_result result;
+    ASSERT_TRUE(warm.lookup(code, {5}, result));
+    ASSERT_EQ("15", result.output);
+    ASSERT_TRUE(result.stopped);
+    ASSERT_EQ(1u, warm.disk_hits());
+    ASSERT_TRUE(warm.lookup(code, {5}, result));
+    ASSERT_EQ(1u, warm.hits());
+    ASSERT_FALSE(warm.lookup(code, {6}, result));
+
+    // a damaged entry is a miss and is replaced
+    {
+        std::ofstream damaged(file, std::ios::trunc);
+        damaged << "garbage";
+    }
+    result_cache again(4, directory);
+    ASSERT_FALSE(again.lookup(code, {5}, result));
+    ASSERT_EQ("15", again.run(code, {5}).output);
+    result_cache repaired(4, directory);
+    ASSERT_TRUE(repaired.lookup(code, {5}, result));
+
+    unlink(file.c_str());
+    rmdir(directory.c_str());
+
+    ASSERT_THROW(result_cache(4, "/proc/version/results"), std::runtime_error);
+}
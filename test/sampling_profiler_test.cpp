@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+
+#include "../assembler.h"
+#include "../interpreter.h"
+#include "../sampling_profiler.h"
+#include "test_programs.h"
+
+namespace {
+
+    //! main calls f at 0, f calls g at 6, g is at 11.
+    std::vector<uint16_t> nested() {
+        return {
+                CALL, 0, 6,
+                PRINTI,
+                STOP,
+                NOOP,
+                CALL, 0, 11,
+                RET, 0,
+                CONST, 7,
+                RET, 0
+        };
+    }
+}
+
+TEST(SamplingProfiler, CollapsedTest) {
+    std::stringstream out;
+    interpreter interp(nested());
+    interp.set_output(out);
+    sampling_profiler profiler;
+
+    // in g
+    interp.step();
+    interp.step();
+    interp.step();
+    profiler.sample(interp);
+    profiler.sample(interp);
+    // back in f
+    interp.step();
+    profiler.sample(interp);
+    // back in main
+    interp.step();
+    profiler.sample(interp);
+
+    std::stringstream collapsed;
+    profiler.write_collapsed(collapsed);
+    ASSERT_EQ("0000;0006;000b 2\n0000;000d 1\n0009 1\n", collapsed.str());
+    ASSERT_EQ(4u, profiler.samples());
+
+    profiler.clear();
+    ASSERT_EQ(0u, profiler.samples());
+}
+
+TEST(SamplingProfiler, CapacityTest) {
+    interpreter interp(nested());
+    sampling_profiler profiler(2);
+    profiler.sample(interp);
+    profiler.sample(interp);
+    profiler.sample(interp);
+    ASSERT_EQ(2u, profiler.samples());
+    ASSERT_EQ(1u, profiler.dropped());
+}
+
+TEST(SamplingProfiler, TimerTest) {
+    auto code = assemble(fib());
+    sampling_profiler profiler;
+    profiler.start(1000);
+
+    sampling_profiler other;
+    ASSERT_THROW(other.start(), std::runtime_error);
+
+    // run until enough CPU time has passed for a few dozen ticks
+    auto begin = std::chrono::steady_clock::now();
+    while (profiler.samples() < 20 && std::chrono::steady_clock::now() - begin < std::chrono::seconds(10)) {
+        std::stringstream out;
+        interpreter interp(code);
+        interp.set_output(out);
+        interp.set_command_line_arguments({15});
+        interp.run();
+        ASSERT_EQ("610", out.str());
+    }
+    profiler.stop();
+    auto samples = profiler.samples();
+    ASSERT_GE(samples, 20u);
+
+    std::stringstream collapsed;
+    profiler.write_collapsed(collapsed);
+    std::string line;
+    uint64_t total = 0;
+    bool recursive = false;
+    while (std::getline(collapsed, line)) {
+        auto space = line.rfind(' ');
+        ASSERT_NE(std::string::npos, space);
+        total += std::stoull(line.substr(space + 1));
+        // fib calls itself from 0x0018 and 0x0020
+        recursive = recursive || line.find(";0018;") != std::string::npos || line.find(";0020;") != std::string::npos;
+    }
+    ASSERT_EQ(samples, total);
+    ASSERT_TRUE(recursive);
+
+    // stopped, so another profiler may start
+    other.start();
+    other.stop();
+    ASSERT_EQ(samples, profiler.samples());
+}
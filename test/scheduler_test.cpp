@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include <sstream>
+
+#include "../bench/workloads.h"
+#include "../scheduler.h"
+
+namespace {
+    std::unique_ptr<interpreter> make_vm(uint16_t n, std::ostream& out) {
+        std::unique_ptr<interpreter> vm(new interpreter(countdown_program(n)));
+        vm->set_output(out);
+        return vm;
+    }
+}
+
+TEST(Scheduler, RunTest) {
+    const size_t count = 50;
+    std::vector<std::stringstream> outputs(count);
+
+    scheduler s(3, 100);
+    for (size_t i = 0; i < count; ++i) {
+        s.spawn(make_vm(static_cast<uint16_t>(i * 40), outputs[i]),
+                static_cast<scheduler::priority>(i % scheduler::PRIORITY_COUNT));
+    }
+    s.wait();
+    ASSERT_EQ(count, s.size());
+
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQ(std::to_string(i * 40), outputs[i].str());
+        ASSERT_TRUE(s.vm(i).is_stopped());
+
+        std::stringstream out;
+        auto alone = make_vm(static_cast<uint16_t>(i * 40), out);
+        auto instructions = alone->run(1000000);
+
+        auto stats = s.stats(i);
+        ASSERT_TRUE(stats.stopped);
+        ASSERT_FALSE(stats.failed);
+        ASSERT_EQ(instructions, stats.instructions);
+        ASSERT_EQ((instructions + 99) / 100, stats.slices);
+        ASSERT_GE(stats.latency_seconds, stats.wait_seconds);
+    }
+
+    ASSERT_GT(s.latency_percentile(0.99), 0.0);
+    ASSERT_LE(s.latency_percentile(0.5), s.latency_percentile(0.99));
+    ASSERT_LE(s.latency_percentile(0.99), s.latency_percentile(1.0));
+}
+
+TEST(Scheduler, PriorityTest) {
+    std::stringstream low_out, high_out;
+
+    // a single worker, so the urgent VM overtakes at the next slice
+    scheduler s(1, 50);
+    auto low = s.spawn(make_vm(3000, low_out), scheduler::LOW);
+    auto high = s.spawn(make_vm(3000, high_out), scheduler::HIGH);
+    s.wait();
+
+    ASSERT_EQ("3000", low_out.str());
+    ASSERT_EQ("3000", high_out.str());
+    ASSERT_LT(s.stats(high).latency_seconds, s.stats(low).latency_seconds);
+}
+
+TEST(Scheduler, StealTest) {
+    const size_t count = 40;
+    std::vector<std::stringstream> outputs(count);
+
+    // VMs are handed out in turn, so the first worker gets all long ones
+    scheduler s(2, 100);
+    for (size_t i = 0; i < count; ++i) {
+        s.spawn(make_vm(i % 2 == 0 ? 2000 : 1, outputs[i]));
+    }
+    s.wait();
+
+    ASSERT_GT(s.steals(), 0u);
+    for (size_t i = 0; i < count; ++i) {
+        ASSERT_EQ(i % 2 == 0 ? "2000" : "1", outputs[i].str());
+    }
+}
+
+TEST(Scheduler, FailTest) {
+    std::stringstream out;
+    scheduler s(2);
+    // jumps past the end of the program
+    std::unique_ptr<interpreter> vm(new interpreter({GOTO, 100}));
+    vm->set_output(out);
+    auto id = s.spawn(std::move(vm));
+    s.wait();
+
+    ASSERT_TRUE(s.stats(id).stopped);
+    ASSERT_TRUE(s.stats(id).failed);
+    ASSERT_THROW(s.spawn(nullptr), std::domain_error);
+}
+
+TEST(Scheduler, PipelineTest) {
+    // small enough for the sum to fit a word
+    const uint16_t n = 200;
+    // send n down to 1 on channel 0
+    std::vector<uint16_t> producer = {CONST, n, DUP, IFZERO, 13, DUP, SEND, 0, CONST, 1, SUB, GOTO, 2, CLOSE, 0};
+    // triple everything from channel 0 onto channel 1
+    std::vector<uint16_t> stage = {RECV, 0, IFZERO, 11, CONST, 3, MUL, SEND, 1, GOTO, 0, CLOSE, 1};
+    // sum channel 1
+    std::vector<uint16_t> consumer = {CONST, 0, RECV, 1, IFZERO, 9, ADD, GOTO, 2, DECSP, 1, PRINTI};
+
+    // two stages share the channels, so the second needs two closes
+    auto first = std::make_shared<channel>(4);
+    auto second = std::make_shared<channel>(4, 2);
+    std::stringstream out;
+
+    scheduler s(3, 50);
+    std::unique_ptr<interpreter> c(new interpreter(consumer));
+    c->set_channel(1, second);
+    c->set_output(out);
+    auto cid = s.spawn(std::move(c));
+    for (int i = 0; i < 2; ++i) {
+        std::unique_ptr<interpreter> st(new interpreter(stage));
+        st->set_channel(0, first);
+        st->set_channel(1, second);
+        s.spawn(std::move(st));
+    }
+    std::unique_ptr<interpreter> p(new interpreter(producer));
+    p->set_channel(0, first);
+    s.spawn(std::move(p));
+    s.wait();
+
+    ASSERT_EQ(std::to_string(3 * n * (n + 1) / 2), out.str());
+    // the consumer started first and waited for the rest
+    ASSERT_GT(s.stats(cid).blocked_seconds, 0.0);
+}
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+
+#include "../interpreter.h"
+#include "../specializer.h"
+#include "test_harness.h"
+
+namespace {
+
+    void expect_same(const std::vector<uint16_t>& code, const std::vector<uint16_t>& residual,
+                     const std::vector<uint16_t>& known, const std::vector<uint16_t>& rest) {
+        auto args = known;
+        args.insert(args.end(), rest.begin(), rest.end());
+        expect_equivalent(run_interpreter(code, args), run_interpreter(residual, rest));
+    }
+
+    //! Prints x to the power of n for the arguments n and x.
+    std::vector<uint16_t> power() {
+        return {
+                LDARGS, DECSP, 1,                   // n x
+                CONST, 1,                           // n x acc
+                CONST, 1, LDI,                      // 5: n x acc n
+                IFZERO, 27,
+                CONST, 1, CONST, 1, LDI, CONST, 1, SUB, STI, DECSP, 1,
+                CONST, 2, LDI, MUL,                 // n x acc*x
+                GOTO, 5,
+                PRINTI                              // 27
+        };
+    }
+
+    //! Prints 0 1 2 ... up to the argument, a known counter in a loop
+    //! bounded by an unknown value.
+    std::vector<uint16_t> count_up() {
+        return {
+                LDARGS, DECSP, 1,                   // n
+                CONST, 0,                           // n i
+                CONST, 1, LDI,                      // 5: n i n
+                IFZERO, 28,
+                DUP, PRINTI,
+                CONST, 1, ADD,                      // n i+1
+                CONST, 1, CONST, 1, LDI, CONST, 1, SUB, STI, DECSP, 1,
+                GOTO, 5,
+                PRINTI                              // 28
+        };
+    }
+
+    bool contains(const std::vector<uint16_t>& code, uint16_t word) {
+        return std::find(code.begin(), code.end(), word) != code.end();
+    }
+}
+
+TEST(Specializer, UnrollTest) {
+    auto code = power();
+    specializer spec;
+    auto residual = spec.run(code, {3}, 1);
+
+    // the loop on the known exponent is gone, the multiplications stay
+    ASSERT_FALSE(contains(residual, IFZERO));
+    ASSERT_FALSE(contains(residual, GOTO));
+    ASSERT_EQ(3, std::count(residual.begin(), residual.end(), MUL));
+    ASSERT_GT(spec.folded(), 0u);
+    for (uint16_t x : {0, 1, 2, 7, 300}) {
+        expect_same(code, residual, {3}, {x});
+    }
+    ASSERT_EQ("343", run_interpreter(residual, {7}).output);
+}
+
+TEST(Specializer, KnownTest) {
+    auto code = power();
+    auto residual = specializer().run(code, {5, 2}, 0);
+    ASSERT_FALSE(contains(residual, MUL));
+    ASSERT_FALSE(contains(residual, LDARGS));
+    ASSERT_LT(residual.size(), code.size());
+    expect_same(code, residual, {5, 2}, {});
+    ASSERT_EQ("32", run_interpreter(residual, {}).output);
+}
+
+TEST(Specializer, WrapTest) {
+    // 0xB505 squared does not fit in an int, folding it wraps like MUL
+    auto code = power();
+    auto residual = specializer().run(code, {2, 0xB505}, 0);
+    ASSERT_FALSE(contains(residual, MUL));
+    expect_same(code, residual, {2, 0xB505}, {});
+}
+
+TEST(Specializer, UnknownTest) {
+    auto code = power();
+    auto residual = specializer().run(code, {}, 2);
+    for (uint16_t n : {0, 1, 4}) {
+        for (uint16_t x : {0, 3, 11}) {
+            expect_same(code, residual, {}, {n, x});
+        }
+    }
+}
+
+TEST(Specializer, BranchTest) {
+    // prints a if the first argument is 0 and b otherwise, then the second
+    std::vector<uint16_t> code = {
+            LDARGS, DECSP, 1, SWAP,
+            IFZERO, 13,
+            CONST, 'b', PRINTC, CONST, 1, GOTO, 18,
+            CONST, 'a', PRINTC, CONST, 1, // 13
+            DECSP, 1, PRINTI              // 18
+    };
+    specializer spec;
+    auto residual = spec.run(code, {0}, 1);
+    ASSERT_FALSE(contains(residual, IFZERO));
+    ASSERT_FALSE(contains(residual, 'b'));
+    ASSERT_LT(residual.size(), code.size());
+    for (uint16_t x : {0, 9}) {
+        expect_same(code, residual, {0}, {x});
+    }
+    ASSERT_EQ("a9", run_interpreter(residual, {9}).output);
+    expect_same(code, spec.run(code, {4}, 1), {4}, {9});
+}
+
+TEST(Specializer, MergeTest) {
+    auto code = count_up();
+    specializer spec(4);
+    auto residual = spec.run(code, {}, 1);
+    for (uint16_t n = 0; n < 12; ++n) {
+        expect_same(code, residual, {}, {n});
+    }
+    ASSERT_EQ("01234", run_interpreter(residual, {4}).output);
+    // the loop stays a loop once the counter is merged
+    expect_same(code, residual, {}, {1000});
+    ASSERT_LE(spec.versions(), 16u);
+}
+
+TEST(Specializer, PrintTest) {
+    // the counts of LDARGS and the CONSTs are known, one argument is not
+    std::vector<uint16_t> code = {LDARGS, PRINTN, CONST, '!', CONST, 1, PRINTS};
+    auto residual = specializer().run(code, {4}, 1);
+    expect_same(code, residual, {4}, {5});
+    ASSERT_EQ("4 5!", run_interpreter(residual, {5}).output);
+
+    ASSERT_THROW(specializer().run({LDARGS, DECSP, 1, PRINTN}, {}, 1), std::domain_error);
+}
+
+TEST(Specializer, ErrorTest) {
+    ASSERT_THROW(specializer().run({CALL, 0, 4, STOP, RET, 0}, {}, 0), std::domain_error);
+    // the stack grows without bound
+    ASSERT_THROW(specializer().run({CONST, 1, GOTO, 0}, {}, 0), std::domain_error);
+    ASSERT_THROW(specializer().run({GOTO, 100}, {}, 0), std::domain_error);
+    // unsupported instructions are fine where they are not reached
+    auto residual = specializer().run({LDARGS, IFZERO, 6, CALL, 0, 7, STOP, RET, 0}, {}, 0);
+    ASSERT_FALSE(contains(residual, CALL));
+}
@@ -0,0 +1,314 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include "../assembler.h"
+#include "../interpreter.h"
+#include "../ssa.h"
+#include "../ssa_passes.h"
+#include "test_harness.h"
+
+namespace {
+
+    void expect_same(const std::vector<uint16_t>& original, const std::vector<uint16_t>& optimized,
+                     const std::vector<uint16_t>& input = {}) {
+        expect_equivalent(run_interpreter(original, {}, input), run_interpreter(optimized, {}, input));
+    }
+
+    //! A loop as a naive code generator emits it: every variable lives in a
+    //! stack slot and is loaded and stored through constant addresses.
+    symbolic_program codegen_loop() {
+        return {
+                {NO_LABEL, instruction(mnemonic::CONST, {0})},    // slot 1: acc
+                {NO_LABEL, instruction(mnemonic::READ)},          // slot 2: n
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {100})},  // slot 3: i
+                {0x1000  , instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::IFZERO, {0x1001})},
+                // acc = acc + n * n + 7
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {2})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::MUL)},
+                {NO_LABEL, instruction(mnemonic::CONST, {7})},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::ADD)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                // i = i - 1
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::CONST, {3})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::SUB)},
+                {NO_LABEL, instruction(mnemonic::STI)},
+                {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+                {NO_LABEL, instruction(mnemonic::GOTO, {0x1000})},
+                {0x1001  , instruction(mnemonic::CONST, {1})},
+                {NO_LABEL, instruction(mnemonic::LDI)},
+                {NO_LABEL, instruction(mnemonic::PRINTI)}
+        };
+    }
+
+    //! Random programs of arithmetic, slot accesses, output and counted
+    //! loops whose bodies leave the stack depth unchanged.
+    class program_generator {
+    public:
+        explicit program_generator(unsigned seed) : m_random(seed) {}
+
+        std::vector<uint16_t> generate() {
+            m_code.clear();
+            m_depth = 0;
+            emit(CONST, 1 + pick(5));
+            m_depth = 1;
+            for (int i = 0; i < 4; ++i) {
+                if (pick(2) == 0) {
+                    loop();
+                } else {
+                    straight(8);
+                }
+            }
+            return m_code;
+        }
+
+    private:
+        unsigned pick(unsigned n) {
+            return std::uniform_int_distribution<unsigned>(0, n - 1)(m_random);
+        }
+
+        void emit(uint16_t m) {
+            m_code.push_back(m);
+        }
+
+        void emit(uint16_t m, unsigned arg) {
+            m_code.push_back(m);
+            m_code.push_back(static_cast<uint16_t>(arg));
+        }
+
+        //! an existing slot other than the loop counters
+        unsigned target() {
+            unsigned slot;
+            do {
+                slot = 1 + pick(m_depth);
+            } while (std::find(m_counters.begin(), m_counters.end(), slot) != m_counters.end());
+            return slot;
+        }
+
+        //! the highest slot the current code must keep
+        unsigned floor() const {
+            return m_counters.empty() ? 1 : m_counters.back();
+        }
+
+        void straight(int length) {
+            for (int i = 0; i < length; ++i) {
+                switch (pick(10)) {
+                    case 0:
+                    case 1:
+                        emit(CONST, pick(2) == 0 ? pick(4) : pick(0x10000));
+                        ++m_depth;
+                        break;
+                    case 2:
+                        if (m_depth >= floor() + 2) {
+                            static const uint16_t ops[] = {ADD, SUB, MUL, EQ, LT};
+                            emit(ops[pick(5)]);
+                            --m_depth;
+                        }
+                        break;
+                    case 3:
+                        if (m_depth >= floor() + 1) {
+                            emit(CONST, 1 + pick(9));
+                            emit(pick(2) == 0 ? DIV : MOD);
+                        }
+                        break;
+                    case 4:
+                        emit(DUP);
+                        ++m_depth;
+                        break;
+                    case 5:
+                        emit(CONST, 1 + pick(m_depth));
+                        emit(LDI);
+                        ++m_depth;
+                        break;
+                    case 6:
+                        emit(CONST, target());
+                        emit(SWAP);
+                        emit(STI);
+                        break;
+                    case 7:
+                        emit(DUP);
+                        emit(PRINTI);
+                        break;
+                    case 8:
+                        if (m_depth >= floor() + 2) {
+                            emit(SWAP);
+                        } else if (m_depth >= floor() + 1) {
+                            emit(NOT);
+                        }
+                        break;
+                    default:
+                        if (m_depth >= floor() + 1) {
+                            emit(DECSP, 1);
+                            --m_depth;
+                        }
+                        break;
+                }
+            }
+        }
+
+        void loop() {
+            // the counter sits on top, the body must not touch it
+            emit(CONST, 1 + pick(4));
+            ++m_depth;
+            auto counter = m_depth;
+            m_counters.push_back(counter);
+
+            auto head = m_code.size();
+            emit(CONST, counter);
+            emit(LDI);
+            emit(IFZERO, 0);
+            auto exit = m_code.size() - 1;
+
+            straight(6);
+            if (m_depth > counter) {
+                emit(DECSP, m_depth - counter);
+                m_depth = counter;
+            }
+            emit(CONST, counter);
+            emit(CONST, counter);
+            emit(LDI);
+            emit(CONST, 1);
+            emit(SUB);
+            emit(STI);
+            emit(DECSP, 1);
+            emit(GOTO, static_cast<unsigned>(head));
+            m_code[exit] = static_cast<uint16_t>(m_code.size());
+
+            m_counters.pop_back();
+        }
+
+        std::mt19937 m_random;
+        std::vector<uint16_t> m_code;
+        std::vector<unsigned> m_counters;
+        unsigned m_depth;
+    };
+}
+
+TEST(Ssa, RoundTripTest) {
+    auto code = assemble(codegen_loop());
+    auto f = lift(code);
+    expect_same(code, lower(f), {5});
+}
+
+TEST(Ssa, ConstantTest) {
+    std::vector<uint16_t> code = {
+            CONST, 6, CONST, 7, MUL, CONST, 2, ADD, PRINTI,
+            CONST, 0xFFFF, CONST, 1, ADD, IFZERO, 21,
+            CONST, 'n', PRINTC, GOTO, 24,
+            CONST, 'z', PRINTC
+    };
+
+    ssa_function f = lift(code);
+    sccp_pass().run(f);
+
+    // the branch is known to jump
+    for (auto& block : f.blocks) {
+        ASSERT_NE(ssa_block::IFZERO, block.terminator);
+    }
+
+    auto optimized = optimize(code);
+    expect_same(code, optimized);
+    ASSERT_LT(run_interpreter(optimized).steps, run_interpreter(code).steps);
+}
+
+TEST(Ssa, WraparoundTest) {
+    std::vector<uint16_t> code = {
+            CONST, 0x8000, CONST, 2, MUL, PRINTI,
+            CONST, 1, CONST, 2, SUB, PRINTI,
+            CONST, 0xFFFF, CONST, 1, ADD, NOT, PRINTI
+    };
+    auto optimized = optimize(code);
+    expect_same(code, optimized);
+    ASSERT_EQ("0655351", run_interpreter(optimized).output);
+}
+
+TEST(Ssa, CseTest) {
+    // n * n + 1 is computed twice from the same slot
+    std::vector<uint16_t> code = {
+            READ, DECSP, 1,
+            CONST, 1, LDI, CONST, 1, LDI, MUL, CONST, 1, ADD, PRINTI,
+            CONST, 1, LDI, CONST, 1, LDI, MUL, CONST, 1, ADD, PRINTI
+    };
+    auto f = lift(code);
+    ASSERT_TRUE(cse_pass().run(f));
+    auto optimized = lower(f);
+    expect_same(code, optimized, {9});
+}
+
+TEST(Ssa, LoopTest) {
+    auto code = assemble(codegen_loop());
+
+    auto f = lift(code);
+    ASSERT_TRUE(licm_pass().run(f));
+
+    auto optimized = optimize(code);
+    expect_same(code, optimized, {5});
+    expect_same(code, optimized, {0xFFFF});
+
+    // the invariant product is computed once, loads and stores get shorter
+    ASSERT_LT(4 * run_interpreter(optimized, {}, {5}).steps, 3 * run_interpreter(code, {}, {5}).steps);
+}
+
+TEST(Ssa, DivisionTest) {
+    // the unused division by an input must still trap, the constant one is folded away
+    std::vector<uint16_t> code = {
+            CONST, 10, CONST, 2, DIV, DECSP, 1,
+            CONST, 10, READ, DECSP, 1, DIV, DECSP, 1,
+            CONST, 'k', PRINTC
+    };
+    auto f = lift(code);
+    ssa_pass_manager passes;
+    passes.add(std::unique_ptr<ssa_pass>(new sccp_pass));
+    passes.add(std::unique_ptr<ssa_pass>(new dce_pass));
+    passes.run(f);
+
+    size_t checks = 0;
+    for (auto& block : f.blocks) {
+        for (auto& e : block.effects) {
+            checks += e.kind == ssa_effect::CHECK ? 1 : 0;
+        }
+    }
+    ASSERT_EQ(1u, checks);
+    expect_same(code, lower(f), {3});
+}
+
+TEST(Ssa, UnsupportedTest) {
+    std::vector<uint16_t> call = {CONST, 1, CALL, 1, 6, STOP, GETBP, LDI, RET, 0};
+    ASSERT_THROW(lift(call), std::domain_error);
+    // the call is inlined first
+    expect_same(call, optimize(call));
+
+    std::vector<uint16_t> recursive = {CONST, 1, CALL, 1, 6, STOP, GETBP, LDI, CALL, 1, 6, RET, 0};
+    ASSERT_TRUE(optimize(recursive) == recursive);
+
+    // the stack depth at the loop head differs between the paths
+    std::vector<uint16_t> growing = {CONST, 1, DUP, GOTO, 2};
+    ASSERT_THROW(lift(growing), std::domain_error);
+
+    std::vector<uint16_t> computed = {READ, LDI, PRINTI};
+    ASSERT_THROW(lift(computed), std::domain_error);
+}
+
+TEST(Ssa, RandomProgramTest) {
+    program_generator generator(4711);
+    for (int i = 0; i < 300; ++i) {
+        auto code = generator.generate();
+        SCOPED_TRACE(i);
+        expect_same(code, lower(lift(code)));
+        expect_same(code, optimize(code));
+    }
+}
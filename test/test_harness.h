@@ -0,0 +1,78 @@
+#ifndef STACKMACHINE_TEST_HARNESS_H
+#define STACKMACHINE_TEST_HARNESS_H
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../input_channel.h"
+#include "../interpreter.h"
+
+//! What a program left behind when it stopped.
+struct run_result {
+    std::string output;
+    interpreter::configs registers;
+    std::vector<uint16_t> stack;
+    //! instructions executed, 0 for the engines which do not count them
+    uint64_t steps;
+
+    //! The stack up to sp.
+    std::vector<uint16_t> live() const {
+        return std::vector<uint16_t>(stack.begin(), stack.begin() + registers.sp + 1);
+    }
+};
+
+inline uint64_t run_counted(interpreter& interp) {
+    return interp.run(std::numeric_limits<uint64_t>::max());
+}
+
+template <typename Engine>
+uint64_t run_counted(Engine& engine) {
+    engine.run();
+    return 0;
+}
+
+//! Run an interpreter or one of the engines until STOP with the output going
+//! to a string. Anything else the run needs is set up by the caller.
+template <typename Machine>
+run_result run_machine(Machine& machine, const std::vector<uint16_t>& args = {},
+                       const std::vector<uint16_t>& input = {}) {
+    std::stringstream out;
+    machine.set_command_line_arguments(args);
+    machine.set_input_channel(std::make_shared<input_channel>(input.data(), input.size()));
+    machine.set_output(out);
+    auto steps = run_counted(machine);
+    machine.set_output(std::cout);
+    return {out.str(), machine.registers(), machine.stack(), steps};
+}
+
+inline run_result run_interpreter(const std::vector<uint16_t>& code, const std::vector<uint16_t>& args = {},
+                                  const std::vector<uint16_t>& input = {}) {
+    interpreter interp(code);
+    return run_machine(interp, args, input);
+}
+
+//! An engine runs a program to exactly the state the interpreter does.
+inline void expect_same_state(const run_result& expected, const run_result& actual) {
+    EXPECT_EQ(expected.output, actual.output);
+    EXPECT_EQ(expected.registers.pc, actual.registers.pc);
+    EXPECT_EQ(expected.registers.sp, actual.registers.sp);
+    EXPECT_EQ(expected.registers.bp, actual.registers.bp);
+    EXPECT_TRUE(expected.stack == actual.stack);
+}
+
+//! A transformed program prints the same and leaves the same stack up to sp,
+//! it may stop elsewhere and leave other words above sp.
+inline void expect_equivalent(const run_result& expected, const run_result& actual) {
+    EXPECT_EQ(expected.output, actual.output);
+    EXPECT_EQ(expected.registers.sp, actual.registers.sp);
+    EXPECT_EQ(expected.registers.bp, actual.registers.bp);
+    EXPECT_TRUE(expected.live() == actual.live());
+}
+
+#endif //STACKMACHINE_TEST_HARNESS_H
@@ -0,0 +1,50 @@
+#ifndef STACKMACHINE_TEST_PROGRAMS_H
+#define STACKMACHINE_TEST_PROGRAMS_H
+
+#include <cstdlib>
+#include <string>
+#include "../assembler.h"
+
+//! fib(n) by naive recursion, n is the first command line argument.
+inline symbolic_program fib() {
+    return {
+            {NO_LABEL, instruction(mnemonic::LDARGS)},
+            {NO_LABEL, instruction(mnemonic::DECSP, {1})},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::PRINTI)},
+            {NO_LABEL, instruction(mnemonic::STOP)},
+            {0x1000  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {2})},
+            {NO_LABEL, instruction(mnemonic::LT)},
+            {NO_LABEL, instruction(mnemonic::IFZERO, {0x1001})},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})},
+            {0x1001  , instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {1})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::GETBP)},
+            {NO_LABEL, instruction(mnemonic::LDI)},
+            {NO_LABEL, instruction(mnemonic::CONST, {2})},
+            {NO_LABEL, instruction(mnemonic::SUB)},
+            {NO_LABEL, instruction(mnemonic::CALL, {1, 0x1000})},
+            {NO_LABEL, instruction(mnemonic::ADD)},
+            {NO_LABEL, instruction(mnemonic::RET, {0})}
+    };
+}
+
+//! Prints the number of arguments and the last one.
+inline std::vector<uint16_t> print_args() {
+    return {LDARGS, PRINTI, PRINTI};
+}
+
+//! Create an empty directory under /tmp for a cache to keep its files in.
+inline std::string make_temp_directory() {
+    char name[] = "/tmp/stackmachine_test_XXXXXX";
+    return mkdtemp(name);
+}
+
+#endif //STACKMACHINE_TEST_PROGRAMS_H
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+
+#include "../interpreter.h"
+#include "../vector_ops.h"
+#include "test_harness.h"
+
+namespace {
+
+    std::vector<vector_isa> supported_isas() {
+        std::vector<vector_isa> isas;
+        for (auto isa : {vector_isa::SCALAR, vector_isa::SSE2, vector_isa::AVX2}) {
+            if (supports(isa)) {
+                isas.push_back(isa);
+            }
+        }
+        return isas;
+    }
+
+    //! Words with the edge cases of wraparound and unsigned comparison.
+    std::vector<uint16_t> random_words(std::mt19937& random, size_t n) {
+        const uint16_t edges[] = {0, 1, 0x7FFF, 0x8000, 0x8001, 0xFFFF};
+        std::vector<uint16_t> words(n);
+        for (auto& w : words) {
+            w = random() % 4 == 0 ? edges[random() % 6] : static_cast<uint16_t>(random());
+        }
+        return words;
+    }
+
+    run_result run(const std::vector<uint16_t>& code, const std::vector<uint16_t>& stack, vector_isa isa) {
+        interpreter interp(code);
+        interp.set_stack(stack);
+        interp.set_vector_isa(isa);
+        return run_machine(interp);
+    }
+}
+
+TEST(VectorOps, KernelTest) {
+    std::mt19937 random(17);
+    auto& scalar = vector_kernels_for(vector_isa::SCALAR);
+    ASSERT_TRUE(supports(best_vector_isa()));
+
+    for (auto isa : supported_isas()) {
+        auto& kernels = vector_kernels_for(isa);
+        ASSERT_EQ(isa, kernels.isa);
+
+        for (size_t n = 0; n < 70; ++n) {
+            auto a = random_words(random, n);
+            auto b = random_words(random, n);
+            std::vector<uint16_t> expected(n), actual(n);
+
+            for (auto op : {&vector_kernels::add, &vector_kernels::sub, &vector_kernels::mul,
+                            &vector_kernels::eq, &vector_kernels::lt}) {
+                (scalar.*op)(expected.data(), a.data(), b.data(), n);
+                (kernels.*op)(actual.data(), a.data(), b.data(), n);
+                ASSERT_TRUE(expected == actual) << static_cast<int>(isa) << " n=" << n;
+            }
+            ASSERT_EQ(scalar.dot(a.data(), b.data(), n), kernels.dot(a.data(), b.data(), n));
+            ASSERT_EQ(scalar.max(a.data(), n), kernels.max(a.data(), n));
+
+            // the destination may be a source
+            auto in_place = a;
+            kernels.sub(in_place.data(), in_place.data(), b.data(), n);
+            scalar.sub(expected.data(), a.data(), b.data(), n);
+            ASSERT_TRUE(expected == in_place);
+        }
+    }
+
+    std::vector<uint16_t> small = {3, 0x8000, 2};
+    std::vector<uint16_t> flags(3);
+    scalar.lt(flags.data(), small.data(), std::vector<uint16_t>{4, 1, 2}.data(), 3);
+    ASSERT_TRUE((std::vector<uint16_t>{1, 0, 0}) == flags);
+    ASSERT_EQ(0x8000, scalar.max(small.data(), 3));
+    ASSERT_EQ(0, scalar.max(small.data(), 0));
+}
+
+TEST(VectorOps, InterpreterTest) {
+    std::mt19937 random(5);
+    const uint16_t n = 100;
+    std::vector<uint16_t> stack(0xFFFF, 0);
+    stack[0] = 0xFFFF;
+    auto a = random_words(random, n);
+    auto b = random_words(random, n);
+    std::copy(a.begin(), a.end(), stack.begin() + 0x1000);
+    std::copy(b.begin(), b.end(), stack.begin() + 0x2000);
+
+    std::vector<uint16_t> code = {
+            CONST, 0x3000, CONST, 0x1000, CONST, 0x2000, CONST, n, VMUL,
+            CONST, 0x3000, CONST, n, VMAX, PRINTI, CONST, ' ', PRINTC,
+            CONST, 0x1000, CONST, 0x2000, CONST, n, VDOT, PRINTI
+    };
+
+    uint16_t max = 0;
+    uint16_t dot = 0;
+    for (uint16_t k = 0; k < n; ++k) {
+        auto product = static_cast<uint16_t>(static_cast<uint32_t>(a[k]) * b[k]);
+        max = std::max(max, product);
+        dot = static_cast<uint16_t>(dot + product);
+    }
+    std::stringstream expected;
+    expected << max << ' ' << dot;
+
+    for (auto isa : supported_isas()) {
+        auto result = run(code, stack, isa);
+        ASSERT_EQ(expected.str(), result.output);
+        for (uint16_t k = 0; k < n; ++k) {
+            ASSERT_EQ(static_cast<uint16_t>(static_cast<uint32_t>(a[k]) * b[k]), result.stack[0x3000 + k]);
+        }
+    }
+}
+
+TEST(VectorOps, OrderTest) {
+    // s[0x1001 + k] = s[0x1000 + k] + 1 sees the result of the element before
+    std::vector<uint16_t> stack(0xFFFF, 0);
+    stack[0] = 0xFFFF;
+    stack[0x1000] = 7;
+    std::fill(stack.begin() + 0x2000, stack.begin() + 0x2040, 1);
+    std::vector<uint16_t> code = {CONST, 0x1001, CONST, 0x1000, CONST, 0x2000, CONST, 0x40, VADD};
+
+    for (auto isa : supported_isas()) {
+        auto result = run(code, stack, isa);
+        for (uint16_t k = 0; k <= 0x40; ++k) {
+            ASSERT_EQ(7 + k, result.stack[0x1000 + k]);
+        }
+    }
+
+    // slices wrap around at 0xFFFF
+    std::vector<uint16_t> words(0x10000, 0);
+    words[0xFFFE] = 5;
+    words[0xFFFF] = 6;
+    words[0] = 7;
+    words[0x100] = 2;
+    words[0x101] = 2;
+    words[0x102] = 2;
+    auto& kernels = vector_kernels_for(best_vector_isa());
+    vector_binary(kernels, mnemonic::VMUL, words.data(), 0x200, 0xFFFE, 0x100, 3);
+    ASSERT_EQ(10, words[0x200]);
+    ASSERT_EQ(12, words[0x201]);
+    ASSERT_EQ(14, words[0x202]);
+    ASSERT_EQ(36, vector_dot(kernels, words.data(), 0xFFFE, 0x100, 3));
+    ASSERT_EQ(7, vector_max(kernels, words.data(), 0xFFFE, 3));
+}
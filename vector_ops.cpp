@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <stdexcept>
+#include "vector_ops.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define STACKMACHINE_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+    // scalar
+
+    template <typename Op>
+    void scalar_binary(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n, Op op) {
+        for (size_t k = 0; k < n; ++k) {
+            dst[k] = op(a[k], b[k]);
+        }
+    }
+
+    uint16_t add_word(uint16_t x, uint16_t y) {
+        return static_cast<uint16_t>(x + y);
+    }
+
+    uint16_t sub_word(uint16_t x, uint16_t y) {
+        return static_cast<uint16_t>(x - y);
+    }
+
+    uint16_t mul_word(uint16_t x, uint16_t y) {
+        return static_cast<uint16_t>(static_cast<uint32_t>(x) * y);
+    }
+
+    uint16_t eq_word(uint16_t x, uint16_t y) {
+        return x == y ? 1 : 0;
+    }
+
+    uint16_t lt_word(uint16_t x, uint16_t y) {
+        return x < y ? 1 : 0;
+    }
+
+    void scalar_add(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n) {
+        scalar_binary(dst, a, b, n, add_word);
+    }
+
+    void scalar_sub(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n) {
+        scalar_binary(dst, a, b, n, sub_word);
+    }
+
+    void scalar_mul(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n) {
+        scalar_binary(dst, a, b, n, mul_word);
+    }
+
+    void scalar_eq(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n) {
+        scalar_binary(dst, a, b, n, eq_word);
+    }
+
+    void scalar_lt(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n) {
+        scalar_binary(dst, a, b, n, lt_word);
+    }
+
+    uint16_t scalar_dot(const uint16_t* a, const uint16_t* b, size_t n) {
+        uint16_t sum = 0;
+        for (size_t k = 0; k < n; ++k) {
+            sum = static_cast<uint16_t>(sum + mul_word(a[k], b[k]));
+        }
+        return sum;
+    }
+
+    uint16_t scalar_max(const uint16_t* a, size_t n) {
+        uint16_t result = 0;
+        for (size_t k = 0; k < n; ++k) {
+            result = a[k] > result ? a[k] : result;
+        }
+        return result;
+    }
+
+    const vector_kernels SCALAR_KERNELS = {
+            vector_isa::SCALAR,
+            scalar_add, scalar_sub, scalar_mul, scalar_eq, scalar_lt, scalar_dot, scalar_max
+    };
+
+#ifdef STACKMACHINE_X86
+
+    // SSE2, eight words per register. SSE2 only compares and takes the
+    // maximum of signed words, flipping the top bit makes that unsigned.
+
+    __attribute__((target("sse2")))
+    __m128i sse2_lt_words(__m128i x, __m128i y) {
+        const __m128i top = _mm_set1_epi16(static_cast<short>(0x8000));
+        return _mm_cmplt_epi16(_mm_xor_si128(x, top), _mm_xor_si128(y, top));
+    }
+
+#define SSE2_BINARY(NAME, EXPR) \
+    __attribute__((target("sse2"))) \
+    void sse2_##NAME(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n) { \
+        size_t k = 0; \
+        for (; k + 8 <= n; k += 8) { \
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k)); \
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k)); \
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + k), EXPR); \
+        } \
+        scalar_##NAME(dst + k, a + k, b + k, n - k); \
+    }
+
+    SSE2_BINARY(add, _mm_add_epi16(x, y))
+    SSE2_BINARY(sub, _mm_sub_epi16(x, y))
+    SSE2_BINARY(mul, _mm_mullo_epi16(x, y))
+    SSE2_BINARY(eq, _mm_and_si128(_mm_cmpeq_epi16(x, y), _mm_set1_epi16(1)))
+    SSE2_BINARY(lt, _mm_and_si128(sse2_lt_words(x, y), _mm_set1_epi16(1)))
+
+    __attribute__((target("sse2")))
+    uint16_t sse2_dot(const uint16_t* a, const uint16_t* b, size_t n) {
+        // the lanes wrap around like the final sum does
+        __m128i sums = _mm_setzero_si128();
+        size_t k = 0;
+        for (; k + 8 <= n; k += 8) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + k));
+            sums = _mm_add_epi16(sums, _mm_mullo_epi16(x, y));
+        }
+        uint16_t lanes[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sums);
+        uint16_t sum = scalar_dot(a + k, b + k, n - k);
+        for (auto lane : lanes) {
+            sum = static_cast<uint16_t>(sum + lane);
+        }
+        return sum;
+    }
+
+    __attribute__((target("sse2")))
+    uint16_t sse2_max(const uint16_t* a, size_t n) {
+        const __m128i top = _mm_set1_epi16(static_cast<short>(0x8000));
+        __m128i flipped = top;
+        size_t k = 0;
+        for (; k + 8 <= n; k += 8) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + k));
+            flipped = _mm_max_epi16(flipped, _mm_xor_si128(x, top));
+        }
+        uint16_t lanes[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), _mm_xor_si128(flipped, top));
+        uint16_t result = scalar_max(a + k, n - k);
+        return std::max(result, scalar_max(lanes, 8));
+    }
+
+    const vector_kernels SSE2_KERNELS = {
+            vector_isa::SSE2,
+            sse2_add, sse2_sub, sse2_mul, sse2_eq, sse2_lt, sse2_dot, sse2_max
+    };
+
+    // AVX2, sixteen words per register
+
+#define AVX2_BINARY(NAME, EXPR) \
+    __attribute__((target("avx2"))) \
+    void avx2_##NAME(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n) { \
+        size_t k = 0; \
+        for (; k + 16 <= n; k += 16) { \
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k)); \
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k)); \
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + k), EXPR); \
+        } \
+        sse2_##NAME(dst + k, a + k, b + k, n - k); \
+    }
+
+    AVX2_BINARY(add, _mm256_add_epi16(x, y))
+    AVX2_BINARY(sub, _mm256_sub_epi16(x, y))
+    AVX2_BINARY(mul, _mm256_mullo_epi16(x, y))
+    AVX2_BINARY(eq, _mm256_and_si256(_mm256_cmpeq_epi16(x, y), _mm256_set1_epi16(1)))
+    // x < y exactly where max(x, y) differs from x
+    AVX2_BINARY(lt, _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(x, y), x), _mm256_set1_epi16(1)))
+
+    __attribute__((target("avx2")))
+    uint16_t avx2_dot(const uint16_t* a, const uint16_t* b, size_t n) {
+        __m256i sums = _mm256_setzero_si256();
+        size_t k = 0;
+        for (; k + 16 <= n; k += 16) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + k));
+            sums = _mm256_add_epi16(sums, _mm256_mullo_epi16(x, y));
+        }
+        uint16_t lanes[16];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sums);
+        uint16_t sum = sse2_dot(a + k, b + k, n - k);
+        for (auto lane : lanes) {
+            sum = static_cast<uint16_t>(sum + lane);
+        }
+        return sum;
+    }
+
+    __attribute__((target("avx2")))
+    uint16_t avx2_max(const uint16_t* a, size_t n) {
+        __m256i result = _mm256_setzero_si256();
+        size_t k = 0;
+        for (; k + 16 <= n; k += 16) {
+            result = _mm256_max_epu16(result, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + k)));
+        }
+        uint16_t lanes[16];
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), result);
+        return std::max(sse2_max(a + k, n - k), scalar_max(lanes, 16));
+    }
+
+    const vector_kernels AVX2_KERNELS = {
+            vector_isa::AVX2,
+            avx2_add, avx2_sub, avx2_mul, avx2_eq, avx2_lt, avx2_dot, avx2_max
+    };
+
+#endif
+
+    //! \return true if the slice of n words at from does not wrap around
+    bool contiguous(uint16_t from, uint16_t n) {
+        return static_cast<uint32_t>(from) + n <= 0xFFFF;
+    }
+
+    //! \return true if the kernels may write dst while reading src
+    bool independent(uint16_t dst, uint16_t src, uint16_t n) {
+        return dst == src || static_cast<uint32_t>(dst) + n <= src || static_cast<uint32_t>(src) + n <= dst;
+    }
+}
+
+bool supports(vector_isa isa) {
+    switch (isa) {
+        case vector_isa::SCALAR:
+            return true;
+#ifdef STACKMACHINE_X86
+        case vector_isa::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case vector_isa::AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+vector_isa best_vector_isa() {
+    static const vector_isa best = supports(vector_isa::AVX2) ? vector_isa::AVX2
+                                 : supports(vector_isa::SSE2) ? vector_isa::SSE2
+                                 : vector_isa::SCALAR;
+    return best;
+}
+
+const vector_kernels &vector_kernels_for(vector_isa isa) {
+    if (!supports(isa)) {
+        throw std::domain_error("instruction set not supported by this CPU");
+    }
+    switch (isa) {
+#ifdef STACKMACHINE_X86
+        case vector_isa::SSE2:
+            return SSE2_KERNELS;
+        case vector_isa::AVX2:
+            return AVX2_KERNELS;
+#endif
+        default:
+            return SCALAR_KERNELS;
+    }
+}
+
+void vector_binary(const vector_kernels &kernels, mnemonic op, uint16_t *words,
+                   uint16_t dst, uint16_t a, uint16_t b, uint16_t n) {
+
+    if (contiguous(dst, n) && contiguous(a, n) && contiguous(b, n)
+        && independent(dst, a, n) && independent(dst, b, n)) {
+        decltype(kernels.add) kernel;
+        switch (op) {
+            case mnemonic::VADD: kernel = kernels.add; break;
+            case mnemonic::VSUB: kernel = kernels.sub; break;
+            case mnemonic::VMUL: kernel = kernels.mul; break;
+            case mnemonic::VEQ: kernel = kernels.eq; break;
+            default: kernel = kernels.lt; break;
+        }
+        kernel(words + dst, words + a, words + b, n);
+        return;
+    }
+
+    uint16_t (*element)(uint16_t, uint16_t);
+    switch (op) {
+        case mnemonic::VADD: element = add_word; break;
+        case mnemonic::VSUB: element = sub_word; break;
+        case mnemonic::VMUL: element = mul_word; break;
+        case mnemonic::VEQ: element = eq_word; break;
+        default: element = lt_word; break;
+    }
+    for (uint16_t k = 0; k < n; ++k) {
+        words[static_cast<uint16_t>(dst + k)] = element(words[static_cast<uint16_t>(a + k)],
+                                                        words[static_cast<uint16_t>(b + k)]);
+    }
+}
+
+uint16_t vector_dot(const vector_kernels &kernels, const uint16_t *words, uint16_t a, uint16_t b, uint16_t n) {
+    if (contiguous(a, n) && contiguous(b, n)) {
+        return kernels.dot(words + a, words + b, n);
+    }
+    uint16_t sum = 0;
+    for (uint16_t k = 0; k < n; ++k) {
+        sum = static_cast<uint16_t>(sum + mul_word(words[static_cast<uint16_t>(a + k)],
+                                                   words[static_cast<uint16_t>(b + k)]));
+    }
+    return sum;
+}
+
+uint16_t vector_max(const vector_kernels &kernels, const uint16_t *words, uint16_t a, uint16_t n) {
+    if (contiguous(a, n)) {
+        return kernels.max(words + a, n);
+    }
+    uint16_t result = 0;
+    for (uint16_t k = 0; k < n; ++k) {
+        result = std::max(result, words[static_cast<uint16_t>(a + k)]);
+    }
+    return result;
+}
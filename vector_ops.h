@@ -0,0 +1,56 @@
+#ifndef STACKMACHINE_VECTOR_OPS_H
+#define STACKMACHINE_VECTOR_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+#include "instructions.h"
+
+//! The instruction sets the vector opcodes can be executed with.
+enum class vector_isa {
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+//! Loops over slices of words behind VADD, VSUB, VMUL, VEQ, VLT, VDOT and
+//! VMAX. All arithmetic wraps around like the scalar instructions, EQ and LT
+//! give 1 or 0 per element and compare unsigned.
+struct vector_kernels {
+    vector_isa isa;
+    //! dst[k] = a[k] op b[k] for k < n, dst may be a or b but must not
+    //! overlap them otherwise
+    void (*add)(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n);
+    void (*sub)(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n);
+    void (*mul)(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n);
+    void (*eq)(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n);
+    void (*lt)(uint16_t* dst, const uint16_t* a, const uint16_t* b, size_t n);
+    //! \return the sum of a[k] * b[k] for k < n
+    uint16_t (*dot)(const uint16_t* a, const uint16_t* b, size_t n);
+    //! \return the largest a[k] for k < n, 0 if n is 0
+    uint16_t (*max)(const uint16_t* a, size_t n);
+};
+
+//! \return the best instruction set this CPU supports, detected by CPUID
+vector_isa best_vector_isa();
+
+//! \return true if this CPU supports isa
+bool supports(vector_isa isa);
+
+//! \return the kernels for isa
+//! \throws std::domain_error if this CPU does not support isa
+const vector_kernels& vector_kernels_for(vector_isa isa);
+
+//! Execute VADD, VSUB, VMUL, VEQ or VLT on the 64k stack words. Slices
+//! wrap around at 0xFFFF and the elements are computed in order, exactly
+//! like a loop of the scalar instruction; the kernels run where the slices
+//! neither wrap nor overlap in a way that makes the order visible.
+void vector_binary(const vector_kernels& kernels, mnemonic op, uint16_t* words,
+                   uint16_t dst, uint16_t a, uint16_t b, uint16_t n);
+
+//! Execute VDOT on the stack words, see vector_binary().
+uint16_t vector_dot(const vector_kernels& kernels, const uint16_t* words, uint16_t a, uint16_t b, uint16_t n);
+
+//! Execute VMAX on the stack words, see vector_binary().
+uint16_t vector_max(const vector_kernels& kernels, const uint16_t* words, uint16_t a, uint16_t n);
+
+#endif //STACKMACHINE_VECTOR_OPS_H